@@ -0,0 +1,302 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/Immediate.h"
+#include "utils/EnvHelper.h"
+#include "utils/ErrorHelper.h"
+
+
+#define APP_TITLE "Helper Microbenchmarks"
+#define TARGET_WIDTH 256
+#define TARGET_HEIGHT 256
+#ifndef BENCH_DIR
+#define BENCH_DIR "benchmarks/"
+#endif
+
+// Fixed costs of the Vulkan helper layer, headless so it runs on a software ICD (VK_ICD_FILENAMES=.../lvp_icd.x86_64.json).
+// Every benchmark runs CT_BENCH_REPS repetitions of a batch of operations and reports ns per operation: median, minimum and spread.
+// Medians are compared against CT_BENCH_BASELINE (default benchmarks/baseline.txt), CT_BENCH_WRITE_BASELINE=1 records the run as the new baseline.
+
+struct Result {
+	std::string name;
+	double median_ns;
+	double min_ns;
+	double stddev_ns;
+	uint32_t reps;
+};
+
+struct Bench {
+	uint32_t reps = 30;				// CT_BENCH_REPS
+	double tolerance = 0.1;			// CT_BENCH_TOLERANCE, relative slowdown reported as regression
+	std::string filter;				// CT_BENCH_FILTER, run only benchmarks containing it
+	std::vector<Result> results;
+};
+
+// run returns the nanoseconds spent on ops operations, so setup and teardown around the timed part stay out of the numbers
+inline void measure(const std::string &name, uint32_t ops, std::function<double()> run, Bench &bench) {
+	if (!bench.filter.empty() && name.find(bench.filter) == std::string::npos)
+		return;
+	run();	// warm up: first use allocations, driver caches
+	std::vector<double> samples(bench.reps);
+	for (uint32_t r = 0; r < bench.reps; r++)
+		samples[r] = run() / ops;
+	std::sort(samples.begin(), samples.end());
+	double mean = 0.0;
+	for (double sample : samples)
+		mean += sample / samples.size();
+	double variance = 0.0;
+	for (double sample : samples)
+		variance += (sample - mean) * (sample - mean) / samples.size();
+	Result result = { name, samples[samples.size() / 2], samples.front(), std::sqrt(variance), bench.reps };
+	bench.results.push_back(result);
+	std::cout << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(1)
+		<< " median-ns: " << std::setw(12) << result.median_ns << " min-ns: " << std::setw(12) << result.min_ns << " stddev-ns: " << std::setw(10) << result.stddev_ns << std::endl;
+}
+
+template <typename F>
+inline double time_ns(F f) {
+	auto t0 = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// -> baseline: one "name median_ns" per line
+
+inline void read_baseline(const std::string &path, std::map<std::string, double> &baseline) {
+	std::ifstream is(path);
+	std::string line;
+	while (std::getline(is, line)) {
+		std::istringstream ls(line);
+		std::string name;
+		double ns;
+		if (line.empty() || line[0] == '#' || !(ls >> name >> ns))
+			continue;
+		baseline[name] = ns;
+	}
+}
+
+inline void write_baseline(const std::string &path, Bench &bench) {
+	std::ofstream os(path, std::ios::out | std::ios::trunc);
+	os << "# name median-ns-per-op" << std::endl;
+	for (auto &result : bench.results)
+		os << result.name << " " << std::fixed << std::setprecision(1) << result.median_ns << std::endl;
+	std::cout << "baseline written: " << path << std::endl;
+}
+
+// Returns the number of regressions
+inline uint32_t compare(const std::map<std::string, double> &baseline, Bench &bench) {
+	uint32_t n_regressions = 0;
+	for (auto &result : bench.results) {
+		auto it = baseline.find(result.name);
+		if (it == baseline.end() || it->second <= 0.0)
+			continue;
+		double change = result.median_ns / it->second - 1.0;
+		bool is_regression = change > bench.tolerance;
+		n_regressions += is_regression ? 1 : 0;
+		std::cout << std::left << std::setw(40) << result.name << std::right << std::fixed << std::setprecision(1)
+			<< " baseline-ns: " << std::setw(12) << it->second << " change: " << std::showpos << change * 100.0 << std::noshowpos << "%"
+			<< (is_regression ? " REGRESSION" : "") << std::endl;
+	}
+	return n_regressions;
+}
+
+// <-
+
+// A build_command_buffer style pass: clear colour and depth in a render pass, set the dynamic state, nothing drawn
+inline void record_pass(VkCommandBuffer command_buffer, VkRenderPass render_pass, VkFramebuffer framebuffer) {
+	VkCommandBufferBeginInfo cmdBufInfo = {};
+	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	VK_CHECK_RESULT(vkBeginCommandBuffer(command_buffer, &cmdBufInfo));
+
+	VkClearValue clear_values[2];
+	clear_values[0].color = { { 0.3f, 0.3f, 0.5f, 1.0f } };
+	clear_values[1].depthStencil = { 1.0f, 0 };
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = render_pass;
+	renderPassBeginInfo.framebuffer = framebuffer;
+	renderPassBeginInfo.renderArea.extent = { TARGET_WIDTH, TARGET_HEIGHT };
+	renderPassBeginInfo.clearValueCount = 2;
+	renderPassBeginInfo.pClearValues = clear_values;
+	vkCmdBeginRenderPass(command_buffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	VkViewport viewport = { 0.0f, 0.0f, (float)TARGET_WIDTH, (float)TARGET_HEIGHT, 0.0f, 1.0f };
+	vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+	VkRect2D scissor = { { 0, 0 }, { TARGET_WIDTH, TARGET_HEIGHT } };
+	vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+	vkCmdEndRenderPass(command_buffer);
+	VK_CHECK_RESULT(vkEndCommandBuffer(command_buffer));
+}
+
+
+int main() {
+	Bench bench;
+	bench.reps = (uint32_t)std::max(3L, ct::env::get_int("CT_BENCH_REPS", bench.reps));
+	bench.tolerance = ct::env::get_double("CT_BENCH_TOLERANCE", bench.tolerance);
+	bench.filter = ct::env::get_string("CT_BENCH_FILTER", "");
+	uint32_t max_batches = (uint32_t)std::max(1L, ct::env::get_int("CT_BENCH_MAX_BATCHES", 16));
+
+	// -> headless device, no swapchain
+	VkInstance vulkan_instance;
+	ct::vulkan::create_instance(APP_TITLE, vulkan_instance);
+	ct::vulkan::LogicalDevice logical_device;
+	ct::vulkan::search_and_pick_gpu(vulkan_instance, logical_device);
+	ct::vulkan::create_device(logical_device, false);
+	ct::vulkan::dispatch::connect_device(logical_device.device, logical_device.extensions);
+	ct::vulkan::create_queues(logical_device, logical_device.queue_graphics, logical_device.queue_compute);
+	ct::vulkan::create_command_pool(logical_device.device, logical_device.queue_family_indices.graphics, logical_device.command_pool);
+	VkDevice &device = logical_device.device;
+	VkQueue &queue = logical_device.queue_graphics;
+	std::cout << "device: " << logical_device.properties.deviceName << " reps: " << bench.reps << std::endl;
+	// <-
+
+	// -> lookups
+	volatile uint32_t sink = 0;
+	measure("get_memory_type", 10000, [&]() {
+		return time_ns([&]() {
+			for (uint32_t i = 0; i < 10000; i++)
+				sink = ct::vulkan::get_memory_type(logical_device.memory_properties, 0xffffffff, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		});
+	}, bench);
+	measure("get_queue_family_index", 1000, [&]() {
+		return time_ns([&]() {
+			for (uint32_t i = 0; i < 1000; i++)
+				sink = ct::vulkan::get_queue_family_index(logical_device.physical_device, VK_QUEUE_GRAPHICS_BIT);
+		});
+	}, bench);
+	// <-
+
+	// -> command buffers
+	measure("create_command_buffer_x16", 16, [&]() {
+		std::vector<VkCommandBuffer> command_buffers;
+		double ns = time_ns([&]() { ct::vulkan::create_command_buffer(16, device, logical_device.command_pool, command_buffers); });
+		vkFreeCommandBuffers(device, logical_device.command_pool, (uint32_t)command_buffers.size(), command_buffers.data());
+		return ns;
+	}, bench);
+
+	ct::vulkan::ColorAttachment color;
+	ct::vulkan::setup_color_attachment(TARGET_WIDTH, TARGET_HEIGHT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, device, logical_device.memory_properties, color);
+	ct::vulkan::Framebuffer framebuffer;
+	ct::vulkan::setup_depth_stencil(TARGET_WIDTH, TARGET_HEIGHT, logical_device.physical_device, device, logical_device.memory_properties, framebuffer.depth_stencil);
+	ct::vulkan::setup_render_pass(color.color_format, framebuffer.depth_stencil.depth_format, device, framebuffer.render_pass, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	std::vector<VkImageView> views = { color.view };
+	VkColorSpaceKHR color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+	ct::vulkan::setup_framebuffer_from_swapchain(TARGET_WIDTH, TARGET_HEIGHT, 1, device, views, color.color_format, color_space, framebuffer);
+	std::vector<VkCommandBuffer> command_buffers;
+	ct::vulkan::create_command_buffer(max_batches, device, logical_device.command_pool, command_buffers);
+	measure("record_pass", 100, [&]() {
+		return time_ns([&]() {
+			for (uint32_t i = 0; i < 100; i++) {
+				VK_CHECK_RESULT(vkResetCommandBuffer(command_buffers[0], 0));
+				record_pass(command_buffers[0], framebuffer.render_pass, framebuffer.framebuffer[0]);
+			}
+		});
+	}, bench);
+	// <-
+
+	// -> submission
+	measure("flush_command_buffer_round_trip", 20, [&]() {
+		return time_ns([&]() {
+			for (uint32_t i = 0; i < 20; i++) {
+				VkCommandBuffer command_buffer = ct::vulkan::get_command_buffer(true, device, logical_device.command_pool);
+				ct::vulkan::flush_command_buffer(device, logical_device.command_pool, queue, command_buffer);
+			}
+		});
+	}, bench);
+
+	// The same 20 empty operations through pooled command buffers and fences, waited for once
+	ct::vulkan::immediate::Context immediate;
+	ct::vulkan::immediate::setup(logical_device, immediate);
+	measure("immediate_batched", 20, [&]() {
+		return time_ns([&]() {
+			for (uint32_t i = 0; i < 20; i++) {
+				ct::vulkan::immediate::begin(immediate);
+				ct::vulkan::immediate::end(immediate);
+			}
+			ct::vulkan::immediate::finish(immediate);
+		});
+	}, bench);
+	ct::vulkan::immediate::destroy(immediate);
+
+	for (auto &command_buffer : command_buffers)
+		record_pass(command_buffer, framebuffer.render_pass, framebuffer.framebuffer[0]);
+	VkFence fence;
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, ct::vulkan::get_allocator(), &fence));
+	// Only the vkQueueSubmit call is timed, per batch of one command buffer; waiting for the GPU is not
+	for (uint32_t n_batches = 1; n_batches <= max_batches; n_batches *= 2) {
+		std::vector<VkSubmitInfo> submits(n_batches);
+		for (uint32_t b = 0; b < n_batches; b++) {
+			submits[b] = {};
+			submits[b].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submits[b].commandBufferCount = 1;
+			submits[b].pCommandBuffers = &command_buffers[b];
+		}
+		measure("vkQueueSubmit_batches_" + std::to_string(n_batches), n_batches * 20, [&]() {
+			double ns = 0.0;
+			for (uint32_t i = 0; i < 20; i++) {
+				ns += time_ns([&]() { VK_CHECK_RESULT(vkQueueSubmit(queue, n_batches, submits.data(), fence)); });
+				VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+				VK_CHECK_RESULT(vkResetFences(device, 1, &fence));
+			}
+			return ns;
+		}, bench);
+	}
+	vkDestroyFence(device, fence, ct::vulkan::get_allocator());
+	// <-
+
+	// -> synchronization objects
+	measure("fence_create_destroy", 1000, [&]() {
+		return time_ns([&]() {
+			for (uint32_t i = 0; i < 1000; i++) {
+				VkFence f;
+				VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, ct::vulkan::get_allocator(), &f));
+				vkDestroyFence(device, f, ct::vulkan::get_allocator());
+			}
+		});
+	}, bench);
+	measure("semaphore_create_destroy", 1000, [&]() {
+		VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		return time_ns([&]() {
+			for (uint32_t i = 0; i < 1000; i++) {
+				VkSemaphore semaphore;
+				VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, ct::vulkan::get_allocator(), &semaphore));
+				vkDestroySemaphore(device, semaphore, ct::vulkan::get_allocator());
+			}
+		});
+	}, bench);
+	// <-
+
+	// -> teardown
+	vkDeviceWaitIdle(device);
+	vkFreeCommandBuffers(device, logical_device.command_pool, (uint32_t)command_buffers.size(), command_buffers.data());
+	ct::vulkan::destroy_framebuffer(device, framebuffer);
+	ct::vulkan::destroy_color_attachment(device, color);
+	ct::vulkan::destroy_device(logical_device);
+	vkDestroyInstance(vulkan_instance, ct::vulkan::get_allocator());
+	// <-
+
+	std::string baseline_path = ct::env::get_string("CT_BENCH_BASELINE", BENCH_DIR "baseline.txt");
+	if (ct::env::get_flag("CT_BENCH_WRITE_BASELINE")) {
+		write_baseline(baseline_path, bench);
+		return 0;
+	}
+	std::map<std::string, double> baseline;
+	read_baseline(baseline_path, baseline);
+	if (baseline.empty()) {
+		std::cout << "no baseline at " << baseline_path << ", record one with CT_BENCH_WRITE_BASELINE=1" << std::endl;
+		return 0;
+	}
+	return compare(baseline, bench) > 0 ? 1 : 0;
+}
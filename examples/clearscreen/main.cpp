@@ -3,11 +3,28 @@
 #include <chrono>
 #include <unordered_map>
 
-#include <omp.h>
-
 #include "vulkanbase/VulkanHelper.h"
 #include "vulkanbase/SwapChainHelper.h"
+#include "vulkanbase/ClearStrategy.h"
+#include "vulkanbase/DynamicRendering.h"
+#include "vulkanbase/TraceGpu.h"
+#include "vulkanbase/GpuCounters.h"
+#include "vulkanbase/ResourceHandle.h"
+#include "vulkanbase/DescriptorHelper.h"
+#include "vulkanbase/Workload.h"
+#include "vulkanbase/GpuCulling.h"
+#include "vulkanbase/DynamicResolution.h"
+#include "vulkanbase/MemoryBudget.h"
+#include "vulkanbase/TransientPool.h"
+#include "vulkanbase/FrameAllocator.h"
+#include "vulkanbase/Immediate.h"
+#include "loader/Streaming.h"
+#include "utils/EnvHelper.h"
 #include "utils/ErrorHelper.h"
+#include "utils/Trace.h"
+#include "utils/Invalidation.h"
+#include "utils/Simulation.h"
+#include "utils/JobSystem.h"
 
 #if defined(VK_USE_PLATFORM_XCB_KHR)
 #include "windowmanager/XCBWindowHelper.h"
@@ -17,71 +34,215 @@
 #define WINDOW_TITLE "Dummy Clear Screen"
 #define WINDOW_HEIGHT 960
 #define WINDOW_WIDTH 1280
+#define FRAMES_WARM_UP 120
+// Passes as the transient pool sees them, the clear calibration runs once before the first frame
+#define PASS_CALIBRATE 0
+#define PASS_RENDER 1
+#define PASS_UPSCALE 2
 
 
 class ToyWorld {
 public:
 
-	void init(ct::vulkan::LogicalDevice &logical_device_, ct::vulkan::Framebuffer &framebuffer_) {
+	void init(ct::vulkan::LogicalDevice &logical_device_, ct::vulkan::Framebuffer &framebuffer_, ct::vulkan::swapchain::SwapChain &swapchain,
+			ct::vulkan::clear::Engine &clear_engine_, ct::vulkan::counters::Counters &counters_, ct::vulkan::Synchronization &synchronization_,
+			ct::vulkan::workload::Workload &workload_, ct::vulkan::culling::Culling &culling_, ct::vulkan::resolution::Resolution &resolution_,
+			ct::vulkan::descriptor::FrameAllocators &frame_descriptors_, ct::vulkan::submission::Service *submission_ = nullptr, ct::vulkan::frame::Allocator *frame_allocator_ = nullptr,
+			ct::vulkan::recording::Cache *recording_ = nullptr) {
 		logical_device = &logical_device_;
 		framebuffer = &framebuffer_;
+		clear_engine = &clear_engine_;
+		counters = &counters_;
+		synchronization = &synchronization_;
+		workload = &workload_;
+		culling = &culling_;
+		resolution = &resolution_;
+		frame_descriptors = &frame_descriptors_;
+		submission = submission_;
+		frame_allocator = frame_allocator_;
+		recording = recording_;
+		swapchain_images = &swapchain;
+
+		// -> one clear target per swapchain image, with dynamic resolution they all render into the internal target and are blitted to the image at the end
+		clear_targets.resize(swapchain.imagecount);
+		render_targets.resize(swapchain.imagecount);
+		for (uint32_t i = 0; i < swapchain.imagecount; i++) {
+			if (resolution->active) {
+				clear_targets[i].color_image = resolution->color.image;
+				clear_targets[i].color_view = resolution->color.view;
+				clear_targets[i].depth_image = resolution->framebuffer.depth_stencil.image;
+				clear_targets[i].depth_view = resolution->framebuffer.depth_stencil.view;
+				clear_targets[i].depth_format = resolution->framebuffer.depth_stencil.depth_format;
+				clear_targets[i].framebuffer = resolution->framebuffer.framebuffer[0];
+				clear_targets[i].final_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			} else {
+				clear_targets[i].color_image = swapchain.images[i];
+				clear_targets[i].color_view = swapchain.views[i];
+				clear_targets[i].depth_image = framebuffer->depth_stencil.image;
+				clear_targets[i].depth_view = framebuffer->depth_stencil.view;
+				clear_targets[i].depth_format = framebuffer->depth_stencil.depth_format;
+				clear_targets[i].framebuffer = framebuffer->framebuffer[i];
+			}
+			set_extent(i, framebuffer->width, framebuffer->height);
+			ct::vulkan::clear::prepare_target(logical_device->device, *clear_engine, clear_targets[i]);
+		}
+		// <-
+
+		for (uint32_t i = 0; i < swapchain.imagecount; i++) {
+			ct::vulkan::resolution::update(i, *resolution);
+			record_command_buffer(i);
+		}
+
+		// Moving objects are simulated at a fixed rate on their own thread unless CT_SIM_HZ=0, which moves them once per frame here
+		ct::simulation::read_params(simulation);
+		if (workload->active && workload->n_updates > 0) {
+			simulated_objects = workload->instances;
+			ct::simulation::start<ct::vulkan::workload::Snapshot>(
+				[this](ct::vulkan::workload::Snapshot &snapshot) { ct::vulkan::workload::prepare_snapshot(*workload, snapshot); },
+				[this](uint64_t tick, double t, ct::vulkan::workload::Snapshot &snapshot) { ct::vulkan::workload::simulate(tick, t, simulated_objects, *workload, snapshot); },
+				simulation);
+		}
+	}
 
-		build_command_buffer();
+	void stop() {
+		ct::simulation::stop(simulation);
 	}
 
-	void build_command_buffer() {
+	void set_extent(uint32_t i, uint32_t width, uint32_t height) {
+		if (resolution->active) {
+			width = ct::vulkan::resolution::get_width(resolution->controller.scale, *resolution);
+			height = ct::vulkan::resolution::get_height(resolution->controller.scale, *resolution);
+		}
+		clear_targets[i].width = width;
+		clear_targets[i].height = height;
+		render_targets[i] = ct::vulkan::clear::get_rendering_target(clear_targets[i]);
+	}
+
+	void record_command_buffer(uint32_t i) {
+		CT_TRACE_FUNCTION();
+		const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
 		VkCommandBufferBeginInfo cmdBufInfo = {};
 		cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 		cmdBufInfo.pNext = nullptr;
 
-		// Set clear values for all framebuffer attachments with loadOp set to clear
-		// We use two attachments (color and depth) that are cleared at the start of the subpass and as such we need to set clear values for both
-		VkClearValue clearValues[2];
-		clearValues[0].color = { { 0.3f, 0.3f, 0.5f, 1.0f } };
-		clearValues[1].depthStencil = { 1.0f, 0 };
-
-		VkRenderPassBeginInfo renderPassBeginInfo = {};
-		renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassBeginInfo.pNext = nullptr;
-		renderPassBeginInfo.renderPass = framebuffer->render_pass;
-		renderPassBeginInfo.renderArea.offset.x = 0;
-		renderPassBeginInfo.renderArea.offset.y = 0;
-		renderPassBeginInfo.renderArea.extent.width = framebuffer->width;
-		renderPassBeginInfo.renderArea.extent.height = framebuffer->height;
-		renderPassBeginInfo.clearValueCount = 2;
-		renderPassBeginInfo.pClearValues = clearValues;
-
-		for (int32_t i = 0; i < logical_device->command_buffer.size(); ++i) {
-			// Set target frame buffer
-			renderPassBeginInfo.framebuffer = framebuffer->framebuffer[i];
-
-			VK_CHECK_RESULT(vkBeginCommandBuffer(logical_device->command_buffer[i], &cmdBufInfo));
-
-			// Start the first sub pass specified in our default render pass setup by the base class
-			// This will clear the color and depth attachment
-			vkCmdBeginRenderPass(logical_device->command_buffer[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			// Actually do nothing
-
-			// Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presenting it to the windowing system
-			vkCmdEndRenderPass(logical_device->command_buffer[i]);
-
-			VK_CHECK_RESULT(vkEndCommandBuffer(logical_device->command_buffer[i]));
+		VK_CHECK_RESULT(dispatch.vkBeginCommandBuffer(logical_device->command_buffer[i], &cmdBufInfo));
+		ct::vulkan::resolution::begin_frame(logical_device->command_buffer[i], i, *resolution);
+		ct::trace::gpu_begin_frame(logical_device->command_buffer[i], i);
+		ct::vulkan::counters::begin_frame(logical_device->command_buffer[i], i, *counters);
+		ct::trace::gpu_begin(logical_device->command_buffer[i], i, "clear");
+		ct::vulkan::counters::begin_pass(logical_device->command_buffer[i], i, "clear", *counters);
+
+		// Clear color and depth with whatever strategy the clear engine picked at startup
+		// Render pass based strategies end with an implicit barrier transitioning the color attachment to the target's final layout,
+		// the others transition explicitly
+		ct::vulkan::clear::record(logical_device->command_buffer[i], *clear_engine, clear_targets[i]);
+
+		ct::vulkan::counters::end_pass(logical_device->command_buffer[i], i, *counters);
+		ct::trace::gpu_end(logical_device->command_buffer[i], i);
+
+		// Synthetic load on top of the clear, only if CT_WORKLOAD_OBJECTS asked for some
+		// With GPU culling the instance counts come from the compute pass, recording does not depend on the number of objects
+		if (workload->active) {
+			ct::trace::gpu_begin(logical_device->command_buffer[i], i, "workload");
+			ct::vulkan::counters::begin_pass(logical_device->command_buffer[i], i, "workload", *counters);
+			if (culling->active) {
+				ct::vulkan::culling::record(logical_device->command_buffer[i], i, render_targets[i], *workload, *culling);
+			} else {
+				ct::vulkan::workload::record(logical_device->command_buffer[i], i, render_targets[i], *workload, recording);
+			}
+			ct::vulkan::counters::end_pass(logical_device->command_buffer[i], i, *counters);
+			ct::trace::gpu_end(logical_device->command_buffer[i], i);
 		}
-
+		// Scales the internal target up to the swapchain image, which ends in PRESENT_SRC as without dynamic resolution
+		ct::vulkan::resolution::end_frame(logical_device->command_buffer[i], i, swapchain_images->images[i], framebuffer->width, framebuffer->height, *resolution);
+		VK_CHECK_RESULT(dispatch.vkEndCommandBuffer(logical_device->command_buffer[i]));
 	}
 
 	void draw() {
-    	// command buffer already build. So nothing to do here
+		CT_TRACE_FUNCTION();
+		// Command buffers are already built, only the moved objects have to reach this slot's instance buffer before it is culled and drawn
+		// and the slot is recorded again when the resolution scale moved since its last recording or the draws changed
+		bool has_workload = workload->active && (workload->n_updates > 0 || culling->active);
+		bool has_churn = is_churning();
+		if (!has_workload && !resolution->active && !has_churn)
+			return;
+		// The slot's frame fence was waited for right after acquiring, the GPU is done reading its buffers and per frame constants
+		uint32_t slot = swapchain_images->current_buffer;
+		if (frame_allocator != nullptr) {
+			ct::vulkan::frame::begin_frame(slot, *frame_allocator);
+		}
+		// Sets allocated for this slot's last frame go back to their pools in one reset per pool
+		ct::vulkan::descriptor::Allocator &descriptors = ct::vulkan::descriptor::begin_frame(slot, *frame_descriptors);
+		bool is_resized = ct::vulkan::resolution::update(slot, *resolution);
+		if (is_resized) {
+			set_extent(slot, framebuffer->width, framebuffer->height);
+		}
+		if (is_resized || has_churn) {
+			record_command_buffer(slot);
+		}
+		if (has_workload) {
+			ct::vulkan::workload::sync_slot(slot, *workload);
+			ct::vulkan::culling::prepare(slot, descriptors, *culling);
+		}
+		// The culling pass reads its Params from the frame allocator, they are flushed before it is submitted
+		if (frame_allocator != nullptr) {
+			ct::vulkan::frame::end_frame(*frame_allocator);
+		}
+		if (has_workload) {
+			ct::vulkan::culling::submit(slot, *synchronization, *culling, submission);
+		}
     }
 
 	void advance(std::size_t iteration_counter, double ms_per_frame) {
-		// do nothing here as well
+		CT_TRACE_FUNCTION();
+		if (is_churning()) {
+			ct::vulkan::workload::churn(*workload, recording);
+		}
+		if (ct::simulation::is_running(simulation)) {
+			float alpha;
+			ct::simulation::Snapshot<ct::vulkan::workload::Snapshot> &snapshot = ct::simulation::get_latest(simulation, alpha);
+			ct::vulkan::workload::apply(snapshot.tick, snapshot.state, alpha, *workload);
+			return;
+		}
+		time += ms_per_frame / 1000.0;
+		ct::vulkan::workload::animate(time, *workload);
     }
 
+	void report(std::ostream &os) {
+		ct::simulation::report(os, simulation);
+	}
+
+	// The clear alone gives the same image every frame, only moving objects and churning draws change it
+	bool is_animated() {
+		return workload->active && (workload->n_updates > 0 || is_churning());
+	}
+
+	// Culling builds its batches once, churning draws only show with the draws recorded on the CPU
+	bool is_churning() {
+		return workload->active && workload->n_churn > 0 && !culling->active;
+	}
+
 private:
 	ct::vulkan::LogicalDevice *logical_device;
 	ct::vulkan::Framebuffer *framebuffer;
+	ct::vulkan::clear::Engine *clear_engine;
+	ct::vulkan::counters::Counters *counters;
+	ct::vulkan::Synchronization *synchronization;
+	ct::vulkan::workload::Workload *workload;
+	ct::vulkan::culling::Culling *culling;
+	ct::vulkan::resolution::Resolution *resolution;
+	ct::vulkan::descriptor::FrameAllocators *frame_descriptors;
+	ct::vulkan::submission::Service *submission = nullptr;
+	ct::vulkan::frame::Allocator *frame_allocator = nullptr;
+	ct::vulkan::recording::Cache *recording = nullptr;
+	ct::vulkan::swapchain::SwapChain *swapchain_images;
+	std::vector<ct::vulkan::clear::Target> clear_targets;
+	std::vector<ct::vulkan::rendering::Target> render_targets;
+	double time = 0.0;
+	// -> owned by the simulation thread while it runs
+	ct::simulation::Simulation<ct::vulkan::workload::Snapshot> simulation;
+	std::vector<ct::vulkan::workload::Instance> simulated_objects;
+	// <-
 
 };
 
@@ -89,66 +250,296 @@ private:
 
 int main() {
 	VkInstance vulkan_instance;
-	ct::vulkan::Framebuffer framebuffer;
-	ct::vulkan::LogicalDevice logical_device;
-	ct::vulkan::Synchronization synchronization;
-	ct::vulkan::swapchain::SwapChain swapchain;
 	ct::windowmanager::xcb::Window window;
-
-	ct::vulkan::create_instance(WINDOW_TITLE, vulkan_instance);
+	// -> owners: everything below the device goes through the deletion queue once the frames using it have retired
+	ct::vulkan::Handle<ct::vulkan::LogicalDevice> logical_device_owner = ct::vulkan::make_logical_device();
+	ct::vulkan::LogicalDevice &logical_device = *logical_device_owner;
+	ct::vulkan::DeletionQueue deletion_queue;
+	ct::vulkan::Handle<ct::vulkan::Synchronization> synchronization_owner = ct::vulkan::make_synchronization(logical_device.device);
+	ct::vulkan::Synchronization &synchronization = *synchronization_owner;
+	ct::vulkan::Handle<ct::vulkan::swapchain::SwapChain> swapchain_owner = ct::vulkan::make_swapchain(logical_device.device, &deletion_queue, &synchronization.frame_submitted);
+	ct::vulkan::swapchain::SwapChain &swapchain = *swapchain_owner;
+	ct::vulkan::Handle<ct::vulkan::Framebuffer> framebuffer_owner = ct::vulkan::make_framebuffer(logical_device.device, &deletion_queue, &synchronization.frame_submitted);
+	ct::vulkan::Framebuffer &framebuffer = *framebuffer_owner;
+	// <-
+
+	ct::trace::init();
+	// Debug utils labels name the GPU spans in RenderDoc and friends, only wanted when tracing
+	std::vector<const char*> instance_extensions;
+	bool has_debug_utils = ct::trace::is_enabled() && ct::vulkan::is_instance_extension_supported(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+	if (has_debug_utils) {
+		instance_extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+	}
+	// The instance table picks the label functions up when the extension is enabled
+	ct::vulkan::create_instance(WINDOW_TITLE, vulkan_instance, instance_extensions);
 	#if defined(VK_USE_PLATFORM_XCB_KHR)
 	ct::windowmanager::xcb::init(window);
 	ct::windowmanager::xcb::setup_window(window, WINDOW_TITLE, WINDOW_WIDTH, WINDOW_HEIGHT);
 	ct::windowmanager::xcb::init_surface(vulkan_instance, window);
 	#endif
 	ct::vulkan::search_and_pick_gpu(vulkan_instance, logical_device);
+	// Needed by the compute fill clear strategy, swapchain formats have no GLSL format qualifier
+	logical_device.features_enabled.shaderStorageImageWriteWithoutFormat = logical_device.features.shaderStorageImageWriteWithoutFormat;
+	// Per pass GPU counters are opt in, pipeline statistics queries are not free on every driver
+	bool has_counters = ct::env::get_flag("CT_GPU_COUNTERS");
+	if (has_counters) {
+		logical_device.features_enabled.pipelineStatisticsQuery = logical_device.features.pipelineStatisticsQuery;
+	}
+	// GPU driven culling of the workload is opt in, it needs indirect draws with a first instance
+	ct::vulkan::culling::Culling culling;
+	bool has_culling = ct::env::get_flag("CT_GPU_CULLING") && ct::vulkan::culling::request(logical_device, culling);
+	// Dynamic rendering is picked up when the device has it, CT_RENDERING_BACKEND decides whether the workload uses it
+	ct::vulkan::rendering::Rendering rendering;
+	ct::vulkan::rendering::request(logical_device, rendering);
+	// Heap budget and usage straight from the driver when it can tell, our own accounting otherwise
+	ct::vulkan::memory::Budget memory_budget;
+	ct::vulkan::memory::request(logical_device, memory_budget);
+	// CT_BINDLESS puts the workload's instance buffers into one update-after-bind set where they are addressed by index, needs VK_EXT_descriptor_indexing
+	ct::vulkan::descriptor::Bindless bindless;
+	bool has_bindless = ct::env::get_flag("CT_BINDLESS") && ct::vulkan::descriptor::request_bindless(logical_device, bindless);
+	// Frames are presented from the graphics queue's family if it can, from a queue of their own otherwise
+	ct::vulkan::swapchain::request_present(window.surface, logical_device);
 	ct::vulkan::create_device(logical_device);
-	ct::vulkan::swapchain::connect(vulkan_instance, logical_device.device, swapchain);
-	ct::vulkan::swapchain::check_present_support(logical_device.physical_device, window.surface, swapchain);
+	// Recording and submission below call straight into the driver through the device table
+	ct::vulkan::dispatch::connect_device(logical_device.device, logical_device.extensions);
+	// CT_CAPTURE=<file> writes the first CT_CAPTURE_FRAMES frames for examples/replay, from the swapchain on
+	std::string capture_path = ct::env::get_string("CT_CAPTURE", "");
+	if (!capture_path.empty())
+		ct::vulkan::capture::begin(capture_path, (uint32_t)std::max(0L, ct::env::get_int("CT_CAPTURE_FRAMES", 300)));
+	ct::vulkan::rendering::connect(rendering);
+	ct::vulkan::swapchain::connect(vulkan_instance, swapchain);
+	ct::vulkan::swapchain::check_present_support(logical_device, window.surface, swapchain);
 	ct::vulkan::swapchain::create(WINDOW_WIDTH, WINDOW_HEIGHT, true, logical_device.physical_device, logical_device.device, window.surface, swapchain);
+	ct::vulkan::memory::connect(logical_device, memory_budget);
+	ct::vulkan::memory::track_swapchain(swapchain.imagecount, WINDOW_WIDTH, WINDOW_HEIGHT, memory_budget);
 
 	ct::vulkan::create_command_pool(logical_device.device, logical_device.queue_family_indices.graphics, logical_device.command_pool);
 	ct::vulkan::create_queues(logical_device, logical_device.queue_graphics, logical_device.queue_compute);
 	ct::vulkan::create_command_buffer(swapchain.imagecount, logical_device.device, logical_device.command_pool, logical_device.command_buffer);
 	ct::vulkan::create_synchronization(logical_device.device, logical_device.command_buffer, synchronization);
-	ct::vulkan::setup_depth_stencil(WINDOW_WIDTH, WINDOW_HEIGHT, logical_device.physical_device, logical_device.device, logical_device.memory_properties, framebuffer.depth_stencil);
+	// -> transient pool: the window depth and the dynamic resolution target, memory of the ones never live in the same pass is shared
+	ct::vulkan::transient::Pool transient_pool;
+	ct::vulkan::transient::setup(logical_device, transient_pool);
+	VkFormat depth_format;
+	VkBool32 validDepthFormat = ct::vulkan::get_supported_depth_format(logical_device.physical_device, depth_format);
+	assert(validDepthFormat);
+	// Dynamic resolution renders into an internal target of the window size and scales the used part of it up to the swapchain, opt in
+	ct::vulkan::resolution::Resolution resolution;
+	if (ct::env::get_flag("CT_DYNRES")) {
+		// Colour and depth of the internal target, at most 4 bytes a texel each
+		ct::vulkan::memory::update(memory_budget);
+		if (ct::vulkan::memory::fits((VkDeviceSize)WINDOW_WIDTH * WINDOW_HEIGHT * 8, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory_budget)) {
+			ct::vulkan::resolution::declare(WINDOW_WIDTH, WINDOW_HEIGHT, swapchain.color_format, swapchain.image_usage, depth_format, PASS_RENDER, PASS_UPSCALE,
+					logical_device, transient_pool, resolution);
+		} else {
+			std::cout << "dynamic-resolution: internal target does not fit the memory budget, disabled" << std::endl;
+		}
+	}
+	// With dynamic resolution every frame renders into the internal target and the window depth is left to the clear calibration
+	uint32_t window_depth = ct::vulkan::transient::declare_image(WINDOW_WIDTH, WINDOW_HEIGHT, depth_format,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+			PASS_CALIBRATE, resolution.pool != nullptr ? PASS_CALIBRATE : PASS_RENDER,
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, transient_pool);
+	ct::vulkan::transient::build(transient_pool);
+	ct::vulkan::transient::get_depth_stencil(window_depth, transient_pool, framebuffer.depth_stencil);
+	ct::vulkan::transient::report(std::cout, transient_pool);
+	// <-
 	ct::vulkan::setup_render_pass(swapchain.color_format, framebuffer.depth_stencil.depth_format, logical_device.device, framebuffer.render_pass);
 	//ct::vulkan::create_pipeline_cache(logical_device.device, pipeline.pipeline_cache);
 	ct::vulkan::setup_framebuffer_from_swapchain(WINDOW_WIDTH, WINDOW_HEIGHT, swapchain.imagecount, logical_device.device, 
 			swapchain.views, swapchain.color_format, swapchain.color_space, framebuffer);
 
+	ct::vulkan::clear::Engine clear_engine;
+	ct::vulkan::clear::setup(WINDOW_WIDTH, WINDOW_HEIGHT, swapchain.imagecount + 1, swapchain.color_format, swapchain.image_usage, framebuffer, logical_device, clear_engine, &rendering);
+	ct::vulkan::clear::select(swapchain.image_usage, framebuffer, logical_device, clear_engine);
+
+	// Setup uploads and query resets are recorded into a few pooled command buffers and waited for once, before the first frame
+	ct::vulkan::immediate::Context immediate;
+	ct::vulkan::immediate::setup(logical_device, immediate);
+	// We use two attachments (color and depth) that are cleared at the start of every frame and as such we need to set clear values for both
+	ct::vulkan::clear::set_clear_values({ { 0.3f, 0.3f, 0.5f, 1.0f } }, { 1.0f, 0 }, logical_device, clear_engine, &immediate);
+	ct::trace::gpu_init(swapchain.imagecount, logical_device);
+	ct::vulkan::counters::Counters counters;
+	if (has_counters) {
+		ct::vulkan::counters::setup(swapchain.imagecount, logical_device, counters, &immediate);
+	}
+
+	ct::vulkan::descriptor::LayoutCache layout_cache;
+	ct::vulkan::descriptor::setup_layout_cache(logical_device.device, layout_cache);
+	ct::vulkan::workload::Params workload_params;
+	ct::vulkan::workload::read_params(workload_params);
+	ct::vulkan::workload::Workload workload;
+	if (resolution.pool != nullptr) {
+		ct::vulkan::resolution::setup(WINDOW_WIDTH, WINDOW_HEIGHT, swapchain.imagecount, swapchain.color_format, swapchain.color_space, swapchain.image_usage,
+				logical_device, resolution);
+	}
+	VkImageLayout color_layout = resolution.active ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// Per frame CPU work of the workload (moving, blending, uploading objects, recording chunks) is spread over a worker per core
+	ct::jobs::JobSystem jobs;
+	ct::jobs::setup(jobs);
+	ct::vulkan::workload::setup(workload_params, swapchain.imagecount, swapchain.color_format, framebuffer.depth_stencil.depth_format, color_layout, logical_device,
+			layout_cache, workload, &rendering, &jobs, &immediate);
+	// Dynamic per frame data (constants, small storage blocks) is bumped out of one mapped buffer with a range per swapchain image
+	ct::vulkan::frame::Allocator frame_allocator;
+	ct::vulkan::frame::setup(swapchain.imagecount, logical_device, frame_allocator);
+	// Descriptor sets that live for one frame (the culling pass's) come from a descriptor allocator per swapchain image, reset once its fence signalled
+	ct::vulkan::descriptor::FrameAllocators frame_descriptors;
+	ct::vulkan::descriptor::setup_frame_allocators(swapchain.imagecount, logical_device.device, ct::vulkan::descriptor::get_default_ratios(), frame_descriptors);
+	if (has_bindless) {
+		ct::vulkan::descriptor::setup_bindless(DESCRIPTOR_BINDLESS_IMAGES, DESCRIPTOR_BINDLESS_BUFFERS, logical_device, layout_cache, bindless);
+		for (auto &buffer : workload.instance_buffers) {
+			ct::vulkan::descriptor::add_buffer(buffer.buffer, 0, VK_WHOLE_SIZE, bindless);
+		}
+	}
+	if (has_culling) {
+		ct::vulkan::culling::setup(swapchain.imagecount, logical_device, layout_cache, workload, frame_allocator, culling);
+	}
+	// CT_RECORD_CHUNKS splits the workload's draws into cached secondaries, only the chunks whose draws changed are recorded again
+	ct::vulkan::recording::Cache recording;
+	if (workload.active && !culling.active && !ct::vulkan::rendering::is_dynamic(&rendering)) {
+		ct::vulkan::recording::setup(swapchain.imagecount, (uint32_t)workload.draws.size(), logical_device, recording, &jobs);
+	}
+	// Setup uploads are done, the immediate context has to let go of the queues before the submit thread takes them over
+	ct::vulkan::immediate::finish(immediate);
+	ct::vulkan::immediate::report(std::cout, immediate);
+	// With CT_SUBMIT_THREAD=1 one thread owns the queues: frames, culling and uploads are pushed to it and merged into as few submits as it can
+	ct::vulkan::submission::Service submission;
+	ct::vulkan::submission::setup(submission);
+	// CT_STREAM lists archives (every entry is streamed) and loose files, ':' separated, loaded in the background while frames run
+	ct::streaming::Streamer streamer;
+	std::string stream_paths = ct::env::get_string("CT_STREAM", "");
+	if (!stream_paths.empty()) {
+		ct::streaming::setup(logical_device, streamer, &jobs, &submission, &synchronization);
+		ct::streaming::request_paths(stream_paths, streamer);
+	}
+
     ToyWorld world;
-	world.init(logical_device, framebuffer);
+	world.init(logical_device, framebuffer, swapchain, clear_engine, counters, synchronization, workload, culling, resolution, frame_descriptors, &submission, &frame_allocator, &recording);
 
 
+	// With CT_ON_DEMAND=1 a frame is rendered only when the world moves, the window was exposed or resized, or the heartbeat is due
+	ct::invalidation::Invalidation invalidation;
+	ct::invalidation::read_params(invalidation);
+
+	// Near the budget of a device local heap dynamic resolution stops growing past the scale it is at, the internal target keeps its size
+	memory_budget.on_pressure = [&resolution](uint32_t heap_index, const ct::vulkan::memory::Heap &heap) {
+		std::cout << "memory-budget: warning: heap " << heap_index << " at " << heap.usage / MEMORY_MB << " of " << heap.budget / MEMORY_MB << " MB" << std::endl;
+		if (heap.is_device_local && resolution.active) {
+			resolution.controller.max_scale = std::max(resolution.controller.min_scale, resolution.controller.scale);
+		}
+	};
+
 	window.is_alive = true;
 	ct::windowmanager::xcb::flush(window.connection);
     std::chrono::high_resolution_clock clock;
     std::size_t iteration_counter = 0;
     std::chrono::high_resolution_clock::time_point t0 = clock.now();
-    std::chrono::milliseconds mspf;
+    std::chrono::duration<double, std::milli> mspf(0.0);
+	// Driver host allocations made through the callbacks that missed the arenas and pools after warm up, the steady state frame loop should
+	// add none. It says nothing about the application's own allocations or about what the driver allocates behind the callbacks.
+	uint64_t heap_allocations_warm = 0;
 	while (window.is_alive) {
+		CT_TRACE_SCOPE("frame");
 		auto tStart = std::chrono::high_resolution_clock::now();
 		xcb_generic_event_t *event;
-		while ((event = xcb_poll_for_event(window.connection))) {
-			ct::windowmanager::xcb::handle_events(event, window);
-			free(event);
+		{
+			CT_TRACE_SCOPE("events");
+			while ((event = xcb_poll_for_event(window.connection))) {
+				ct::windowmanager::xcb::handle_events(event, window);
+				free(event);
+			}
 		}
+		// -> invalidation, blocks on window events while there is nothing new to show
+		if (window.is_exposed) {
+			ct::invalidation::invalidate(ct::invalidation::EXPOSE, invalidation);
+			window.is_exposed = false;
+		}
+		// The swapchain keeps its size, the presentation engine scales it to the new window size
+		if (window.is_resized) {
+			ct::invalidation::invalidate(ct::invalidation::RESIZE, invalidation);
+			window.is_resized = false;
+		}
+		// Uploads only move on when frames do
+		if (world.is_animated() || ct::streaming::is_busy(streamer)) {
+			ct::invalidation::invalidate(ct::invalidation::STATE, invalidation);
+		}
+		if (!ct::invalidation::should_render(invalidation)) {
+			CT_TRACE_SCOPE("idle");
+			ct::windowmanager::xcb::wait_for_events(window.connection, ct::invalidation::get_timeout_ms(invalidation));
+			continue;
+		}
+		// <-
 		world.advance(iteration_counter++, mspf.count());
 
-		ct::vulkan::swapchain::acquire_next_image(logical_device.device, synchronization.present_complete, swapchain);
+		ct::vulkan::swapchain::acquire_next_image(logical_device.device, synchronization, swapchain, &submission);
+		ct::vulkan::swapchain::wait_frame(logical_device, swapchain, synchronization);
+		// Whatever the last use of this image left in its queries, its fence was just waited for
+		ct::vulkan::counters::collect(swapchain.current_buffer, counters);
 		world.draw();
-		ct::vulkan::swapchain::render_and_swap(logical_device, swapchain, synchronization);
-
-		mspf = std::chrono::duration_cast<std::chrono::milliseconds>(clock.now() - t0);
+		// Uploads go right before the frame on the graphics queue and are submitted and retired with it
+		ct::streaming::pump(streamer);
+		ct::vulkan::swapchain::render_and_swap(logical_device, swapchain, synchronization, &submission);
+		ct::invalidation::rendered(invalidation);
+		ct::vulkan::collect(synchronization.frame_completed, deletion_queue);
+		ct::vulkan::memory::update(memory_budget);
+
+		mspf = clock.now() - t0;
 		t0 = clock.now();
+		if (iteration_counter == FRAMES_WARM_UP) {
+			heap_allocations_warm = ct::vulkan::host_allocator::get_heap_allocations();
+		}
 		if (iteration_counter% 60 == 0) {
 			std::cout << "ms_per_frame: " << mspf.count() << std::endl;
+			if (iteration_counter > FRAMES_WARM_UP) {
+				std::cout << "steady-state-driver-heap-allocations: " << ct::vulkan::host_allocator::get_heap_allocations() - heap_allocations_warm << std::endl;
+			}
+			ct::vulkan::counters::report(std::cout, counters);
+			ct::vulkan::workload::report(std::cout, workload);
+			ct::vulkan::culling::report(std::cout, culling);
+			ct::vulkan::resolution::report(std::cout, resolution);
+			ct::invalidation::report(std::cout, invalidation);
+			world.report(std::cout);
+			ct::jobs::report(std::cout, jobs);
+			ct::vulkan::memory::report(std::cout, memory_budget);
+			ct::streaming::report(std::cout, streamer);
+			ct::vulkan::submission::report(std::cout, submission);
+			ct::vulkan::frame::report(std::cout, frame_allocator);
+			ct::vulkan::recording::report(std::cout, recording);
 		}
 	}
+	world.stop();
+	ct::jobs::destroy(jobs);
+	ct::vulkan::submission::destroy(submission);
+	// -> teardown: one wait at exit, children before the device
 	if (logical_device.device != VK_NULL_HANDLE) {
 		vkDeviceWaitIdle(logical_device.device);
 	}
+	ct::vulkan::capture::report(std::cout);
+	ct::vulkan::capture::end();
+	ct::streaming::report(std::cout, streamer);
+	ct::streaming::destroy(streamer);
+	ct::vulkan::frame::destroy(frame_allocator);
+	ct::vulkan::descriptor::destroy_frame_allocators(frame_descriptors);
+	ct::vulkan::descriptor::destroy_bindless(bindless);
+	ct::vulkan::recording::destroy(recording);
+	ct::vulkan::immediate::destroy(immediate);
+	ct::vulkan::culling::destroy(culling);
+	ct::vulkan::resolution::destroy(resolution);
+	ct::vulkan::workload::destroy(workload);
+	ct::vulkan::descriptor::destroy_layout_cache(layout_cache);
+	ct::vulkan::counters::destroy(counters);
+	ct::trace::gpu_destroy();
+	ct::vulkan::clear::destroy(logical_device.device, clear_engine);
+	framebuffer_owner.reset();
+	swapchain_owner.reset();
+	synchronization_owner.reset();
+	ct::vulkan::flush(deletion_queue);
+	ct::vulkan::transient::destroy(transient_pool);
+	logical_device_owner.reset();
+	// <-
+	ct::vulkan::host_allocator::report(std::cout);
+	ct::trace::write();
 
 
     return 0;
@@ -0,0 +1,47 @@
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/MultiDevice.h"
+#include "utils/ErrorHelper.h"
+
+
+#define APP_TITLE "Multi Device Clear"
+#define FRAME_HEIGHT 960
+#define FRAME_WIDTH 1280
+#define N_FRAMES 600
+
+
+int main(int argc, char **argv) {
+	uint32_t n_frames = argc > 1 ? std::atoi(argv[1]) : N_FRAMES;
+
+	VkInstance vulkan_instance;
+	ct::vulkan::create_instance(APP_TITLE, vulkan_instance);
+
+	// -> one worker per physical device
+	std::vector<VkPhysicalDevice> physical_devices;
+	ct::vulkan::search_gpus(vulkan_instance, physical_devices);
+
+	std::vector<ct::vulkan::multidevice::Worker> workers(physical_devices.size());
+	for (uint32_t i = 0; i < workers.size(); i++)
+		ct::vulkan::multidevice::setup_worker(i, FRAME_WIDTH, FRAME_HEIGHT, physical_devices[i], workers[i]);
+	// <-
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	ct::vulkan::multidevice::run(n_frames, workers);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+	std::vector<uint32_t> frame_texels;
+	uint32_t n_mismatch = ct::vulkan::multidevice::gather(n_frames, workers, frame_texels);
+	std::cout << "n-workers: " << workers.size() << " n-frames: " << n_frames << " ms_per_frame: " << ms / n_frames << std::endl;
+
+	for (auto &worker : workers)
+		ct::vulkan::multidevice::destroy_worker(worker);
+
+	if (n_mismatch > 0) {
+		ct::error::exit("Gathered frames do not match their frame id: " + std::to_string(n_mismatch), 1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/DynamicRendering.h"
+#include "vulkanbase/DescriptorHelper.h"
+#include "vulkanbase/Replay.h"
+#include "utils/EnvHelper.h"
+
+
+#define APP_TITLE "Capture Replay"
+
+
+// Runs a CT_CAPTURE file offscreen as fast as the device goes: replay <capture>
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " <capture>" << std::endl;
+		return 1;
+	}
+	uint32_t loops = (uint32_t)std::max(1L, ct::env::get_int("CT_REPLAY_LOOPS", 1));
+	uint32_t frames_in_flight = (uint32_t)std::max(1L, ct::env::get_int("CT_REPLAY_FRAMES_IN_FLIGHT", 2));
+
+	// -> headless device, no swapchain
+	VkInstance vulkan_instance;
+	ct::vulkan::create_instance(APP_TITLE, vulkan_instance);
+	ct::vulkan::LogicalDevice logical_device;
+	ct::vulkan::search_and_pick_gpu(vulkan_instance, logical_device);
+	// What the examples may have recorded with, where the device has it: the replay skips what needs something missing
+	ct::vulkan::replay::Replay replay;
+	ct::vulkan::rendering::Rendering rendering;
+	ct::vulkan::rendering::request(logical_device, rendering);
+	ct::vulkan::descriptor::Bindless bindless;
+	replay.has_descriptor_indexing = ct::vulkan::descriptor::request_bindless(logical_device, bindless);
+	logical_device.features_enabled.drawIndirectFirstInstance = logical_device.features.drawIndirectFirstInstance;
+	logical_device.features_enabled.multiDrawIndirect = logical_device.features.multiDrawIndirect;
+	replay.has_multi_draw_indirect = logical_device.features.multiDrawIndirect == VK_TRUE;
+	if (ct::vulkan::is_device_extension_supported(logical_device, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME))
+		logical_device.extensions_enabled.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	ct::vulkan::create_device(logical_device, false);
+	ct::vulkan::dispatch::connect_device(logical_device.device, logical_device.extensions);
+	ct::vulkan::create_queues(logical_device, logical_device.queue_graphics, logical_device.queue_compute);
+	ct::vulkan::create_command_pool(logical_device.device, logical_device.queue_family_indices.graphics, logical_device.command_pool);
+	std::cout << "device: " << logical_device.properties.deviceName << std::endl;
+	// <-
+
+	if (!ct::vulkan::replay::load(argv[1], logical_device, replay)) {
+		std::cout << "could not read a capture from " << argv[1] << std::endl;
+		ct::vulkan::destroy_device(logical_device);
+		vkDestroyInstance(vulkan_instance, ct::vulkan::get_allocator());
+		return 1;
+	}
+	ct::vulkan::replay::report(std::cout, replay);
+
+	double ms = ct::vulkan::replay::run(loops, frames_in_flight, replay);
+	uint64_t n_frames = (uint64_t)replay.frames.size() * loops;
+	std::cout << "replay: " << n_frames << " frames in " << ms << " ms, " << (n_frames > 0 ? ms / n_frames : 0.0) << " ms/frame, "
+		<< (ms > 0.0 ? n_frames * 1000.0 / ms : 0.0) << " fps" << std::endl;
+
+	// -> teardown
+	vkDeviceWaitIdle(logical_device.device);
+	ct::vulkan::replay::destroy(replay);
+	ct::vulkan::destroy_device(logical_device);
+	vkDestroyInstance(vulkan_instance, ct::vulkan::get_allocator());
+	// <-
+	return 0;
+}
@@ -0,0 +1,21 @@
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include "loader/Streaming.h"
+
+
+// Packs files into an archive for CT_STREAM: streampack out.ctpk file...
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		std::cout << "usage: " << argv[0] << " <archive> <file>..." << std::endl;
+		return 1;
+	}
+	std::vector<std::string> files(argv + 2, argv + argc);
+	if (!ct::streaming::write_archive(argv[1], files)) {
+		std::cout << "could not write " << argv[1] << std::endl;
+		return 1;
+	}
+	std::cout << "packed " << files.size() << " files into " << argv[1] << std::endl;
+	return 0;
+}
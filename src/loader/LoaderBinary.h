@@ -1,6 +1,8 @@
 #pragma once
 
 #include <fstream>
+#include <vector>
+#include <cassert>
 #include <string>
 
 namespace ct {
@@ -0,0 +1,762 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <vulkan/vulkan.h>
+#include "loader/LoaderBinary.h"
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/Submission.h"
+#include "utils/JobSystem.h"
+#include "utils/EnvHelper.h"
+#include "utils/Trace.h"
+
+namespace ct {
+	namespace streaming {
+#define STREAMING_ARCHIVE_MAGIC 0x4b505443		// "CTPK" little endian
+#define STREAMING_ARCHIVE_VERSION 1
+#define STREAMING_ARCHIVE_ALIGNMENT 4096
+#define STREAMING_NAME_SIZE 64
+#define STREAMING_SLOTS 3
+#define STREAMING_READ_CHUNK (4 * 1024 * 1024)
+#define STREAMING_COPY_ALIGNMENT 16
+#define STREAMING_MB (1024.0 * 1024.0)
+
+		// -> packed archive: header, count entries, then the data of every entry at a page aligned offset
+		struct ArchiveHeader {
+			uint32_t magic;
+			uint32_t version;
+			uint32_t count;
+			uint32_t reserved;
+		};
+
+		struct ArchiveEntry {
+			char name[STREAMING_NAME_SIZE];
+			uint64_t offset;
+			uint64_t size;
+		};
+		// <-
+
+		struct Archive {
+			int fd = -1;
+			std::string path;
+			std::vector<ArchiveEntry> entries;
+			std::unordered_map<std::string, uint32_t> index;
+		};
+
+		enum Status {
+			QUEUED,
+			READING,
+			READ,
+			UPLOADING,
+			RESIDENT,
+			FAILED
+		};
+
+		inline const char* status2string(Status status) {
+			switch (status) {
+#define STR(r) case r: return #r
+				STR(QUEUED);
+				STR(READING);
+				STR(READ);
+				STR(UPLOADING);
+				STR(RESIDENT);
+				STR(FAILED);
+#undef STR
+				default: return "UNKNOWN_STATUS";
+			}
+		}
+
+		enum Kind {
+			BUFFER,
+			IMAGE
+		};
+
+		struct Asset {
+			uint32_t handle = 0;
+			std::string name;
+			Kind kind = BUFFER;
+			uint32_t priority = 0;
+
+			// -> source, an archive entry (fd of the archive) or a loose file opened when it is read
+			int fd = -1;
+			uint64_t file_offset = 0;
+			uint64_t size = 0;
+			// <-
+
+			// -> destination: buffers at offset in the streamer's buffer, images bound at offset in its memory
+			VkDeviceSize offset = 0;
+			VkImage image = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			uint32_t width = 0;
+			uint32_t height = 0;
+			VkFormat format = VK_FORMAT_UNDEFINED;
+			// <-
+
+			std::vector<char> data;
+			VkDeviceSize uploaded = 0;
+			std::atomic<Status> status{QUEUED};
+			// Called on the thread calling pump(), once the asset is resident or failed
+			std::function<void(Asset&)> on_complete;
+		};
+
+		struct Pending {
+			uint32_t priority;
+			uint64_t sequence;
+			Asset *asset;
+		};
+
+		// Lowest priority value first, in request order within a priority
+		struct PendingOrder {
+			bool operator()(const Pending &a, const Pending &b) const {
+				return a.priority != b.priority ? a.priority > b.priority : a.sequence > b.sequence;
+			}
+		};
+
+		// One staging slot per upload in flight, retired by its own fence or by the frame value it was submitted with
+		struct Slot {
+			VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+			VkFence fence = VK_NULL_HANDLE;
+			uint64_t frame = 0;
+			bool in_flight = false;
+			std::vector<Asset*> completes;
+		};
+
+		// I/O threads read requested assets with pread in priority order, at most read_ahead bytes ahead of the uploads.
+		// pump() runs on the render thread once per frame: it retires finished uploads (callbacks, residency) and copies up to frame_budget bytes
+		// through the staging ring into memory allocated once at setup, so a big scene loads over many frames instead of stalling one.
+		// The transfer queue is the graphics queue's family here, uploads are submitted from pump(), or handed to the submit thread
+		// that owns the queue when submission is set, so the queue is only used from one thread. With synchronization set and the transfer
+		// queue being the graphics queue, uploads carry no fence: pump() runs right before the frame is submitted, the frame's submission
+		// follows them on the queue and its fence retires them, so the submit thread puts both into one vkQueueSubmit.
+		struct Streamer {
+			VkDevice device = VK_NULL_HANDLE;
+			VkQueue queue = VK_NULL_HANDLE;
+			VkPhysicalDeviceMemoryProperties memory_properties;
+			VkDeviceSize granularity = 1;
+			ct::jobs::JobSystem *jobs = nullptr;
+			ct::vulkan::submission::Service *submission = nullptr;
+			const ct::vulkan::Synchronization *synchronization = nullptr;
+
+			// -> parameters, from CT_STREAM_* environment variables
+			uint32_t n_threads = 2;							// CT_STREAM_THREADS
+			VkDeviceSize arena_size = 256 * 1024 * 1024;	// CT_STREAM_POOL_MB
+			VkDeviceSize staging_size = 24 * 1024 * 1024;	// CT_STREAM_STAGING_MB, split into STREAMING_SLOTS
+			VkDeviceSize frame_budget = 8 * 1024 * 1024;	// CT_STREAM_FRAME_MB
+			VkDeviceSize read_ahead = 64 * 1024 * 1024;		// CT_STREAM_READ_AHEAD_MB
+			// <-
+
+			// -> device memory every asset is placed in, bump allocated and released as a whole
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			uint32_t memory_type = 0;
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceSize arena_used = 0;
+			// <-
+
+			// -> staging ring
+			ct::vulkan::Buffer staging;
+			VkDeviceSize slot_size = 0;
+			VkCommandPool command_pool = VK_NULL_HANDLE;
+			Slot slots[STREAMING_SLOTS];
+			Asset *uploading = nullptr;
+			// <-
+
+			std::vector<std::unique_ptr<Archive>> archives;
+
+			// -> shared with the I/O threads, under mutex
+			std::mutex mutex;
+			std::condition_variable wake;
+			std::priority_queue<Pending, std::vector<Pending>, PendingOrder> pending;
+			uint64_t sequence = 0;
+			std::vector<std::unique_ptr<Asset>> assets;
+			std::deque<Asset*> ready;
+			VkDeviceSize bytes_ready = 0;
+			std::vector<Asset*> failed;
+			// <-
+			std::vector<std::thread> threads;
+			std::atomic<bool> running{false};
+
+			// -> stats
+			std::atomic<uint64_t> bytes_read{0};
+			std::atomic<uint64_t> read_ns{0};
+			uint64_t bytes_uploaded = 0;
+			uint32_t n_resident = 0;
+			uint32_t n_failed = 0;
+			uint32_t n_uploads = 0;
+			std::chrono::steady_clock::time_point first_request;
+			std::chrono::steady_clock::time_point last_resident;
+			// <-
+		};
+
+		inline void read_params(Streamer &streamer) {
+			streamer.n_threads = (uint32_t)std::max(1L, ct::env::get_int("CT_STREAM_THREADS", streamer.n_threads));
+			streamer.arena_size = (VkDeviceSize)(std::max(1.0, ct::env::get_double("CT_STREAM_POOL_MB", streamer.arena_size / STREAMING_MB)) * STREAMING_MB);
+			streamer.staging_size = (VkDeviceSize)(std::max(1.0, ct::env::get_double("CT_STREAM_STAGING_MB", streamer.staging_size / STREAMING_MB)) * STREAMING_MB);
+			streamer.frame_budget = (VkDeviceSize)(std::max(0.1, ct::env::get_double("CT_STREAM_FRAME_MB", streamer.frame_budget / STREAMING_MB)) * STREAMING_MB);
+			streamer.read_ahead = (VkDeviceSize)(std::max(1.0, ct::env::get_double("CT_STREAM_READ_AHEAD_MB", streamer.read_ahead / STREAMING_MB)) * STREAMING_MB);
+		}
+
+		// -> archives
+
+		inline bool read_exact(int fd, void *data, uint64_t size, uint64_t offset) {
+			char *destination = static_cast<char*>(data);
+			uint64_t done = 0;
+			while (done < size) {
+				ssize_t n = pread(fd, destination + done, (size_t)std::min<uint64_t>(STREAMING_READ_CHUNK, size - done), (off_t)(offset + done));
+				if (n <= 0)
+					return false;
+				done += (uint64_t)n;
+			}
+			return true;
+		}
+
+		// Only the index is read here, entry data is read by the I/O threads when requested
+		inline bool open_archive(const std::string &path, Archive &archive) {
+			archive.fd = open(path.c_str(), O_RDONLY);
+			if (archive.fd < 0)
+				return false;
+			ArchiveHeader header;
+			if (!read_exact(archive.fd, &header, sizeof(header), 0) || header.magic != STREAMING_ARCHIVE_MAGIC || header.version != STREAMING_ARCHIVE_VERSION) {
+				close(archive.fd);
+				archive.fd = -1;
+				return false;
+			}
+			archive.entries.resize(header.count);
+			if (header.count > 0 && !read_exact(archive.fd, archive.entries.data(), header.count * sizeof(ArchiveEntry), sizeof(header))) {
+				close(archive.fd);
+				archive.fd = -1;
+				return false;
+			}
+			archive.path = path;
+			for (uint32_t i = 0; i < header.count; i++) {
+				archive.entries[i].name[STREAMING_NAME_SIZE - 1] = '\0';
+				archive.index[archive.entries[i].name] = i;
+			}
+			return true;
+		}
+
+		// Packs files into an archive, every entry is named by the path it was given as
+		inline bool write_archive(const std::string &path, const std::vector<std::string> &files) {
+			ArchiveHeader header = { STREAMING_ARCHIVE_MAGIC, STREAMING_ARCHIVE_VERSION, (uint32_t)files.size(), 0 };
+			std::vector<ArchiveEntry> entries(files.size());
+			std::vector<std::vector<char>> contents(files.size());
+			uint64_t offset = sizeof(ArchiveHeader) + files.size() * sizeof(ArchiveEntry);
+			for (uint32_t i = 0; i < files.size(); i++) {
+				if (files[i].size() >= STREAMING_NAME_SIZE) {
+					std::cout << "streaming: name too long for an archive entry: " << files[i] << std::endl;
+					return false;
+				}
+				ct::load_binary(files[i], contents[i]);
+				std::memset(entries[i].name, 0, STREAMING_NAME_SIZE);
+				std::memcpy(entries[i].name, files[i].c_str(), files[i].size());
+				offset = (offset + STREAMING_ARCHIVE_ALIGNMENT - 1) / STREAMING_ARCHIVE_ALIGNMENT * STREAMING_ARCHIVE_ALIGNMENT;
+				entries[i].offset = offset;
+				entries[i].size = contents[i].size();
+				offset += entries[i].size;
+			}
+			std::ofstream os(path, std::ios::binary | std::ios::out | std::ios::trunc);
+			if (!os.is_open())
+				return false;
+			os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			os.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ArchiveEntry));
+			for (uint32_t i = 0; i < files.size(); i++) {
+				std::vector<char> padding((size_t)(entries[i].offset - (uint64_t)os.tellp()), 0);
+				os.write(padding.data(), padding.size());
+				os.write(contents[i].data(), contents[i].size());
+			}
+			return os.good();
+		}
+
+		// <-
+
+		// -> I/O threads
+
+		inline void fail(Asset &asset, Streamer &streamer) {
+			asset.status = FAILED;
+			asset.data = std::vector<char>();
+			std::lock_guard<std::mutex> lock(streamer.mutex);
+			streamer.failed.push_back(&asset);
+		}
+
+		inline void read(Asset &asset, Streamer &streamer) {
+			CT_TRACE_SCOPE("stream_read");
+			auto t0 = std::chrono::steady_clock::now();
+			bool is_loose = asset.fd < 0;
+			int fd = is_loose ? open(asset.name.c_str(), O_RDONLY) : asset.fd;
+			asset.data.resize((size_t)asset.size);
+			bool is_read = fd >= 0 && read_exact(fd, asset.data.data(), asset.size, asset.file_offset);
+			if (is_loose && fd >= 0)
+				close(fd);
+			if (!is_read) {
+				std::cout << "streaming: could not read " << asset.name << std::endl;
+				fail(asset, streamer);
+				return;
+			}
+			streamer.read_ns.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count(), std::memory_order_relaxed);
+			streamer.bytes_read.fetch_add(asset.size, std::memory_order_relaxed);
+			asset.status = READ;
+			std::lock_guard<std::mutex> lock(streamer.mutex);
+			streamer.ready.push_back(&asset);
+			streamer.bytes_ready += asset.size;
+		}
+
+		// Waits while read_ahead bytes are read but not uploaded yet, one asset bigger than that is still read on its own
+		inline void work(Streamer &streamer) {
+			while (true) {
+				Asset *asset;
+				{
+					std::unique_lock<std::mutex> lock(streamer.mutex);
+					streamer.wake.wait(lock, [&streamer]() {
+						return !streamer.running.load(std::memory_order_relaxed) || (!streamer.pending.empty() && streamer.bytes_ready < streamer.read_ahead);
+					});
+					if (!streamer.running.load(std::memory_order_relaxed))
+						return;
+					asset = streamer.pending.top().asset;
+					streamer.pending.pop();
+				}
+				asset->status = READING;
+				read(*asset, streamer);
+			}
+		}
+
+		// <-
+
+		inline void setup(ct::vulkan::LogicalDevice &logical_device, Streamer &streamer, ct::jobs::JobSystem *jobs = nullptr,
+				ct::vulkan::submission::Service *submission = nullptr, const ct::vulkan::Synchronization *synchronization = nullptr) {
+			read_params(streamer);
+			VkDevice &device = logical_device.device;
+			streamer.device = device;
+			streamer.memory_properties = logical_device.memory_properties;
+			streamer.granularity = std::max((VkDeviceSize)1, logical_device.properties.limits.bufferImageGranularity);
+			streamer.jobs = jobs;
+			streamer.submission = submission;
+			vkGetDeviceQueue(device, logical_device.queue_family_indices.transfer, 0, &streamer.queue);
+			streamer.synchronization = streamer.queue == logical_device.queue_graphics ? synchronization : nullptr;
+
+			// -> one allocation for every asset, the buffer over all of it holds the buffer assets
+			VkBufferCreateInfo bufferInfo = {};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = streamer.arena_size;
+			bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+				| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, ct::vulkan::get_allocator(), &streamer.buffer));
+			ct::vulkan::capture::buffer(streamer.buffer, bufferInfo);
+			VkMemoryRequirements memReqs;
+			vkGetBufferMemoryRequirements(device, streamer.buffer, &memReqs);
+			VkMemoryAllocateInfo mem_alloc = {};
+			mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			mem_alloc.allocationSize = memReqs.size;
+			mem_alloc.memoryTypeIndex = ct::vulkan::get_memory_type(streamer.memory_properties, memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			VK_CHECK_RESULT(vkAllocateMemory(device, &mem_alloc, ct::vulkan::get_allocator(), &streamer.memory));
+			ct::vulkan::memory::track(streamer.memory, mem_alloc.memoryTypeIndex, mem_alloc.allocationSize, ct::vulkan::memory::BUFFER);
+			VK_CHECK_RESULT(vkBindBufferMemory(device, streamer.buffer, streamer.memory, 0));
+			streamer.memory_type = mem_alloc.memoryTypeIndex;
+			// <-
+
+			// -> staging ring and the command buffers copying out of it
+			ct::vulkan::create_buffer(streamer.staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					device, logical_device.memory_properties, streamer.staging);
+			streamer.slot_size = streamer.staging_size / STREAMING_SLOTS / STREAMING_COPY_ALIGNMENT * STREAMING_COPY_ALIGNMENT;
+			ct::vulkan::create_command_pool(device, logical_device.queue_family_indices.transfer, streamer.command_pool);
+			std::vector<VkCommandBuffer> command_buffers;
+			ct::vulkan::create_command_buffer(STREAMING_SLOTS, device, streamer.command_pool, command_buffers);
+			VkFenceCreateInfo fenceCreateInfo = {};
+			fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			for (uint32_t i = 0; i < STREAMING_SLOTS; i++) {
+				streamer.slots[i].command_buffer = command_buffers[i];
+				VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, ct::vulkan::get_allocator(), &streamer.slots[i].fence));
+			}
+			// <-
+
+			streamer.running = true;
+			for (uint32_t i = 0; i < streamer.n_threads; i++)
+				streamer.threads.emplace_back([&streamer]() { work(streamer); });
+			std::cout << "streaming: io-threads: " << streamer.n_threads << " pool-mb: " << streamer.arena_size / STREAMING_MB
+				<< " staging-mb: " << streamer.staging_size / STREAMING_MB << " frame-mb: " << streamer.frame_budget / STREAMING_MB << std::endl;
+		}
+
+		// -> requests, from any thread
+
+		// Archives are searched in the order they were added, before the file system
+		inline bool add_archive(const std::string &path, Streamer &streamer) {
+			std::unique_ptr<Archive> archive(new Archive());
+			if (!open_archive(path, *archive))
+				return false;
+			std::lock_guard<std::mutex> lock(streamer.mutex);
+			streamer.archives.push_back(std::move(archive));
+			return true;
+		}
+
+		inline bool locate(Asset &asset, Streamer &streamer) {
+			for (auto &archive : streamer.archives) {
+				auto it = archive->index.find(asset.name);
+				if (it == archive->index.end())
+					continue;
+				asset.fd = archive->fd;
+				asset.file_offset = archive->entries[it->second].offset;
+				asset.size = archive->entries[it->second].size;
+				return true;
+			}
+			struct stat info;
+			if (stat(asset.name.c_str(), &info) != 0)
+				return false;
+			asset.size = (uint64_t)info.st_size;
+			return true;
+		}
+
+		inline bool allocate(VkDeviceSize size, VkDeviceSize alignment, Streamer &streamer, VkDeviceSize &offset) {
+			offset = (streamer.arena_used + alignment - 1) / alignment * alignment;
+			if (offset + size > streamer.arena_size)
+				return false;
+			streamer.arena_used = offset + size;
+			return true;
+		}
+
+		// Images are created and bound here, the upload only fills them. Raw texels, tightly packed, no mip levels.
+		inline bool create_image(Asset &asset, Streamer &streamer) {
+			if (asset.size > streamer.slot_size) {
+				std::cout << "streaming: " << asset.name << " does not fit a staging slot, images are uploaded in one copy" << std::endl;
+				return false;
+			}
+			VkImageCreateInfo image = {};
+			image.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			image.imageType = VK_IMAGE_TYPE_2D;
+			image.format = asset.format;
+			image.extent = { asset.width, asset.height, 1 };
+			image.mipLevels = 1;
+			image.arrayLayers = 1;
+			image.samples = VK_SAMPLE_COUNT_1_BIT;
+			image.tiling = VK_IMAGE_TILING_OPTIMAL;
+			image.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			VK_CHECK_RESULT(vkCreateImage(streamer.device, &image, ct::vulkan::get_allocator(), &asset.image));
+			ct::vulkan::capture::image(asset.image, image);
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(streamer.device, asset.image, &memReqs);
+			if ((memReqs.memoryTypeBits & (1u << streamer.memory_type)) == 0 || !allocate(memReqs.size, std::max(memReqs.alignment, streamer.granularity), streamer, asset.offset))
+				return false;
+			VK_CHECK_RESULT(vkBindImageMemory(streamer.device, asset.image, streamer.memory, asset.offset));
+
+			VkImageViewCreateInfo view = {};
+			view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			view.format = asset.format;
+			view.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			view.image = asset.image;
+			VK_CHECK_RESULT(vkCreateImageView(streamer.device, &view, ct::vulkan::get_allocator(), &asset.view));
+			ct::vulkan::capture::view(asset.view, view);
+			return true;
+		}
+
+		inline uint32_t enqueue(std::unique_ptr<Asset> asset, Streamer &streamer) {
+			std::lock_guard<std::mutex> lock(streamer.mutex);
+			bool is_placed = locate(*asset, streamer);
+			if (is_placed && asset->kind == IMAGE)
+				is_placed = create_image(*asset, streamer);
+			else if (is_placed)
+				is_placed = allocate(asset->size, STREAMING_COPY_ALIGNMENT, streamer, asset->offset);
+			if (streamer.assets.empty())
+				streamer.first_request = std::chrono::steady_clock::now();
+			asset->handle = (uint32_t)streamer.assets.size();
+			Asset *requested = asset.get();
+			streamer.assets.push_back(std::move(asset));
+			if (!is_placed) {
+				std::cout << "streaming: could not place " << requested->name << std::endl;
+				requested->status = FAILED;
+				streamer.failed.push_back(requested);
+				return requested->handle;
+			}
+			streamer.pending.push({ requested->priority, streamer.sequence++, requested });
+			streamer.wake.notify_one();
+			return requested->handle;
+		}
+
+		// name is an archive entry or a file path, lower priority values are read first
+		inline uint32_t request(const std::string &name, uint32_t priority, std::function<void(Asset&)> on_complete, Streamer &streamer) {
+			std::unique_ptr<Asset> asset(new Asset());
+			asset->name = name;
+			asset->kind = BUFFER;
+			asset->priority = priority;
+			asset->on_complete = std::move(on_complete);
+			return enqueue(std::move(asset), streamer);
+		}
+
+		inline uint32_t request_image(const std::string &name, uint32_t width, uint32_t height, VkFormat format, uint32_t priority,
+				std::function<void(Asset&)> on_complete, Streamer &streamer) {
+			std::unique_ptr<Asset> asset(new Asset());
+			asset->name = name;
+			asset->kind = IMAGE;
+			asset->width = width;
+			asset->height = height;
+			asset->format = format;
+			asset->priority = priority;
+			asset->on_complete = std::move(on_complete);
+			return enqueue(std::move(asset), streamer);
+		}
+
+		// Every entry of every archive and every loose file in a ':' separated list, in list order
+		inline uint32_t request_paths(const std::string &paths, Streamer &streamer) {
+			uint32_t n = 0;
+			size_t begin = 0;
+			while (begin <= paths.size()) {
+				size_t end = std::min(paths.find(':', begin), paths.size());
+				std::string path = paths.substr(begin, end - begin);
+				begin = end + 1;
+				if (path.empty())
+					continue;
+				if (add_archive(path, streamer)) {
+					for (auto &entry : streamer.archives.back()->entries)
+						request(entry.name, n++, nullptr, streamer);
+				} else {
+					request(path, n++, nullptr, streamer);
+				}
+			}
+			return n;
+		}
+
+		inline Status get_status(uint32_t handle, Streamer &streamer) {
+			std::lock_guard<std::mutex> lock(streamer.mutex);
+			return handle < streamer.assets.size() ? streamer.assets[handle]->status.load() : FAILED;
+		}
+
+		inline bool is_resident(uint32_t handle, Streamer &streamer) {
+			return get_status(handle, streamer) == RESIDENT;
+		}
+
+		// <-
+
+		// -> uploads, render thread
+
+		inline void complete(Asset &asset, Streamer &streamer) {
+			if (asset.status == RESIDENT) {
+				streamer.n_resident++;
+				streamer.last_resident = std::chrono::steady_clock::now();
+			} else {
+				streamer.n_failed++;
+			}
+			if (asset.on_complete)
+				asset.on_complete(asset);
+		}
+
+		inline void retire(Streamer &streamer) {
+			const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+			for (auto &slot : streamer.slots) {
+				if (!slot.in_flight)
+					continue;
+				if (streamer.synchronization != nullptr) {
+					if (streamer.synchronization->frame_completed < slot.frame)
+						continue;
+				} else {
+					if (dispatch.vkGetFenceStatus(streamer.device, slot.fence) != VK_SUCCESS)
+						continue;
+					VK_CHECK_RESULT(dispatch.vkResetFences(streamer.device, 1, &slot.fence));
+				}
+				slot.in_flight = false;
+				for (Asset *asset : slot.completes) {
+					asset->status = RESIDENT;
+					complete(*asset, streamer);
+				}
+				slot.completes.clear();
+			}
+			std::vector<Asset*> failed;
+			{
+				std::lock_guard<std::mutex> lock(streamer.mutex);
+				failed.swap(streamer.failed);
+			}
+			for (Asset *asset : failed)
+				complete(*asset, streamer);
+		}
+
+		inline Asset* next_ready(Streamer &streamer) {
+			std::lock_guard<std::mutex> lock(streamer.mutex);
+			if (streamer.ready.empty())
+				return nullptr;
+			Asset *asset = streamer.ready.front();
+			streamer.ready.pop_front();
+			streamer.bytes_ready -= asset->size;
+			streamer.wake.notify_all();
+			return asset;
+		}
+
+		inline void record_image(VkCommandBuffer command_buffer, VkBuffer staging, VkDeviceSize staging_offset, Asset &asset) {
+			const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+			ct::vulkan::set_image_layout(command_buffer, asset.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+			VkBufferImageCopy region = {};
+			region.bufferOffset = staging_offset;
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			region.imageExtent = { asset.width, asset.height, 1 };
+			dispatch.vkCmdCopyBufferToImage(command_buffer, staging, asset.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			ct::vulkan::set_image_layout(command_buffer, asset.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+		}
+
+		// Fills one staging slot with up to budget bytes, buffers in as many pieces as it takes, images whole. Returns the bytes copied.
+		inline VkDeviceSize upload(Slot &slot, VkDeviceSize staging_base, VkDeviceSize budget, Streamer &streamer) {
+			const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+			VkDeviceSize limit = std::min(streamer.slot_size, budget);
+			VkDeviceSize used = 0;
+			char *staging = static_cast<char*>(streamer.staging.mapped) + staging_base;
+			bool is_recording = false;
+			while (used < limit) {
+				if (streamer.uploading == nullptr && (streamer.uploading = next_ready(streamer)) == nullptr)
+					break;
+				Asset &asset = *streamer.uploading;
+				VkDeviceSize size = asset.kind == IMAGE ? asset.size - asset.uploaded : std::min(asset.size - asset.uploaded, limit - used);
+				// An image that does not fit what is left waits for the next slot, it always fits an empty one
+				if (used + size > streamer.slot_size)
+					break;
+				if (!is_recording) {
+					VkCommandBufferBeginInfo cmdBufInfo = {};
+					cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+					cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+					VK_CHECK_RESULT(dispatch.vkBeginCommandBuffer(slot.command_buffer, &cmdBufInfo));
+					is_recording = true;
+				}
+				asset.status = UPLOADING;
+				ct::jobs::parallel_copy(staging + used, asset.data.data() + asset.uploaded, (size_t)size, streamer.jobs);
+				if (asset.kind == IMAGE) {
+					record_image(slot.command_buffer, streamer.staging.buffer, staging_base + used, asset);
+				} else {
+					VkBufferCopy region = { staging_base + used, asset.offset + asset.uploaded, size };
+					dispatch.vkCmdCopyBuffer(slot.command_buffer, streamer.staging.buffer, streamer.buffer, 1, &region);
+				}
+				asset.uploaded += size;
+				used = (used + size + STREAMING_COPY_ALIGNMENT - 1) / STREAMING_COPY_ALIGNMENT * STREAMING_COPY_ALIGNMENT;
+				streamer.bytes_uploaded += size;
+				if (asset.uploaded == asset.size) {
+					asset.data = std::vector<char>();
+					slot.completes.push_back(&asset);
+					streamer.uploading = nullptr;
+				}
+			}
+			if (!is_recording)
+				return 0;
+
+			// Later submissions read what was copied, anywhere in the pipeline
+			VkMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			dispatch.vkCmdPipelineBarrier(slot.command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			VK_CHECK_RESULT(dispatch.vkEndCommandBuffer(slot.command_buffer));
+
+			ct::vulkan::submission::Work work;
+			work.queue = streamer.queue;
+			ct::vulkan::submission::add_command_buffer(slot.command_buffer, work);
+			if (streamer.synchronization != nullptr)
+				slot.frame = streamer.synchronization->frame_submitted + 1;
+			else
+				work.fence = slot.fence;
+			ct::vulkan::submission::submit(work, streamer.submission);
+			slot.in_flight = true;
+			streamer.n_uploads++;
+			return used;
+		}
+
+		// Once per frame on the thread that submits frames, after the frame's fence was waited for and before the frame is submitted:
+		// completions first, then at most frame_budget bytes of new uploads
+		inline void pump(Streamer &streamer) {
+			CT_TRACE_FUNCTION();
+			if (streamer.device == VK_NULL_HANDLE)
+				return;
+			retire(streamer);
+			VkDeviceSize budget = streamer.frame_budget;
+			for (uint32_t i = 0; i < STREAMING_SLOTS && budget > 0; i++) {
+				Slot &slot = streamer.slots[i];
+				if (slot.in_flight)
+					continue;
+				VkDeviceSize used = upload(slot, i * streamer.slot_size, budget, streamer);
+				if (used == 0)
+					break;
+				budget -= std::min(budget, used);
+			}
+		}
+
+		// Something is still queued, being read or uploaded
+		inline bool is_busy(Streamer &streamer) {
+			if (streamer.device == VK_NULL_HANDLE)
+				return false;
+			std::lock_guard<std::mutex> lock(streamer.mutex);
+			return streamer.n_resident + streamer.n_failed < streamer.assets.size();
+		}
+
+		// <-
+
+		inline void report(std::ostream &os, Streamer &streamer) {
+			if (streamer.device == VK_NULL_HANDLE)
+				return;
+			size_t n_assets;
+			{
+				std::lock_guard<std::mutex> lock(streamer.mutex);
+				n_assets = streamer.assets.size();
+			}
+			double read_s = streamer.read_ns.load() / 1e9;
+			auto until = streamer.n_resident + streamer.n_failed < n_assets ? std::chrono::steady_clock::now() : streamer.last_resident;
+			double wall_s = std::chrono::duration<double>(until - streamer.first_request).count();
+			os << "streaming: resident: " << streamer.n_resident << "/" << n_assets << " failed: " << streamer.n_failed
+				<< " read-mb: " << streamer.bytes_read.load() / STREAMING_MB << " read-mb-per-s: " << (read_s > 0.0 ? streamer.bytes_read.load() / STREAMING_MB / read_s : 0.0)
+				<< " uploaded-mb: " << streamer.bytes_uploaded / STREAMING_MB << " mb-per-s: " << (wall_s > 0.0 ? streamer.bytes_uploaded / STREAMING_MB / wall_s : 0.0)
+				<< " uploads: " << streamer.n_uploads << " pool-used-mb: " << streamer.arena_used / STREAMING_MB << std::endl;
+		}
+
+		// The device has to be idle, assets still in flight are dropped
+		inline void destroy(Streamer &streamer) {
+			if (streamer.device == VK_NULL_HANDLE)
+				return;
+			{
+				std::lock_guard<std::mutex> lock(streamer.mutex);
+				streamer.running = false;
+			}
+			streamer.wake.notify_all();
+			for (auto &thread : streamer.threads)
+				thread.join();
+			streamer.threads.clear();
+
+			VkDevice device = streamer.device;
+			for (auto &slot : streamer.slots) {
+				vkDestroyFence(device, slot.fence, ct::vulkan::get_allocator());
+				slot = Slot();
+			}
+			vkDestroyCommandPool(device, streamer.command_pool, ct::vulkan::get_allocator());
+			streamer.command_pool = VK_NULL_HANDLE;
+			for (auto &asset : streamer.assets) {
+				vkDestroyImageView(device, asset->view, ct::vulkan::get_allocator());
+				vkDestroyImage(device, asset->image, ct::vulkan::get_allocator());
+			}
+			streamer.assets.clear();
+			streamer.ready.clear();
+			streamer.failed.clear();
+			streamer.uploading = nullptr;
+			vkDestroyBuffer(device, streamer.buffer, ct::vulkan::get_allocator());
+			ct::vulkan::memory::untrack(streamer.memory);
+			vkFreeMemory(device, streamer.memory, ct::vulkan::get_allocator());
+			streamer.buffer = VK_NULL_HANDLE;
+			streamer.memory = VK_NULL_HANDLE;
+			ct::vulkan::destroy_buffer(device, streamer.staging);
+			for (auto &archive : streamer.archives)
+				close(archive->fd);
+			streamer.archives.clear();
+			streamer.device = VK_NULL_HANDLE;
+		}
+
+	}
+}
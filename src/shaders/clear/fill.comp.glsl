@@ -0,0 +1,17 @@
+#version 450
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// No format qualifier: the target may be any colour format, writes need shaderStorageImageWriteWithoutFormat
+layout (set = 0, binding = 0) uniform writeonly image2D target;
+
+layout (push_constant) uniform PushConstants {
+	vec4 color;
+	ivec2 extent;
+} pc;
+
+void main() {
+	ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+	if (p.x < pc.extent.x && p.y < pc.extent.y)
+		imageStore(target, p, pc.color);
+}
@@ -0,0 +1,45 @@
+#version 450
+
+layout (local_size_x = 64) in;
+
+// Matches VkDrawIndexedIndirectCommand
+struct DrawCommand {
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int vertex_offset;
+	uint first_instance;
+};
+
+layout (std430, set = 0, binding = 0) buffer Stats { uint n_visible; uint n_batches; } stats;
+layout (std430, set = 0, binding = 1) readonly buffer Instances { vec4 instances[]; };
+layout (std430, set = 0, binding = 2) readonly buffer ObjectBatch { uint object_batch[]; };
+layout (std430, set = 0, binding = 3) buffer Commands { DrawCommand commands[]; };
+layout (std430, set = 0, binding = 4) writeonly buffer Visible { vec4 visible[]; };
+layout (std430, set = 0, binding = 5) buffer Counts { uint counts[]; };
+layout (std430, set = 0, binding = 6) writeonly buffer Compacted { DrawCommand compacted[]; };
+// Per batch: x group, y first command of the group
+layout (std430, set = 0, binding = 7) readonly buffer BatchGroup { uvec2 batch_group[]; };
+
+// Written every frame into the frame allocator, bound with a dynamic offset
+layout (std140, set = 0, binding = 8) uniform Params {
+	uint n_objects;
+	uint n_batches;
+} params;
+
+// One invocation per batch: batches with visible instances are appended to their group's range, counts[group] becomes the draw count
+void main() {
+	uint b = gl_GlobalInvocationID.x;
+	if (b >= params.n_batches)
+		return;
+
+	DrawCommand command = commands[b];
+	if (command.instance_count == 0)
+		return;
+
+	atomicAdd(stats.n_visible, command.instance_count);
+	atomicAdd(stats.n_batches, 1);
+	uvec2 group = batch_group[b];
+	uint slot = atomicAdd(counts[group.x], 1);
+	compacted[group.y + slot] = command;
+}
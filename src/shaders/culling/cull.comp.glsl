@@ -0,0 +1,45 @@
+#version 450
+
+layout (local_size_x = 64) in;
+
+// Matches VkDrawIndexedIndirectCommand
+struct DrawCommand {
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int vertex_offset;
+	uint first_instance;
+};
+
+layout (std430, set = 0, binding = 0) buffer Stats { uint n_visible; uint n_batches; } stats;
+// Per instance: xy centre, z depth, w half extent, all in NDC
+layout (std430, set = 0, binding = 1) readonly buffer Instances { vec4 instances[]; };
+layout (std430, set = 0, binding = 2) readonly buffer ObjectBatch { uint object_batch[]; };
+layout (std430, set = 0, binding = 3) buffer Commands { DrawCommand commands[]; };
+layout (std430, set = 0, binding = 4) writeonly buffer Visible { vec4 visible[]; };
+layout (std430, set = 0, binding = 5) buffer Counts { uint counts[]; };
+layout (std430, set = 0, binding = 6) writeonly buffer Compacted { DrawCommand compacted[]; };
+// Per batch: x group, y first command of the group
+layout (std430, set = 0, binding = 7) readonly buffer BatchGroup { uvec2 batch_group[]; };
+
+// Written every frame into the frame allocator, bound with a dynamic offset
+layout (std140, set = 0, binding = 8) uniform Params {
+	uint n_objects;
+	uint n_batches;
+} params;
+
+// One invocation per object: frustum test, then append to its batch's range of the visible instances
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= params.n_objects)
+		return;
+
+	vec4 instance = instances[i];
+	bool outside = any(greaterThan(abs(instance.xy) - vec2(instance.w), vec2(1.0))) || instance.z < 0.0 || instance.z > 1.0;
+	if (outside)
+		return;
+
+	uint batch = object_batch[i];
+	uint slot = atomicAdd(commands[batch].instance_count, 1);
+	visible[commands[batch].first_instance + slot] = instance;
+}
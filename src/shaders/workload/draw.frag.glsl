@@ -0,0 +1,22 @@
+#version 450
+
+// Pipelines only differ in this constant, it scales the ALU work per fragment
+layout (constant_id = 0) const int VARIANT = 0;
+
+layout (set = 0, binding = 0) uniform Material {
+	vec4 color;
+	vec4 params;	// x: pattern frequency
+} material;
+
+layout (location = 0) in vec2 in_uv;
+
+layout (location = 0) out vec4 out_color;
+
+void main() {
+	float pattern = 0.0;
+	for (int i = 0; i <= VARIANT; i++) {
+		float f = material.params.x * float(i + 1);
+		pattern += sin(in_uv.x * f) * cos(in_uv.y * f);
+	}
+	out_color = vec4(material.color.rgb * (0.75 + 0.25 * pattern / float(VARIANT + 1)), material.color.a);
+}
@@ -0,0 +1,12 @@
+#version 450
+
+layout (location = 0) in vec2 in_position;
+// Per instance: xy centre, z depth, w half extent, all in NDC
+layout (location = 1) in vec4 in_instance;
+
+layout (location = 0) out vec2 out_uv;
+
+void main() {
+	out_uv = in_position * 0.5 + 0.5;
+	gl_Position = vec4(in_instance.xy + in_position * in_instance.w, in_instance.z, 1.0);
+}
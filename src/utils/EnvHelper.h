@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+
+namespace ct {
+	namespace env {
+		// Runtime overrides are read from environment variables so examples keep an argument-free main()
+		inline std::string get_string(const char *name, std::string fallback) {
+			const char *value = std::getenv(name);
+			return value != nullptr && value[0] != '\0' ? std::string(value) : fallback;
+		}
+
+		inline long get_int(const char *name, long fallback) {
+			const char *value = std::getenv(name);
+			return value != nullptr && value[0] != '\0' ? std::strtol(value, nullptr, 10) : fallback;
+		}
+
+		inline double get_double(const char *name, double fallback) {
+			const char *value = std::getenv(name);
+			return value != nullptr && value[0] != '\0' ? std::strtod(value, nullptr) : fallback;
+		}
+
+		inline bool get_flag(const char *name) {
+			return get_int(name, 0) != 0;
+		}
+
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#include "utils/EnvHelper.h"
+
+namespace ct {
+	namespace invalidation {
+#define INVALIDATION_N_REASONS 4
+
+		enum Reason {
+			STATE,
+			EXPOSE,
+			RESIZE,
+			HEARTBEAT
+		};
+
+		inline const char* reason2string(Reason reason) {
+#define STR(r) case r: return #r
+			switch (reason) {
+				STR(STATE);
+				STR(EXPOSE);
+				STR(RESIZE);
+				STR(HEARTBEAT);
+				default: return "UNKNOWN_REASON";
+			}
+#undef STR
+		}
+
+		// Frames are rendered only when something invalidated the last one, or a heartbeat is due (so a stalled display or compositor
+		// still gets a fresh image every heartbeat_ms). Without on_demand every frame counts as invalidated, the loop runs flat out as before.
+		struct Invalidation {
+			bool on_demand = false;			// CT_ON_DEMAND=1
+			double heartbeat_ms = 1000.0;	// CT_HEARTBEAT_MS, 0 for none
+			bool is_invalid = true;			// the first frame always renders
+			Reason reason = STATE;
+			std::chrono::steady_clock::time_point last_frame = std::chrono::steady_clock::now();
+
+			uint64_t n_rendered = 0;
+			uint64_t n_idle = 0;
+			uint64_t n_reasons[INVALIDATION_N_REASONS] = {};
+		};
+
+		inline void read_params(Invalidation &invalidation) {
+			invalidation.on_demand = ct::env::get_flag("CT_ON_DEMAND");
+			invalidation.heartbeat_ms = std::max(0.0, ct::env::get_double("CT_HEARTBEAT_MS", invalidation.heartbeat_ms));
+		}
+
+		// The first reason since the last rendered frame is the one counted
+		inline void invalidate(Reason reason, Invalidation &invalidation) {
+			if (invalidation.is_invalid)
+				return;
+			invalidation.is_invalid = true;
+			invalidation.reason = reason;
+		}
+
+		inline double get_ms_since_frame(Invalidation &invalidation) {
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - invalidation.last_frame).count();
+		}
+
+		inline bool should_render(Invalidation &invalidation) {
+			if (!invalidation.on_demand)
+				return true;
+			if (!invalidation.is_invalid && invalidation.heartbeat_ms > 0.0 && get_ms_since_frame(invalidation) >= invalidation.heartbeat_ms)
+				invalidate(HEARTBEAT, invalidation);
+			if (!invalidation.is_invalid)
+				invalidation.n_idle++;
+			return invalidation.is_invalid;
+		}
+
+		// How long the loop may block on window events before the heartbeat is due, -1 to block until the next event
+		inline int get_timeout_ms(Invalidation &invalidation) {
+			if (invalidation.heartbeat_ms <= 0.0)
+				return -1;
+			return (int)std::ceil(std::max(0.0, invalidation.heartbeat_ms - get_ms_since_frame(invalidation)));
+		}
+
+		// Call once the frame has been submitted
+		inline void rendered(Invalidation &invalidation) {
+			invalidation.n_reasons[invalidation.reason]++;
+			invalidation.n_rendered++;
+			invalidation.is_invalid = false;
+			invalidation.reason = STATE;
+			invalidation.last_frame = std::chrono::steady_clock::now();
+		}
+
+		inline void report(std::ostream &os, Invalidation &invalidation) {
+			if (!invalidation.on_demand)
+				return;
+			os << "on-demand: rendered: " << invalidation.n_rendered << " idle-wakeups: " << invalidation.n_idle;
+			for (int i = 0; i < INVALIDATION_N_REASONS; i++)
+				os << " " << reason2string((Reason)i) << ": " << invalidation.n_reasons[i];
+			os << std::endl;
+		}
+
+	}
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "utils/EnvHelper.h"
+
+namespace ct {
+	namespace jobs {
+#define JOBS_QUEUE_CAPACITY 1024
+#define JOBS_COPY_CHUNK (256 * 1024)
+// Threads that are not workers (the render thread, the simulation thread) with a queue of their own, any beyond share queue 0
+#define JOBS_MAX_EXTERNAL 8
+
+		// Outstanding jobs of a group. Work that depends on the group waits on it, the waiting thread runs other jobs meanwhile.
+		struct Counter {
+			std::atomic<uint32_t> pending{0};
+		};
+
+		// Plain function and range, no std::function, so submitting never allocates
+		struct Job {
+			void (*function)(void *data, uint32_t begin, uint32_t end);
+			void *data;
+			uint32_t begin;
+			uint32_t end;
+			Counter *counter;
+		};
+
+		// Fixed size ring, the owner pushes and pops at the tail (newest first, still warm in cache), thieves take from the head (oldest, biggest left over)
+		struct Queue {
+			std::mutex mutex;
+			Job ring[JOBS_QUEUE_CAPACITY];
+			uint32_t head = 0;
+			uint32_t tail = 0;
+		};
+
+		// One queue per worker thread (1..n_workers) and per thread that is not a worker, handed out on its first push or wait.
+		// Workers run and steal from every queue. Other threads only run jobs of their own queue while they wait, so the render thread
+		// never ends up running the simulation thread's jobs or the other way round. Queue 0 is shared by the threads beyond JOBS_MAX_EXTERNAL.
+		// Sized to the cores with CT_JOB_WORKERS as override, 0 workers runs everything inline on the submitting thread.
+		struct JobSystem {
+			uint32_t n_workers = 0;
+			std::vector<std::unique_ptr<Queue>> queues;
+			std::atomic<uint32_t> n_external{0};
+			std::vector<std::thread> threads;
+			std::atomic<bool> running{false};
+			std::atomic<uint32_t> n_queued{0};
+			std::mutex sleep_mutex;
+			std::condition_variable wake;
+
+			std::atomic<uint64_t> n_jobs{0};
+			std::atomic<uint64_t> n_steals{0};
+			std::atomic<uint64_t> n_inline{0};
+		};
+
+		inline uint32_t& get_worker_index() {
+			thread_local uint32_t index = UINT32_MAX;
+			return index;
+		}
+
+		inline bool is_worker(uint32_t index, JobSystem &system) {
+			return index >= 1 && index <= system.n_workers;
+		}
+
+		// The calling thread's queue, a thread that is not a worker gets one the first time it asks
+		inline uint32_t get_queue(JobSystem &system) {
+			uint32_t &index = get_worker_index();
+			if (index == UINT32_MAX) {
+				uint32_t k = system.n_external.fetch_add(1, std::memory_order_relaxed);
+				index = k < JOBS_MAX_EXTERNAL ? system.n_workers + 1 + k : 0;
+			}
+			return index;
+		}
+
+		inline void execute(const Job &job, JobSystem &system) {
+			job.function(job.data, job.begin, job.end);
+			if (job.counter != nullptr)
+				job.counter->pending.fetch_sub(1, std::memory_order_release);
+			system.n_jobs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// Runs the job right away if the queue is full, work is never dropped and pushing never blocks on space
+		inline void push(const Job &job, JobSystem &system) {
+			Queue &queue = *system.queues[get_queue(system)];
+			bool is_queued;
+			{
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				is_queued = queue.tail - queue.head < JOBS_QUEUE_CAPACITY;
+				if (is_queued) {
+					queue.ring[queue.tail++ % JOBS_QUEUE_CAPACITY] = job;
+					system.n_queued.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			if (!is_queued) {
+				system.n_inline.fetch_add(1, std::memory_order_relaxed);
+				execute(job, system);
+				return;
+			}
+			// Taking the lock orders this against a worker between checking n_queued and going to sleep
+			{ std::lock_guard<std::mutex> lock(system.sleep_mutex); }
+			system.wake.notify_one();
+		}
+
+		inline bool pop(uint32_t index, bool is_steal, Job &job, JobSystem &system) {
+			Queue &queue = *system.queues[index];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tail == queue.head)
+				return false;
+			job = is_steal ? queue.ring[queue.head++ % JOBS_QUEUE_CAPACITY] : queue.ring[--queue.tail % JOBS_QUEUE_CAPACITY];
+			system.n_queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		// Own queue first, then (workers only) the others round robin from the next one on
+		inline bool try_run_one(JobSystem &system) {
+			uint32_t index = get_queue(system);
+			uint32_t n = (uint32_t)system.queues.size();
+			Job job;
+			if (pop(index, false, job, system)) {
+				execute(job, system);
+				return true;
+			}
+			if (!is_worker(index, system))
+				return false;
+			for (uint32_t k = 1; k < n; k++) {
+				if (pop((index + k) % n, true, job, system)) {
+					system.n_steals.fetch_add(1, std::memory_order_relaxed);
+					execute(job, system);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		inline void work(uint32_t index, JobSystem &system) {
+			get_worker_index() = index;
+			while (system.running.load(std::memory_order_relaxed)) {
+				if (try_run_one(system))
+					continue;
+				std::unique_lock<std::mutex> lock(system.sleep_mutex);
+				system.wake.wait(lock, [&system]() { return system.n_queued.load(std::memory_order_relaxed) > 0 || !system.running.load(std::memory_order_relaxed); });
+			}
+		}
+
+		inline void setup(JobSystem &system) {
+			uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+			// The submitting thread helps while it waits, so it counts as one of the cores
+			system.n_workers = (uint32_t)std::max(0L, ct::env::get_int("CT_JOB_WORKERS", cores - 1));
+			system.queues.clear();
+			for (uint32_t i = 0; i <= system.n_workers + JOBS_MAX_EXTERNAL; i++)
+				system.queues.emplace_back(new Queue());
+			system.running = true;
+			for (uint32_t i = 1; i <= system.n_workers; i++)
+				system.threads.emplace_back([i, &system]() { work(i, system); });
+			std::cout << "jobs: workers: " << system.n_workers << std::endl;
+		}
+
+		// Queues jobs as one group, counter reaches 0 when all of them ran
+		inline void run(const Job *jobs, uint32_t count, Counter &counter, JobSystem &system) {
+			counter.pending.fetch_add(count, std::memory_order_relaxed);
+			for (uint32_t i = 0; i < count; i++) {
+				Job job = jobs[i];
+				job.counter = &counter;
+				push(job, system);
+			}
+		}
+
+		// Runs other jobs until counter reaches 0, so a thread waiting on its dependencies is never idle while there is work
+		inline void wait(Counter &counter, JobSystem &system) {
+			while (counter.pending.load(std::memory_order_acquire) != 0) {
+				if (!try_run_one(system))
+					std::this_thread::yield();
+			}
+		}
+
+		// Splits [0, count) into chunks of at least min_chunk, one per core at most. The caller runs the first chunk and returns once all ran.
+		// Without a job system, or too little work to split, function runs inline over the whole range.
+		inline void parallel_for(uint32_t count, uint32_t min_chunk, void (*function)(void*, uint32_t, uint32_t), void *data, JobSystem *system) {
+			uint32_t n_chunks = system == nullptr ? 1 : std::min(system->n_workers + 1, count / std::max(1u, min_chunk));
+			if (n_chunks <= 1) {
+				function(data, 0, count);
+				return;
+			}
+			uint32_t chunk = (count + n_chunks - 1) / n_chunks;
+			n_chunks = (count + chunk - 1) / chunk;
+			Counter counter;
+			counter.pending.store(n_chunks - 1, std::memory_order_relaxed);
+			for (uint32_t c = 1; c < n_chunks; c++) {
+				Job job = { function, data, c * chunk, std::min(count, (c + 1) * chunk), &counter };
+				push(job, *system);
+			}
+			function(data, 0, chunk);
+			wait(counter, *system);
+		}
+
+		// memcpy split over the cores, for uploads and readbacks of more than a few hundred KB
+		inline void parallel_copy(void *destination, const void *source, size_t size, JobSystem *system) {
+			struct Copy {
+				char *destination;
+				const char *source;
+				size_t size;
+			} copy = { static_cast<char*>(destination), static_cast<const char*>(source), size };
+			uint32_t n_chunks = (uint32_t)((size + JOBS_COPY_CHUNK - 1) / JOBS_COPY_CHUNK);
+			parallel_for(n_chunks, 1, [](void *data, uint32_t begin, uint32_t end) {
+				Copy &copy = *static_cast<Copy*>(data);
+				size_t offset = (size_t)begin * JOBS_COPY_CHUNK;
+				size_t size = std::min(copy.size, (size_t)end * JOBS_COPY_CHUNK) - offset;
+				std::memcpy(copy.destination + offset, copy.source + offset, size);
+			}, &copy, system);
+		}
+
+		inline void report(std::ostream &os, JobSystem &system) {
+			if (system.n_workers == 0)
+				return;
+			os << "jobs: ran: " << system.n_jobs.load() << " stolen: " << system.n_steals.load() << " inline (queue full): " << system.n_inline.load() << std::endl;
+		}
+
+		inline void destroy(JobSystem &system) {
+			{
+				std::lock_guard<std::mutex> lock(system.sleep_mutex);
+				system.running = false;
+			}
+			system.wake.notify_all();
+			for (auto &thread : system.threads)
+				thread.join();
+			system.threads.clear();
+			system.queues.clear();
+			system.n_workers = 0;
+		}
+
+	}
+}
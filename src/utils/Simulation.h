@@ -0,0 +1,123 @@
+#pragma once
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include "utils/TripleBuffer.h"
+#include "utils/EnvHelper.h"
+
+namespace ct {
+	namespace simulation {
+#define SIMULATION_MAX_CATCH_UP 8
+
+		template <typename State>
+		struct Snapshot {
+			uint64_t tick = 0;
+			double time = 0.0;
+			std::chrono::steady_clock::time_point published;
+			State state;
+		};
+
+		// Steps State at a fixed rate on its own thread and hands the newest snapshot to the render thread through a triple buffer.
+		// A slow frame never holds the simulation back and a slow tick only makes the renderer interpolate from an older snapshot.
+		// The step function gets the snapshot to fill, which is up to three ticks old: it has to write the whole state, not only changes.
+		template <typename State>
+		struct Simulation {
+			double hz = 60.0;			// CT_SIM_HZ, 0 runs no thread
+			double tick_s = 1.0 / 60.0;
+			std::function<void(uint64_t, double, State&)> step;
+			ct::sync::TripleBuffer<Snapshot<State>> snapshots;
+			std::thread thread;
+			std::atomic<bool> running{false};
+
+			// -> written by the simulation thread, read for reports only
+			std::atomic<uint64_t> n_ticks{0};
+			std::atomic<uint64_t> n_dropped{0};
+			// <-
+		};
+
+		template <typename State>
+		inline void read_params(Simulation<State> &simulation) {
+			simulation.hz = std::max(0.0, ct::env::get_double("CT_SIM_HZ", simulation.hz));
+			simulation.tick_s = simulation.hz > 0.0 ? 1.0 / simulation.hz : 0.0;
+		}
+
+		// Ticks that fall behind by more than SIMULATION_MAX_CATCH_UP are dropped (simulated time stalls) instead of spiralling
+		template <typename State>
+		inline void run(Simulation<State> &simulation) {
+			auto tick_duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(simulation.tick_s));
+			auto next = std::chrono::steady_clock::now() + tick_duration;
+			uint64_t tick = 0;
+			while (simulation.running.load(std::memory_order_relaxed)) {
+				std::this_thread::sleep_until(next);
+				auto now = std::chrono::steady_clock::now();
+				if (now - next > tick_duration * SIMULATION_MAX_CATCH_UP) {
+					uint64_t behind = (uint64_t)((now - next) / tick_duration);
+					simulation.n_dropped.fetch_add(behind, std::memory_order_relaxed);
+					next += tick_duration * behind;
+				}
+				// Catch up on every tick that is due, each one is published so the reader sees consistent steps
+				while (next <= now && simulation.running.load(std::memory_order_relaxed)) {
+					tick++;
+					Snapshot<State> &snapshot = ct::sync::get_back(simulation.snapshots);
+					snapshot.tick = tick;
+					snapshot.time = tick * simulation.tick_s;
+					simulation.step(tick, snapshot.time, snapshot.state);
+					snapshot.published = std::chrono::steady_clock::now();
+					ct::sync::publish(simulation.snapshots);
+					simulation.n_ticks.fetch_add(1, std::memory_order_relaxed);
+					next += tick_duration;
+				}
+			}
+		}
+
+		// prepare is called on every snapshot's state before the thread starts, so steady state steps do not allocate
+		template <typename State>
+		inline void start(std::function<void(State&)> prepare, std::function<void(uint64_t, double, State&)> step, Simulation<State> &simulation) {
+			if (simulation.hz <= 0.0)
+				return;
+			for (auto &snapshot : simulation.snapshots.slots)
+				prepare(snapshot.state);
+			simulation.step = std::move(step);
+			simulation.running = true;
+			simulation.thread = std::thread([&simulation]() { run(simulation); });
+			std::cout << "simulation: thread at " << simulation.hz << " Hz" << std::endl;
+		}
+
+		template <typename State>
+		inline bool is_running(Simulation<State> &simulation) {
+			return simulation.thread.joinable();
+		}
+
+		// Render thread: the newest snapshot, and how far the render time is past it in ticks [0, 1].
+		// Interpolating from the previous tick's state by alpha shows the world one tick late but without stutter.
+		template <typename State>
+		inline Snapshot<State>& get_latest(Simulation<State> &simulation, float &alpha) {
+			ct::sync::acquire(simulation.snapshots);
+			Snapshot<State> &snapshot = ct::sync::get_front(simulation.snapshots);
+			double since = std::chrono::duration<double>(std::chrono::steady_clock::now() - snapshot.published).count();
+			alpha = (float)std::min(1.0, std::max(0.0, since / simulation.tick_s));
+			return snapshot;
+		}
+
+		template <typename State>
+		inline void report(std::ostream &os, Simulation<State> &simulation) {
+			if (!is_running(simulation))
+				return;
+			os << "simulation: ticks: " << simulation.n_ticks.load() << " dropped: " << simulation.n_dropped.load() << std::endl;
+		}
+
+		template <typename State>
+		inline void stop(Simulation<State> &simulation) {
+			if (!is_running(simulation))
+				return;
+			simulation.running = false;
+			simulation.thread.join();
+		}
+
+	}
+}
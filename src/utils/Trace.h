@@ -0,0 +1,178 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "utils/EnvHelper.h"
+
+// Scoped CPU spans, exported as Chrome trace JSON (loads in Perfetto and chrome://tracing).
+// Compiled in with CT_TRACE, switched on at runtime by CT_TRACE_FILE=<path>. Compiled in but switched off a span costs one relaxed load.
+#if defined(CT_TRACE)
+#define CT_TRACE_CONCAT_(a, b) a##b
+#define CT_TRACE_CONCAT(a, b) CT_TRACE_CONCAT_(a, b)
+#define CT_TRACE_SCOPE(name) ct::trace::ScopedSpan CT_TRACE_CONCAT(ct_trace_span_, __LINE__)(name)
+#define CT_TRACE_FUNCTION() CT_TRACE_SCOPE(__func__)
+#else
+#define CT_TRACE_SCOPE(name) ((void)0)
+#define CT_TRACE_FUNCTION() ((void)0)
+#endif
+
+namespace ct {
+	namespace trace {
+#define TRACE_EVENTS_PER_THREAD (1 << 16)
+#define TRACE_GPU_TID 0
+
+		struct Event {
+			const char *name;
+			uint64_t begin_ns;
+			uint64_t end_ns;
+		};
+
+		// Written by exactly one thread, read by the exporter. Full buffers drop events instead of blocking.
+		struct ThreadBuffer {
+			uint32_t tid;
+			std::atomic<uint32_t> count{0};
+			std::atomic<uint64_t> dropped{0};
+			ThreadBuffer *next = nullptr;
+			Event events[TRACE_EVENTS_PER_THREAD];
+		};
+
+		struct Registry {
+			std::atomic<bool> enabled{false};
+			std::atomic<ThreadBuffer*> head{nullptr};
+			std::atomic<uint32_t> next_tid{TRACE_GPU_TID + 1};
+			std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+			std::string path;
+		};
+
+		inline Registry& get_registry() {
+			static Registry registry;
+			return registry;
+		}
+
+		inline bool is_enabled() {
+			return get_registry().enabled.load(std::memory_order_relaxed);
+		}
+
+		inline uint64_t now_ns() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - get_registry().epoch).count();
+		}
+
+		inline uint64_t to_trace_ns(std::chrono::steady_clock::time_point t) {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(t - get_registry().epoch).count();
+		}
+
+		// Threads register their buffer once, lock free, by pushing it onto the registry list
+		inline ThreadBuffer* register_buffer(uint32_t tid) {
+			Registry &registry = get_registry();
+			ThreadBuffer *buffer = new ThreadBuffer();
+			buffer->tid = tid;
+			buffer->next = registry.head.load(std::memory_order_relaxed);
+			while (!registry.head.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed));
+			return buffer;
+		}
+
+		inline ThreadBuffer* get_thread_buffer() {
+			thread_local ThreadBuffer *buffer = register_buffer(get_registry().next_tid.fetch_add(1, std::memory_order_relaxed));
+			return buffer;
+		}
+
+		inline ThreadBuffer* get_gpu_buffer() {
+			static ThreadBuffer *buffer = register_buffer(TRACE_GPU_TID);
+			return buffer;
+		}
+
+		inline void emit(ThreadBuffer *buffer, const char *name, uint64_t begin_ns, uint64_t end_ns) {
+			uint32_t index = buffer->count.load(std::memory_order_relaxed);
+			if (index >= TRACE_EVENTS_PER_THREAD) {
+				buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			buffer->events[index] = { name, begin_ns, end_ns };
+			buffer->count.store(index + 1, std::memory_order_release);
+		}
+
+		struct ScopedSpan {
+			const char *name;
+			uint64_t begin_ns;
+
+			explicit ScopedSpan(const char *name_) : name(nullptr), begin_ns(0) {
+				if (is_enabled()) {
+					name = name_;
+					begin_ns = now_ns();
+				}
+			}
+
+			~ScopedSpan() {
+				if (name != nullptr)
+					emit(get_thread_buffer(), name, begin_ns, now_ns());
+			}
+
+			ScopedSpan(const ScopedSpan&) = delete;
+			ScopedSpan& operator=(const ScopedSpan&) = delete;
+		};
+
+		// Enables tracing if CT_TRACE_FILE is set. Call once at startup.
+		inline void init() {
+#if defined(CT_TRACE)
+			Registry &registry = get_registry();
+			registry.path = ct::env::get_string("CT_TRACE_FILE", "");
+			registry.enabled.store(!registry.path.empty(), std::memory_order_relaxed);
+			if (!registry.path.empty())
+				std::cout << "trace: recording to " << registry.path << std::endl;
+#endif
+		}
+
+		inline void write_json_string(std::ostream &os, const char *s) {
+			os << '"';
+			for (; *s != '\0'; s++) {
+				if (*s == '"' || *s == '\\')
+					os << '\\';
+				os << *s;
+			}
+			os << '"';
+		}
+
+		// Writes every buffered span as Chrome trace JSON. Call once threads are done tracing.
+		inline void write() {
+			Registry &registry = get_registry();
+			if (registry.path.empty())
+				return;
+
+			std::ofstream os(registry.path);
+			if (!os.is_open()) {
+				std::cerr << "trace: could not open " << registry.path << std::endl;
+				return;
+			}
+
+			os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+			bool first = true;
+			uint64_t dropped = 0;
+			for (ThreadBuffer *buffer = registry.head.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next) {
+				os << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer->tid
+					<< ",\"args\":{\"name\":\"" << (buffer->tid == TRACE_GPU_TID ? std::string("GPU") : "thread-" + std::to_string(buffer->tid)) << "\"}}";
+				first = false;
+
+				uint32_t count = buffer->count.load(std::memory_order_acquire);
+				for (uint32_t i = 0; i < count; i++) {
+					Event &event = buffer->events[i];
+					os << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid << ",\"name\":";
+					write_json_string(os, event.name);
+					os << ",\"ts\":" << event.begin_ns / 1000.0 << ",\"dur\":" << (event.end_ns - event.begin_ns) / 1000.0 << "}";
+				}
+				dropped += buffer->dropped.load(std::memory_order_relaxed);
+			}
+			os << std::endl << "]}" << std::endl;
+
+			std::cout << "trace: written to " << registry.path;
+			if (dropped > 0)
+				std::cout << " (" << dropped << " events dropped)";
+			std::cout << std::endl;
+		}
+
+	}
+}
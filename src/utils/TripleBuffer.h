@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace ct {
+	namespace sync {
+#define TRIPLE_BUFFER_FRESH 4u
+
+		// Single producer, single consumer hand over of the latest value, lock free and wait free on both sides.
+		// The writer owns back, the reader owns front, middle is swapped with either of them and carries a flag telling whether
+		// it holds a value the reader has not seen yet. Writers that outpace the reader overwrite, the reader always gets the newest.
+		template <typename T>
+		struct TripleBuffer {
+			T slots[3];
+			std::atomic<uint32_t> middle{1};
+			uint32_t back = 0;
+			uint32_t front = 2;
+		};
+
+		// Writer side: fill this, then publish it
+		template <typename T>
+		inline T& get_back(TripleBuffer<T> &buffer) {
+			return buffer.slots[buffer.back];
+		}
+
+		template <typename T>
+		inline void publish(TripleBuffer<T> &buffer) {
+			buffer.back = buffer.middle.exchange(buffer.back | TRIPLE_BUFFER_FRESH, std::memory_order_acq_rel) & ~TRIPLE_BUFFER_FRESH;
+		}
+
+		// Reader side: true if a newer value than the one in front was published and has been swapped in
+		template <typename T>
+		inline bool acquire(TripleBuffer<T> &buffer) {
+			if ((buffer.middle.load(std::memory_order_relaxed) & TRIPLE_BUFFER_FRESH) == 0)
+				return false;
+			buffer.front = buffer.middle.exchange(buffer.front, std::memory_order_acq_rel) & ~TRIPLE_BUFFER_FRESH;
+			return true;
+		}
+
+		template <typename T>
+		inline T& get_front(TripleBuffer<T> &buffer) {
+			return buffer.slots[buffer.front];
+		}
+
+	}
+}
@@ -0,0 +1,1193 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/Dispatch.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace capture {
+#define CAPTURE_MAGIC 0x50435443		// "CTCP"
+#define CAPTURE_VERSION 2
+
+			// A capture file is a header and records in the order things happened: resources, shader modules, layouts, pipelines and descriptor
+			// sets as they are created, descriptor updates, command buffers when their recording ends, submissions and frame ends. Vulkan structs
+			// are stored as they are, with pNext cleared and every handle replaced by an id in its bits (0 for handles created before the capture
+			// started or outside the helpers). Pointers inside a stored struct are meaningless, what they point at follows it as arrays.
+			enum Record {
+				IMAGE = 1,
+				BUFFER,
+				VIEW,
+				RENDER_PASS,
+				FRAMEBUFFER,
+				COMMANDS,
+				SUBMIT,
+				FRAME,
+				SHADER_MODULE,
+				SET_LAYOUT,
+				PIPELINE_LAYOUT,
+				GRAPHICS_PIPELINE,
+				COMPUTE_PIPELINE,
+				DESCRIPTOR_SET,
+				UPDATE_DESCRIPTORS
+			};
+
+			// Commands kept in a COMMANDS record. Queries, timestamps and debug labels are not kept: they change what is measured, not what is drawn.
+			enum Op {
+				BARRIER = 1,
+				CLEAR_COLOR,
+				CLEAR_DEPTH_STENCIL,
+				CLEAR_ATTACHMENTS,
+				COPY_BUFFER,
+				FILL_BUFFER,
+				UPDATE_BUFFER,
+				COPY_IMAGE,
+				BLIT_IMAGE,
+				COPY_BUFFER_TO_IMAGE,
+				COPY_IMAGE_TO_BUFFER,
+				BEGIN_RENDER_PASS,
+				NEXT_SUBPASS,
+				END_RENDER_PASS,
+				SET_VIEWPORT,
+				SET_SCISSOR,
+				BIND_PIPELINE,
+				BIND_DESCRIPTOR_SETS,
+				PUSH_CONSTANTS,
+				BIND_VERTEX_BUFFERS,
+				BIND_INDEX_BUFFER,
+				DRAW,
+				DRAW_INDEXED,
+				DRAW_INDEXED_INDIRECT,
+				DRAW_INDEXED_INDIRECT_COUNT,
+				DISPATCH,
+				BEGIN_RENDERING,
+				END_RENDERING,
+				EXECUTE_COMMANDS
+			};
+
+			inline const char* op2string(Op op) {
+				switch (op) {
+#define STR(r) case r: return #r
+					STR(BARRIER);
+					STR(CLEAR_COLOR);
+					STR(CLEAR_DEPTH_STENCIL);
+					STR(CLEAR_ATTACHMENTS);
+					STR(COPY_BUFFER);
+					STR(FILL_BUFFER);
+					STR(UPDATE_BUFFER);
+					STR(COPY_IMAGE);
+					STR(BLIT_IMAGE);
+					STR(COPY_BUFFER_TO_IMAGE);
+					STR(COPY_IMAGE_TO_BUFFER);
+					STR(BEGIN_RENDER_PASS);
+					STR(NEXT_SUBPASS);
+					STR(END_RENDER_PASS);
+					STR(SET_VIEWPORT);
+					STR(SET_SCISSOR);
+					STR(BIND_PIPELINE);
+					STR(BIND_DESCRIPTOR_SETS);
+					STR(PUSH_CONSTANTS);
+					STR(BIND_VERTEX_BUFFERS);
+					STR(BIND_INDEX_BUFFER);
+					STR(DRAW);
+					STR(DRAW_INDEXED);
+					STR(DRAW_INDEXED_INDIRECT);
+					STR(DRAW_INDEXED_INDIRECT_COUNT);
+					STR(DISPATCH);
+					STR(BEGIN_RENDERING);
+					STR(END_RENDERING);
+					STR(EXECUTE_COMMANDS);
+#undef STR
+					default: return "UNKNOWN_OP";
+				}
+			}
+
+			// -> bytes of a record, written and read POD by POD
+			struct Stream {
+				std::vector<char> bytes;
+			};
+
+			template <typename T>
+			inline void put(const T &value, Stream &stream) {
+				const char *p = reinterpret_cast<const char*>(&value);
+				stream.bytes.insert(stream.bytes.end(), p, p + sizeof(T));
+			}
+
+			template <typename T>
+			inline void put_array(const T *values, uint32_t count, Stream &stream) {
+				put(count, stream);
+				const char *p = reinterpret_cast<const char*>(values);
+				stream.bytes.insert(stream.bytes.end(), p, p + sizeof(T) * count);
+			}
+
+			// A struct a create info may leave out: an array of zero or one
+			template <typename T>
+			inline void put_optional(const T *value, Stream &stream) {
+				if (value == nullptr) {
+					put_array<T>(nullptr, 0, stream);
+					return;
+				}
+				T copy = *value;
+				copy.pNext = nullptr;
+				put_array(&copy, 1, stream);
+			}
+
+			struct Cursor {
+				const char *data = nullptr;
+				size_t size = 0;
+				size_t at = 0;
+			};
+
+			template <typename T>
+			inline T get(Cursor &cursor) {
+				assert(cursor.at + sizeof(T) <= cursor.size);
+				T value;
+				std::memcpy(&value, cursor.data + cursor.at, sizeof(T));
+				cursor.at += sizeof(T);
+				return value;
+			}
+
+			template <typename T>
+			inline std::vector<T> get_array(Cursor &cursor) {
+				uint32_t count = get<uint32_t>(cursor);
+				assert(cursor.at + sizeof(T) * count <= cursor.size);
+				std::vector<T> values(count);
+				if (count > 0)
+					std::memcpy(values.data(), cursor.data + cursor.at, sizeof(T) * count);
+				cursor.at += sizeof(T) * count;
+				return values;
+			}
+			// <-
+
+			// -> handles and their ids, ids start at 1 and are kept in the bits of the handle type so structs keep their layout
+			template <typename T>
+			inline uint64_t to_key(T handle) {
+				uint64_t key = 0;
+				std::memcpy(&key, &handle, sizeof(T));
+				return key;
+			}
+
+			template <typename T>
+			inline T from_key(uint64_t key) {
+				T handle;
+				std::memcpy(&handle, &key, sizeof(T));
+				return handle;
+			}
+
+			struct Ids {
+				std::unordered_map<uint64_t, uint32_t> ids;
+				uint32_t next = 1;
+			};
+
+			// A handle the driver hands out again after a destroy is a new resource and gets a new id
+			template <typename T>
+			inline uint32_t add(T handle, Ids &ids) {
+				uint32_t id = ids.next++;
+				ids.ids[to_key(handle)] = id;
+				return id;
+			}
+
+			template <typename T>
+			inline uint32_t find(T handle, Ids &ids) {
+				auto it = ids.ids.find(to_key(handle));
+				return it != ids.ids.end() ? it->second : 0;
+			}
+
+			template <typename T>
+			inline T encode(T handle, Ids &ids) {
+				return from_key<T>(find(handle, ids));
+			}
+			// <-
+
+			// The one extension struct of type a record keeps, nullptr if next's chain has none
+			struct Chained {
+				VkStructureType sType;
+				const void *pNext;
+			};
+
+			inline const void* find_next(const void *next, VkStructureType type) {
+				while (next != nullptr) {
+					const Chained *chained = static_cast<const Chained*>(next);
+					if (chained->sType == type)
+						return chained;
+					next = chained->pNext;
+				}
+				return nullptr;
+			}
+
+			// Started with CT_CAPTURE=<file> in the examples: the device table's allocation, descriptor update, recording and submission entries
+			// are swapped for ones that write what they were called with, the helpers report the resources, shader modules, layouts and pipelines
+			// they create.
+			struct Capture {
+				std::atomic<bool> active{false};		// read without the mutex by the entries that have nothing to record
+				std::ofstream file;
+				std::mutex mutex;
+				ct::vulkan::dispatch::DeviceTable next;
+				Ids images;
+				Ids buffers;
+				Ids views;
+				Ids render_passes;
+				Ids framebuffers;
+				Ids command_buffers;
+				Ids shader_modules;
+				Ids set_layouts;
+				Ids pipeline_layouts;
+				Ids pipelines;
+				Ids descriptor_sets;
+				std::unordered_set<uint64_t> secondaries;		// command buffers allocated as secondaries
+				// Command buffers between begin and end, how they began and their commands so far
+				std::unordered_map<uint64_t, Stream> recording;
+				std::unordered_map<uint64_t, uint32_t> n_ops;
+
+				uint32_t max_frames = 0;		// CT_CAPTURE_FRAMES, 0 for no limit
+				uint32_t n_frames = 0;
+				uint64_t n_records = 0;
+				uint64_t n_bytes = 0;
+			};
+
+			inline Capture& get_capture() {
+				static Capture capture;
+				return capture;
+			}
+
+			inline bool is_active() {
+				return get_capture().active;
+			}
+
+			// Caller holds the mutex
+			inline void write(Record type, const Stream &stream, Capture &capture) {
+				uint32_t header[2] = { (uint32_t)type, (uint32_t)stream.bytes.size() };
+				capture.file.write(reinterpret_cast<const char*>(header), sizeof(header));
+				capture.file.write(stream.bytes.data(), stream.bytes.size());
+				capture.n_records++;
+				capture.n_bytes += sizeof(header) + stream.bytes.size();
+			}
+
+			// -> resources and pipelines, reported by the helpers that create them
+			inline void image(VkImage image, const VkImageCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				VkImageCreateInfo copy = info;
+				copy.pNext = nullptr;
+				copy.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+				copy.queueFamilyIndexCount = 0;
+				copy.pQueueFamilyIndices = nullptr;
+				Stream stream;
+				put(add(image, capture.images), stream);
+				put(copy, stream);
+				write(IMAGE, stream, capture);
+			}
+
+			// Presentable images are stored as plain images of the swapchain's format, extent and usage. The replay drops the usage a plain image
+			// of that format cannot have.
+			inline void swapchain_images(const std::vector<VkImage> &images, const VkSwapchainCreateInfoKHR &info) {
+				VkImageCreateInfo imageInfo = {};
+				imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+				imageInfo.imageType = VK_IMAGE_TYPE_2D;
+				imageInfo.format = info.imageFormat;
+				imageInfo.extent = { info.imageExtent.width, info.imageExtent.height, 1 };
+				imageInfo.mipLevels = 1;
+				imageInfo.arrayLayers = info.imageArrayLayers;
+				imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+				imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+				imageInfo.usage = info.imageUsage;
+				imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				for (VkImage swapchain_image : images)
+					image(swapchain_image, imageInfo);
+			}
+
+			inline void buffer(VkBuffer buffer, const VkBufferCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				VkBufferCreateInfo copy = info;
+				copy.pNext = nullptr;
+				copy.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+				copy.queueFamilyIndexCount = 0;
+				copy.pQueueFamilyIndices = nullptr;
+				Stream stream;
+				put(add(buffer, capture.buffers), stream);
+				put(copy, stream);
+				write(BUFFER, stream, capture);
+			}
+
+			inline void view(VkImageView view, const VkImageViewCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				VkImageViewCreateInfo copy = info;
+				copy.pNext = nullptr;
+				copy.image = encode(copy.image, capture.images);
+				Stream stream;
+				put(add(view, capture.views), stream);
+				put(copy, stream);
+				write(VIEW, stream, capture);
+			}
+
+			// Subpasses keep their input, colour and depth attachments, the helpers create no resolve or preserve attachments
+			inline void render_pass(VkRenderPass render_pass, const VkRenderPassCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				Stream stream;
+				put(add(render_pass, capture.render_passes), stream);
+				put_array(info.pAttachments, info.attachmentCount, stream);
+				put(info.subpassCount, stream);
+				for (uint32_t s = 0; s < info.subpassCount; s++) {
+					const VkSubpassDescription &subpass = info.pSubpasses[s];
+					put(subpass.pipelineBindPoint, stream);
+					put_array(subpass.pInputAttachments, subpass.inputAttachmentCount, stream);
+					put_array(subpass.pColorAttachments, subpass.colorAttachmentCount, stream);
+					put(subpass.pDepthStencilAttachment != nullptr ? *subpass.pDepthStencilAttachment : VkAttachmentReference{ VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED }, stream);
+				}
+				put_array(info.pDependencies, info.dependencyCount, stream);
+				write(RENDER_PASS, stream, capture);
+			}
+
+			inline void framebuffer(VkFramebuffer framebuffer, const VkFramebufferCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				std::vector<uint32_t> views(info.attachmentCount);
+				for (uint32_t i = 0; i < info.attachmentCount; i++)
+					views[i] = find(info.pAttachments[i], capture.views);
+				Stream stream;
+				put(add(framebuffer, capture.framebuffers), stream);
+				put(find(info.renderPass, capture.render_passes), stream);
+				put(info.width, stream);
+				put(info.height, stream);
+				put(info.layers, stream);
+				put_array(views.data(), (uint32_t)views.size(), stream);
+				write(FRAMEBUFFER, stream, capture);
+			}
+
+			inline void shader_module(VkShaderModule module, const VkShaderModuleCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				Stream stream;
+				put(add(module, capture.shader_modules), stream);
+				put_array(info.pCode, (uint32_t)(info.codeSize / sizeof(uint32_t)), stream);
+				write(SHADER_MODULE, stream, capture);
+			}
+
+			// Immutable samplers are left out, the helpers create none. The binding flags of descriptor indexing follow the bindings.
+			inline void set_layout(VkDescriptorSetLayout layout, const VkDescriptorSetLayoutCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				std::vector<VkDescriptorSetLayoutBinding> bindings(info.pBindings, info.pBindings + info.bindingCount);
+				for (VkDescriptorSetLayoutBinding &binding : bindings)
+					binding.pImmutableSamplers = nullptr;
+				const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT *flags = static_cast<const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT*>(
+					find_next(info.pNext, VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT));
+				Stream stream;
+				put(add(layout, capture.set_layouts), stream);
+				put(info.flags, stream);
+				put_array(bindings.data(), (uint32_t)bindings.size(), stream);
+				if (flags != nullptr)
+					put_array(flags->pBindingFlags, flags->bindingCount, stream);
+				else
+					put_array<VkDescriptorBindingFlagsEXT>(nullptr, 0, stream);
+				write(SET_LAYOUT, stream, capture);
+			}
+
+			inline void pipeline_layout(VkPipelineLayout layout, const VkPipelineLayoutCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				std::vector<uint32_t> set_layouts(info.setLayoutCount);
+				for (uint32_t i = 0; i < info.setLayoutCount; i++)
+					set_layouts[i] = find(info.pSetLayouts[i], capture.set_layouts);
+				Stream stream;
+				put(add(layout, capture.pipeline_layouts), stream);
+				put_array(set_layouts.data(), (uint32_t)set_layouts.size(), stream);
+				put_array(info.pPushConstantRanges, info.pushConstantRangeCount, stream);
+				write(PIPELINE_LAYOUT, stream, capture);
+			}
+
+			// Caller holds the mutex. The entry point name keeps its terminator, specialization constants their map and bytes.
+			inline void put_stage(const VkPipelineShaderStageCreateInfo &stage, Capture &capture, Stream &stream) {
+				put(stage.flags, stream);
+				put(stage.stage, stream);
+				put(find(stage.module, capture.shader_modules), stream);
+				put_array(stage.pName, (uint32_t)std::strlen(stage.pName) + 1, stream);
+				const VkSpecializationInfo *specialization = stage.pSpecializationInfo;
+				if (specialization != nullptr) {
+					put_array(specialization->pMapEntries, specialization->mapEntryCount, stream);
+					put_array(static_cast<const char*>(specialization->pData), (uint32_t)specialization->dataSize, stream);
+				} else {
+					put_array<VkSpecializationMapEntry>(nullptr, 0, stream);
+					put_array<char>(nullptr, 0, stream);
+				}
+			}
+
+			// Each state the pipeline has is followed by its arrays, a state it leaves out by empty ones. Tessellation is left out, the helpers
+			// create no tessellation pipelines. Pipelines of dynamic rendering keep their attachment formats.
+			inline void graphics_pipeline(VkPipeline pipeline, const VkGraphicsPipelineCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				Stream stream;
+				put(add(pipeline, capture.pipelines), stream);
+				put(info.flags, stream);
+				put(info.stageCount, stream);
+				for (uint32_t s = 0; s < info.stageCount; s++)
+					put_stage(info.pStages[s], capture, stream);
+
+				const VkPipelineVertexInputStateCreateInfo *vertex = info.pVertexInputState;
+				put_optional(vertex, stream);
+				put_array(vertex != nullptr ? vertex->pVertexBindingDescriptions : nullptr, vertex != nullptr ? vertex->vertexBindingDescriptionCount : 0, stream);
+				put_array(vertex != nullptr ? vertex->pVertexAttributeDescriptions : nullptr, vertex != nullptr ? vertex->vertexAttributeDescriptionCount : 0, stream);
+				put_optional(info.pInputAssemblyState, stream);
+				const VkPipelineViewportStateCreateInfo *viewport = info.pViewportState;
+				put_optional(viewport, stream);
+				put_array(viewport != nullptr ? viewport->pViewports : nullptr, viewport != nullptr && viewport->pViewports != nullptr ? viewport->viewportCount : 0, stream);
+				put_array(viewport != nullptr ? viewport->pScissors : nullptr, viewport != nullptr && viewport->pScissors != nullptr ? viewport->scissorCount : 0, stream);
+				put_optional(info.pRasterizationState, stream);
+				const VkPipelineMultisampleStateCreateInfo *multisample = info.pMultisampleState;
+				put_optional(multisample, stream);
+				put_array(multisample != nullptr ? multisample->pSampleMask : nullptr,
+					multisample != nullptr && multisample->pSampleMask != nullptr ? ((uint32_t)multisample->rasterizationSamples + 31) / 32 : 0, stream);
+				put_optional(info.pDepthStencilState, stream);
+				const VkPipelineColorBlendStateCreateInfo *blend = info.pColorBlendState;
+				put_optional(blend, stream);
+				put_array(blend != nullptr ? blend->pAttachments : nullptr, blend != nullptr ? blend->attachmentCount : 0, stream);
+				const VkPipelineDynamicStateCreateInfo *dynamic = info.pDynamicState;
+				put_optional(dynamic, stream);
+				put_array(dynamic != nullptr ? dynamic->pDynamicStates : nullptr, dynamic != nullptr ? dynamic->dynamicStateCount : 0, stream);
+
+				put(find(info.layout, capture.pipeline_layouts), stream);
+				put(find(info.renderPass, capture.render_passes), stream);
+				put(info.subpass, stream);
+				const VkPipelineRenderingCreateInfoKHR *rendering = static_cast<const VkPipelineRenderingCreateInfoKHR*>(
+					find_next(info.pNext, VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR));
+				put_optional(rendering, stream);
+				put_array(rendering != nullptr ? rendering->pColorAttachmentFormats : nullptr, rendering != nullptr ? rendering->colorAttachmentCount : 0, stream);
+				write(GRAPHICS_PIPELINE, stream, capture);
+			}
+
+			inline void compute_pipeline(VkPipeline pipeline, const VkComputePipelineCreateInfo &info) {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				Stream stream;
+				put(add(pipeline, capture.pipelines), stream);
+				put(info.flags, stream);
+				put_stage(info.stage, capture, stream);
+				put(find(info.layout, capture.pipeline_layouts), stream);
+				write(COMPUTE_PIPELINE, stream, capture);
+			}
+
+			// After a frame's present: the frame ends here in the file, the capture stops after max_frames of them
+			inline void frame() {
+				Capture &capture = get_capture();
+				if (!capture.active)
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				write(FRAME, Stream(), capture);
+				capture.n_frames++;
+				if (capture.max_frames > 0 && capture.n_frames >= capture.max_frames) {
+					capture.active = false;
+					capture.file.flush();
+					std::cout << "capture: " << capture.n_frames << " frames written" << std::endl;
+				}
+			}
+			// <-
+
+			// -> device table entries: record, then call the driver. The recording stream of a command buffer is nullptr outside begin and end.
+			inline Stream* get_recording(VkCommandBuffer command_buffer, Op op, Capture &capture) {
+				if (!capture.active)
+					return nullptr;
+				auto it = capture.recording.find(to_key(command_buffer));
+				if (it == capture.recording.end())
+					return nullptr;
+				put((uint32_t)op, it->second);
+				capture.n_ops[to_key(command_buffer)]++;
+				return &it->second;
+			}
+
+			inline VKAPI_ATTR VkResult VKAPI_CALL allocate_command_buffers(VkDevice device, const VkCommandBufferAllocateInfo *info, VkCommandBuffer *command_buffers) {
+				Capture &capture = get_capture();
+				VkResult result = capture.next.vkAllocateCommandBuffers(device, info, command_buffers);
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				if (result == VK_SUCCESS && capture.active) {
+					for (uint32_t i = 0; i < info->commandBufferCount; i++) {
+						if (info->level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+							capture.secondaries.insert(to_key(command_buffers[i]));
+						else
+							capture.secondaries.erase(to_key(command_buffers[i]));
+					}
+				}
+				return result;
+			}
+
+			// Caller holds the mutex. A recording starts with how its command buffer began: its level and, for a secondary, the render pass or
+			// the attachment formats of dynamic rendering it continues.
+			inline void put_begin(VkCommandBuffer command_buffer, const VkCommandBufferBeginInfo &info, Capture &capture, Stream &stream) {
+				bool is_secondary = capture.secondaries.count(to_key(command_buffer)) > 0;
+				const VkCommandBufferInheritanceInfo *inheritance = is_secondary ? info.pInheritanceInfo : nullptr;
+				const VkCommandBufferInheritanceRenderingInfoKHR *rendering = inheritance != nullptr ? static_cast<const VkCommandBufferInheritanceRenderingInfoKHR*>(
+					find_next(inheritance->pNext, VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR)) : nullptr;
+				put(is_secondary ? VK_COMMAND_BUFFER_LEVEL_SECONDARY : VK_COMMAND_BUFFER_LEVEL_PRIMARY, stream);
+				put(info.flags, stream);
+				put(inheritance != nullptr ? find(inheritance->renderPass, capture.render_passes) : 0u, stream);
+				put(inheritance != nullptr ? inheritance->subpass : 0u, stream);
+				put(inheritance != nullptr ? find(inheritance->framebuffer, capture.framebuffers) : 0u, stream);
+				put_optional(rendering, stream);
+				put_array(rendering != nullptr ? rendering->pColorAttachmentFormats : nullptr, rendering != nullptr ? rendering->colorAttachmentCount : 0, stream);
+			}
+
+			inline VKAPI_ATTR VkResult VKAPI_CALL begin_command_buffer(VkCommandBuffer command_buffer, const VkCommandBufferBeginInfo *info) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (capture.active) {
+						Stream &stream = capture.recording[to_key(command_buffer)] = Stream();
+						put_begin(command_buffer, *info, capture, stream);
+						capture.n_ops[to_key(command_buffer)] = 0;
+					}
+				}
+				return capture.next.vkBeginCommandBuffer(command_buffer, info);
+			}
+
+			// A command buffer keeps its id when it is recorded again, the replay uses the newest recording from then on
+			inline VKAPI_ATTR VkResult VKAPI_CALL end_command_buffer(VkCommandBuffer command_buffer) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					auto it = capture.recording.find(to_key(command_buffer));
+					if (it != capture.recording.end()) {
+						if (capture.active) {
+							uint32_t id = find(command_buffer, capture.command_buffers);
+							Stream stream;
+							put(id != 0 ? id : add(command_buffer, capture.command_buffers), stream);
+							put(capture.n_ops[to_key(command_buffer)], stream);
+							stream.bytes.insert(stream.bytes.end(), it->second.bytes.begin(), it->second.bytes.end());
+							write(COMMANDS, stream, capture);
+						}
+						capture.recording.erase(it);
+					}
+				}
+				return capture.next.vkEndCommandBuffer(command_buffer);
+			}
+
+			inline VKAPI_ATTR VkResult VKAPI_CALL allocate_descriptor_sets(VkDevice device, const VkDescriptorSetAllocateInfo *info, VkDescriptorSet *sets) {
+				Capture &capture = get_capture();
+				VkResult result = capture.next.vkAllocateDescriptorSets(device, info, sets);
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				if (result == VK_SUCCESS && capture.active) {
+					for (uint32_t i = 0; i < info->descriptorSetCount; i++) {
+						Stream stream;
+						put(add(sets[i], capture.descriptor_sets), stream);
+						put(find(info->pSetLayouts[i], capture.set_layouts), stream);
+						write(DESCRIPTOR_SET, stream, capture);
+					}
+				}
+				return result;
+			}
+
+			inline bool has_image_info(VkDescriptorType type) {
+				return type == VK_DESCRIPTOR_TYPE_SAMPLER || type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+					|| type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE || type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			}
+
+			inline bool has_buffer_info(VkDescriptorType type) {
+				return type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER || type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+					|| type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+			}
+
+			// Each write keeps its image or buffer infos, samplers and texel buffer views are left out: the helpers create none. The replay applies
+			// updates when it loads, a set updated during the capture replays with its last contents.
+			inline VKAPI_ATTR void VKAPI_CALL update_descriptor_sets(VkDevice device, uint32_t n_writes, const VkWriteDescriptorSet *writes, uint32_t n_copies,
+					const VkCopyDescriptorSet *copies) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (capture.active) {
+						Stream stream;
+						put(n_writes, stream);
+						for (uint32_t w = 0; w < n_writes; w++) {
+							const VkWriteDescriptorSet &update = writes[w];
+							std::vector<VkDescriptorImageInfo> images;
+							std::vector<VkDescriptorBufferInfo> buffers;
+							for (uint32_t i = 0; i < update.descriptorCount && has_image_info(update.descriptorType); i++)
+								images.push_back({ VK_NULL_HANDLE, encode(update.pImageInfo[i].imageView, capture.views), update.pImageInfo[i].imageLayout });
+							for (uint32_t i = 0; i < update.descriptorCount && has_buffer_info(update.descriptorType); i++)
+								buffers.push_back({ encode(update.pBufferInfo[i].buffer, capture.buffers), update.pBufferInfo[i].offset, update.pBufferInfo[i].range });
+							put(find(update.dstSet, capture.descriptor_sets), stream);
+							put(update.dstBinding, stream);
+							put(update.dstArrayElement, stream);
+							put(update.descriptorType, stream);
+							put(update.descriptorCount, stream);
+							put_array(images.data(), (uint32_t)images.size(), stream);
+							put_array(buffers.data(), (uint32_t)buffers.size(), stream);
+						}
+						std::vector<VkCopyDescriptorSet> copied(copies, copies + n_copies);
+						for (VkCopyDescriptorSet &copy : copied) {
+							copy.pNext = nullptr;
+							copy.srcSet = encode(copy.srcSet, capture.descriptor_sets);
+							copy.dstSet = encode(copy.dstSet, capture.descriptor_sets);
+						}
+						put_array(copied.data(), n_copies, stream);
+						write(UPDATE_DESCRIPTORS, stream, capture);
+					}
+				}
+				capture.next.vkUpdateDescriptorSets(device, n_writes, writes, n_copies, copies);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_pipeline_barrier(VkCommandBuffer command_buffer, VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage,
+					VkDependencyFlags dependency_flags, uint32_t n_memory, const VkMemoryBarrier *memory_barriers, uint32_t n_buffer, const VkBufferMemoryBarrier *buffer_barriers,
+					uint32_t n_image, const VkImageMemoryBarrier *image_barriers) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, BARRIER, capture)) {
+						put(src_stage, *stream);
+						put(dst_stage, *stream);
+						put(dependency_flags, *stream);
+						std::vector<VkMemoryBarrier> memory(memory_barriers, memory_barriers + n_memory);
+						for (auto &barrier : memory)
+							barrier.pNext = nullptr;
+						std::vector<VkBufferMemoryBarrier> buffers(buffer_barriers, buffer_barriers + n_buffer);
+						for (auto &barrier : buffers) {
+							barrier.pNext = nullptr;
+							barrier.buffer = encode(barrier.buffer, capture.buffers);
+						}
+						std::vector<VkImageMemoryBarrier> images(image_barriers, image_barriers + n_image);
+						for (auto &barrier : images) {
+							barrier.pNext = nullptr;
+							barrier.image = encode(barrier.image, capture.images);
+						}
+						put_array(memory.data(), n_memory, *stream);
+						put_array(buffers.data(), n_buffer, *stream);
+						put_array(images.data(), n_image, *stream);
+					}
+				}
+				capture.next.vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, dependency_flags, n_memory, memory_barriers, n_buffer, buffer_barriers, n_image, image_barriers);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_clear_color_image(VkCommandBuffer command_buffer, VkImage image, VkImageLayout layout, const VkClearColorValue *color,
+					uint32_t n_ranges, const VkImageSubresourceRange *ranges) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, CLEAR_COLOR, capture)) {
+						put(find(image, capture.images), *stream);
+						put(layout, *stream);
+						put(*color, *stream);
+						put_array(ranges, n_ranges, *stream);
+					}
+				}
+				capture.next.vkCmdClearColorImage(command_buffer, image, layout, color, n_ranges, ranges);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_clear_depth_stencil_image(VkCommandBuffer command_buffer, VkImage image, VkImageLayout layout, const VkClearDepthStencilValue *value,
+					uint32_t n_ranges, const VkImageSubresourceRange *ranges) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, CLEAR_DEPTH_STENCIL, capture)) {
+						put(find(image, capture.images), *stream);
+						put(layout, *stream);
+						put(*value, *stream);
+						put_array(ranges, n_ranges, *stream);
+					}
+				}
+				capture.next.vkCmdClearDepthStencilImage(command_buffer, image, layout, value, n_ranges, ranges);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_clear_attachments(VkCommandBuffer command_buffer, uint32_t n_attachments, const VkClearAttachment *attachments,
+					uint32_t n_rects, const VkClearRect *rects) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, CLEAR_ATTACHMENTS, capture)) {
+						put_array(attachments, n_attachments, *stream);
+						put_array(rects, n_rects, *stream);
+					}
+				}
+				capture.next.vkCmdClearAttachments(command_buffer, n_attachments, attachments, n_rects, rects);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_copy_buffer(VkCommandBuffer command_buffer, VkBuffer src, VkBuffer dst, uint32_t n_regions, const VkBufferCopy *regions) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, COPY_BUFFER, capture)) {
+						put(find(src, capture.buffers), *stream);
+						put(find(dst, capture.buffers), *stream);
+						put_array(regions, n_regions, *stream);
+					}
+				}
+				capture.next.vkCmdCopyBuffer(command_buffer, src, dst, n_regions, regions);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_fill_buffer(VkCommandBuffer command_buffer, VkBuffer dst, VkDeviceSize offset, VkDeviceSize size, uint32_t data) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, FILL_BUFFER, capture)) {
+						put(find(dst, capture.buffers), *stream);
+						put(offset, *stream);
+						put(size, *stream);
+						put(data, *stream);
+					}
+				}
+				capture.next.vkCmdFillBuffer(command_buffer, dst, offset, size, data);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_update_buffer(VkCommandBuffer command_buffer, VkBuffer dst, VkDeviceSize offset, VkDeviceSize size, const void *data) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, UPDATE_BUFFER, capture)) {
+						put(find(dst, capture.buffers), *stream);
+						put(offset, *stream);
+						put_array(static_cast<const char*>(data), (uint32_t)size, *stream);
+					}
+				}
+				capture.next.vkCmdUpdateBuffer(command_buffer, dst, offset, size, data);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_copy_image(VkCommandBuffer command_buffer, VkImage src, VkImageLayout src_layout, VkImage dst, VkImageLayout dst_layout,
+					uint32_t n_regions, const VkImageCopy *regions) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, COPY_IMAGE, capture)) {
+						put(find(src, capture.images), *stream);
+						put(src_layout, *stream);
+						put(find(dst, capture.images), *stream);
+						put(dst_layout, *stream);
+						put_array(regions, n_regions, *stream);
+					}
+				}
+				capture.next.vkCmdCopyImage(command_buffer, src, src_layout, dst, dst_layout, n_regions, regions);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_blit_image(VkCommandBuffer command_buffer, VkImage src, VkImageLayout src_layout, VkImage dst, VkImageLayout dst_layout,
+					uint32_t n_regions, const VkImageBlit *regions, VkFilter filter) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, BLIT_IMAGE, capture)) {
+						put(find(src, capture.images), *stream);
+						put(src_layout, *stream);
+						put(find(dst, capture.images), *stream);
+						put(dst_layout, *stream);
+						put_array(regions, n_regions, *stream);
+						put(filter, *stream);
+					}
+				}
+				capture.next.vkCmdBlitImage(command_buffer, src, src_layout, dst, dst_layout, n_regions, regions, filter);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_copy_buffer_to_image(VkCommandBuffer command_buffer, VkBuffer src, VkImage dst, VkImageLayout dst_layout,
+					uint32_t n_regions, const VkBufferImageCopy *regions) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, COPY_BUFFER_TO_IMAGE, capture)) {
+						put(find(src, capture.buffers), *stream);
+						put(find(dst, capture.images), *stream);
+						put(dst_layout, *stream);
+						put_array(regions, n_regions, *stream);
+					}
+				}
+				capture.next.vkCmdCopyBufferToImage(command_buffer, src, dst, dst_layout, n_regions, regions);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_copy_image_to_buffer(VkCommandBuffer command_buffer, VkImage src, VkImageLayout src_layout, VkBuffer dst,
+					uint32_t n_regions, const VkBufferImageCopy *regions) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, COPY_IMAGE_TO_BUFFER, capture)) {
+						put(find(src, capture.images), *stream);
+						put(src_layout, *stream);
+						put(find(dst, capture.buffers), *stream);
+						put_array(regions, n_regions, *stream);
+					}
+				}
+				capture.next.vkCmdCopyImageToBuffer(command_buffer, src, src_layout, dst, n_regions, regions);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_begin_render_pass(VkCommandBuffer command_buffer, const VkRenderPassBeginInfo *info, VkSubpassContents contents) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, BEGIN_RENDER_PASS, capture)) {
+						put(find(info->renderPass, capture.render_passes), *stream);
+						put(find(info->framebuffer, capture.framebuffers), *stream);
+						put(info->renderArea, *stream);
+						put_array(info->pClearValues, info->clearValueCount, *stream);
+						put(contents, *stream);
+					}
+				}
+				capture.next.vkCmdBeginRenderPass(command_buffer, info, contents);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_next_subpass(VkCommandBuffer command_buffer, VkSubpassContents contents) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, NEXT_SUBPASS, capture))
+						put(contents, *stream);
+				}
+				capture.next.vkCmdNextSubpass(command_buffer, contents);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_end_render_pass(VkCommandBuffer command_buffer) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					get_recording(command_buffer, END_RENDER_PASS, capture);
+				}
+				capture.next.vkCmdEndRenderPass(command_buffer);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_set_viewport(VkCommandBuffer command_buffer, uint32_t first, uint32_t count, const VkViewport *viewports) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, SET_VIEWPORT, capture)) {
+						put(first, *stream);
+						put_array(viewports, count, *stream);
+					}
+				}
+				capture.next.vkCmdSetViewport(command_buffer, first, count, viewports);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_set_scissor(VkCommandBuffer command_buffer, uint32_t first, uint32_t count, const VkRect2D *scissors) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, SET_SCISSOR, capture)) {
+						put(first, *stream);
+						put_array(scissors, count, *stream);
+					}
+				}
+				capture.next.vkCmdSetScissor(command_buffer, first, count, scissors);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_bind_pipeline(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point, VkPipeline pipeline) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, BIND_PIPELINE, capture)) {
+						put(bind_point, *stream);
+						put(find(pipeline, capture.pipelines), *stream);
+					}
+				}
+				capture.next.vkCmdBindPipeline(command_buffer, bind_point, pipeline);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_bind_descriptor_sets(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point, VkPipelineLayout layout, uint32_t first,
+					uint32_t n_sets, const VkDescriptorSet *sets, uint32_t n_offsets, const uint32_t *offsets) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, BIND_DESCRIPTOR_SETS, capture)) {
+						std::vector<uint32_t> ids(n_sets);
+						for (uint32_t i = 0; i < n_sets; i++)
+							ids[i] = find(sets[i], capture.descriptor_sets);
+						put(bind_point, *stream);
+						put(find(layout, capture.pipeline_layouts), *stream);
+						put(first, *stream);
+						put_array(ids.data(), n_sets, *stream);
+						put_array(offsets, n_offsets, *stream);
+					}
+				}
+				capture.next.vkCmdBindDescriptorSets(command_buffer, bind_point, layout, first, n_sets, sets, n_offsets, offsets);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_push_constants(VkCommandBuffer command_buffer, VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset,
+					uint32_t size, const void *values) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, PUSH_CONSTANTS, capture)) {
+						put(find(layout, capture.pipeline_layouts), *stream);
+						put(stages, *stream);
+						put(offset, *stream);
+						put_array(static_cast<const char*>(values), size, *stream);
+					}
+				}
+				capture.next.vkCmdPushConstants(command_buffer, layout, stages, offset, size, values);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_bind_vertex_buffers(VkCommandBuffer command_buffer, uint32_t first, uint32_t n_buffers, const VkBuffer *buffers,
+					const VkDeviceSize *offsets) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, BIND_VERTEX_BUFFERS, capture)) {
+						std::vector<uint32_t> ids(n_buffers);
+						for (uint32_t i = 0; i < n_buffers; i++)
+							ids[i] = find(buffers[i], capture.buffers);
+						put(first, *stream);
+						put_array(ids.data(), n_buffers, *stream);
+						put_array(offsets, n_buffers, *stream);
+					}
+				}
+				capture.next.vkCmdBindVertexBuffers(command_buffer, first, n_buffers, buffers, offsets);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_bind_index_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset, VkIndexType type) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, BIND_INDEX_BUFFER, capture)) {
+						put(find(buffer, capture.buffers), *stream);
+						put(offset, *stream);
+						put(type, *stream);
+					}
+				}
+				capture.next.vkCmdBindIndexBuffer(command_buffer, buffer, offset, type);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_draw(VkCommandBuffer command_buffer, uint32_t n_vertices, uint32_t n_instances, uint32_t first_vertex, uint32_t first_instance) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, DRAW, capture)) {
+						uint32_t args[4] = { n_vertices, n_instances, first_vertex, first_instance };
+						put(args, *stream);
+					}
+				}
+				capture.next.vkCmdDraw(command_buffer, n_vertices, n_instances, first_vertex, first_instance);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_draw_indexed(VkCommandBuffer command_buffer, uint32_t n_indices, uint32_t n_instances, uint32_t first_index, int32_t vertex_offset,
+					uint32_t first_instance) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, DRAW_INDEXED, capture)) {
+						VkDrawIndexedIndirectCommand args = { n_indices, n_instances, first_index, vertex_offset, first_instance };
+						put(args, *stream);
+					}
+				}
+				capture.next.vkCmdDrawIndexed(command_buffer, n_indices, n_instances, first_index, vertex_offset, first_instance);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_draw_indexed_indirect(VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset, uint32_t n_draws, uint32_t stride) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, DRAW_INDEXED_INDIRECT, capture)) {
+						put(find(buffer, capture.buffers), *stream);
+						put(offset, *stream);
+						put(n_draws, *stream);
+						put(stride, *stream);
+					}
+				}
+				capture.next.vkCmdDrawIndexedIndirect(command_buffer, buffer, offset, n_draws, stride);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_draw_indexed_indirect_count(VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer count_buffer,
+					VkDeviceSize count_offset, uint32_t max_draws, uint32_t stride) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, DRAW_INDEXED_INDIRECT_COUNT, capture)) {
+						put(find(buffer, capture.buffers), *stream);
+						put(offset, *stream);
+						put(find(count_buffer, capture.buffers), *stream);
+						put(count_offset, *stream);
+						put(max_draws, *stream);
+						put(stride, *stream);
+					}
+				}
+				capture.next.vkCmdDrawIndexedIndirectCountKHR(command_buffer, buffer, offset, count_buffer, count_offset, max_draws, stride);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_dispatch(VkCommandBuffer command_buffer, uint32_t x, uint32_t y, uint32_t z) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, DISPATCH, capture)) {
+						uint32_t groups[3] = { x, y, z };
+						put(groups, *stream);
+					}
+				}
+				capture.next.vkCmdDispatch(command_buffer, x, y, z);
+			}
+
+			// The attachments keep their load and store ops and clear values, the depth and stencil attachment are arrays of zero or one
+			inline VKAPI_ATTR void VKAPI_CALL cmd_begin_rendering(VkCommandBuffer command_buffer, const VkRenderingInfoKHR *info) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, BEGIN_RENDERING, capture)) {
+						auto encode_attachment = [&capture](const VkRenderingAttachmentInfoKHR &attachment) {
+							VkRenderingAttachmentInfoKHR copy = attachment;
+							copy.pNext = nullptr;
+							copy.imageView = encode(copy.imageView, capture.views);
+							copy.resolveImageView = encode(copy.resolveImageView, capture.views);
+							return copy;
+						};
+						std::vector<VkRenderingAttachmentInfoKHR> colors;
+						for (uint32_t i = 0; i < info->colorAttachmentCount; i++)
+							colors.push_back(encode_attachment(info->pColorAttachments[i]));
+						VkRenderingAttachmentInfoKHR depth = info->pDepthAttachment != nullptr ? encode_attachment(*info->pDepthAttachment) : VkRenderingAttachmentInfoKHR{};
+						VkRenderingAttachmentInfoKHR stencil = info->pStencilAttachment != nullptr ? encode_attachment(*info->pStencilAttachment) : VkRenderingAttachmentInfoKHR{};
+						put(info->flags, *stream);
+						put(info->renderArea, *stream);
+						put(info->layerCount, *stream);
+						put(info->viewMask, *stream);
+						put_array(colors.data(), (uint32_t)colors.size(), *stream);
+						put_array(&depth, info->pDepthAttachment != nullptr ? 1 : 0, *stream);
+						put_array(&stencil, info->pStencilAttachment != nullptr ? 1 : 0, *stream);
+					}
+				}
+				capture.next.vkCmdBeginRenderingKHR(command_buffer, info);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_end_rendering(VkCommandBuffer command_buffer) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					get_recording(command_buffer, END_RENDERING, capture);
+				}
+				capture.next.vkCmdEndRenderingKHR(command_buffer);
+			}
+
+			inline VKAPI_ATTR void VKAPI_CALL cmd_execute_commands(VkCommandBuffer command_buffer, uint32_t n_command_buffers, const VkCommandBuffer *command_buffers) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (Stream *stream = get_recording(command_buffer, EXECUTE_COMMANDS, capture)) {
+						std::vector<uint32_t> ids(n_command_buffers);
+						for (uint32_t i = 0; i < n_command_buffers; i++)
+							ids[i] = find(command_buffers[i], capture.command_buffers);
+						put_array(ids.data(), n_command_buffers, *stream);
+					}
+				}
+				capture.next.vkCmdExecuteCommands(command_buffer, n_command_buffers, command_buffers);
+			}
+
+			// One SUBMIT record per batch, its command buffers in order. Semaphores and fences are left out, the replay runs on one queue.
+			inline VKAPI_ATTR VkResult VKAPI_CALL queue_submit(VkQueue queue, uint32_t n_submits, const VkSubmitInfo *submits, VkFence fence) {
+				Capture &capture = get_capture();
+				{
+					std::lock_guard<std::mutex> lock(capture.mutex);
+					if (capture.active) {
+						for (uint32_t s = 0; s < n_submits; s++) {
+							std::vector<uint32_t> ids(submits[s].commandBufferCount);
+							for (uint32_t i = 0; i < submits[s].commandBufferCount; i++)
+								ids[i] = find(submits[s].pCommandBuffers[i], capture.command_buffers);
+							Stream stream;
+							put_array(ids.data(), (uint32_t)ids.size(), stream);
+							write(SUBMIT, stream, capture);
+						}
+					}
+				}
+				return capture.next.vkQueueSubmit(queue, n_submits, submits, fence);
+			}
+			// <-
+
+			// Call right after dispatch::connect_device, before the resources the frames use are created. Batches of the immediate context are captured,
+			// only the one shot command buffers of get_command_buffer and flush_command_buffer bypass the device table.
+			inline bool begin(const std::string &path, uint32_t max_frames) {
+				Capture &capture = get_capture();
+				capture.file.open(path, std::ios::binary | std::ios::trunc);
+				if (!capture.file) {
+					std::cout << "capture: could not open " << path << std::endl;
+					return false;
+				}
+				uint32_t header[2] = { CAPTURE_MAGIC, CAPTURE_VERSION };
+				capture.file.write(reinterpret_cast<const char*>(header), sizeof(header));
+				capture.max_frames = max_frames;
+
+				ct::vulkan::dispatch::DeviceTable &table = ct::vulkan::dispatch::Tables<>::device;
+				capture.next = table;
+				table.vkAllocateCommandBuffers = allocate_command_buffers;
+				table.vkAllocateDescriptorSets = allocate_descriptor_sets;
+				table.vkUpdateDescriptorSets = update_descriptor_sets;
+				table.vkBeginCommandBuffer = begin_command_buffer;
+				table.vkEndCommandBuffer = end_command_buffer;
+				table.vkCmdPipelineBarrier = cmd_pipeline_barrier;
+				table.vkCmdClearColorImage = cmd_clear_color_image;
+				table.vkCmdClearDepthStencilImage = cmd_clear_depth_stencil_image;
+				table.vkCmdClearAttachments = cmd_clear_attachments;
+				table.vkCmdCopyBuffer = cmd_copy_buffer;
+				table.vkCmdFillBuffer = cmd_fill_buffer;
+				table.vkCmdUpdateBuffer = cmd_update_buffer;
+				table.vkCmdCopyImage = cmd_copy_image;
+				table.vkCmdBlitImage = cmd_blit_image;
+				table.vkCmdCopyBufferToImage = cmd_copy_buffer_to_image;
+				table.vkCmdCopyImageToBuffer = cmd_copy_image_to_buffer;
+				table.vkCmdBeginRenderPass = cmd_begin_render_pass;
+				table.vkCmdNextSubpass = cmd_next_subpass;
+				table.vkCmdEndRenderPass = cmd_end_render_pass;
+				table.vkCmdSetViewport = cmd_set_viewport;
+				table.vkCmdSetScissor = cmd_set_scissor;
+				table.vkCmdBindPipeline = cmd_bind_pipeline;
+				table.vkCmdBindDescriptorSets = cmd_bind_descriptor_sets;
+				table.vkCmdPushConstants = cmd_push_constants;
+				table.vkCmdBindVertexBuffers = cmd_bind_vertex_buffers;
+				table.vkCmdBindIndexBuffer = cmd_bind_index_buffer;
+				table.vkCmdDraw = cmd_draw;
+				table.vkCmdDrawIndexed = cmd_draw_indexed;
+				table.vkCmdDrawIndexedIndirect = cmd_draw_indexed_indirect;
+				table.vkCmdDispatch = cmd_dispatch;
+				table.vkCmdExecuteCommands = cmd_execute_commands;
+				// Extension entries are only wrapped when the device has them
+				if (table.vkCmdDrawIndexedIndirectCountKHR != nullptr)
+					table.vkCmdDrawIndexedIndirectCountKHR = cmd_draw_indexed_indirect_count;
+				if (table.vkCmdBeginRenderingKHR != nullptr)
+					table.vkCmdBeginRenderingKHR = cmd_begin_rendering;
+				if (table.vkCmdEndRenderingKHR != nullptr)
+					table.vkCmdEndRenderingKHR = cmd_end_rendering;
+				table.vkQueueSubmit = queue_submit;
+				capture.active = true;
+				std::cout << "capture: " << path << (max_frames > 0 ? " frames: " + std::to_string(max_frames) : std::string()) << std::endl;
+				return true;
+			}
+
+			inline void report(std::ostream &os) {
+				Capture &capture = get_capture();
+				if (!capture.file.is_open())
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				os << "capture: frames: " << capture.n_frames << " records: " << capture.n_records << " KB: " << capture.n_bytes / 1024.0 << std::endl;
+			}
+
+			// Puts the driver's entries back, once nothing records or submits any more
+			inline void end() {
+				Capture &capture = get_capture();
+				if (!capture.file.is_open())
+					return;
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				capture.active = false;
+				ct::vulkan::dispatch::Tables<>::device = capture.next;
+				capture.file.close();
+			}
+
+		}
+	}
+}
@@ -0,0 +1,559 @@
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/DynamicRendering.h"
+#include "vulkanbase/Immediate.h"
+#include "utils/ErrorHelper.h"
+#include "utils/EnvHelper.h"
+#include "loader/LoaderBinary.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace clear {
+#define CLEAR_CALIBRATION_ITERATIONS 32
+#define CLEAR_COMPUTE_GROUP_SIZE 8
+
+			// Every strategy leaves colour in the target's final layout and depth in DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+			enum Strategy {
+				RENDER_PASS = 0,		// loadOp CLEAR when the render pass begins
+				CLEAR_IMAGE,			// vkCmdClearColorImage and vkCmdClearDepthStencilImage outside a pass
+				CLEAR_ATTACHMENTS,		// vkCmdClearAttachments inside a loadOp DONT_CARE pass
+				COMPUTE_FILL,			// compute shader imageStore, depth through vkCmdClearDepthStencilImage
+				FILL_BUFFER_COPY,		// vkCmdFillBuffer once per clear colour, buffer to image copy per frame
+				DYNAMIC_RENDERING,		// loadOp CLEAR in vkCmdBeginRenderingKHR, no render pass or framebuffer
+				STRATEGY_COUNT
+			};
+
+			inline std::string strategy2string(Strategy strategy) {
+				switch (strategy) {
+#define STR(r) case r: return #r
+					STR(RENDER_PASS);
+					STR(CLEAR_IMAGE);
+					STR(CLEAR_ATTACHMENTS);
+					STR(COMPUTE_FILL);
+					STR(FILL_BUFFER_COPY);
+					STR(DYNAMIC_RENDERING);
+#undef STR
+					default: return "UNKNOWN_CLEAR_STRATEGY";
+				}
+			}
+
+			struct Target {
+				uint32_t width;
+				uint32_t height;
+				VkImage color_image;
+				VkImageView color_view;
+				VkImage depth_image;
+				VkImageView depth_view = VK_NULL_HANDLE;
+				VkFormat depth_format;
+				VkFramebuffer framebuffer;
+				VkImageLayout final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+				VkDescriptorSet storage_set = VK_NULL_HANDLE;
+				// Set by prepare_target for targets not ending in PRESENT_SRC, the engine's own passes are used otherwise
+				VkRenderPass render_pass_clear = VK_NULL_HANDLE;
+				VkRenderPass render_pass_dont_care = VK_NULL_HANDLE;
+			};
+
+			// Render pass variants ending in another layout than PRESENT_SRC
+			struct LayoutPasses {
+				VkImageLayout final_layout;
+				VkRenderPass render_pass_clear;
+				VkRenderPass render_pass_dont_care;
+			};
+
+			struct Engine {
+				Strategy strategy = RENDER_PASS;
+				bool supported[STRATEGY_COUNT] = {};
+				double ms[STRATEGY_COUNT] = {};
+
+				uint32_t width;
+				uint32_t height;
+				VkFormat color_format;
+				VkClearColorValue color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+				VkClearDepthStencilValue depth_stencil = { 1.0f, 0 };
+
+				VkRenderPass render_pass_clear = VK_NULL_HANDLE;
+				VkRenderPass render_pass_dont_care = VK_NULL_HANDLE;
+				ct::vulkan::rendering::Rendering *rendering = nullptr;
+				std::vector<LayoutPasses> layout_passes;
+
+				// -> compute fill
+				VkDescriptorSetLayout descriptor_set_layout = VK_NULL_HANDLE;
+				VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+				VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+				VkPipeline pipeline = VK_NULL_HANDLE;
+				// <-
+
+				// -> fill buffer + copy
+				ct::vulkan::Buffer fill_buffer;
+				// <-
+			};
+
+			struct PushConstants {
+				float color[4];
+				int32_t extent[2];
+				int32_t pad[2];
+			};
+
+			inline bool parse_strategy(std::string name, Strategy &strategy) {
+				for (int32_t i = 0; i < STRATEGY_COUNT; i++) {
+					if (name == strategy2string((Strategy)i) || name == std::to_string(i)) {
+						strategy = (Strategy)i;
+						return true;
+					}
+				}
+				return false;
+			}
+
+			// Byte order of a 4 byte colour texel as vkCmdFillBuffer writes it (little endian uint32)
+			inline bool pack_color(VkFormat color_format, VkClearColorValue &color, uint32_t &texel) {
+				auto unorm8 = [](float v) { return (uint32_t)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f); };
+				uint32_t r = unorm8(color.float32[0]), g = unorm8(color.float32[1]), b = unorm8(color.float32[2]), a = unorm8(color.float32[3]);
+				if (color_format == VK_FORMAT_R8G8B8A8_UNORM) {
+					texel = r | (g << 8) | (b << 16) | (a << 24);
+					return true;
+				}
+				if (color_format == VK_FORMAT_B8G8R8A8_UNORM) {
+					texel = b | (g << 8) | (r << 16) | (a << 24);
+					return true;
+				}
+				return false;
+			}
+
+			inline void setup_compute_fill(uint32_t max_targets, VkDevice &device, Engine &engine) {
+				std::vector<char> shader_code;
+				ct::load_binary(std::string(SHADER_BIN_DIR) + "clear/fill.comp.spv", shader_code);
+				if (shader_code.empty()) {
+					std::cout << "clear: compute fill disabled, shader not found" << std::endl;
+					engine.supported[COMPUTE_FILL] = false;
+					return;
+				}
+
+				VkDescriptorSetLayoutBinding binding = {};
+				binding.binding = 0;
+				binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+				binding.descriptorCount = 1;
+				binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+				VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+				layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+				layoutInfo.bindingCount = 1;
+				layoutInfo.pBindings = &binding;
+				VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &layoutInfo, ct::vulkan::get_allocator(), &engine.descriptor_set_layout));
+				ct::vulkan::capture::set_layout(engine.descriptor_set_layout, layoutInfo);
+
+				VkDescriptorPoolSize poolSize = {};
+				poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+				poolSize.descriptorCount = max_targets;
+
+				VkDescriptorPoolCreateInfo poolInfo = {};
+				poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+				poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+				poolInfo.maxSets = max_targets;
+				poolInfo.poolSizeCount = 1;
+				poolInfo.pPoolSizes = &poolSize;
+				VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolInfo, ct::vulkan::get_allocator(), &engine.descriptor_pool));
+
+				VkPushConstantRange pushConstantRange = {};
+				pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+				pushConstantRange.offset = 0;
+				pushConstantRange.size = sizeof(PushConstants);
+
+				VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+				pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+				pipelineLayoutInfo.setLayoutCount = 1;
+				pipelineLayoutInfo.pSetLayouts = &engine.descriptor_set_layout;
+				pipelineLayoutInfo.pushConstantRangeCount = 1;
+				pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+				VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, ct::vulkan::get_allocator(), &engine.pipeline_layout));
+				ct::vulkan::capture::pipeline_layout(engine.pipeline_layout, pipelineLayoutInfo);
+
+				VkShaderModuleCreateInfo moduleCreateInfo = {};
+				moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+				moduleCreateInfo.codeSize = shader_code.size();
+				moduleCreateInfo.pCode = (uint32_t*)shader_code.data();
+				VkShaderModule shader_module;
+				VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, ct::vulkan::get_allocator(), &shader_module));
+				ct::vulkan::capture::shader_module(shader_module, moduleCreateInfo);
+
+				VkComputePipelineCreateInfo pipelineInfo = {};
+				pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+				pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+				pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+				pipelineInfo.stage.module = shader_module;
+				pipelineInfo.stage.pName = "main";
+				pipelineInfo.layout = engine.pipeline_layout;
+				VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, ct::vulkan::get_allocator(), &engine.pipeline));
+				ct::vulkan::capture::compute_pipeline(engine.pipeline, pipelineInfo);
+
+				vkDestroyShaderModule(device, shader_module, ct::vulkan::get_allocator());
+			}
+
+			// Creates everything the strategies need. color_usage are the usage flags of the images that will be cleared.
+			// With rendering (connected and supported) dynamic rendering competes with the other strategies.
+			inline void setup(uint32_t width, uint32_t height, uint32_t max_targets, VkFormat color_format, VkImageUsageFlags color_usage,
+					ct::vulkan::Framebuffer &framebuffer, ct::vulkan::LogicalDevice &logical_device, Engine &engine, ct::vulkan::rendering::Rendering *rendering = nullptr) {
+				engine.width = width;
+				engine.height = height;
+				engine.color_format = color_format;
+				engine.render_pass_clear = framebuffer.render_pass;
+				engine.rendering = rendering;
+
+				// -> which strategies can run on this device and these images
+				engine.supported[RENDER_PASS] = true;
+				engine.supported[CLEAR_ATTACHMENTS] = true;
+				engine.supported[CLEAR_IMAGE] = (color_usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0;
+				engine.supported[COMPUTE_FILL] = (color_usage & VK_IMAGE_USAGE_STORAGE_BIT) != 0
+					&& logical_device.features_enabled.shaderStorageImageWriteWithoutFormat == VK_TRUE;
+				uint32_t texel;
+				engine.supported[FILL_BUFFER_COPY] = (color_usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0 && pack_color(color_format, engine.color, texel);
+				engine.supported[DYNAMIC_RENDERING] = rendering != nullptr && rendering->supported;
+				// <-
+
+				// Same attachments as the clearing pass, so framebuffers of one are compatible with the other
+				ct::vulkan::setup_render_pass(color_format, framebuffer.depth_stencil.depth_format, logical_device.device, engine.render_pass_dont_care,
+						VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+
+				if (engine.supported[COMPUTE_FILL])
+					setup_compute_fill(max_targets, logical_device.device, engine);
+
+				if (engine.supported[FILL_BUFFER_COPY])
+					ct::vulkan::create_buffer((VkDeviceSize)width * height * 4, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+							logical_device.device, logical_device.memory_properties, engine.fill_buffer);
+			}
+
+			// Call before the first frame is recorded. With an immediate context the fill goes out with the other setup work, finish the context
+			// before the first frame is submitted.
+			inline void set_clear_values(VkClearColorValue color, VkClearDepthStencilValue depth_stencil, ct::vulkan::LogicalDevice &logical_device, Engine &engine,
+					ct::vulkan::immediate::Context *immediate = nullptr) {
+				engine.color = color;
+				engine.depth_stencil = depth_stencil;
+
+				// The fill buffer only changes with the clear colour, so fill it once on the graphics queue that copies from it every frame
+				uint32_t texel;
+				if (engine.supported[FILL_BUFFER_COPY] && pack_color(engine.color_format, engine.color, texel)) {
+					const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+					VkCommandBuffer command_buffer = immediate != nullptr ? ct::vulkan::immediate::begin(*immediate)
+						: ct::vulkan::get_command_buffer(true, logical_device.device, logical_device.command_pool);
+					dispatch.vkCmdFillBuffer(command_buffer, engine.fill_buffer.buffer, 0, VK_WHOLE_SIZE, texel);
+					if (immediate != nullptr)
+						ct::vulkan::immediate::end(*immediate);
+					else
+						ct::vulkan::flush_command_buffer(logical_device.device, logical_device.command_pool, logical_device.queue_graphics, command_buffer);
+				}
+			}
+
+			inline void prepare_render_passes(VkDevice &device, Engine &engine, Target &target) {
+				if (target.final_layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR || target.render_pass_clear != VK_NULL_HANDLE)
+					return;
+				for (auto &passes : engine.layout_passes) {
+					if (passes.final_layout == target.final_layout) {
+						target.render_pass_clear = passes.render_pass_clear;
+						target.render_pass_dont_care = passes.render_pass_dont_care;
+						return;
+					}
+				}
+				LayoutPasses passes = { target.final_layout, VK_NULL_HANDLE, VK_NULL_HANDLE };
+				ct::vulkan::setup_render_pass(engine.color_format, target.depth_format, device, passes.render_pass_clear, target.final_layout, VK_ATTACHMENT_LOAD_OP_CLEAR);
+				ct::vulkan::setup_render_pass(engine.color_format, target.depth_format, device, passes.render_pass_dont_care, target.final_layout, VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+				engine.layout_passes.push_back(passes);
+				target.render_pass_clear = passes.render_pass_clear;
+				target.render_pass_dont_care = passes.render_pass_dont_care;
+			}
+
+			inline void prepare_target(VkDevice &device, Engine &engine, Target &target) {
+				assert(target.width <= engine.width && target.height <= engine.height);
+				prepare_render_passes(device, engine, target);
+				if (engine.pipeline == VK_NULL_HANDLE || target.storage_set != VK_NULL_HANDLE)
+					return;
+
+				VkDescriptorSetAllocateInfo allocInfo = {};
+				allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+				allocInfo.descriptorPool = engine.descriptor_pool;
+				allocInfo.descriptorSetCount = 1;
+				allocInfo.pSetLayouts = &engine.descriptor_set_layout;
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VK_CHECK_RESULT(dispatch.vkAllocateDescriptorSets(device, &allocInfo, &target.storage_set));
+
+				VkDescriptorImageInfo imageInfo = {};
+				imageInfo.imageView = target.color_view;
+				imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+				VkWriteDescriptorSet write = {};
+				write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				write.dstSet = target.storage_set;
+				write.dstBinding = 0;
+				write.descriptorCount = 1;
+				write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+				write.pImageInfo = &imageInfo;
+				dispatch.vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+			}
+
+			inline void release_target(VkDevice &device, Engine &engine, Target &target) {
+				if (target.storage_set != VK_NULL_HANDLE)
+					vkFreeDescriptorSets(device, engine.descriptor_pool, 1, &target.storage_set);
+				target.storage_set = VK_NULL_HANDLE;
+			}
+
+			inline void begin_pass(VkRenderPass render_pass, uint32_t clear_value_count, VkCommandBuffer command_buffer, Engine &engine, Target &target) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VkClearValue clearValues[2];
+				clearValues[0].color = engine.color;
+				clearValues[1].depthStencil = engine.depth_stencil;
+
+				VkRenderPassBeginInfo renderPassBeginInfo = {};
+				renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+				renderPassBeginInfo.renderPass = render_pass;
+				renderPassBeginInfo.framebuffer = target.framebuffer;
+				renderPassBeginInfo.renderArea.offset = { 0, 0 };
+				renderPassBeginInfo.renderArea.extent = { target.width, target.height };
+				renderPassBeginInfo.clearValueCount = clear_value_count;
+				renderPassBeginInfo.pClearValues = clear_value_count > 0 ? clearValues : nullptr;
+				dispatch.vkCmdBeginRenderPass(command_buffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			}
+
+			inline ct::vulkan::rendering::Target get_rendering_target(Target &target) {
+				ct::vulkan::rendering::Target rendering_target;
+				rendering_target.width = target.width;
+				rendering_target.height = target.height;
+				rendering_target.color_image = target.color_image;
+				rendering_target.color_view = target.color_view;
+				rendering_target.depth_image = target.depth_image;
+				rendering_target.depth_view = target.depth_view;
+				rendering_target.depth_format = target.depth_format;
+				rendering_target.framebuffer = target.framebuffer;
+				rendering_target.final_layout = target.final_layout;
+				return rendering_target;
+			}
+
+			// Records the clear of target with the given strategy into command_buffer (outside of any render pass)
+			inline void record(Strategy strategy, VkCommandBuffer command_buffer, Engine &engine, Target &target) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VkImageAspectFlags depth_aspect = ct::vulkan::get_depth_aspect(target.depth_format);
+				VkImageSubresourceRange colorRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+				VkImageSubresourceRange depthRange = { depth_aspect, 0, 1, 0, 1 };
+				VkPipelineStageFlags depth_stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+				switch (strategy) {
+					case RENDER_PASS: {
+						begin_pass(target.render_pass_clear != VK_NULL_HANDLE ? target.render_pass_clear : engine.render_pass_clear, 2, command_buffer, engine, target);
+						dispatch.vkCmdEndRenderPass(command_buffer);
+						return;
+					}
+					case CLEAR_ATTACHMENTS: {
+						begin_pass(target.render_pass_dont_care != VK_NULL_HANDLE ? target.render_pass_dont_care : engine.render_pass_dont_care, 0, command_buffer, engine, target);
+						VkClearAttachment clearAttachments[2] = {};
+						clearAttachments[0].aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+						clearAttachments[0].colorAttachment = 0;
+						clearAttachments[0].clearValue.color = engine.color;
+						clearAttachments[1].aspectMask = depth_aspect;
+						clearAttachments[1].clearValue.depthStencil = engine.depth_stencil;
+						VkClearRect clearRect = {};
+						clearRect.rect.extent = { target.width, target.height };
+						clearRect.layerCount = 1;
+						dispatch.vkCmdClearAttachments(command_buffer, 2, clearAttachments, 1, &clearRect);
+						dispatch.vkCmdEndRenderPass(command_buffer);
+						return;
+					}
+					case DYNAMIC_RENDERING: {
+						VkClearValue clearValues[2];
+						clearValues[0].color = engine.color;
+						clearValues[1].depthStencil = engine.depth_stencil;
+						ct::vulkan::rendering::Target rendering_target = get_rendering_target(target);
+						ct::vulkan::rendering::begin(command_buffer, rendering_target, VK_ATTACHMENT_LOAD_OP_CLEAR, clearValues, *engine.rendering);
+						ct::vulkan::rendering::end(command_buffer, rendering_target, *engine.rendering);
+						return;
+					}
+					default:
+						break;
+				}
+
+				// -> strategies outside a render pass
+				// The first colour transition waits on COLOR_ATTACHMENT_OUTPUT so it chains with the acquire semaphore wait
+				VkImageLayout color_layout = strategy == COMPUTE_FILL ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				VkPipelineStageFlags color_stage = strategy == COMPUTE_FILL ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT;
+				ct::vulkan::set_image_layout(command_buffer, target.color_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, color_layout,
+						VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, color_stage);
+				ct::vulkan::set_image_layout(command_buffer, target.depth_image, depth_aspect, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+						depth_stages, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+				if (strategy == CLEAR_IMAGE) {
+					dispatch.vkCmdClearColorImage(command_buffer, target.color_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &engine.color, 1, &colorRange);
+				} else if (strategy == COMPUTE_FILL) {
+					PushConstants pushConstants = {};
+					for (int32_t i = 0; i < 4; i++)
+						pushConstants.color[i] = engine.color.float32[i];
+					pushConstants.extent[0] = target.width;
+					pushConstants.extent[1] = target.height;
+					dispatch.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, engine.pipeline);
+					dispatch.vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, engine.pipeline_layout, 0, 1, &target.storage_set, 0, nullptr);
+					dispatch.vkCmdPushConstants(command_buffer, engine.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+					dispatch.vkCmdDispatch(command_buffer, (target.width + CLEAR_COMPUTE_GROUP_SIZE - 1) / CLEAR_COMPUTE_GROUP_SIZE,
+							(target.height + CLEAR_COMPUTE_GROUP_SIZE - 1) / CLEAR_COMPUTE_GROUP_SIZE, 1);
+				} else if (strategy == FILL_BUFFER_COPY) {
+					VkBufferImageCopy region = {};
+					region.bufferOffset = 0;
+					region.bufferRowLength = 0;
+					region.bufferImageHeight = 0;
+					region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+					region.imageSubresource.layerCount = 1;
+					region.imageExtent = { target.width, target.height, 1 };
+					dispatch.vkCmdCopyBufferToImage(command_buffer, engine.fill_buffer.buffer, target.color_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+				}
+				dispatch.vkCmdClearDepthStencilImage(command_buffer, target.depth_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &engine.depth_stencil, 1, &depthRange);
+
+				ct::vulkan::set_image_layout(command_buffer, target.color_image, VK_IMAGE_ASPECT_COLOR_BIT, color_layout, target.final_layout,
+						color_stage, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+				ct::vulkan::set_image_layout(command_buffer, target.depth_image, depth_aspect, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+						VK_PIPELINE_STAGE_TRANSFER_BIT, depth_stages);
+				// <-
+			}
+
+			inline void record(VkCommandBuffer command_buffer, Engine &engine, Target &target) {
+				record(engine.strategy, command_buffer, engine, target);
+			}
+
+			// Times every supported strategy on target with GPU timestamps (CPU wall time if the queue has no timestamps)
+			inline void calibrate(uint32_t iterations, ct::vulkan::LogicalDevice &logical_device, Engine &engine, Target &target) {
+				uint64_t timestamp_mask = ct::vulkan::get_timestamp_mask(logical_device, logical_device.queue_family_indices.graphics);
+				bool has_timestamps = timestamp_mask != 0;
+
+				VkQueryPool query_pool = VK_NULL_HANDLE;
+				if (has_timestamps) {
+					VkQueryPoolCreateInfo queryPoolInfo = {};
+					queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+					queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+					queryPoolInfo.queryCount = 2;
+					VK_CHECK_RESULT(vkCreateQueryPool(logical_device.device, &queryPoolInfo, ct::vulkan::get_allocator(), &query_pool));
+				}
+
+				for (int32_t i = 0; i < STRATEGY_COUNT; i++) {
+					Strategy strategy = (Strategy)i;
+					if (!engine.supported[strategy])
+						continue;
+
+					VkCommandBuffer command_buffer = ct::vulkan::get_command_buffer(true, logical_device.device, logical_device.command_pool);
+					if (has_timestamps)
+						vkCmdResetQueryPool(command_buffer, query_pool, 0, 2);
+					// One warm up clear, then time the rest back to back
+					record(strategy, command_buffer, engine, target);
+					if (has_timestamps)
+						vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 0);
+					for (uint32_t j = 0; j < iterations; j++)
+						record(strategy, command_buffer, engine, target);
+					if (has_timestamps)
+						vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+
+					auto t0 = std::chrono::high_resolution_clock::now();
+					ct::vulkan::flush_command_buffer(logical_device.device, logical_device.command_pool, logical_device.queue_graphics, command_buffer);
+					double ms_cpu = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+					if (has_timestamps) {
+						uint64_t timestamps[2];
+						VK_CHECK_RESULT(vkGetQueryPoolResults(logical_device.device, query_pool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+									VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+						uint64_t ticks = ((timestamps[1] & timestamp_mask) - (timestamps[0] & timestamp_mask)) & timestamp_mask;
+						engine.ms[strategy] = ticks * (double)logical_device.properties.limits.timestampPeriod / 1e6 / iterations;
+					} else {
+						engine.ms[strategy] = ms_cpu / (iterations + 1);
+					}
+				}
+
+				if (query_pool != VK_NULL_HANDLE)
+					vkDestroyQueryPool(logical_device.device, query_pool, ct::vulkan::get_allocator());
+			}
+
+			// Calibrates on a temporary offscreen image with the same format and usage as the real targets
+			inline void calibrate_offscreen(uint32_t iterations, VkImageUsageFlags color_usage, ct::vulkan::Framebuffer &framebuffer,
+					ct::vulkan::LogicalDevice &logical_device, Engine &engine) {
+				ct::vulkan::ColorAttachment color_attachment;
+				ct::vulkan::setup_color_attachment(engine.width, engine.height, engine.color_format, color_usage, logical_device.device,
+						logical_device.memory_properties, color_attachment);
+
+				VkImageView attachments[2] = { color_attachment.view, framebuffer.depth_stencil.view };
+				VkFramebufferCreateInfo frameBufferCreateInfo = {};
+				frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+				frameBufferCreateInfo.renderPass = engine.render_pass_clear;
+				frameBufferCreateInfo.attachmentCount = 2;
+				frameBufferCreateInfo.pAttachments = attachments;
+				frameBufferCreateInfo.width = engine.width;
+				frameBufferCreateInfo.height = engine.height;
+				frameBufferCreateInfo.layers = 1;
+
+				Target target;
+				target.width = engine.width;
+				target.height = engine.height;
+				target.color_image = color_attachment.image;
+				target.color_view = color_attachment.view;
+				target.depth_image = framebuffer.depth_stencil.image;
+				target.depth_view = framebuffer.depth_stencil.view;
+				target.depth_format = framebuffer.depth_stencil.depth_format;
+				VK_CHECK_RESULT(vkCreateFramebuffer(logical_device.device, &frameBufferCreateInfo, ct::vulkan::get_allocator(), &target.framebuffer));
+				ct::vulkan::capture::framebuffer(target.framebuffer, frameBufferCreateInfo);
+				prepare_target(logical_device.device, engine, target);
+
+				calibrate(iterations, logical_device, engine, target);
+
+				release_target(logical_device.device, engine, target);
+				vkDestroyFramebuffer(logical_device.device, target.framebuffer, ct::vulkan::get_allocator());
+				ct::vulkan::destroy_color_attachment(logical_device.device, color_attachment);
+			}
+
+			// Picks the strategy: CT_CLEAR_STRATEGY (name or index) overrides, otherwise the fastest calibrated one
+			inline void select(VkImageUsageFlags color_usage, ct::vulkan::Framebuffer &framebuffer, ct::vulkan::LogicalDevice &logical_device, Engine &engine) {
+				std::string override_name = ct::env::get_string("CT_CLEAR_STRATEGY", "");
+				Strategy strategy;
+				if (!override_name.empty()) {
+					if (parse_strategy(override_name, strategy) && engine.supported[strategy]) {
+						engine.strategy = strategy;
+						std::cout << "clear-strategy: " << strategy2string(engine.strategy) << " (override)" << std::endl;
+						return;
+					}
+					std::cout << "clear-strategy: ignoring unknown or unsupported override " << override_name << std::endl;
+				}
+
+				calibrate_offscreen(CLEAR_CALIBRATION_ITERATIONS, color_usage, framebuffer, logical_device, engine);
+
+				engine.strategy = RENDER_PASS;
+				for (int32_t i = 0; i < STRATEGY_COUNT; i++) {
+					if (!engine.supported[i]) {
+						std::cout << "clear-calibration: " << strategy2string((Strategy)i) << " unsupported" << std::endl;
+						continue;
+					}
+					std::cout << "clear-calibration: " << strategy2string((Strategy)i) << " ms: " << engine.ms[i] << std::endl;
+					if (engine.ms[i] < engine.ms[engine.strategy])
+						engine.strategy = (Strategy)i;
+				}
+				std::cout << "clear-strategy: " << strategy2string(engine.strategy) << std::endl;
+			}
+
+			// render_pass_clear belongs to the framebuffer, storage sets go with the descriptor pool
+			inline void destroy(VkDevice &device, Engine &engine) {
+				vkDestroyRenderPass(device, engine.render_pass_dont_care, ct::vulkan::get_allocator());
+				for (auto &passes : engine.layout_passes) {
+					vkDestroyRenderPass(device, passes.render_pass_clear, ct::vulkan::get_allocator());
+					vkDestroyRenderPass(device, passes.render_pass_dont_care, ct::vulkan::get_allocator());
+				}
+				engine.layout_passes.clear();
+				vkDestroyPipeline(device, engine.pipeline, ct::vulkan::get_allocator());
+				vkDestroyPipelineLayout(device, engine.pipeline_layout, ct::vulkan::get_allocator());
+				vkDestroyDescriptorPool(device, engine.descriptor_pool, ct::vulkan::get_allocator());
+				vkDestroyDescriptorSetLayout(device, engine.descriptor_set_layout, ct::vulkan::get_allocator());
+				engine.render_pass_dont_care = VK_NULL_HANDLE;
+				engine.pipeline = VK_NULL_HANDLE;
+				engine.pipeline_layout = VK_NULL_HANDLE;
+				engine.descriptor_pool = VK_NULL_HANDLE;
+				engine.descriptor_set_layout = VK_NULL_HANDLE;
+				ct::vulkan::destroy_buffer(device, engine.fill_buffer);
+			}
+
+		}
+	}
+}
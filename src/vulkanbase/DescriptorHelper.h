@@ -0,0 +1,432 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace descriptor {
+#define DESCRIPTOR_SETS_PER_POOL 64
+#define DESCRIPTOR_SETS_PER_POOL_MAX 4096
+#define DESCRIPTOR_BINDLESS_IMAGES 16384
+#define DESCRIPTOR_BINDLESS_BUFFERS 16384
+
+			// Descriptors of one type reserved per set when a pool is sized
+			struct PoolRatio {
+				VkDescriptorType type;
+				float ratio;
+			};
+
+			inline std::vector<PoolRatio> get_default_ratios() {
+				return {
+					{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+					{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+					{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f },
+					{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+					{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f }
+				};
+			}
+
+			// -> growable allocator
+			// Sets come from the current pool until it runs dry, then from the next one. Pools are never freed set by set,
+			// reset() hands all of them back in one call per pool. Every new pool is twice the size of the previous one.
+			struct Allocator {
+				VkDevice device = VK_NULL_HANDLE;
+				std::vector<PoolRatio> ratios;
+				uint32_t sets_per_pool = DESCRIPTOR_SETS_PER_POOL;
+
+				VkDescriptorPool current = VK_NULL_HANDLE;
+				std::vector<VkDescriptorPool> full;
+				std::vector<VkDescriptorPool> ready;
+
+				uint32_t n_pools = 0;
+				uint64_t n_sets = 0;
+			};
+
+			inline VkDescriptorPool create_pool(uint32_t max_sets, std::vector<PoolRatio> &ratios, VkDescriptorPoolCreateFlags flags, VkDevice &device) {
+				std::vector<VkDescriptorPoolSize> poolSizes;
+				poolSizes.reserve(ratios.size());
+				for (auto &ratio : ratios)
+					poolSizes.push_back({ ratio.type, std::max(1u, (uint32_t)(ratio.ratio * max_sets)) });
+
+				VkDescriptorPoolCreateInfo poolInfo = {};
+				poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+				poolInfo.flags = flags;
+				poolInfo.maxSets = max_sets;
+				poolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+				poolInfo.pPoolSizes = poolSizes.data();
+
+				VkDescriptorPool pool;
+				VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolInfo, ct::vulkan::get_allocator(), &pool));
+				return pool;
+			}
+
+			inline void setup_allocator(VkDevice &device, std::vector<PoolRatio> ratios, Allocator &allocator) {
+				allocator.device = device;
+				allocator.ratios = ratios;
+			}
+
+			inline VkDescriptorPool grab_pool(Allocator &allocator) {
+				if (!allocator.ready.empty()) {
+					VkDescriptorPool pool = allocator.ready.back();
+					allocator.ready.pop_back();
+					return pool;
+				}
+				VkDescriptorPool pool = create_pool(allocator.sets_per_pool, allocator.ratios, 0, allocator.device);
+				allocator.sets_per_pool = std::min(allocator.sets_per_pool * 2, (uint32_t)DESCRIPTOR_SETS_PER_POOL_MAX);
+				allocator.n_pools++;
+				return pool;
+			}
+
+			inline void allocate(VkDescriptorSetLayout layout, Allocator &allocator, VkDescriptorSet &set) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (allocator.current == VK_NULL_HANDLE)
+					allocator.current = grab_pool(allocator);
+
+				VkDescriptorSetAllocateInfo allocInfo = {};
+				allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+				allocInfo.descriptorPool = allocator.current;
+				allocInfo.descriptorSetCount = 1;
+				allocInfo.pSetLayouts = &layout;
+
+				VkResult res = dispatch.vkAllocateDescriptorSets(allocator.device, &allocInfo, &set);
+				if (res == VK_ERROR_OUT_OF_POOL_MEMORY || res == VK_ERROR_FRAGMENTED_POOL) {
+					// Current pool is exhausted, retire it and retry once on a fresh one
+					allocator.full.push_back(allocator.current);
+					allocator.current = grab_pool(allocator);
+					allocInfo.descriptorPool = allocator.current;
+					res = dispatch.vkAllocateDescriptorSets(allocator.device, &allocInfo, &set);
+				}
+				VK_CHECK_RESULT(res);
+				allocator.n_sets++;
+			}
+
+			// Invalidates every set handed out so far. Only once the GPU is done with them.
+			inline void reset(Allocator &allocator) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (allocator.current != VK_NULL_HANDLE)
+					allocator.full.push_back(allocator.current);
+				allocator.current = VK_NULL_HANDLE;
+				for (auto &pool : allocator.full) {
+					dispatch.vkResetDescriptorPool(allocator.device, pool, 0);
+					allocator.ready.push_back(pool);
+				}
+				allocator.full.clear();
+			}
+
+			inline void destroy_allocator(Allocator &allocator) {
+				reset(allocator);
+				for (auto &pool : allocator.ready)
+					vkDestroyDescriptorPool(allocator.device, pool, ct::vulkan::get_allocator());
+				allocator.ready.clear();
+			}
+			// <-
+
+			// -> per frame allocators
+			// One allocator per frame slot. A slot's sets are thrown away in bulk when the slot comes around again.
+			struct FrameAllocators {
+				std::vector<Allocator> frames;
+			};
+
+			inline void setup_frame_allocators(uint32_t n_slots, VkDevice &device, std::vector<PoolRatio> ratios, FrameAllocators &frame_allocators) {
+				frame_allocators.frames.resize(n_slots);
+				for (auto &allocator : frame_allocators.frames)
+					setup_allocator(device, ratios, allocator);
+			}
+
+			// Call after the slot's fence has signalled
+			inline Allocator& begin_frame(uint32_t slot, FrameAllocators &frame_allocators) {
+				Allocator &allocator = frame_allocators.frames[slot];
+				reset(allocator);
+				return allocator;
+			}
+
+			inline void destroy_frame_allocators(FrameAllocators &frame_allocators) {
+				for (auto &allocator : frame_allocators.frames)
+					destroy_allocator(allocator);
+				frame_allocators.frames.clear();
+			}
+			// <-
+
+			// -> layout cache
+			// Layouts are deduplicated by their bindings. Bindings are sorted by binding number first, so declaration order does not matter.
+			struct LayoutCache {
+				struct Entry {
+					std::vector<VkDescriptorSetLayoutBinding> bindings;
+					std::vector<VkDescriptorBindingFlagsEXT> binding_flags;
+					VkDescriptorSetLayoutCreateFlags flags;
+					VkDescriptorSetLayout layout;
+				};
+
+				VkDevice device = VK_NULL_HANDLE;
+				std::unordered_map<uint64_t, std::vector<Entry>> entries;
+				uint64_t n_hits = 0;
+				uint64_t n_misses = 0;
+			};
+
+			inline void hash_combine(uint64_t &hash, uint64_t value) {
+				// FNV-1a over the 8 bytes of value
+				for (int32_t i = 0; i < 8; i++) {
+					hash ^= (value >> (8 * i)) & 0xff;
+					hash *= 1099511628211ULL;
+				}
+			}
+
+			inline uint64_t hash_bindings(std::vector<VkDescriptorSetLayoutBinding> &bindings, std::vector<VkDescriptorBindingFlagsEXT> &binding_flags,
+					VkDescriptorSetLayoutCreateFlags flags) {
+				uint64_t hash = 14695981039346656037ULL;
+				hash_combine(hash, flags);
+				for (std::size_t i = 0; i < bindings.size(); i++) {
+					hash_combine(hash, bindings[i].binding);
+					hash_combine(hash, bindings[i].descriptorType);
+					hash_combine(hash, bindings[i].descriptorCount);
+					hash_combine(hash, bindings[i].stageFlags);
+					hash_combine(hash, i < binding_flags.size() ? binding_flags[i] : 0);
+				}
+				return hash;
+			}
+
+			inline bool is_same_layout(LayoutCache::Entry &entry, std::vector<VkDescriptorSetLayoutBinding> &bindings, std::vector<VkDescriptorBindingFlagsEXT> &binding_flags,
+					VkDescriptorSetLayoutCreateFlags flags) {
+				if (entry.flags != flags || entry.bindings.size() != bindings.size() || entry.binding_flags != binding_flags)
+					return false;
+				for (std::size_t i = 0; i < bindings.size(); i++) {
+					VkDescriptorSetLayoutBinding &a = entry.bindings[i];
+					VkDescriptorSetLayoutBinding &b = bindings[i];
+					if (a.binding != b.binding || a.descriptorType != b.descriptorType || a.descriptorCount != b.descriptorCount
+							|| a.stageFlags != b.stageFlags || a.pImmutableSamplers != b.pImmutableSamplers)
+						return false;
+				}
+				return true;
+			}
+
+			inline void setup_layout_cache(VkDevice &device, LayoutCache &cache) {
+				cache.device = device;
+			}
+
+			// binding_flags is either empty or has one entry per binding (VK_EXT_descriptor_indexing)
+			inline VkDescriptorSetLayout get_layout(std::vector<VkDescriptorSetLayoutBinding> bindings, LayoutCache &cache,
+					std::vector<VkDescriptorBindingFlagsEXT> binding_flags = {}, VkDescriptorSetLayoutCreateFlags flags = 0) {
+				assert(binding_flags.empty() || binding_flags.size() == bindings.size());
+				// -> canonical order
+				std::vector<uint32_t> order(bindings.size());
+				for (uint32_t i = 0; i < order.size(); i++)
+					order[i] = i;
+				std::sort(order.begin(), order.end(), [&bindings](uint32_t a, uint32_t b) { return bindings[a].binding < bindings[b].binding; });
+				std::vector<VkDescriptorSetLayoutBinding> sorted_bindings(bindings.size());
+				std::vector<VkDescriptorBindingFlagsEXT> sorted_flags(binding_flags.size());
+				for (uint32_t i = 0; i < order.size(); i++) {
+					sorted_bindings[i] = bindings[order[i]];
+					if (!binding_flags.empty())
+						sorted_flags[i] = binding_flags[order[i]];
+				}
+				// <-
+
+				uint64_t hash = hash_bindings(sorted_bindings, sorted_flags, flags);
+				std::vector<LayoutCache::Entry> &bucket = cache.entries[hash];
+				for (auto &entry : bucket) {
+					if (is_same_layout(entry, sorted_bindings, sorted_flags, flags)) {
+						cache.n_hits++;
+						return entry.layout;
+					}
+				}
+
+				VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+				bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+				bindingFlagsInfo.bindingCount = (uint32_t)sorted_flags.size();
+				bindingFlagsInfo.pBindingFlags = sorted_flags.data();
+
+				VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+				layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+				layoutInfo.pNext = sorted_flags.empty() ? nullptr : &bindingFlagsInfo;
+				layoutInfo.flags = flags;
+				layoutInfo.bindingCount = (uint32_t)sorted_bindings.size();
+				layoutInfo.pBindings = sorted_bindings.data();
+
+				LayoutCache::Entry entry;
+				VK_CHECK_RESULT(vkCreateDescriptorSetLayout(cache.device, &layoutInfo, ct::vulkan::get_allocator(), &entry.layout));
+				ct::vulkan::capture::set_layout(entry.layout, layoutInfo);
+				entry.bindings = sorted_bindings;
+				entry.binding_flags = sorted_flags;
+				entry.flags = flags;
+				bucket.push_back(entry);
+				cache.n_misses++;
+				return entry.layout;
+			}
+
+			inline void destroy_layout_cache(LayoutCache &cache) {
+				for (auto &bucket : cache.entries)
+					for (auto &entry : bucket.second)
+						vkDestroyDescriptorSetLayout(cache.device, entry.layout, ct::vulkan::get_allocator());
+				cache.entries.clear();
+			}
+			// <-
+
+			// -> bindless
+			// One big update-after-bind set: binding 0 holds combined image samplers, binding 1 storage buffers.
+			// Resources are addressed by index in the shader, so thousands of them bind with a single vkCmdBindDescriptorSets per frame.
+			struct Bindless {
+				bool active = false;
+				VkPhysicalDeviceDescriptorIndexingFeaturesEXT features = {};
+
+				VkDevice device = VK_NULL_HANDLE;
+				VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+				VkDescriptorPool pool = VK_NULL_HANDLE;
+				VkDescriptorSet set = VK_NULL_HANDLE;
+
+				uint32_t n_images = 0;
+				uint32_t n_buffers = 0;
+				uint32_t next_image = 0;
+				uint32_t next_buffer = 0;
+				std::vector<uint32_t> free_images;
+				std::vector<uint32_t> free_buffers;
+			};
+
+			// Checks VK_EXT_descriptor_indexing and, if usable, chains its features into device creation. Call between pick_gpu and create_device.
+			inline bool request_bindless(LogicalDevice &logical_device, Bindless &bindless) {
+				if (!ct::vulkan::is_device_extension_supported(logical_device, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+					return false;
+
+				VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported = {};
+				supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+				VkPhysicalDeviceFeatures2 features2 = {};
+				features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+				features2.pNext = &supported;
+				vkGetPhysicalDeviceFeatures2(logical_device.physical_device, &features2);
+				if (!supported.runtimeDescriptorArray || !supported.descriptorBindingPartiallyBound || !supported.descriptorBindingUpdateUnusedWhilePending
+						|| !supported.descriptorBindingSampledImageUpdateAfterBind || !supported.descriptorBindingStorageBufferUpdateAfterBind
+						|| !supported.shaderSampledImageArrayNonUniformIndexing)
+					return false;
+
+				bindless.features = {};
+				bindless.features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+				bindless.features.pNext = logical_device.features_next;
+				bindless.features.runtimeDescriptorArray = VK_TRUE;
+				bindless.features.descriptorBindingPartiallyBound = VK_TRUE;
+				bindless.features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+				bindless.features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+				bindless.features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+				bindless.features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+				bindless.features.shaderStorageBufferArrayNonUniformIndexing = supported.shaderStorageBufferArrayNonUniformIndexing;
+				logical_device.features_next = &bindless.features;
+				logical_device.extensions_enabled.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+				return true;
+			}
+
+			// Array sizes are clamped to the device's update-after-bind limits
+			inline void setup_bindless(uint32_t n_images, uint32_t n_buffers, LogicalDevice &logical_device, LayoutCache &cache, Bindless &bindless) {
+				VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits = {};
+				limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+				VkPhysicalDeviceProperties2 properties2 = {};
+				properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+				properties2.pNext = &limits;
+				vkGetPhysicalDeviceProperties2(logical_device.physical_device, &properties2);
+				n_images = std::min({ n_images, limits.maxDescriptorSetUpdateAfterBindSampledImages, limits.maxDescriptorSetUpdateAfterBindSamplers,
+						limits.maxPerStageDescriptorUpdateAfterBindSampledImages, limits.maxPerStageDescriptorUpdateAfterBindSamplers });
+				n_buffers = std::min({ n_buffers, limits.maxDescriptorSetUpdateAfterBindStorageBuffers, limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+
+				bindless.device = logical_device.device;
+				bindless.n_images = n_images;
+				bindless.n_buffers = n_buffers;
+
+				VkDescriptorBindingFlagsEXT binding_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT
+					| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+				std::vector<VkDescriptorSetLayoutBinding> bindings = {
+					{ 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, n_images, VK_SHADER_STAGE_ALL, nullptr },
+					{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, n_buffers, VK_SHADER_STAGE_ALL, nullptr }
+				};
+				bindless.layout = get_layout(bindings, cache, { binding_flags, binding_flags }, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT);
+
+				VkDescriptorPoolSize poolSizes[2] = {
+					{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, n_images },
+					{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, n_buffers }
+				};
+				VkDescriptorPoolCreateInfo poolInfo = {};
+				poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+				poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+				poolInfo.maxSets = 1;
+				poolInfo.poolSizeCount = 2;
+				poolInfo.pPoolSizes = poolSizes;
+				VK_CHECK_RESULT(vkCreateDescriptorPool(logical_device.device, &poolInfo, ct::vulkan::get_allocator(), &bindless.pool));
+
+				VkDescriptorSetAllocateInfo allocInfo = {};
+				allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+				allocInfo.descriptorPool = bindless.pool;
+				allocInfo.descriptorSetCount = 1;
+				allocInfo.pSetLayouts = &bindless.layout;
+				VK_CHECK_RESULT(ct::vulkan::dispatch::get_device().vkAllocateDescriptorSets(logical_device.device, &allocInfo, &bindless.set));
+
+				bindless.active = true;
+				std::cout << "bindless: " << n_images << " images " << n_buffers << " buffers" << std::endl;
+			}
+
+			inline uint32_t take_index(uint32_t capacity, uint32_t &next, std::vector<uint32_t> &free_list) {
+				if (!free_list.empty()) {
+					uint32_t index = free_list.back();
+					free_list.pop_back();
+					return index;
+				}
+				if (next == capacity)
+					ct::error::exit("Bindless descriptor array is full.", 1);
+				return next++;
+			}
+
+			// Returns the array index the shader uses to address the image
+			inline uint32_t add_image(VkImageView view, VkSampler sampler, VkImageLayout layout, Bindless &bindless) {
+				uint32_t index = take_index(bindless.n_images, bindless.next_image, bindless.free_images);
+				VkDescriptorImageInfo imageInfo = { sampler, view, layout };
+				VkWriteDescriptorSet write = {};
+				write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				write.dstSet = bindless.set;
+				write.dstBinding = 0;
+				write.dstArrayElement = index;
+				write.descriptorCount = 1;
+				write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				write.pImageInfo = &imageInfo;
+				ct::vulkan::dispatch::get_device().vkUpdateDescriptorSets(bindless.device, 1, &write, 0, nullptr);
+				return index;
+			}
+
+			inline uint32_t add_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range, Bindless &bindless) {
+				uint32_t index = take_index(bindless.n_buffers, bindless.next_buffer, bindless.free_buffers);
+				VkDescriptorBufferInfo bufferInfo = { buffer, offset, range };
+				VkWriteDescriptorSet write = {};
+				write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				write.dstSet = bindless.set;
+				write.dstBinding = 1;
+				write.dstArrayElement = index;
+				write.descriptorCount = 1;
+				write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				write.pBufferInfo = &bufferInfo;
+				ct::vulkan::dispatch::get_device().vkUpdateDescriptorSets(bindless.device, 1, &write, 0, nullptr);
+				return index;
+			}
+
+			// Frees an index for reuse. Frames in flight may still read it, so release through the deletion queue.
+			inline void release_image(uint32_t index, Bindless &bindless) {
+				bindless.free_images.push_back(index);
+			}
+
+			inline void release_buffer(uint32_t index, Bindless &bindless) {
+				bindless.free_buffers.push_back(index);
+			}
+
+			// The layout belongs to the layout cache
+			inline void destroy_bindless(Bindless &bindless) {
+				if (bindless.pool != VK_NULL_HANDLE)
+					vkDestroyDescriptorPool(bindless.device, bindless.pool, ct::vulkan::get_allocator());
+				bindless.pool = VK_NULL_HANDLE;
+				bindless.set = VK_NULL_HANDLE;
+				bindless.active = false;
+			}
+			// <-
+
+		}
+	}
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+
+#include <vulkan/vulkan.h>
+
+// -> every function the tables hold, X(name) for core functions, X(name, extension) for extension ones
+#define CT_VK_INSTANCE_FUNCTIONS(X) \
+	X(vkDestroyInstance) \
+	X(vkEnumeratePhysicalDevices) \
+	X(vkGetPhysicalDeviceProperties) \
+	X(vkGetPhysicalDeviceFeatures) \
+	X(vkGetPhysicalDeviceMemoryProperties) \
+	X(vkGetPhysicalDeviceFormatProperties) \
+	X(vkGetPhysicalDeviceQueueFamilyProperties) \
+	X(vkEnumerateDeviceExtensionProperties) \
+	X(vkCreateDevice) \
+	X(vkGetDeviceProcAddr)
+
+#define CT_VK_INSTANCE_EXTENSION_FUNCTIONS(X) \
+	X(vkGetPhysicalDeviceSurfaceSupportKHR, VK_KHR_SURFACE_EXTENSION_NAME) \
+	X(vkGetPhysicalDeviceSurfaceCapabilitiesKHR, VK_KHR_SURFACE_EXTENSION_NAME) \
+	X(vkGetPhysicalDeviceSurfaceFormatsKHR, VK_KHR_SURFACE_EXTENSION_NAME) \
+	X(vkGetPhysicalDeviceSurfacePresentModesKHR, VK_KHR_SURFACE_EXTENSION_NAME) \
+	X(vkCmdBeginDebugUtilsLabelEXT, VK_EXT_DEBUG_UTILS_EXTENSION_NAME) \
+	X(vkCmdEndDebugUtilsLabelEXT, VK_EXT_DEBUG_UTILS_EXTENSION_NAME)
+
+#define CT_VK_DEVICE_FUNCTIONS(X) \
+	X(vkDestroyDevice) \
+	X(vkGetDeviceQueue) \
+	X(vkQueueSubmit) \
+	X(vkQueueWaitIdle) \
+	X(vkDeviceWaitIdle) \
+	X(vkAllocateMemory) \
+	X(vkFreeMemory) \
+	X(vkMapMemory) \
+	X(vkUnmapMemory) \
+	X(vkFlushMappedMemoryRanges) \
+	X(vkInvalidateMappedMemoryRanges) \
+	X(vkBindBufferMemory) \
+	X(vkBindImageMemory) \
+	X(vkGetBufferMemoryRequirements) \
+	X(vkGetImageMemoryRequirements) \
+	X(vkCreateFence) \
+	X(vkDestroyFence) \
+	X(vkResetFences) \
+	X(vkGetFenceStatus) \
+	X(vkWaitForFences) \
+	X(vkCreateSemaphore) \
+	X(vkDestroySemaphore) \
+	X(vkCreateEvent) \
+	X(vkDestroyEvent) \
+	X(vkGetEventStatus) \
+	X(vkSetEvent) \
+	X(vkResetEvent) \
+	X(vkCreateQueryPool) \
+	X(vkDestroyQueryPool) \
+	X(vkGetQueryPoolResults) \
+	X(vkCreateBuffer) \
+	X(vkDestroyBuffer) \
+	X(vkCreateBufferView) \
+	X(vkDestroyBufferView) \
+	X(vkCreateImage) \
+	X(vkDestroyImage) \
+	X(vkGetImageSubresourceLayout) \
+	X(vkCreateImageView) \
+	X(vkDestroyImageView) \
+	X(vkCreateShaderModule) \
+	X(vkDestroyShaderModule) \
+	X(vkCreatePipelineCache) \
+	X(vkDestroyPipelineCache) \
+	X(vkGetPipelineCacheData) \
+	X(vkMergePipelineCaches) \
+	X(vkCreateGraphicsPipelines) \
+	X(vkCreateComputePipelines) \
+	X(vkDestroyPipeline) \
+	X(vkCreatePipelineLayout) \
+	X(vkDestroyPipelineLayout) \
+	X(vkCreateSampler) \
+	X(vkDestroySampler) \
+	X(vkCreateDescriptorSetLayout) \
+	X(vkDestroyDescriptorSetLayout) \
+	X(vkCreateDescriptorPool) \
+	X(vkDestroyDescriptorPool) \
+	X(vkResetDescriptorPool) \
+	X(vkAllocateDescriptorSets) \
+	X(vkFreeDescriptorSets) \
+	X(vkUpdateDescriptorSets) \
+	X(vkCreateFramebuffer) \
+	X(vkDestroyFramebuffer) \
+	X(vkCreateRenderPass) \
+	X(vkDestroyRenderPass) \
+	X(vkGetRenderAreaGranularity) \
+	X(vkCreateCommandPool) \
+	X(vkDestroyCommandPool) \
+	X(vkResetCommandPool) \
+	X(vkAllocateCommandBuffers) \
+	X(vkFreeCommandBuffers) \
+	X(vkBeginCommandBuffer) \
+	X(vkEndCommandBuffer) \
+	X(vkResetCommandBuffer) \
+	X(vkCmdBindPipeline) \
+	X(vkCmdSetViewport) \
+	X(vkCmdSetScissor) \
+	X(vkCmdSetLineWidth) \
+	X(vkCmdSetDepthBias) \
+	X(vkCmdSetBlendConstants) \
+	X(vkCmdSetDepthBounds) \
+	X(vkCmdSetStencilCompareMask) \
+	X(vkCmdSetStencilWriteMask) \
+	X(vkCmdSetStencilReference) \
+	X(vkCmdBindDescriptorSets) \
+	X(vkCmdBindIndexBuffer) \
+	X(vkCmdBindVertexBuffers) \
+	X(vkCmdDraw) \
+	X(vkCmdDrawIndexed) \
+	X(vkCmdDrawIndirect) \
+	X(vkCmdDrawIndexedIndirect) \
+	X(vkCmdDispatch) \
+	X(vkCmdDispatchIndirect) \
+	X(vkCmdCopyBuffer) \
+	X(vkCmdCopyImage) \
+	X(vkCmdBlitImage) \
+	X(vkCmdCopyBufferToImage) \
+	X(vkCmdCopyImageToBuffer) \
+	X(vkCmdUpdateBuffer) \
+	X(vkCmdFillBuffer) \
+	X(vkCmdClearColorImage) \
+	X(vkCmdClearDepthStencilImage) \
+	X(vkCmdClearAttachments) \
+	X(vkCmdResolveImage) \
+	X(vkCmdSetEvent) \
+	X(vkCmdResetEvent) \
+	X(vkCmdWaitEvents) \
+	X(vkCmdPipelineBarrier) \
+	X(vkCmdBeginQuery) \
+	X(vkCmdEndQuery) \
+	X(vkCmdResetQueryPool) \
+	X(vkCmdWriteTimestamp) \
+	X(vkCmdCopyQueryPoolResults) \
+	X(vkCmdPushConstants) \
+	X(vkCmdBeginRenderPass) \
+	X(vkCmdNextSubpass) \
+	X(vkCmdEndRenderPass) \
+	X(vkCmdExecuteCommands)
+
+#define CT_VK_DEVICE_EXTENSION_FUNCTIONS(X) \
+	X(vkCreateSwapchainKHR, VK_KHR_SWAPCHAIN_EXTENSION_NAME) \
+	X(vkDestroySwapchainKHR, VK_KHR_SWAPCHAIN_EXTENSION_NAME) \
+	X(vkGetSwapchainImagesKHR, VK_KHR_SWAPCHAIN_EXTENSION_NAME) \
+	X(vkAcquireNextImageKHR, VK_KHR_SWAPCHAIN_EXTENSION_NAME) \
+	X(vkQueuePresentKHR, VK_KHR_SWAPCHAIN_EXTENSION_NAME) \
+	X(vkCmdBeginRenderingKHR, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) \
+	X(vkCmdEndRenderingKHR, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) \
+	X(vkCmdDrawIndexedIndirectCountKHR, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)
+// <-
+
+namespace ct {
+	namespace vulkan {
+		namespace dispatch {
+
+#define CT_VK_MEMBER(name, ...) PFN_##name name = nullptr;
+			struct InstanceTable {
+				VkInstance instance = VK_NULL_HANDLE;
+				CT_VK_INSTANCE_FUNCTIONS(CT_VK_MEMBER)
+				CT_VK_INSTANCE_EXTENSION_FUNCTIONS(CT_VK_MEMBER)
+			};
+#undef CT_VK_MEMBER
+
+			// Entry points straight into the driver, vkGetDeviceProcAddr skips the loader trampoline that looks the device's dispatch table up on
+			// every call. Core functions start out at the loader's exports, so code running before connect_device (or on another device) still works.
+#define CT_VK_CORE_MEMBER(name) PFN_##name name = ::name;
+#define CT_VK_EXTENSION_MEMBER(name, extension) PFN_##name name = nullptr;
+			struct DeviceTable {
+				VkDevice device = VK_NULL_HANDLE;
+				CT_VK_DEVICE_FUNCTIONS(CT_VK_CORE_MEMBER)
+				CT_VK_DEVICE_EXTENSION_FUNCTIONS(CT_VK_EXTENSION_MEMBER)
+			};
+#undef CT_VK_CORE_MEMBER
+#undef CT_VK_EXTENSION_MEMBER
+
+			// Header only without C++17 inline variables: a static member of a class template is defined once across translation units
+			template <typename T = void>
+			struct Tables {
+				static InstanceTable instance;
+				static DeviceTable device;
+			};
+			template <typename T> InstanceTable Tables<T>::instance;
+			template <typename T> DeviceTable Tables<T>::device;
+
+			inline const InstanceTable& get_instance() {
+				return Tables<>::instance;
+			}
+
+			// The table of the device the frame loop records and submits for. Take a reference once per function, not per call.
+			inline const DeviceTable& get_device() {
+				return Tables<>::device;
+			}
+
+			inline bool has_extension(const std::vector<const char*> &extensions, const char *name) {
+				for (const char *extension : extensions) {
+					if (std::strcmp(extension, name) == 0)
+						return true;
+				}
+				return false;
+			}
+
+			// Missing core functions are a broken driver, missing functions of an enabled extension only leave their pointer null
+			inline void connect_instance(VkInstance instance, const std::vector<const char*> &extensions) {
+				InstanceTable &table = Tables<>::instance;
+				table.instance = instance;
+				uint32_t n_missing = 0;
+#define CT_VK_LOAD(name) \
+				table.name = reinterpret_cast<PFN_##name>(vkGetInstanceProcAddr(instance, #name)); \
+				n_missing += table.name == nullptr;
+#define CT_VK_LOAD_EXTENSION(name, extension) \
+				table.name = has_extension(extensions, extension) ? reinterpret_cast<PFN_##name>(vkGetInstanceProcAddr(instance, #name)) : nullptr;
+				CT_VK_INSTANCE_FUNCTIONS(CT_VK_LOAD)
+				CT_VK_INSTANCE_EXTENSION_FUNCTIONS(CT_VK_LOAD_EXTENSION)
+#undef CT_VK_LOAD
+#undef CT_VK_LOAD_EXTENSION
+				if (n_missing > 0)
+					std::cout << "dispatch: " << n_missing << " core instance functions missing" << std::endl;
+			}
+
+			// Call once right after create_device with the extensions it enabled
+			inline void connect_device(VkDevice device, const std::vector<const char*> &extensions) {
+				DeviceTable &table = Tables<>::device;
+				table.device = device;
+				uint32_t n_loaded = 0;
+				uint32_t n_missing = 0;
+#define CT_VK_LOAD(name) \
+				{ \
+					PFN_##name fp = reinterpret_cast<PFN_##name>(vkGetDeviceProcAddr(device, #name)); \
+					if (fp != nullptr) { \
+						table.name = fp; \
+						n_loaded++; \
+					} else { \
+						n_missing++; \
+					} \
+				}
+#define CT_VK_LOAD_EXTENSION(name, extension) \
+				table.name = has_extension(extensions, extension) ? reinterpret_cast<PFN_##name>(vkGetDeviceProcAddr(device, #name)) : nullptr; \
+				n_loaded += table.name != nullptr;
+				CT_VK_DEVICE_FUNCTIONS(CT_VK_LOAD)
+				CT_VK_DEVICE_EXTENSION_FUNCTIONS(CT_VK_LOAD_EXTENSION)
+#undef CT_VK_LOAD
+#undef CT_VK_LOAD_EXTENSION
+				std::cout << "dispatch: device functions: " << n_loaded;
+				if (n_missing > 0)
+					std::cout << " (" << n_missing << " core missing, left on the loader)";
+				std::cout << std::endl;
+			}
+
+		}
+	}
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "utils/ErrorHelper.h"
+#include "utils/EnvHelper.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace rendering {
+
+			enum Backend {
+				RENDER_PASS = 0,		// VkRenderPass plus one VkFramebuffer per target
+				DYNAMIC_RENDERING,		// vkCmdBeginRenderingKHR on the image views, layouts handled with explicit barriers
+				BACKEND_COUNT
+			};
+
+			inline std::string backend2string(Backend backend) {
+				switch (backend) {
+#define STR(r) case r: return #r
+					STR(RENDER_PASS);
+					STR(DYNAMIC_RENDERING);
+#undef STR
+					default: return "UNKNOWN_RENDERING_BACKEND";
+				}
+			}
+
+			// What a pass draws into. The framebuffer is only used by the render pass backend, the views only by dynamic rendering.
+			struct Target {
+				uint32_t width;
+				uint32_t height;
+				VkImage color_image;
+				VkImageView color_view;
+				VkImage depth_image;
+				VkImageView depth_view;
+				VkFormat depth_format;
+				VkFramebuffer framebuffer = VK_NULL_HANDLE;
+				VkImageLayout final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+			};
+
+			struct Rendering {
+				bool supported = false;
+				Backend backend = RENDER_PASS;
+				VkPhysicalDeviceDynamicRenderingFeaturesKHR features;
+			};
+
+			// Call between pick_gpu and create_device. VK_KHR_dynamic_rendering (core in 1.3) needs depth_stencil_resolve and create_renderpass2 on a 1.1 device.
+			inline bool request(ct::vulkan::LogicalDevice &logical_device, Rendering &rendering) {
+				const char *extensions[3] = { VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME, VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME };
+				for (auto extension : extensions)
+					if (!ct::vulkan::is_device_extension_supported(logical_device, extension))
+						return false;
+
+				VkPhysicalDeviceDynamicRenderingFeaturesKHR supported = {};
+				supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+				VkPhysicalDeviceFeatures2 features2 = {};
+				features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+				features2.pNext = &supported;
+				vkGetPhysicalDeviceFeatures2(logical_device.physical_device, &features2);
+				if (!supported.dynamicRendering)
+					return false;
+
+				rendering.features = {};
+				rendering.features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+				rendering.features.pNext = logical_device.features_next;
+				rendering.features.dynamicRendering = VK_TRUE;
+				logical_device.features_next = &rendering.features;
+				for (auto extension : extensions)
+					logical_device.extensions_enabled.push_back(extension);
+				rendering.supported = true;
+				return true;
+			}
+
+			// Call after dispatch::connect_device, which loads the entry points. Picks the backend: CT_RENDERING_BACKEND (name or index) if supported,
+			// the render pass path otherwise.
+			inline void connect(Rendering &rendering) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				rendering.supported = rendering.supported && dispatch.vkCmdBeginRenderingKHR != nullptr && dispatch.vkCmdEndRenderingKHR != nullptr;
+
+				rendering.backend = RENDER_PASS;
+				std::string name = ct::env::get_string("CT_RENDERING_BACKEND", "");
+				if (name == backend2string(DYNAMIC_RENDERING) || name == std::to_string(DYNAMIC_RENDERING)) {
+					if (rendering.supported)
+						rendering.backend = DYNAMIC_RENDERING;
+					else
+						std::cout << "rendering-backend: " << name << " not supported by this device" << std::endl;
+				}
+				std::cout << "rendering-backend: " << backend2string(rendering.backend) << std::endl;
+			}
+
+			inline bool is_dynamic(Rendering *rendering) {
+				return rendering != nullptr && rendering->backend == DYNAMIC_RENDERING;
+			}
+
+			inline void image_barrier(VkCommandBuffer command_buffer, VkImage image, VkImageAspectFlags aspect, VkImageLayout old_layout, VkImageLayout new_layout,
+					VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.srcAccessMask = src_access;
+				barrier.dstAccessMask = dst_access;
+				barrier.oldLayout = old_layout;
+				barrier.newLayout = new_layout;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.image = image;
+				barrier.subresourceRange = { aspect, 0, 1, 0, 1 };
+				dispatch.vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			}
+
+			// Starts rendering into target. With LOAD colour is expected in target.final_layout and depth in DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			// which is what every clear leaves behind, otherwise previous contents are discarded and clear_values (colour, depth) are used.
+			// The barriers do what the subpass dependencies of setup_render_pass do for the render pass backend.
+			inline void begin(VkCommandBuffer command_buffer, Target &target, VkAttachmentLoadOp load_op, const VkClearValue *clear_values, Rendering &rendering) {
+				bool is_load = load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
+				VkImageAspectFlags depth_aspect = ct::vulkan::get_depth_aspect(target.depth_format);
+				VkPipelineStageFlags depth_stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+				VkAccessFlags depth_access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+				VkAccessFlags color_access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+				if (is_load) {
+					// Whatever wrote the attachments before (a clear by transfer, compute or an earlier pass) has to be done and visible
+					VkPipelineStageFlags writers = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+					VkAccessFlags writes = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+					image_barrier(command_buffer, target.color_image, VK_IMAGE_ASPECT_COLOR_BIT, target.final_layout, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+							writes, color_access, writers, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+					image_barrier(command_buffer, target.depth_image, depth_aspect, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+							VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, depth_access, depth_stages | VK_PIPELINE_STAGE_TRANSFER_BIT, depth_stages);
+				} else {
+					// Chains with the acquire semaphore wait on COLOR_ATTACHMENT_OUTPUT
+					image_barrier(command_buffer, target.color_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+							0, color_access, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+					image_barrier(command_buffer, target.depth_image, depth_aspect, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+							VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, depth_access, depth_stages, depth_stages);
+				}
+
+				VkRenderingAttachmentInfoKHR colorAttachment = {};
+				colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+				colorAttachment.imageView = target.color_view;
+				colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+				colorAttachment.loadOp = load_op;
+				colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+				if (clear_values != nullptr)
+					colorAttachment.clearValue = clear_values[0];
+
+				VkRenderingAttachmentInfoKHR depthAttachment = {};
+				depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+				depthAttachment.imageView = target.depth_view;
+				depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+				depthAttachment.loadOp = load_op;
+				depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+				if (clear_values != nullptr)
+					depthAttachment.clearValue = clear_values[1];
+
+				VkRenderingInfoKHR renderingInfo = {};
+				renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+				renderingInfo.renderArea.offset = { 0, 0 };
+				renderingInfo.renderArea.extent = { target.width, target.height };
+				renderingInfo.layerCount = 1;
+				renderingInfo.colorAttachmentCount = 1;
+				renderingInfo.pColorAttachments = &colorAttachment;
+				renderingInfo.pDepthAttachment = &depthAttachment;
+				// Combined depth stencil formats are bound as both, matching the pipelines' stencil format
+				if (depth_aspect & VK_IMAGE_ASPECT_STENCIL_BIT)
+					renderingInfo.pStencilAttachment = &depthAttachment;
+				ct::vulkan::dispatch::get_device().vkCmdBeginRenderingKHR(command_buffer, &renderingInfo);
+			}
+
+			// Ends rendering and hands colour over in target.final_layout, depth stays in DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+			inline void end(VkCommandBuffer command_buffer, Target &target, Rendering &rendering) {
+				ct::vulkan::dispatch::get_device().vkCmdEndRenderingKHR(command_buffer);
+				image_barrier(command_buffer, target.color_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, target.final_layout,
+						VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+			}
+
+			// Chained into VkGraphicsPipelineCreateInfo::pNext in place of a render pass, color_format has to outlive pipeline creation
+			inline VkPipelineRenderingCreateInfoKHR get_pipeline_info(const VkFormat &color_format, VkFormat depth_format) {
+				VkPipelineRenderingCreateInfoKHR pipelineRenderingInfo = {};
+				pipelineRenderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+				pipelineRenderingInfo.colorAttachmentCount = 1;
+				pipelineRenderingInfo.pColorAttachmentFormats = &color_format;
+				pipelineRenderingInfo.depthAttachmentFormat = depth_format;
+				pipelineRenderingInfo.stencilAttachmentFormat = ct::vulkan::get_depth_aspect(depth_format) & VK_IMAGE_ASPECT_STENCIL_BIT ? depth_format : VK_FORMAT_UNDEFINED;
+				return pipelineRenderingInfo;
+			}
+
+		}
+	}
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/TransientPool.h"
+#include "utils/ErrorHelper.h"
+#include "utils/EnvHelper.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace resolution {
+#define RESOLUTION_SCALE_STEP 0.03125f
+#define RESOLUTION_MAX_CHANGE 0.1f
+#define RESOLUTION_SMOOTHING 0.1
+
+			// Everything is read from CT_DYNRES_* environment variables, CT_DYNRES=1 enables it
+			struct Controller {
+				float budget_ms = 16.6f;		// CT_DYNRES_BUDGET_MS, GPU time per frame to hold
+				float min_scale = 0.5f;			// CT_DYNRES_MIN_SCALE, per axis
+				float max_scale = 1.0f;			// CT_DYNRES_MAX_SCALE, per axis, at most 1 (the preallocated size)
+				float headroom = 0.9f;			// aim below the budget so spikes do not immediately miss it
+				float scale = 1.0f;
+				double smoothed_ms = 0.0;
+			};
+
+			// The frame renders into an internal target of at most max_width x max_height, of which only scale * (max_width x max_height) is used.
+			// end_frame scales that region up to the swapchain image with a linear blit. Nothing is reallocated when the scale changes,
+			// only the command buffer of the slot has to be recorded again with the new extent.
+			struct Resolution {
+				bool active = false;
+				VkDevice device = VK_NULL_HANDLE;
+				uint32_t max_width = 0;
+				uint32_t max_height = 0;
+
+				// -> internal target, colour in swapchain format, ends every pass in TRANSFER_SRC_OPTIMAL for the blit
+				ct::vulkan::ColorAttachment color;
+				ct::vulkan::Framebuffer framebuffer;
+				// <-
+
+				// -> GPU time of every slot's command buffer, read back when the slot comes around again
+				VkQueryPool query_pool = VK_NULL_HANDLE;
+				double timestamp_period = 1.0;
+				uint64_t timestamp_mask = ~0ULL;
+				std::vector<bool> written;
+				// <-
+
+				// -> internal target in the transient pool if declared there, allocated by setup otherwise
+				ct::vulkan::transient::Pool *pool = nullptr;
+				uint32_t transient_color = TRANSIENT_NONE;
+				uint32_t transient_depth = TRANSIENT_NONE;
+				// <-
+
+				Controller controller;
+				// Scale each slot's command buffer was last recorded with
+				std::vector<float> slot_scale;
+				uint32_t n_changes = 0;
+			};
+
+			inline void read_controller(Controller &controller) {
+				controller.budget_ms = (float)std::max(0.1, ct::env::get_double("CT_DYNRES_BUDGET_MS", controller.budget_ms));
+				controller.max_scale = (float)std::min(1.0, std::max(0.1, ct::env::get_double("CT_DYNRES_MAX_SCALE", controller.max_scale)));
+				controller.min_scale = (float)std::min((double)controller.max_scale, std::max(0.1, ct::env::get_double("CT_DYNRES_MIN_SCALE", controller.min_scale)));
+				controller.scale = controller.max_scale;
+			}
+
+			// Blitting with a linear filter needs these on the internal (source) and swapchain (destination) format
+			inline bool is_supported(VkFormat color_format, VkImageUsageFlags swapchain_usage, ct::vulkan::LogicalDevice &logical_device) {
+				VkFormatProperties formatProps;
+				vkGetPhysicalDeviceFormatProperties(logical_device.physical_device, color_format, &formatProps);
+				VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+				return (formatProps.optimalTilingFeatures & needed) == needed && (swapchain_usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0;
+			}
+
+			inline VkImageUsageFlags get_color_usage(VkImageUsageFlags swapchain_usage) {
+				return swapchain_usage | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			}
+
+			// Puts the internal target in the transient pool instead of memory of its own: colour lives from render_pass to upscale_pass, depth in render_pass only.
+			// Call before the pool is built, setup takes the images from it.
+			inline void declare(uint32_t max_width, uint32_t max_height, VkFormat color_format, VkImageUsageFlags swapchain_usage, VkFormat depth_format,
+					uint32_t render_pass, uint32_t upscale_pass, ct::vulkan::LogicalDevice &logical_device, ct::vulkan::transient::Pool &pool, Resolution &resolution) {
+				if (!is_supported(color_format, swapchain_usage, logical_device))
+					return;
+				resolution.pool = &pool;
+				resolution.transient_color = ct::vulkan::transient::declare_image(max_width, max_height, color_format, get_color_usage(swapchain_usage), render_pass, upscale_pass,
+						VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT, pool);
+				resolution.transient_depth = ct::vulkan::transient::declare_image(max_width, max_height, depth_format,
+						VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, render_pass, render_pass,
+						VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+						VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, pool);
+			}
+
+			// The internal colour image gets the swapchain images' usage, so whatever clear strategy was picked for those works on it too
+			inline void setup(uint32_t max_width, uint32_t max_height, uint32_t n_slots, VkFormat color_format, VkColorSpaceKHR color_space, VkImageUsageFlags swapchain_usage,
+					ct::vulkan::LogicalDevice &logical_device, Resolution &resolution) {
+				if (!is_supported(color_format, swapchain_usage, logical_device)) {
+					std::cout << "dynamic-resolution: linear blit to the swapchain not supported, disabled" << std::endl;
+					return;
+				}
+				// The controller steers by GPU time, without timestamps there is nothing to steer by
+				uint64_t timestamp_mask = ct::vulkan::get_timestamp_mask(logical_device, logical_device.queue_family_indices.graphics);
+				if (timestamp_mask == 0) {
+					std::cout << "dynamic-resolution: graphics queue has no timestamps, disabled" << std::endl;
+					return;
+				}
+				VkDevice &device = logical_device.device;
+				resolution.device = device;
+				resolution.max_width = max_width;
+				resolution.max_height = max_height;
+				read_controller(resolution.controller);
+				resolution.slot_scale.assign(n_slots, 0.0f);
+				resolution.written.assign(n_slots, false);
+				resolution.timestamp_period = logical_device.properties.limits.timestampPeriod;
+				resolution.timestamp_mask = timestamp_mask;
+
+				// -> internal target at the maximum size
+				if (resolution.pool != nullptr) {
+					ct::vulkan::transient::get_color_attachment(resolution.transient_color, *resolution.pool, resolution.color);
+					ct::vulkan::transient::get_depth_stencil(resolution.transient_depth, *resolution.pool, resolution.framebuffer.depth_stencil);
+				} else {
+					ct::vulkan::setup_color_attachment(max_width, max_height, color_format, get_color_usage(swapchain_usage), device, logical_device.memory_properties, resolution.color);
+					ct::vulkan::setup_depth_stencil(max_width, max_height, logical_device.physical_device, device, logical_device.memory_properties, resolution.framebuffer.depth_stencil);
+				}
+				ct::vulkan::setup_render_pass(color_format, resolution.framebuffer.depth_stencil.depth_format, device, resolution.framebuffer.render_pass,
+						VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+				std::vector<VkImageView> views = { resolution.color.view };
+				ct::vulkan::setup_framebuffer_from_swapchain(max_width, max_height, 1, device, views, color_format, color_space, resolution.framebuffer);
+				// <-
+
+				VkQueryPoolCreateInfo queryPoolInfo = {};
+				queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+				queryPoolInfo.queryCount = 2 * n_slots;
+				VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, ct::vulkan::get_allocator(), &resolution.query_pool));
+
+				resolution.active = true;
+				std::cout << "dynamic-resolution: max: " << max_width << "x" << max_height << " budget-ms: " << resolution.controller.budget_ms
+					<< " scale: " << resolution.controller.min_scale << "-" << resolution.controller.max_scale << std::endl;
+			}
+
+			inline uint32_t get_width(float scale, Resolution &resolution) {
+				return std::max(1u, (uint32_t)(resolution.max_width * scale));
+			}
+
+			inline uint32_t get_height(float scale, Resolution &resolution) {
+				return std::max(1u, (uint32_t)(resolution.max_height * scale));
+			}
+
+			// Pixel cost goes with scale^2, so the step towards the budget is the square root of the time ratio, limited and quantized against jitter
+			inline void control(double gpu_ms, Controller &controller) {
+				controller.smoothed_ms = controller.smoothed_ms == 0.0 ? gpu_ms : controller.smoothed_ms + RESOLUTION_SMOOTHING * (gpu_ms - controller.smoothed_ms);
+				if (controller.smoothed_ms <= 0.0)
+					return;
+				float wanted = controller.scale * (float)std::sqrt(controller.budget_ms * controller.headroom / controller.smoothed_ms);
+				wanted = std::min(std::max(wanted, controller.scale * (1.0f - RESOLUTION_MAX_CHANGE)), controller.scale * (1.0f + RESOLUTION_MAX_CHANGE));
+				wanted = std::round(wanted / RESOLUTION_SCALE_STEP) * RESOLUTION_SCALE_STEP;
+				controller.scale = std::min(std::max(wanted, controller.min_scale), controller.max_scale);
+			}
+
+			// Reads the slot's last GPU time (if available, never waits) and steps the controller.
+			// Returns true if the slot's command buffer has to be recorded again with get_width/get_height of the current scale.
+			inline bool update(uint32_t slot, Resolution &resolution) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (!resolution.active)
+					return false;
+				if (resolution.written[slot]) {
+					uint64_t timestamps[4];
+					VkResult res = dispatch.vkGetQueryPoolResults(resolution.device, resolution.query_pool, 2 * slot, 2, sizeof(timestamps), timestamps, 2 * sizeof(uint64_t),
+							VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+					if ((res == VK_SUCCESS || res == VK_NOT_READY) && timestamps[1] != 0 && timestamps[3] != 0) {
+						uint64_t ticks = ((timestamps[2] & resolution.timestamp_mask) - (timestamps[0] & resolution.timestamp_mask)) & resolution.timestamp_mask;
+						control(ticks * resolution.timestamp_period / 1e6, resolution.controller);
+					}
+				}
+				if (resolution.slot_scale[slot] == resolution.controller.scale)
+					return false;
+				if (resolution.slot_scale[slot] != 0.0f)
+					resolution.n_changes++;
+				resolution.slot_scale[slot] = resolution.controller.scale;
+				return true;
+			}
+
+			// Call first thing in the slot's command buffer, outside of any pass
+			inline void begin_frame(VkCommandBuffer command_buffer, uint32_t slot, Resolution &resolution) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (!resolution.active)
+					return;
+				dispatch.vkCmdResetQueryPool(command_buffer, resolution.query_pool, 2 * slot, 2);
+				dispatch.vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, resolution.query_pool, 2 * slot);
+				resolution.written[slot] = true;
+				if (resolution.pool != nullptr) {
+					ct::vulkan::transient::begin_use(command_buffer, resolution.transient_color, *resolution.pool);
+					ct::vulkan::transient::begin_use(command_buffer, resolution.transient_depth, *resolution.pool);
+				}
+				// The internal target is shared by all slots: the previous frame's blit has to be done reading before this frame writes
+				dispatch.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+						| VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+			}
+
+			// Call last: scales the used region of the internal target up to swapchain_image and leaves that in PRESENT_SRC
+			inline void end_frame(VkCommandBuffer command_buffer, uint32_t slot, VkImage swapchain_image, uint32_t width, uint32_t height, Resolution &resolution) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (!resolution.active)
+					return;
+				float scale = resolution.slot_scale[slot];
+
+				// Whatever rendered into the internal target has to be done and visible to the blit
+				VkImageMemoryBarrier barriers[2] = {};
+				barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barriers[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+				barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+				barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+				barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barriers[0].image = resolution.color.image;
+				barriers[0].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+				// The swapchain image's old contents are not needed, COLOR_ATTACHMENT_OUTPUT chains with the acquire semaphore wait
+				barriers[1] = barriers[0];
+				barriers[1].srcAccessMask = 0;
+				barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barriers[1].image = swapchain_image;
+				dispatch.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+				VkImageBlit region = {};
+				region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+				region.srcOffsets[1] = { (int32_t)get_width(scale, resolution), (int32_t)get_height(scale, resolution), 1 };
+				region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+				region.dstOffsets[1] = { (int32_t)width, (int32_t)height, 1 };
+				dispatch.vkCmdBlitImage(command_buffer, resolution.color.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapchain_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+						1, &region, VK_FILTER_LINEAR);
+
+				ct::vulkan::set_image_layout(command_buffer, swapchain_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+				dispatch.vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, resolution.query_pool, 2 * slot + 1);
+			}
+
+			inline void report(std::ostream &os, Resolution &resolution) {
+				if (!resolution.active)
+					return;
+				Controller &controller = resolution.controller;
+				os << "dynamic-resolution: scale: " << controller.scale << " (" << get_width(controller.scale, resolution) << "x" << get_height(controller.scale, resolution)
+					<< ") gpu-ms: " << controller.smoothed_ms << " budget-ms: " << controller.budget_ms << " changes: " << resolution.n_changes << std::endl;
+				resolution.n_changes = 0;
+			}
+
+			inline void destroy(Resolution &resolution) {
+				if (resolution.device == VK_NULL_HANDLE)
+					return;
+				vkDestroyQueryPool(resolution.device, resolution.query_pool, ct::vulkan::get_allocator());
+				resolution.query_pool = VK_NULL_HANDLE;
+				ct::vulkan::destroy_framebuffer(resolution.device, resolution.framebuffer);
+				ct::vulkan::destroy_color_attachment(resolution.device, resolution.color);
+				resolution.active = false;
+				resolution.device = VK_NULL_HANDLE;
+			}
+
+		}
+	}
+}
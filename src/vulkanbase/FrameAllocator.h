@@ -0,0 +1,154 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/Dispatch.h"
+#include "utils/EnvHelper.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace frame {
+#define FRAME_ALLOCATOR_KB 1024
+
+			// Where per frame data went: bind buffer (whole range or the allocation's) and pass offset as the dynamic offset
+			struct Allocation {
+				VkBuffer buffer = VK_NULL_HANDLE;
+				VkDeviceSize offset = 0;
+				VkDeviceSize size = 0;
+				void *data = nullptr;
+			};
+
+			struct Slot {
+				VkDeviceSize begin = 0;
+				VkDeviceSize head = 0;
+				VkDeviceSize peak = 0;
+			};
+
+			// One persistently mapped buffer split into a range per frame slot, allocations bump the slot's head and are never freed one by one.
+			// A slot starts over in begin_frame, once its frame fence signalled, so per frame constants never allocate memory or wait for a copy.
+			// The memory is device local and host visible when the device has such a type (resizable BAR, integrated GPUs), host visible otherwise.
+			struct Allocator {
+				VkDevice device = VK_NULL_HANDLE;
+				ct::vulkan::Buffer buffer;
+				bool is_device_local = false;
+				bool is_coherent = true;
+				VkDeviceSize alignment = 1;
+				VkDeviceSize slot_size = FRAME_ALLOCATOR_KB * 1024;		// CT_FRAME_ALLOCATOR_KB
+				std::vector<Slot> slots;
+				uint32_t current = 0;
+
+				uint64_t n_allocations = 0;
+				uint64_t n_full = 0;
+			};
+
+			inline bool has_memory_type(VkPhysicalDeviceMemoryProperties &memory_properties, VkMemoryPropertyFlags properties) {
+				for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+					if ((memory_properties.memoryTypes[i].propertyFlags & properties) == properties)
+						return true;
+				}
+				return false;
+			}
+
+			// n_slots ranges of slot_size, offsets aligned for uniform and storage dynamic offsets (and flushes, without coherent memory)
+			inline void setup(uint32_t n_slots, ct::vulkan::LogicalDevice &logical_device, Allocator &allocator) {
+				allocator.device = logical_device.device;
+				allocator.slot_size = (VkDeviceSize)std::max(1L, ct::env::get_int("CT_FRAME_ALLOCATOR_KB", FRAME_ALLOCATOR_KB)) * 1024;
+				const VkPhysicalDeviceLimits &limits = logical_device.properties.limits;
+				allocator.alignment = std::max((VkDeviceSize)1, std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment));
+
+				VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+				allocator.is_device_local = has_memory_type(logical_device.memory_properties, properties | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+				if (allocator.is_device_local) {
+					properties |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+				} else if (!has_memory_type(logical_device.memory_properties, properties)) {
+					properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+					allocator.is_coherent = false;
+					allocator.alignment = std::max(allocator.alignment, limits.nonCoherentAtomSize);
+				}
+				allocator.slot_size = (allocator.slot_size + allocator.alignment - 1) / allocator.alignment * allocator.alignment;
+
+				ct::vulkan::create_buffer(allocator.slot_size * n_slots, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, properties,
+						logical_device.device, logical_device.memory_properties, allocator.buffer);
+				allocator.slots.assign(n_slots, Slot());
+				for (uint32_t i = 0; i < n_slots; i++) {
+					allocator.slots[i].begin = i * allocator.slot_size;
+					allocator.slots[i].head = allocator.slots[i].begin;
+				}
+				std::cout << "frame-allocator: slots: " << n_slots << " slot: " << allocator.slot_size / 1024 << " KB alignment: " << allocator.alignment
+					<< (allocator.is_device_local ? " device-local" : " host") << std::endl;
+			}
+
+			// Starts slot over, the slot's frame fence must have been waited for
+			inline void begin_frame(uint32_t slot, Allocator &allocator) {
+				if (allocator.slots.empty())
+					return;
+				Slot &s = allocator.slots[slot];
+				s.peak = std::max(s.peak, s.head - s.begin);
+				s.head = s.begin;
+				allocator.current = slot;
+			}
+
+			// size bytes in the current slot, false if the slot is full (the caller skips the data or falls back, nothing is grown mid frame)
+			inline bool allocate(VkDeviceSize size, Allocator &allocator, Allocation &allocation) {
+				if (allocator.slots.empty())
+					return false;
+				Slot &s = allocator.slots[allocator.current];
+				if (s.head + size > s.begin + allocator.slot_size) {
+					allocator.n_full++;
+					return false;
+				}
+				allocation.buffer = allocator.buffer.buffer;
+				allocation.offset = s.head;
+				allocation.size = size;
+				allocation.data = static_cast<char*>(allocator.buffer.mapped) + s.head;
+				s.head += (size + allocator.alignment - 1) / allocator.alignment * allocator.alignment;
+				allocator.n_allocations++;
+				return true;
+			}
+
+			// Copies data into a new allocation of the current slot
+			inline bool push(const void *data, VkDeviceSize size, Allocator &allocator, Allocation &allocation) {
+				if (!allocate(size, allocator, allocation))
+					return false;
+				std::memcpy(allocation.data, data, size);
+				return true;
+			}
+
+			// Before the frame is submitted: makes the slot's writes visible without coherent memory, a no-op otherwise
+			inline void end_frame(Allocator &allocator) {
+				if (allocator.slots.empty() || allocator.is_coherent)
+					return;
+				Slot &s = allocator.slots[allocator.current];
+				if (s.head == s.begin)
+					return;
+				VkMappedMemoryRange range = {};
+				range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+				range.memory = allocator.buffer.mem;
+				range.offset = s.begin;
+				range.size = s.head - s.begin;
+				VK_CHECK_RESULT(ct::vulkan::dispatch::get_device().vkFlushMappedMemoryRanges(allocator.device, 1, &range));
+			}
+
+			inline void report(std::ostream &os, Allocator &allocator) {
+				if (allocator.slots.empty())
+					return;
+				VkDeviceSize peak = 0;
+				for (auto &s : allocator.slots)
+					peak = std::max(peak, std::max(s.peak, s.head - s.begin));
+				os << "frame-allocator: allocations: " << allocator.n_allocations << " peak: " << peak / 1024.0 << " of " << allocator.slot_size / 1024 << " KB full: " << allocator.n_full << std::endl;
+			}
+
+			inline void destroy(Allocator &allocator) {
+				if (allocator.buffer.buffer != VK_NULL_HANDLE)
+					ct::vulkan::destroy_buffer(allocator.device, allocator.buffer);
+				allocator.slots.clear();
+			}
+
+		}
+	}
+}
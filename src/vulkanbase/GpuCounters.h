@@ -0,0 +1,251 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cassert>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/Immediate.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace counters {
+#define COUNTERS_PASSES_PER_SLOT 16
+#define COUNTERS_STATISTIC_COUNT 7
+
+			enum Statistic {
+				INPUT_VERTICES = 0,
+				INPUT_PRIMITIVES,
+				VERTEX_INVOCATIONS,
+				CLIPPING_INVOCATIONS,
+				CLIPPING_PRIMITIVES,
+				FRAGMENT_INVOCATIONS,
+				COMPUTE_INVOCATIONS
+			};
+
+			// Bit order matches the order results are written in, which is the order of Statistic
+			static const VkQueryPipelineStatisticFlags STATISTIC_FLAGS =
+				VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+			struct PassQuery {
+				const char *name;
+				uint32_t query;
+			};
+
+			// Accumulated over the current report interval
+			struct PassStats {
+				const char *name;
+				uint64_t samples = 0;
+				uint64_t statistics[COUNTERS_STATISTIC_COUNT] = {};
+				uint32_t n_frames = 0;
+			};
+
+			// Queries live per frame slot. A slot is read back only when it comes around again, without waiting,
+			// so the results are always n_slots frames old and unavailable ones are skipped instead of stalling.
+			struct Counters {
+				bool active = false;
+				bool has_statistics = false;
+				uint32_t slots = 0;
+				VkDevice device = VK_NULL_HANDLE;
+				VkQueryPool statistics_pool = VK_NULL_HANDLE;
+				VkQueryPool occlusion_pool = VK_NULL_HANDLE;
+
+				std::vector<std::vector<PassQuery>> passes;
+				std::vector<uint32_t> open;
+				std::vector<uint64_t> results;
+				std::vector<PassStats> stats;
+				uint64_t n_unavailable = 0;
+			};
+
+			inline std::string statistic2string(uint32_t statistic) {
+				switch (statistic) {
+#define STR(r) case r: return #r
+					STR(INPUT_VERTICES);
+					STR(INPUT_PRIMITIVES);
+					STR(VERTEX_INVOCATIONS);
+					STR(CLIPPING_INVOCATIONS);
+					STR(CLIPPING_PRIMITIVES);
+					STR(FRAGMENT_INVOCATIONS);
+					STR(COMPUTE_INVOCATIONS);
+#undef STR
+					default: return "UNKNOWN_STATISTIC";
+				}
+			}
+
+			// Pipeline statistics need features_enabled.pipelineStatisticsQuery, occlusion queries are always there.
+			// With an immediate context the resets join its open batch, finish it before the first frame.
+			inline void setup(uint32_t n_slots, ct::vulkan::LogicalDevice &logical_device, Counters &counters, ct::vulkan::immediate::Context *immediate = nullptr) {
+				counters.device = logical_device.device;
+				counters.slots = n_slots;
+				counters.has_statistics = logical_device.features_enabled.pipelineStatisticsQuery == VK_TRUE;
+				counters.passes.resize(n_slots);
+				counters.open.assign(n_slots, UINT32_MAX);
+				for (auto &passes : counters.passes)
+					passes.reserve(COUNTERS_PASSES_PER_SLOT);
+				// Statistics plus availability for every pass of a slot
+				counters.results.resize(COUNTERS_PASSES_PER_SLOT * (COUNTERS_STATISTIC_COUNT + 1));
+				counters.stats.reserve(COUNTERS_PASSES_PER_SLOT);
+
+				VkQueryPoolCreateInfo queryPoolInfo = {};
+				queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				queryPoolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
+				queryPoolInfo.queryCount = n_slots * COUNTERS_PASSES_PER_SLOT;
+				VK_CHECK_RESULT(vkCreateQueryPool(logical_device.device, &queryPoolInfo, ct::vulkan::get_allocator(), &counters.occlusion_pool));
+
+				if (counters.has_statistics) {
+					queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+					queryPoolInfo.pipelineStatistics = STATISTIC_FLAGS;
+					VK_CHECK_RESULT(vkCreateQueryPool(logical_device.device, &queryPoolInfo, ct::vulkan::get_allocator(), &counters.statistics_pool));
+				} else {
+					std::cout << "counters: pipelineStatisticsQuery not enabled, only occlusion is counted" << std::endl;
+				}
+
+				// Start with every query reset, reads of a never submitted slot then just come back unavailable
+				VkCommandBuffer command_buffer = immediate != nullptr ? ct::vulkan::immediate::begin(*immediate)
+					: ct::vulkan::get_command_buffer(true, logical_device.device, logical_device.command_pool);
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				dispatch.vkCmdResetQueryPool(command_buffer, counters.occlusion_pool, 0, queryPoolInfo.queryCount);
+				if (counters.has_statistics)
+					dispatch.vkCmdResetQueryPool(command_buffer, counters.statistics_pool, 0, queryPoolInfo.queryCount);
+				if (immediate != nullptr)
+					ct::vulkan::immediate::end(*immediate);
+				else
+					ct::vulkan::flush_command_buffer(logical_device.device, logical_device.command_pool, logical_device.queue_graphics, command_buffer);
+				counters.active = true;
+			}
+
+			// Call at the start of recording a slot's command buffer, outside of any render pass
+			inline void begin_frame(VkCommandBuffer command_buffer, uint32_t slot, Counters &counters) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (!counters.active)
+					return;
+				dispatch.vkCmdResetQueryPool(command_buffer, counters.occlusion_pool, slot * COUNTERS_PASSES_PER_SLOT, COUNTERS_PASSES_PER_SLOT);
+				if (counters.has_statistics)
+					dispatch.vkCmdResetQueryPool(command_buffer, counters.statistics_pool, slot * COUNTERS_PASSES_PER_SLOT, COUNTERS_PASSES_PER_SLOT);
+				counters.passes[slot].clear();
+				counters.open[slot] = UINT32_MAX;
+			}
+
+			// Passes do not nest. A pass begun outside a render pass must end outside, one begun inside must end in the same subpass.
+			inline void begin_pass(VkCommandBuffer command_buffer, uint32_t slot, const char *name, Counters &counters) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (!counters.active)
+					return;
+				std::vector<PassQuery> &passes = counters.passes[slot];
+				assert(counters.open[slot] == UINT32_MAX);
+				if (passes.size() == COUNTERS_PASSES_PER_SLOT)
+					return;
+
+				uint32_t query = slot * COUNTERS_PASSES_PER_SLOT + (uint32_t)passes.size();
+				dispatch.vkCmdBeginQuery(command_buffer, counters.occlusion_pool, query, 0);
+				if (counters.has_statistics)
+					dispatch.vkCmdBeginQuery(command_buffer, counters.statistics_pool, query, 0);
+				counters.open[slot] = query;
+				passes.push_back({ name, query });
+			}
+
+			inline void end_pass(VkCommandBuffer command_buffer, uint32_t slot, Counters &counters) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (!counters.active || counters.open[slot] == UINT32_MAX)
+					return;
+				if (counters.has_statistics)
+					dispatch.vkCmdEndQuery(command_buffer, counters.statistics_pool, counters.open[slot]);
+				dispatch.vkCmdEndQuery(command_buffer, counters.occlusion_pool, counters.open[slot]);
+				counters.open[slot] = UINT32_MAX;
+			}
+
+			inline PassStats& get_pass_stats(const char *name, Counters &counters) {
+				for (auto &stats : counters.stats)
+					if (stats.name == name || std::strcmp(stats.name, name) == 0)
+						return stats;
+				PassStats stats;
+				stats.name = name;
+				counters.stats.push_back(stats);
+				return counters.stats.back();
+			}
+
+			// Reads the slot's last results if the GPU is done with them. Never waits.
+			inline void collect(uint32_t slot, Counters &counters) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (!counters.active || counters.passes[slot].empty())
+					return;
+				std::vector<PassQuery> &passes = counters.passes[slot];
+
+				uint32_t n_passes = (uint32_t)passes.size();
+				uint32_t first = slot * COUNTERS_PASSES_PER_SLOT;
+				VkQueryResultFlags flags = VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+				uint64_t *results = counters.results.data();
+
+				// -> occlusion: (samples, availability) per pass
+				uint64_t occlusion[2 * COUNTERS_PASSES_PER_SLOT];
+				VkResult res = dispatch.vkGetQueryPoolResults(counters.device, counters.occlusion_pool, first, n_passes, sizeof(occlusion), occlusion, 2 * sizeof(uint64_t), flags);
+				if (res != VK_SUCCESS && res != VK_NOT_READY)
+					return;
+				// <-
+
+				// -> statistics: (statistics..., availability) per pass
+				uint32_t stride = COUNTERS_STATISTIC_COUNT + 1;
+				if (counters.has_statistics) {
+					res = dispatch.vkGetQueryPoolResults(counters.device, counters.statistics_pool, first, n_passes, n_passes * stride * sizeof(uint64_t), results,
+							stride * sizeof(uint64_t), flags);
+					if (res != VK_SUCCESS && res != VK_NOT_READY)
+						return;
+				}
+				// <-
+
+				for (uint32_t i = 0; i < n_passes; i++) {
+					bool available = occlusion[2 * i + 1] != 0 && (!counters.has_statistics || results[i * stride + COUNTERS_STATISTIC_COUNT] != 0);
+					if (!available) {
+						counters.n_unavailable++;
+						continue;
+					}
+					PassStats &stats = get_pass_stats(passes[i].name, counters);
+					stats.samples += occlusion[2 * i];
+					if (counters.has_statistics)
+						for (uint32_t j = 0; j < COUNTERS_STATISTIC_COUNT; j++)
+							stats.statistics[j] += results[i * stride + j];
+					stats.n_frames++;
+				}
+			}
+
+			inline void destroy(Counters &counters) {
+				if (counters.device == VK_NULL_HANDLE)
+					return;
+				vkDestroyQueryPool(counters.device, counters.statistics_pool, ct::vulkan::get_allocator());
+				vkDestroyQueryPool(counters.device, counters.occlusion_pool, ct::vulkan::get_allocator());
+				counters.statistics_pool = VK_NULL_HANDLE;
+				counters.occlusion_pool = VK_NULL_HANDLE;
+				counters.active = false;
+			}
+
+			// Prints per pass averages over the frames collected since the last report and starts a new interval
+			inline void report(std::ostream &os, Counters &counters) {
+				for (auto &stats : counters.stats) {
+					if (stats.n_frames == 0)
+						continue;
+					os << "pass: " << stats.name << " frames: " << stats.n_frames << " samples: " << stats.samples / stats.n_frames;
+					if (counters.has_statistics)
+						for (uint32_t j = 0; j < COUNTERS_STATISTIC_COUNT; j++)
+							os << " " << statistic2string(j) << ": " << stats.statistics[j] / stats.n_frames;
+					os << std::endl;
+					const char *name = stats.name;
+					stats = PassStats();
+					stats.name = name;
+				}
+				if (counters.n_unavailable > 0)
+					os << "counters-unavailable: " << counters.n_unavailable << std::endl;
+				counters.n_unavailable = 0;
+			}
+
+		}
+	}
+}
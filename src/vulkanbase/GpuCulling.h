@@ -0,0 +1,454 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/DescriptorHelper.h"
+#include "vulkanbase/Workload.h"
+#include "vulkanbase/Submission.h"
+#include "vulkanbase/FrameAllocator.h"
+#include "utils/ErrorHelper.h"
+#include "loader/LoaderBinary.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace culling {
+#define CULLING_GROUP_SIZE 64
+#define CULLING_BINDINGS 8
+#define CULLING_BINDING_PARAMS 8
+
+			// Layout of the shaders' Stats block, written by the GPU and read back once the slot has retired
+			struct Stats {
+				uint32_t n_visible;
+				uint32_t n_batches;
+			};
+
+			// Workload draws with the same pipeline and material, drawn with one indirect call
+			struct Group {
+				uint32_t pipeline;
+				uint32_t material;
+				uint32_t first;
+				uint32_t count;
+			};
+
+			// Culls the workload's objects on queue_compute every frame and draws what is left with indirect draws.
+			// Every workload Draw is one batch with its own VkDrawIndexedIndirectCommand whose instance count the cull pass fills in,
+			// the compact pass then packs the non empty ones per group so vkCmdDrawIndexedIndirectCount skips the rest.
+			// Recording depends on the number of groups only, never on the number of objects.
+			struct Culling {
+				bool active = false;
+				bool has_draw_indirect_count = false;
+				bool has_multi_draw_indirect = false;
+				VkDevice device = VK_NULL_HANDLE;
+
+				// -> compute submission, one command buffer and semaphore per frame slot
+				VkQueue queue = VK_NULL_HANDLE;
+				VkCommandPool command_pool = VK_NULL_HANDLE;
+				std::vector<VkCommandBuffer> command_buffers;
+				std::vector<VkSemaphore> complete;
+				std::vector<bool> submitted;
+				std::vector<bool> prepared;
+				// <-
+
+				// -> buffers: static ones are shared, the others exist once per frame slot
+				ct::vulkan::Buffer object_batch;
+				ct::vulkan::Buffer batch_group;
+				ct::vulkan::Buffer command_template;
+				std::vector<ct::vulkan::Buffer> stats;
+				std::vector<ct::vulkan::Buffer> commands;
+				std::vector<ct::vulkan::Buffer> counts;
+				std::vector<ct::vulkan::Buffer> compacted;
+				std::vector<ct::vulkan::Buffer> visible;
+				// <-
+
+				// Params of the frame come from here, one block per frame
+				ct::vulkan::frame::Allocator *frame_allocator = nullptr;
+
+				// The set is allocated from the frame's descriptor allocator every frame, only what it points to is kept per slot
+				VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+				std::vector<VkDescriptorBufferInfo> buffer_infos;
+				VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+				VkPipeline cull_pipeline = VK_NULL_HANDLE;
+				VkPipeline compact_pipeline = VK_NULL_HANDLE;
+
+				std::vector<Group> groups;
+				uint32_t n_objects = 0;
+				uint32_t n_batches = 0;
+				uint32_t n_draw_calls = 0;
+
+				// -> accumulated over the current report interval
+				uint32_t n_frames = 0;
+				uint64_t n_visible = 0;
+				uint64_t n_batches_drawn = 0;
+				// <-
+			};
+
+			// Layout of the shaders' Params block (std140)
+			struct Params {
+				uint32_t n_objects;
+				uint32_t n_batches;
+			};
+
+			// Call between pick_gpu and create_device. Indirect draws with a first instance are required, a draw count and multi draw are used if there.
+			inline bool request(ct::vulkan::LogicalDevice &logical_device, Culling &culling) {
+				if (!logical_device.features.drawIndirectFirstInstance) {
+					std::cout << "culling: drawIndirectFirstInstance not supported, culling disabled" << std::endl;
+					return false;
+				}
+				logical_device.features_enabled.drawIndirectFirstInstance = VK_TRUE;
+				logical_device.features_enabled.multiDrawIndirect = logical_device.features.multiDrawIndirect;
+				culling.has_multi_draw_indirect = logical_device.features.multiDrawIndirect == VK_TRUE;
+				culling.has_draw_indirect_count = ct::vulkan::is_device_extension_supported(logical_device, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+				if (culling.has_draw_indirect_count)
+					logical_device.extensions_enabled.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+				return true;
+			}
+
+			inline VkPipeline create_pipeline(const std::string &name, VkDevice &device, Culling &culling) {
+				std::vector<char> shader_code;
+				ct::load_binary(std::string(SHADER_BIN_DIR) + "culling/" + name + ".comp.spv", shader_code);
+				if (shader_code.empty())
+					return VK_NULL_HANDLE;
+
+				VkShaderModuleCreateInfo moduleCreateInfo = {};
+				moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+				moduleCreateInfo.codeSize = shader_code.size();
+				moduleCreateInfo.pCode = (uint32_t*)shader_code.data();
+				VkShaderModule shader_module;
+				VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, ct::vulkan::get_allocator(), &shader_module));
+				ct::vulkan::capture::shader_module(shader_module, moduleCreateInfo);
+
+				VkComputePipelineCreateInfo pipelineInfo = {};
+				pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+				pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+				pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+				pipelineInfo.stage.module = shader_module;
+				pipelineInfo.stage.pName = "main";
+				pipelineInfo.layout = culling.pipeline_layout;
+				VkPipeline pipeline;
+				VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, ct::vulkan::get_allocator(), &pipeline));
+				ct::vulkan::capture::compute_pipeline(pipeline, pipelineInfo);
+
+				vkDestroyShaderModule(device, shader_module, ct::vulkan::get_allocator());
+				return pipeline;
+			}
+
+			// Batches are the workload's (sorted) draws, consecutive ones sharing pipeline and material form a group
+			inline void setup_batches(ct::vulkan::LogicalDevice &logical_device, ct::vulkan::workload::Workload &workload, Culling &culling) {
+				culling.n_objects = workload.params.n_objects;
+				culling.n_batches = (uint32_t)workload.draws.size();
+
+				std::vector<uint32_t> object_batch(culling.n_objects);
+				std::vector<uint32_t> batch_group(2 * culling.n_batches);
+				std::vector<VkDrawIndexedIndirectCommand> command_template(culling.n_batches);
+				culling.groups.clear();
+				for (uint32_t b = 0; b < culling.n_batches; b++) {
+					ct::vulkan::workload::Draw &draw = workload.draws[b];
+					if (culling.groups.empty() || culling.groups.back().pipeline != draw.pipeline || culling.groups.back().material != draw.material)
+						culling.groups.push_back({ draw.pipeline, draw.material, b, 0 });
+					culling.groups.back().count++;
+					batch_group[2 * b] = (uint32_t)culling.groups.size() - 1;
+					batch_group[2 * b + 1] = culling.groups.back().first;
+
+					for (uint32_t i = 0; i < draw.instance_count; i++)
+						object_batch[draw.first_instance + i] = b;
+					// The instance count is what the cull pass fills in, visible instances keep the batch's range
+					command_template[b] = { workload.index_count, 0, 0, 0, draw.first_instance };
+				}
+
+				// Copied in on the graphics queue, read by the cull pass on the compute queue
+				std::vector<uint32_t> families = { logical_device.queue_family_indices.graphics, logical_device.queue_family_indices.compute };
+				ct::vulkan::workload::upload(object_batch.data(), object_batch.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, logical_device, culling.object_batch,
+						workload.immediate, families);
+				ct::vulkan::workload::upload(batch_group.data(), batch_group.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, logical_device, culling.batch_group,
+						workload.immediate, families);
+				ct::vulkan::workload::upload(command_template.data(), command_template.size() * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+						logical_device, culling.command_template, workload.immediate, families);
+			}
+
+			inline void setup_slot_buffers(uint32_t n_slots, ct::vulkan::LogicalDevice &logical_device, ct::vulkan::workload::Workload &workload, Culling &culling) {
+				// Written on the compute queue, read by the graphics queue
+				std::vector<uint32_t> families = { logical_device.queue_family_indices.compute, logical_device.queue_family_indices.graphics };
+				VkDeviceSize commands_size = culling.n_batches * sizeof(VkDrawIndexedIndirectCommand);
+				culling.stats.resize(n_slots);
+				culling.commands.resize(n_slots);
+				culling.counts.resize(n_slots);
+				culling.compacted.resize(n_slots);
+				culling.visible.resize(n_slots);
+				for (uint32_t i = 0; i < n_slots; i++) {
+					ct::vulkan::create_buffer(sizeof(Stats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+							logical_device.device, logical_device.memory_properties, culling.stats[i]);
+					std::memset(culling.stats[i].mapped, 0, sizeof(Stats));
+					ct::vulkan::create_buffer(commands_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+							VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, logical_device.device, logical_device.memory_properties, culling.commands[i], families);
+					ct::vulkan::create_buffer(culling.groups.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+							VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, logical_device.device, logical_device.memory_properties, culling.counts[i], families);
+					ct::vulkan::create_buffer(commands_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+							VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, logical_device.device, logical_device.memory_properties, culling.compacted[i], families);
+					ct::vulkan::create_buffer(culling.n_objects * sizeof(ct::vulkan::workload::Instance), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+							VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, logical_device.device, logical_device.memory_properties, culling.visible[i], families);
+				}
+			}
+
+			inline void setup_descriptors(uint32_t n_slots, VkDevice &device, ct::vulkan::descriptor::LayoutCache &layout_cache, ct::vulkan::workload::Workload &workload,
+					Culling &culling) {
+				std::vector<VkDescriptorSetLayoutBinding> bindings(CULLING_BINDINGS + 1);
+				for (uint32_t i = 0; i < CULLING_BINDINGS; i++)
+					bindings[i] = { i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+				bindings[CULLING_BINDING_PARAMS] = { CULLING_BINDING_PARAMS, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+				culling.layout = ct::vulkan::descriptor::get_layout(bindings, layout_cache);
+
+				culling.buffer_infos.resize(n_slots * (CULLING_BINDINGS + 1));
+				for (uint32_t i = 0; i < n_slots; i++) {
+					// Binding order of the shaders
+					ct::vulkan::Buffer *buffers[CULLING_BINDINGS] = { &culling.stats[i], &workload.instance_buffers[i], &culling.object_batch, &culling.commands[i],
+						&culling.visible[i], &culling.counts[i], &culling.compacted[i], &culling.batch_group };
+					VkDescriptorBufferInfo *bufferInfos = &culling.buffer_infos[i * (CULLING_BINDINGS + 1)];
+					for (uint32_t j = 0; j < CULLING_BINDINGS; j++)
+						bufferInfos[j] = { buffers[j]->buffer, 0, VK_WHOLE_SIZE };
+					// The frame's Params block sits at the dynamic offset given when the set is bound
+					bufferInfos[CULLING_BINDING_PARAMS] = { culling.frame_allocator->buffer.buffer, 0, sizeof(Params) };
+				}
+
+				VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+				pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+				pipelineLayoutInfo.setLayoutCount = 1;
+				pipelineLayoutInfo.pSetLayouts = &culling.layout;
+				VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, ct::vulkan::get_allocator(), &culling.pipeline_layout));
+				ct::vulkan::capture::pipeline_layout(culling.pipeline_layout, pipelineLayoutInfo);
+			}
+
+			inline void write_set(uint32_t slot, VkDescriptorSet set, Culling &culling) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VkWriteDescriptorSet writes[CULLING_BINDINGS + 1];
+				for (uint32_t j = 0; j < CULLING_BINDINGS + 1; j++) {
+					writes[j] = {};
+					writes[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+					writes[j].dstSet = set;
+					writes[j].dstBinding = j;
+					writes[j].descriptorCount = 1;
+					writes[j].descriptorType = j == CULLING_BINDING_PARAMS ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+					writes[j].pBufferInfo = &culling.buffer_infos[slot * (CULLING_BINDINGS + 1) + j];
+				}
+				dispatch.vkUpdateDescriptorSets(culling.device, CULLING_BINDINGS + 1, writes, 0, nullptr);
+			}
+
+			inline void buffer_barrier(VkCommandBuffer command_buffer, VkBuffer buffer, VkAccessFlags src_access, VkAccessFlags dst_access,
+					VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VkBufferMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				barrier.srcAccessMask = src_access;
+				barrier.dstAccessMask = dst_access;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.buffer = buffer;
+				barrier.offset = 0;
+				barrier.size = VK_WHOLE_SIZE;
+				dispatch.vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+			}
+
+			// Writes the frame's Params into the frame allocator and records the slot's compute work with its offset: reset commands and counts,
+			// cull, compact. Call after frame::begin_frame and before frame::end_frame, the frame's fence must have been waited for.
+			// The descriptor set comes from the slot's descriptor allocator, returned by descriptor::begin_frame for the same slot.
+			// A full frame allocator skips the pass, the slot then draws what it culled last time.
+			inline void prepare(uint32_t slot, ct::vulkan::descriptor::Allocator &descriptors, Culling &culling) {
+				if (!culling.active)
+					return;
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				Params params = { culling.n_objects, culling.n_batches };
+				ct::vulkan::frame::Allocation allocation;
+				culling.prepared[slot] = ct::vulkan::frame::push(&params, sizeof(Params), *culling.frame_allocator, allocation);
+				if (!culling.prepared[slot])
+					return;
+				uint32_t dynamic_offset = (uint32_t)allocation.offset;
+				VkDescriptorSet set;
+				ct::vulkan::descriptor::allocate(culling.layout, descriptors, set);
+				write_set(slot, set, culling);
+
+				VkCommandBuffer command_buffer = culling.command_buffers[slot];
+				VkCommandBufferBeginInfo cmdBufInfo = {};
+				cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+				VK_CHECK_RESULT(dispatch.vkBeginCommandBuffer(command_buffer, &cmdBufInfo));
+
+				VkBufferCopy region = { 0, 0, culling.n_batches * sizeof(VkDrawIndexedIndirectCommand) };
+				dispatch.vkCmdCopyBuffer(command_buffer, culling.command_template.buffer, culling.commands[slot].buffer, 1, &region);
+				dispatch.vkCmdFillBuffer(command_buffer, culling.counts[slot].buffer, 0, VK_WHOLE_SIZE, 0);
+				buffer_barrier(command_buffer, culling.commands[slot].buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+				buffer_barrier(command_buffer, culling.counts[slot].buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+				dispatch.vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.pipeline_layout, 0, 1, &set, 1, &dynamic_offset);
+				dispatch.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.cull_pipeline);
+				dispatch.vkCmdDispatch(command_buffer, (culling.n_objects + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE, 1, 1);
+
+				buffer_barrier(command_buffer, culling.commands[slot].buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+						VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+				dispatch.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.compact_pipeline);
+				dispatch.vkCmdDispatch(command_buffer, (culling.n_batches + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE, 1, 1);
+				// Stats are read on the host once the frame fence has signalled
+				buffer_barrier(command_buffer, culling.stats[slot].buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+						VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+
+				VK_CHECK_RESULT(dispatch.vkEndCommandBuffer(command_buffer));
+			}
+
+			// n_slots frame slots each get their own compute command buffer and output buffers, the per frame Params come from frame_allocator
+			// (set up with the same n_slots, like the frame descriptor allocators prepare takes its set from). Does nothing if the workload is not active.
+			inline void setup(uint32_t n_slots, ct::vulkan::LogicalDevice &logical_device, ct::vulkan::descriptor::LayoutCache &layout_cache,
+					ct::vulkan::workload::Workload &workload, ct::vulkan::frame::Allocator &frame_allocator, Culling &culling) {
+				if (!workload.active)
+					return;
+				VkDevice &device = logical_device.device;
+				culling.device = device;
+				culling.frame_allocator = &frame_allocator;
+				culling.queue = logical_device.queue_compute;
+
+				setup_batches(logical_device, workload, culling);
+				setup_slot_buffers(n_slots, logical_device, workload, culling);
+				setup_descriptors(n_slots, device, layout_cache, workload, culling);
+				culling.cull_pipeline = create_pipeline("cull", device, culling);
+				culling.compact_pipeline = create_pipeline("compact", device, culling);
+				if (culling.cull_pipeline == VK_NULL_HANDLE || culling.compact_pipeline == VK_NULL_HANDLE) {
+					std::cout << "culling: shaders not found in " << SHADER_BIN_DIR << ", culling disabled" << std::endl;
+					return;
+				}
+
+				// The entry point comes from the device table, connect_device loaded it with the extension
+				culling.has_draw_indirect_count = culling.has_draw_indirect_count && ct::vulkan::dispatch::get_device().vkCmdDrawIndexedIndirectCountKHR != nullptr;
+
+				ct::vulkan::create_command_pool(device, logical_device.queue_family_indices.compute, culling.command_pool);
+				ct::vulkan::create_command_buffer(n_slots, device, culling.command_pool, culling.command_buffers);
+				culling.complete.resize(n_slots);
+				culling.submitted.assign(n_slots, false);
+				culling.prepared.assign(n_slots, false);
+				VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+				semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+				for (auto &semaphore : culling.complete)
+					VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, ct::vulkan::get_allocator(), &semaphore));
+
+				culling.active = true;
+
+				const char *path = culling.has_draw_indirect_count ? "draw-indirect-count" : (culling.has_multi_draw_indirect ? "multi-draw-indirect" : "draw-indirect");
+				std::cout << "culling: objects: " << culling.n_objects << " batches: " << culling.n_batches << " groups: " << culling.groups.size() << " path: " << path << std::endl;
+			}
+
+			// Submits what prepare recorded. The graphics submission of the frame waits for it through synchronization's extra waits,
+			// both go through service if there is one.
+			inline void submit(uint32_t slot, ct::vulkan::Synchronization &synchronization, Culling &culling, ct::vulkan::submission::Service *service = nullptr) {
+				if (!culling.active)
+					return;
+				Stats *stats = static_cast<Stats*>(culling.stats[slot].mapped);
+				if (culling.submitted[slot]) {
+					culling.n_visible += stats->n_visible;
+					culling.n_batches_drawn += stats->n_batches;
+					culling.n_frames++;
+				}
+				culling.submitted[slot] = false;
+				if (!culling.prepared[slot])
+					return;
+				*stats = {};
+
+				ct::vulkan::submission::Work work;
+				work.queue = culling.queue;
+				ct::vulkan::submission::add_command_buffer(culling.command_buffers[slot], work);
+				ct::vulkan::submission::add_signal(culling.complete[slot], work);
+				ct::vulkan::submission::submit(work, service);
+				culling.submitted[slot] = true;
+
+				synchronization.extra_waits.push_back(culling.complete[slot]);
+				synchronization.extra_wait_stages.push_back(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+			}
+
+			// Records the workload's pass with one indirect draw per group (or per batch without multi draw indirect)
+			inline void record(VkCommandBuffer command_buffer, uint32_t slot, ct::vulkan::rendering::Target &target, ct::vulkan::workload::Workload &workload, Culling &culling) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (!culling.active)
+					return;
+				ct::vulkan::workload::begin_render(command_buffer, target, workload);
+				VkDeviceSize offset = 0;
+				dispatch.vkCmdBindVertexBuffers(command_buffer, 1, 1, &culling.visible[slot].buffer, &offset);
+
+				uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+				uint32_t pipeline = UINT32_MAX;
+				culling.n_draw_calls = 0;
+				for (uint32_t g = 0; g < culling.groups.size(); g++) {
+					Group &group = culling.groups[g];
+					if (group.pipeline != pipeline) {
+						pipeline = group.pipeline;
+						dispatch.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, workload.pipelines[pipeline]);
+					}
+					// Consecutive groups always differ in pipeline or material
+					dispatch.vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, workload.pipeline_layout, 0, 1, &workload.material_sets[group.material], 0, nullptr);
+
+					if (culling.has_draw_indirect_count) {
+						dispatch.vkCmdDrawIndexedIndirectCountKHR(command_buffer, culling.compacted[slot].buffer, group.first * stride, culling.counts[slot].buffer,
+								g * sizeof(uint32_t), group.count, stride);
+						culling.n_draw_calls++;
+					} else if (culling.has_multi_draw_indirect) {
+						dispatch.vkCmdDrawIndexedIndirect(command_buffer, culling.commands[slot].buffer, group.first * stride, group.count, stride);
+						culling.n_draw_calls++;
+					} else {
+						for (uint32_t b = group.first; b < group.first + group.count; b++)
+							dispatch.vkCmdDrawIndexedIndirect(command_buffer, culling.commands[slot].buffer, b * stride, 1, stride);
+						culling.n_draw_calls += group.count;
+					}
+				}
+				ct::vulkan::workload::end_render(command_buffer, target, workload);
+			}
+
+			// Averages over the frames read back since the last report
+			inline void report(std::ostream &os, Culling &culling) {
+				if (!culling.active || culling.n_frames == 0)
+					return;
+				uint64_t visible = culling.n_visible / culling.n_frames;
+				os << "culling: visible: " << visible << " culled: " << culling.n_objects - visible
+					<< " batches-drawn: " << culling.n_batches_drawn / culling.n_frames << "/" << culling.n_batches
+					<< " indirect-draws-recorded: " << culling.n_draw_calls << std::endl;
+				culling.n_frames = 0;
+				culling.n_visible = 0;
+				culling.n_batches_drawn = 0;
+			}
+
+			// The descriptor set layout belongs to the layout cache
+			inline void destroy(Culling &culling) {
+				if (culling.device == VK_NULL_HANDLE)
+					return;
+				VkDevice &device = culling.device;
+				vkDestroyPipeline(device, culling.cull_pipeline, ct::vulkan::get_allocator());
+				vkDestroyPipeline(device, culling.compact_pipeline, ct::vulkan::get_allocator());
+				vkDestroyPipelineLayout(device, culling.pipeline_layout, ct::vulkan::get_allocator());
+				culling.cull_pipeline = VK_NULL_HANDLE;
+				culling.compact_pipeline = VK_NULL_HANDLE;
+				culling.pipeline_layout = VK_NULL_HANDLE;
+				culling.buffer_infos.clear();
+				for (auto &semaphore : culling.complete)
+					vkDestroySemaphore(device, semaphore, ct::vulkan::get_allocator());
+				culling.complete.clear();
+				if (!culling.command_buffers.empty())
+					vkFreeCommandBuffers(device, culling.command_pool, (uint32_t)culling.command_buffers.size(), culling.command_buffers.data());
+				culling.command_buffers.clear();
+				vkDestroyCommandPool(device, culling.command_pool, ct::vulkan::get_allocator());
+				culling.command_pool = VK_NULL_HANDLE;
+
+				ct::vulkan::destroy_buffer(device, culling.object_batch);
+				ct::vulkan::destroy_buffer(device, culling.batch_group);
+				ct::vulkan::destroy_buffer(device, culling.command_template);
+				for (auto *buffers : { &culling.stats, &culling.commands, &culling.counts, &culling.compacted, &culling.visible }) {
+					for (auto &buffer : *buffers)
+						ct::vulkan::destroy_buffer(device, buffer);
+					buffers->clear();
+				}
+				culling.active = false;
+				culling.device = VK_NULL_HANDLE;
+			}
+
+		}
+	}
+}
@@ -0,0 +1,445 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <vulkan/vulkan.h>
+#include "utils/EnvHelper.h"
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace ct {
+	namespace vulkan {
+		namespace host_allocator {
+#define HOST_ALLOCATOR_SCOPE_COUNT 5
+#define HOST_ALLOCATOR_ARENA_SIZE (256 * 1024)
+#define HOST_ALLOCATOR_POOL_CHUNK_SIZE (64 * 1024)
+#define HOST_ALLOCATOR_POOL_CLASS_COUNT 7
+#define HOST_ALLOCATOR_POOL_MIN_BLOCK 64
+#define HOST_ALLOCATOR_MAX_ALIGNMENT 64
+
+			// COMMAND scope allocations live no longer than the vkXxx call that made them -> per thread bump arena.
+			// OBJECT scope allocations are small and churn with object lifetimes -> per thread size class pools.
+			// Everything else, oversized and over-aligned requests go to the heap.
+			enum Kind : uint32_t {
+				KIND_HEAP = 0,
+				KIND_ARENA,
+				KIND_POOL
+			};
+
+			struct Arena;
+			struct Pools;
+
+			// Sits right in front of every pointer handed to the driver
+			struct Header {
+				uint64_t size;
+				uint32_t kind;
+				uint32_t scope;
+				uint32_t offset;		// user pointer - block start
+				uint32_t size_class;
+				Arena *arena;
+				Pools *pools;
+			};
+
+			// live counts the arena's allocations plus one for the thread that bumps it, whoever drops it to zero hands the arena back
+			// to the registry. A driver may free a COMMAND block on another thread after the owning thread exited.
+			struct Arena {
+				char *base = nullptr;
+				size_t offset = 0;
+				std::atomic<uint32_t> live{0};
+			};
+
+			// Only the owning thread pops from free_list. Other threads push the blocks they free onto remote_free, which the owner takes over
+			// in one exchange once its own list of the class runs dry. A thread that exits leaves its pools, blocks and remote frees included,
+			// to the next thread that needs some, so a block freed on any thread is never lost.
+			struct Pools {
+				void *free_list[HOST_ALLOCATOR_POOL_CLASS_COUNT] = {};
+				std::atomic<void*> remote_free[HOST_ALLOCATOR_POOL_CLASS_COUNT] = {};
+			};
+
+			// Arenas and pools no thread owns, taken by the next thread that needs one. Both live for the whole process.
+			struct Registry {
+				std::mutex mutex;
+				std::vector<Arena*> idle;
+				std::vector<Pools*> idle_pools;
+			};
+
+			struct ScopeStats {
+				std::atomic<uint64_t> allocations{0};
+				std::atomic<uint64_t> reallocations{0};
+				std::atomic<uint64_t> frees{0};
+				std::atomic<uint64_t> bytes_live{0};
+				std::atomic<uint64_t> bytes_peak{0};
+				std::atomic<uint64_t> bytes_total{0};
+				std::atomic<uint64_t> internal_allocations{0};
+				std::atomic<uint64_t> internal_bytes_live{0};
+			};
+
+			struct Stats {
+				ScopeStats scope[HOST_ALLOCATOR_SCOPE_COUNT];
+				// Every call of the callbacks that reached the system heap, arena and pool refills included. What the driver allocates without
+				// the callbacks and what the application allocates itself is not seen here.
+				std::atomic<uint64_t> heap_allocations{0};
+			};
+
+			inline Stats& get_stats() {
+				static Stats stats;
+				return stats;
+			}
+
+			inline Registry& get_registry() {
+				static Registry registry;
+				return registry;
+			}
+
+			inline void unref(Arena *arena) {
+				if (arena->live.fetch_sub(1, std::memory_order_acq_rel) != 1)
+					return;
+				Registry &registry = get_registry();
+				std::lock_guard<std::mutex> lock(registry.mutex);
+				registry.idle.push_back(arena);
+			}
+
+			// The thread's reference to its arena, dropped when the thread exits
+			struct ArenaOwner {
+				Arena *arena = nullptr;
+
+				ArenaOwner() {
+					Registry &registry = get_registry();
+					{
+						std::lock_guard<std::mutex> lock(registry.mutex);
+						if (!registry.idle.empty()) {
+							arena = registry.idle.back();
+							registry.idle.pop_back();
+						}
+					}
+					if (arena == nullptr)
+						arena = new Arena();
+					arena->offset = 0;
+					arena->live.store(1, std::memory_order_relaxed);
+				}
+
+				~ArenaOwner() {
+					unref(arena);
+				}
+			};
+
+			inline Arena& get_arena() {
+				thread_local ArenaOwner owner;
+				return *owner.arena;
+			}
+
+			// The pools the calling thread owns, nullptr if it never allocated from a pool or already exited
+			inline Pools*& get_owned_pools() {
+				thread_local Pools *pools = nullptr;
+				return pools;
+			}
+
+			// The thread's pools, handed back to the registry when the thread exits
+			struct PoolsOwner {
+				Pools *pools = nullptr;
+
+				PoolsOwner() {
+					Registry &registry = get_registry();
+					{
+						std::lock_guard<std::mutex> lock(registry.mutex);
+						if (!registry.idle_pools.empty()) {
+							pools = registry.idle_pools.back();
+							registry.idle_pools.pop_back();
+						}
+					}
+					if (pools == nullptr)
+						pools = new Pools();
+					get_owned_pools() = pools;
+				}
+
+				~PoolsOwner() {
+					get_owned_pools() = nullptr;
+					Registry &registry = get_registry();
+					std::lock_guard<std::mutex> lock(registry.mutex);
+					registry.idle_pools.push_back(pools);
+				}
+			};
+
+			inline Pools& get_pools() {
+				thread_local PoolsOwner owner;
+				return *owner.pools;
+			}
+
+			inline size_t align_up(size_t value, size_t alignment) {
+				return (value + alignment - 1) & ~(alignment - 1);
+			}
+
+			inline Header* get_header(void *memory) {
+				return reinterpret_cast<Header*>(static_cast<char*>(memory) - sizeof(Header));
+			}
+
+			inline void* system_alloc(size_t size, size_t alignment) {
+				get_stats().heap_allocations.fetch_add(1, std::memory_order_relaxed);
+#if defined(_WIN32)
+				return _aligned_malloc(size, alignment);
+#else
+				void *memory = nullptr;
+				if (posix_memalign(&memory, std::max(alignment, sizeof(void*)), size) != 0)
+					return nullptr;
+				return memory;
+#endif
+			}
+
+			inline void system_free(void *memory) {
+#if defined(_WIN32)
+				_aligned_free(memory);
+#else
+				std::free(memory);
+#endif
+			}
+
+			// Places the header and the aligned user pointer inside [block, block + capacity)
+			inline void* place(char *block, size_t size, size_t alignment, Kind kind, uint32_t scope, uint32_t size_class, Arena *arena, Pools *pools) {
+				char *user = reinterpret_cast<char*>(align_up(reinterpret_cast<uintptr_t>(block) + sizeof(Header), alignment));
+				Header *header = get_header(user);
+				header->size = size;
+				header->kind = kind;
+				header->scope = scope;
+				header->offset = static_cast<uint32_t>(user - block);
+				header->size_class = size_class;
+				header->arena = arena;
+				header->pools = pools;
+				return user;
+			}
+
+			inline size_t block_size(uint32_t size_class) {
+				return (size_t)HOST_ALLOCATOR_POOL_MIN_BLOCK << size_class;
+			}
+
+			inline void* heap_alloc(size_t size, size_t alignment, uint32_t scope) {
+				size_t capacity = size + sizeof(Header) + alignment;
+				char *block = static_cast<char*>(system_alloc(capacity, alignment));
+				if (block == nullptr)
+					return nullptr;
+				return place(block, size, alignment, KIND_HEAP, scope, 0, nullptr, nullptr);
+			}
+
+			inline void* arena_alloc(size_t size, size_t alignment, uint32_t scope) {
+				Arena &arena = get_arena();
+				if (arena.base == nullptr)
+					arena.base = static_cast<char*>(system_alloc(HOST_ALLOCATOR_ARENA_SIZE, HOST_ALLOCATOR_MAX_ALIGNMENT));
+				// Only the owning thread rewinds, and only once every allocation of the arena is gone (its own reference is left)
+				if (arena.live.load(std::memory_order_acquire) == 1)
+					arena.offset = 0;
+
+				size_t capacity = size + sizeof(Header) + alignment;
+				if (arena.base == nullptr || arena.offset + capacity > HOST_ALLOCATOR_ARENA_SIZE)
+					return heap_alloc(size, alignment, scope);
+
+				char *block = arena.base + arena.offset;
+				arena.offset += capacity;
+				arena.live.fetch_add(1, std::memory_order_relaxed);
+				return place(block, size, alignment, KIND_ARENA, scope, 0, &arena, nullptr);
+			}
+
+			inline void* pool_alloc(size_t size, size_t alignment, uint32_t scope) {
+				size_t capacity = size + sizeof(Header) + alignment;
+				uint32_t size_class = 0;
+				while (size_class < HOST_ALLOCATOR_POOL_CLASS_COUNT && block_size(size_class) < capacity)
+					size_class++;
+				if (size_class == HOST_ALLOCATOR_POOL_CLASS_COUNT)
+					return heap_alloc(size, alignment, scope);
+
+				Pools &pools = get_pools();
+				if (pools.free_list[size_class] == nullptr)
+					pools.free_list[size_class] = pools.remote_free[size_class].exchange(nullptr, std::memory_order_acquire);
+				if (pools.free_list[size_class] == nullptr) {
+					// Refill: carve a fresh chunk into blocks. Chunks live for the whole process.
+					size_t n_blocks = std::max<size_t>(1, HOST_ALLOCATOR_POOL_CHUNK_SIZE / block_size(size_class));
+					char *chunk = static_cast<char*>(system_alloc(n_blocks * block_size(size_class), HOST_ALLOCATOR_MAX_ALIGNMENT));
+					if (chunk == nullptr)
+						return nullptr;
+					for (size_t i = 0; i < n_blocks; i++) {
+						char *block = chunk + i * block_size(size_class);
+						*reinterpret_cast<void**>(block) = pools.free_list[size_class];
+						pools.free_list[size_class] = block;
+					}
+				}
+
+				char *block = static_cast<char*>(pools.free_list[size_class]);
+				pools.free_list[size_class] = *reinterpret_cast<void**>(block);
+				return place(block, size, alignment, KIND_POOL, scope, size_class, nullptr, &pools);
+			}
+
+			inline void release(void *memory) {
+				Header *header = get_header(memory);
+				char *block = static_cast<char*>(memory) - header->offset;
+				switch (header->kind) {
+					case KIND_ARENA:
+						unref(header->arena);
+						break;
+					case KIND_POOL: {
+						// Blocks go back to the pools they came from: straight onto the free list on the owning thread, lock free onto the remote list
+						// from any other. The link overwrites the header, read it first.
+						Pools *pools = header->pools;
+						uint32_t size_class = header->size_class;
+						if (pools == get_owned_pools()) {
+							*reinterpret_cast<void**>(block) = pools->free_list[size_class];
+							pools->free_list[size_class] = block;
+							break;
+						}
+						void *head = pools->remote_free[size_class].load(std::memory_order_relaxed);
+						do {
+							*reinterpret_cast<void**>(block) = head;
+						} while (!pools->remote_free[size_class].compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+						break;
+					}
+					default:
+						system_free(block);
+						break;
+				}
+			}
+
+			inline void track_alloc(uint32_t scope, uint64_t size) {
+				ScopeStats &stats = get_stats().scope[scope];
+				stats.allocations.fetch_add(1, std::memory_order_relaxed);
+				stats.bytes_total.fetch_add(size, std::memory_order_relaxed);
+				uint64_t live = stats.bytes_live.fetch_add(size, std::memory_order_relaxed) + size;
+				uint64_t peak = stats.bytes_peak.load(std::memory_order_relaxed);
+				while (live > peak && !stats.bytes_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+			}
+
+			inline void track_free(uint32_t scope, uint64_t size) {
+				ScopeStats &stats = get_stats().scope[scope];
+				stats.frees.fetch_add(1, std::memory_order_relaxed);
+				stats.bytes_live.fetch_sub(size, std::memory_order_relaxed);
+			}
+
+			inline void* allocate(size_t size, size_t alignment, VkSystemAllocationScope allocation_scope) {
+				uint32_t scope = static_cast<uint32_t>(allocation_scope) % HOST_ALLOCATOR_SCOPE_COUNT;
+				alignment = std::max<size_t>(alignment, alignof(Header));
+
+				void *memory;
+				if (alignment > HOST_ALLOCATOR_MAX_ALIGNMENT)
+					memory = heap_alloc(size, alignment, scope);
+				else if (allocation_scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND)
+					memory = arena_alloc(size, alignment, scope);
+				else if (allocation_scope == VK_SYSTEM_ALLOCATION_SCOPE_OBJECT)
+					memory = pool_alloc(size, alignment, scope);
+				else
+					memory = heap_alloc(size, alignment, scope);
+
+				if (memory != nullptr)
+					track_alloc(scope, size);
+				return memory;
+			}
+
+			inline void deallocate(void *memory) {
+				if (memory == nullptr)
+					return;
+				Header *header = get_header(memory);
+				track_free(header->scope, header->size);
+				release(memory);
+			}
+
+			// -> VkAllocationCallbacks entry points
+			VKAPI_ATTR inline void* VKAPI_CALL vk_allocation(void*, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+				return allocate(size, alignment, scope);
+			}
+
+			VKAPI_ATTR inline void* VKAPI_CALL vk_reallocation(void*, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+				if (original == nullptr)
+					return allocate(size, alignment, scope);
+				if (size == 0) {
+					deallocate(original);
+					return nullptr;
+				}
+
+				Header *header = get_header(original);
+				get_stats().scope[header->scope].reallocations.fetch_add(1, std::memory_order_relaxed);
+
+				// Shrinking or growing inside a pool block keeps the pointer
+				if (header->kind == KIND_POOL && (reinterpret_cast<uintptr_t>(original) & (alignment - 1)) == 0
+						&& header->offset + size <= block_size(header->size_class)) {
+					track_free(header->scope, header->size);
+					track_alloc(header->scope, size);
+					header->size = size;
+					return original;
+				}
+
+				void *memory = allocate(size, alignment, scope);
+				if (memory != nullptr) {
+					std::memcpy(memory, original, std::min<size_t>(size, header->size));
+					deallocate(original);
+				}
+				return memory;
+			}
+
+			VKAPI_ATTR inline void VKAPI_CALL vk_free(void*, void *memory) {
+				deallocate(memory);
+			}
+
+			VKAPI_ATTR inline void VKAPI_CALL vk_internal_allocation(void*, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+				ScopeStats &stats = get_stats().scope[static_cast<uint32_t>(scope) % HOST_ALLOCATOR_SCOPE_COUNT];
+				stats.internal_allocations.fetch_add(1, std::memory_order_relaxed);
+				stats.internal_bytes_live.fetch_add(size, std::memory_order_relaxed);
+			}
+
+			VKAPI_ATTR inline void VKAPI_CALL vk_internal_free(void*, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+				get_stats().scope[static_cast<uint32_t>(scope) % HOST_ALLOCATOR_SCOPE_COUNT].internal_bytes_live.fetch_sub(size, std::memory_order_relaxed);
+			}
+			// <-
+
+			inline std::string scope2string(uint32_t scope) {
+				switch (scope) {
+#define STR(r) case VK_SYSTEM_ALLOCATION_SCOPE_ ##r: return #r
+					STR(COMMAND);
+					STR(OBJECT);
+					STR(CACHE);
+					STR(DEVICE);
+					STR(INSTANCE);
+#undef STR
+					default: return "UNKNOWN_SCOPE";
+				}
+			}
+
+			inline uint64_t get_heap_allocations() {
+				return get_stats().heap_allocations.load(std::memory_order_relaxed);
+			}
+
+			inline void report(std::ostream &os) {
+				Stats &stats = get_stats();
+				os << "host-allocations (scope: count reallocs frees live peak total internal):" << std::endl;
+				for (uint32_t i = 0; i < HOST_ALLOCATOR_SCOPE_COUNT; i++) {
+					ScopeStats &s = stats.scope[i];
+					os << "  " << scope2string(i) << ": " << s.allocations.load() << " " << s.reallocations.load() << " " << s.frees.load()
+						<< " " << s.bytes_live.load() << "B " << s.bytes_peak.load() << "B " << s.bytes_total.load() << "B "
+						<< s.internal_allocations.load() << std::endl;
+				}
+				os << "  heap-allocations: " << stats.heap_allocations.load() << std::endl;
+			}
+
+		}
+
+		// Allocation callbacks for every vkCreate*/vkAllocate* call. CT_HOST_ALLOCATOR=0 hands nullptr to the driver instead.
+		// Decided once, so objects are always destroyed with the callbacks they were created with.
+		inline const VkAllocationCallbacks* get_allocator() {
+			static VkAllocationCallbacks callbacks = {
+				nullptr,
+				ct::vulkan::host_allocator::vk_allocation,
+				ct::vulkan::host_allocator::vk_reallocation,
+				ct::vulkan::host_allocator::vk_free,
+				ct::vulkan::host_allocator::vk_internal_allocation,
+				ct::vulkan::host_allocator::vk_internal_free
+			};
+			static const VkAllocationCallbacks *allocator = ct::env::get_int("CT_HOST_ALLOCATOR", 1) != 0 ? &callbacks : nullptr;
+			return allocator;
+		}
+
+	}
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/Dispatch.h"
+#include "utils/EnvHelper.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace immediate {
+// Operations recorded into one command buffer before it goes out on its own
+#define IMMEDIATE_BATCH_OPERATIONS 64
+// Command buffer and fence pairs kept, beyond that the oldest batch is waited for and reused
+#define IMMEDIATE_MAX_BATCHES 8
+
+			// Names the batch an operation went out in, done once that batch's fence signalled
+			typedef uint64_t Ticket;
+
+			struct Batch {
+				VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+				VkFence fence = VK_NULL_HANDLE;
+				Ticket ticket = 0;
+				bool is_pending = false;
+				// Staging buffers the batch reads, destroyed when it is done
+				std::vector<ct::vulkan::Buffer> retired;
+			};
+
+			// One shot setup and transfer work without a fence, a command buffer and a wait per operation: operations are recorded into
+			// the open batch, which is submitted once full, on flush or when one of its tickets is waited on. Command buffers and fences
+			// are reset and reused. Meant for the thread that sets things up, nothing is locked. Everything goes through the device table
+			// (a capture sees the uploads) straight to the queue, so finish the context before a submission service takes the queue over.
+			struct Context {
+				VkDevice device = VK_NULL_HANDLE;
+				VkQueue queue = VK_NULL_HANDLE;
+				VkCommandPool command_pool = VK_NULL_HANDLE;
+				uint32_t max_operations = IMMEDIATE_BATCH_OPERATIONS;		// CT_IMMEDIATE_BATCH
+				std::vector<Batch> batches;
+				int32_t open = -1;			// batch being recorded
+				uint32_t n_open_operations = 0;
+				Ticket next_ticket = 1;
+
+				uint64_t n_operations = 0;
+				uint64_t n_submits = 0;
+				uint64_t n_waits = 0;
+			};
+
+			// On the graphics queue, with a pool of its own so recycling does not touch logical_device.command_pool
+			inline void setup(ct::vulkan::LogicalDevice &logical_device, Context &context) {
+				context.device = logical_device.device;
+				context.queue = logical_device.queue_graphics;
+				context.max_operations = (uint32_t)std::max(1L, ct::env::get_int("CT_IMMEDIATE_BATCH", IMMEDIATE_BATCH_OPERATIONS));
+				ct::vulkan::create_command_pool(context.device, logical_device.queue_family_indices.graphics, context.command_pool);
+				context.batches.reserve(IMMEDIATE_MAX_BATCHES);
+			}
+
+			inline void recycle(Batch &batch, Context &context) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VK_CHECK_RESULT(dispatch.vkResetFences(context.device, 1, &batch.fence));
+				for (auto &buffer : batch.retired)
+					ct::vulkan::destroy_buffer(context.device, buffer);
+				batch.retired.clear();
+				batch.is_pending = false;
+			}
+
+			// Recycles every pending batch that is done, without waiting
+			inline void collect(Context &context) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				for (auto &batch : context.batches) {
+					if (batch.is_pending && dispatch.vkGetFenceStatus(context.device, batch.fence) == VK_SUCCESS)
+						recycle(batch, context);
+				}
+			}
+
+			// A batch that is neither pending nor open: a recycled one, a new one while under IMMEDIATE_MAX_BATCHES, else the oldest once done
+			inline uint32_t acquire(Context &context) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				collect(context);
+				for (uint32_t i = 0; i < context.batches.size(); i++) {
+					if (!context.batches[i].is_pending)
+						return i;
+				}
+				if (context.batches.size() < IMMEDIATE_MAX_BATCHES) {
+					Batch batch;
+					VkCommandBufferAllocateInfo allocateInfo = {};
+					allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+					allocateInfo.commandPool = context.command_pool;
+					allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+					allocateInfo.commandBufferCount = 1;
+					VK_CHECK_RESULT(dispatch.vkAllocateCommandBuffers(context.device, &allocateInfo, &batch.command_buffer));
+					VkFenceCreateInfo fenceCreateInfo = {};
+					fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+					VK_CHECK_RESULT(dispatch.vkCreateFence(context.device, &fenceCreateInfo, ct::vulkan::get_allocator(), &batch.fence));
+					context.batches.push_back(batch);
+					return (uint32_t)context.batches.size() - 1;
+				}
+				uint32_t oldest = 0;
+				for (uint32_t i = 1; i < context.batches.size(); i++) {
+					if (context.batches[i].ticket < context.batches[oldest].ticket)
+						oldest = i;
+				}
+				Batch &batch = context.batches[oldest];
+				VK_CHECK_RESULT(dispatch.vkWaitForFences(context.device, 1, &batch.fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+				context.n_waits++;
+				recycle(batch, context);
+				return oldest;
+			}
+
+			// Submits the open batch, if any
+			inline void flush(Context &context) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (context.open < 0)
+					return;
+				Batch &batch = context.batches[context.open];
+				VK_CHECK_RESULT(dispatch.vkEndCommandBuffer(batch.command_buffer));
+				VkSubmitInfo submitInfo = {};
+				submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+				submitInfo.commandBufferCount = 1;
+				submitInfo.pCommandBuffers = &batch.command_buffer;
+				VK_CHECK_RESULT(dispatch.vkQueueSubmit(context.queue, 1, &submitInfo, batch.fence));
+				batch.is_pending = true;
+				context.open = -1;
+				context.n_open_operations = 0;
+				context.n_submits++;
+			}
+
+			// The open batch's command buffer to record one operation into, close it with end()
+			inline VkCommandBuffer begin(Context &context) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (context.open < 0) {
+					context.open = (int32_t)acquire(context);
+					Batch &batch = context.batches[context.open];
+					batch.ticket = context.next_ticket++;
+					VkCommandBufferBeginInfo cmdBufInfo = {};
+					cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+					cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+					VK_CHECK_RESULT(dispatch.vkBeginCommandBuffer(batch.command_buffer, &cmdBufInfo));
+				}
+				return context.batches[context.open].command_buffer;
+			}
+
+			// Destroys buffer once the open batch is done, for staging memory the operation just recorded reads
+			inline void retire(const ct::vulkan::Buffer &buffer, Context &context) {
+				assert(context.open >= 0);
+				context.batches[context.open].retired.push_back(buffer);
+			}
+
+			// Ends the operation begin() handed out a command buffer for, the batch goes out once it holds max_operations
+			inline Ticket end(Context &context) {
+				assert(context.open >= 0);
+				Ticket ticket = context.batches[context.open].ticket;
+				context.n_operations++;
+				if (++context.n_open_operations >= context.max_operations)
+					flush(context);
+				return ticket;
+			}
+
+			inline bool is_done(Ticket ticket, Context &context) {
+				if (context.open >= 0 && context.batches[context.open].ticket <= ticket)
+					return false;
+				collect(context);
+				for (auto &batch : context.batches) {
+					if (batch.is_pending && batch.ticket <= ticket)
+						return false;
+				}
+				return true;
+			}
+
+			// Blocks until the batch of ticket and every batch before it are done, the open batch goes out first if it is one of them
+			inline void wait(Ticket ticket, Context &context) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (context.open >= 0 && context.batches[context.open].ticket <= ticket)
+					flush(context);
+				std::vector<VkFence> fences;
+				for (auto &batch : context.batches) {
+					if (batch.is_pending && batch.ticket <= ticket)
+						fences.push_back(batch.fence);
+				}
+				if (fences.empty())
+					return;
+				VK_CHECK_RESULT(dispatch.vkWaitForFences(context.device, (uint32_t)fences.size(), fences.data(), VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+				context.n_waits++;
+				for (auto &batch : context.batches) {
+					if (batch.is_pending && batch.ticket <= ticket)
+						recycle(batch, context);
+				}
+			}
+
+			// Everything recorded so far is done, before frames use what setup uploaded
+			inline void finish(Context &context) {
+				wait(context.next_ticket - 1, context);
+			}
+
+			inline void report(std::ostream &os, Context &context) {
+				os << "immediate: operations: " << context.n_operations << " submits: " << context.n_submits << " waits: " << context.n_waits
+					<< " command buffers: " << context.batches.size() << std::endl;
+			}
+
+			inline void destroy(Context &context) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (context.device == VK_NULL_HANDLE)
+					return;
+				finish(context);
+				for (auto &batch : context.batches)
+					dispatch.vkDestroyFence(context.device, batch.fence, ct::vulkan::get_allocator());
+				context.batches.clear();
+				dispatch.vkDestroyCommandPool(context.device, context.command_pool, ct::vulkan::get_allocator());
+				context.command_pool = VK_NULL_HANDLE;
+				context.device = VK_NULL_HANDLE;
+			}
+
+		}
+	}
+}
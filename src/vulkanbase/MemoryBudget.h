@@ -0,0 +1,168 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/MemoryLedger.h"
+#include "utils/EnvHelper.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace memory {
+// Without VK_EXT_memory_budget the budget is this share of the heap, the rest is left to other processes and the driver
+#define MEMORY_FALLBACK_BUDGET 0.8
+#define MEMORY_MB (1024.0 * 1024.0)
+
+			struct Heap {
+				VkDeviceSize size = 0;
+				bool is_device_local = false;
+				// What the process may use and uses, from the extension or our own accounting
+				VkDeviceSize budget = 0;
+				VkDeviceSize usage = 0;
+				// Our own accounting per category, swapchain images estimated
+				VkDeviceSize bytes[MEMORY_CATEGORY_COUNT] = {};
+				bool is_pressured = false;
+			};
+
+			// Pressure is reported once per crossing of warn_fraction of a heap's budget, by on_pressure if set and a printed warning otherwise.
+			// Allocation decisions ask fits() before they allocate big things.
+			struct Budget {
+				bool has_extension = false;
+				VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+				VkPhysicalDeviceMemoryProperties properties = {};
+				double warn_fraction = 0.9;		// CT_MEMORY_WARN
+				std::vector<Heap> heaps;
+				std::function<void(uint32_t heap, const Heap&)> on_pressure;
+				uint32_t n_pressure = 0;
+
+				// -> swapchain images are allocated by the presentation engine, estimated from their size
+				uint32_t swapchain_heap = 0;
+				VkDeviceSize swapchain_bytes = 0;
+				// <-
+			};
+
+			// Enables VK_EXT_memory_budget if the device has it, call before create_device
+			inline bool request(ct::vulkan::LogicalDevice &logical_device, Budget &budget) {
+				budget.has_extension = ct::vulkan::is_device_extension_supported(logical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+				if (budget.has_extension)
+					logical_device.extensions_enabled.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+				return budget.has_extension;
+			}
+
+			inline void update(Budget &budget);
+
+			inline void connect(ct::vulkan::LogicalDevice &logical_device, Budget &budget) {
+				budget.physical_device = logical_device.physical_device;
+				budget.properties = logical_device.memory_properties;
+				budget.warn_fraction = std::min(1.0, std::max(0.0, ct::env::get_double("CT_MEMORY_WARN", budget.warn_fraction)));
+				budget.heaps.assign(budget.properties.memoryHeapCount, Heap());
+				for (uint32_t h = 0; h < budget.properties.memoryHeapCount; h++) {
+					budget.heaps[h].size = budget.properties.memoryHeaps[h].size;
+					budget.heaps[h].is_device_local = (budget.properties.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+				}
+				update(budget);
+				std::cout << "memory-budget: " << (budget.has_extension ? "VK_EXT_memory_budget" : "own accounting") << " heaps: " << budget.heaps.size() << std::endl;
+			}
+
+			// The presentation engine's images count against the first device local heap, one 4 byte texel per pixel
+			inline void track_swapchain(uint32_t imagecount, uint32_t width, uint32_t height, Budget &budget) {
+				budget.swapchain_bytes = (VkDeviceSize)imagecount * width * height * 4;
+				budget.swapchain_heap = 0;
+				for (uint32_t h = 0; h < budget.heaps.size(); h++) {
+					if (budget.heaps[h].is_device_local) {
+						budget.swapchain_heap = h;
+						break;
+					}
+				}
+			}
+
+			// Once per frame: reads the budget (a cheap physical device query), attributes our allocations and reports heaps crossing warn_fraction
+			inline void update(Budget &budget) {
+				if (budget.physical_device == VK_NULL_HANDLE)
+					return;
+				VkDeviceSize bytes[VK_MAX_MEMORY_TYPES][MEMORY_CATEGORY_COUNT];
+				get_bytes(bytes);
+				for (auto &heap : budget.heaps)
+					std::fill(heap.bytes, heap.bytes + MEMORY_CATEGORY_COUNT, 0);
+				for (uint32_t t = 0; t < budget.properties.memoryTypeCount; t++) {
+					Heap &heap = budget.heaps[budget.properties.memoryTypes[t].heapIndex];
+					for (uint32_t c = 0; c < MEMORY_CATEGORY_COUNT; c++)
+						heap.bytes[c] += bytes[t][c];
+				}
+				if (!budget.heaps.empty())
+					budget.heaps[budget.swapchain_heap].bytes[SWAPCHAIN] += budget.swapchain_bytes;
+
+				VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+				budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+				if (budget.has_extension) {
+					VkPhysicalDeviceMemoryProperties2 properties2 = {};
+					properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+					properties2.pNext = &budgetProperties;
+					vkGetPhysicalDeviceMemoryProperties2(budget.physical_device, &properties2);
+				}
+
+				for (uint32_t h = 0; h < budget.heaps.size(); h++) {
+					Heap &heap = budget.heaps[h];
+					if (budget.has_extension) {
+						heap.budget = budgetProperties.heapBudget[h];
+						heap.usage = budgetProperties.heapUsage[h];
+					} else {
+						heap.budget = (VkDeviceSize)(heap.size * MEMORY_FALLBACK_BUDGET);
+						heap.usage = 0;
+						for (uint32_t c = 0; c < MEMORY_CATEGORY_COUNT; c++)
+							heap.usage += heap.bytes[c];
+					}
+					bool is_pressured = heap.budget > 0 && heap.usage >= heap.budget * budget.warn_fraction;
+					if (is_pressured && !heap.is_pressured) {
+						budget.n_pressure++;
+						if (budget.on_pressure) {
+							budget.on_pressure(h, heap);
+						} else {
+							std::cout << "memory-budget: warning: heap " << h << " at " << heap.usage / MEMORY_MB << " of " << heap.budget / MEMORY_MB << " MB" << std::endl;
+						}
+					}
+					heap.is_pressured = is_pressured;
+				}
+			}
+
+			// Room left in the heap of memory_type before the budget is reached
+			inline VkDeviceSize get_headroom(uint32_t memory_type, Budget &budget) {
+				if (budget.heaps.empty())
+					return UINT64_MAX;
+				Heap &heap = budget.heaps[budget.properties.memoryTypes[memory_type].heapIndex];
+				return heap.usage < heap.budget ? heap.budget - heap.usage : 0;
+			}
+
+			// Whether size more bytes of memory with properties stay below warn_fraction of the budget, for callers that can evict or downscale instead
+			inline bool fits(VkDeviceSize size, VkMemoryPropertyFlags properties, Budget &budget) {
+				if (budget.heaps.empty())
+					return true;
+				for (uint32_t t = 0; t < budget.properties.memoryTypeCount; t++) {
+					if ((budget.properties.memoryTypes[t].propertyFlags & properties) != properties)
+						continue;
+					Heap &heap = budget.heaps[budget.properties.memoryTypes[t].heapIndex];
+					return heap.usage + size <= heap.budget * budget.warn_fraction;
+				}
+				return false;
+			}
+
+			inline void report(std::ostream &os, Budget &budget) {
+				for (uint32_t h = 0; h < budget.heaps.size(); h++) {
+					Heap &heap = budget.heaps[h];
+					os << "memory-heap " << h << (heap.is_device_local ? " (device-local)" : "") << ": usage: " << heap.usage / MEMORY_MB << " MB budget: " << heap.budget / MEMORY_MB
+						<< " MB size: " << heap.size / MEMORY_MB << " MB";
+					for (uint32_t c = 0; c < MEMORY_CATEGORY_COUNT; c++)
+						os << " " << category2string((Category)c) << ": " << heap.bytes[c] / MEMORY_MB;
+					os << std::endl;
+				}
+				if (budget.n_pressure > 0)
+					os << "memory-budget: pressure warnings: " << budget.n_pressure << std::endl;
+			}
+
+		}
+	}
+}
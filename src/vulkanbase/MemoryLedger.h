@@ -0,0 +1,91 @@
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+#include <vulkan/vulkan.h>
+
+namespace ct {
+	namespace vulkan {
+		namespace memory {
+#define MEMORY_CATEGORY_COUNT 5
+
+			// What an allocation is for. SWAPCHAIN covers colour targets at swapchain size, the swapchain images themselves are estimated by the budget.
+			// TRANSIENT is the aliased memory of the transient pool, whatever the resources in it are.
+			enum Category {
+				DEPTH,
+				SWAPCHAIN,
+				STAGING,
+				BUFFER,
+				TRANSIENT
+			};
+
+			inline const char* category2string(Category category) {
+				switch (category) {
+#define STR(r) case r: return #r
+					STR(DEPTH);
+					STR(SWAPCHAIN);
+					STR(STAGING);
+					STR(BUFFER);
+					STR(TRANSIENT);
+#undef STR
+					default: return "UNKNOWN_CATEGORY";
+				}
+			}
+
+			struct Allocation {
+				uint32_t memory_type;
+				VkDeviceSize size;
+				Category category;
+			};
+
+			// Our own account of every vkAllocateMemory the helpers make, per memory type and category.
+			// The budget falls back to it without VK_EXT_memory_budget, and it is what attributes usage to categories either way.
+			struct Ledger {
+				std::mutex mutex;
+				std::unordered_map<VkDeviceMemory, Allocation> allocations;
+				VkDeviceSize bytes[VK_MAX_MEMORY_TYPES][MEMORY_CATEGORY_COUNT] = {};
+				uint64_t n_allocations = 0;
+				uint64_t n_frees = 0;
+			};
+
+			inline Ledger& get_ledger() {
+				static Ledger ledger;
+				return ledger;
+			}
+
+			inline void track(VkDeviceMemory memory, uint32_t memory_type, VkDeviceSize size, Category category) {
+				Ledger &ledger = get_ledger();
+				std::lock_guard<std::mutex> lock(ledger.mutex);
+				ledger.allocations[memory] = { memory_type, size, category };
+				ledger.bytes[memory_type][category] += size;
+				ledger.n_allocations++;
+			}
+
+			// Call before vkFreeMemory, the handle may be reused right after
+			inline void untrack(VkDeviceMemory memory) {
+				if (memory == VK_NULL_HANDLE)
+					return;
+				Ledger &ledger = get_ledger();
+				std::lock_guard<std::mutex> lock(ledger.mutex);
+				auto it = ledger.allocations.find(memory);
+				if (it == ledger.allocations.end())
+					return;
+				ledger.bytes[it->second.memory_type][it->second.category] -= it->second.size;
+				ledger.allocations.erase(it);
+				ledger.n_frees++;
+			}
+
+			// Copy of the per memory type totals, so readers do not hold the lock
+			inline void get_bytes(VkDeviceSize bytes[VK_MAX_MEMORY_TYPES][MEMORY_CATEGORY_COUNT]) {
+				Ledger &ledger = get_ledger();
+				std::lock_guard<std::mutex> lock(ledger.mutex);
+				for (uint32_t t = 0; t < VK_MAX_MEMORY_TYPES; t++)
+					for (uint32_t c = 0; c < MEMORY_CATEGORY_COUNT; c++)
+						bytes[t][c] = ledger.bytes[t][c];
+			}
+
+		}
+	}
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "utils/ErrorHelper.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace multidevice {
+#define MULTIDEVICE_FRAMES_IN_FLIGHT 2
+
+			// One worker owns everything it touches: its own logical device, offscreen targets and fences.
+			// Workers never talk to each other while rendering, results are only gathered after join.
+			struct Worker {
+				uint32_t index;
+				uint32_t width;
+				uint32_t height;
+
+				ct::vulkan::LogicalDevice logical_device;
+				ct::vulkan::Framebuffer framebuffer;
+				ct::vulkan::Synchronization synchronization;
+				std::vector<ct::vulkan::ColorAttachment> targets;
+				std::vector<ct::vulkan::Buffer> readback;
+				std::vector<uint32_t> slot_frame;
+
+				// -> results
+				std::vector<uint32_t> frame_ids;
+				std::vector<uint32_t> frame_texels;
+				double ms_total = 0;
+				// <-
+			};
+
+			// Frames are handed out round robin: frame i belongs to worker i % n_workers
+			inline uint32_t n_frames_of_worker(uint32_t worker_index, uint32_t n_workers, uint32_t n_frames) {
+				return n_frames / n_workers + (worker_index < n_frames % n_workers ? 1 : 0);
+			}
+
+			inline void setup_worker(uint32_t index, uint32_t width, uint32_t height, VkPhysicalDevice physical_device, Worker &worker) {
+				worker.index = index;
+				worker.width = width;
+				worker.height = height;
+
+				ct::vulkan::pick_gpu(physical_device, worker.logical_device);
+				ct::vulkan::create_device(worker.logical_device, false);
+				ct::vulkan::create_queues(worker.logical_device, worker.logical_device.queue_graphics, worker.logical_device.queue_compute);
+				ct::vulkan::create_command_pool(worker.logical_device.device, worker.logical_device.queue_family_indices.graphics, worker.logical_device.command_pool);
+				ct::vulkan::create_command_buffer(MULTIDEVICE_FRAMES_IN_FLIGHT, worker.logical_device.device, worker.logical_device.command_pool, worker.logical_device.command_buffer);
+				ct::vulkan::create_synchronization(worker.logical_device.device, worker.logical_device.command_buffer, worker.synchronization);
+
+				// -> offscreen targets, one per frame in flight
+				VkFormat color_format = VK_FORMAT_R8G8B8A8_UNORM;
+				VkColorSpaceKHR color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+				worker.targets.resize(MULTIDEVICE_FRAMES_IN_FLIGHT);
+				worker.readback.resize(MULTIDEVICE_FRAMES_IN_FLIGHT);
+				worker.slot_frame.assign(MULTIDEVICE_FRAMES_IN_FLIGHT, UINT32_MAX);
+				std::vector<VkImageView> views(MULTIDEVICE_FRAMES_IN_FLIGHT);
+				for (uint32_t i = 0; i < MULTIDEVICE_FRAMES_IN_FLIGHT; i++) {
+					ct::vulkan::setup_color_attachment(width, height, color_format, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, worker.logical_device.device,
+							worker.logical_device.memory_properties, worker.targets[i]);
+					ct::vulkan::create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+							worker.logical_device.device, worker.logical_device.memory_properties, worker.readback[i]);
+					views[i] = worker.targets[i].view;
+				}
+				// <-
+
+				ct::vulkan::setup_depth_stencil(width, height, worker.logical_device.physical_device, worker.logical_device.device, worker.logical_device.memory_properties,
+						worker.framebuffer.depth_stencil);
+				ct::vulkan::setup_render_pass(color_format, worker.framebuffer.depth_stencil.depth_format, worker.logical_device.device, worker.framebuffer.render_pass,
+						VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+				ct::vulkan::setup_framebuffer_from_swapchain(width, height, MULTIDEVICE_FRAMES_IN_FLIGHT, worker.logical_device.device, views, color_format, color_space,
+						worker.framebuffer);
+			}
+
+			inline void build_command_buffer(uint32_t frame_id, uint32_t slot, Worker &worker) {
+				VkCommandBuffer command_buffer = worker.logical_device.command_buffer[slot];
+
+				VkCommandBufferBeginInfo cmdBufInfo = {};
+				cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+				// Encode the frame id into the clear colour so gathered frames can be verified
+				VkClearValue clearValues[2];
+				clearValues[0].color = { { (frame_id & 0xff) / 255.0f, 0.3f, 0.5f, 1.0f } };
+				clearValues[1].depthStencil = { 1.0f, 0 };
+
+				VkRenderPassBeginInfo renderPassBeginInfo = {};
+				renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+				renderPassBeginInfo.renderPass = worker.framebuffer.render_pass;
+				renderPassBeginInfo.framebuffer = worker.framebuffer.framebuffer[slot];
+				renderPassBeginInfo.renderArea.offset = { 0, 0 };
+				renderPassBeginInfo.renderArea.extent = { worker.width, worker.height };
+				renderPassBeginInfo.clearValueCount = 2;
+				renderPassBeginInfo.pClearValues = clearValues;
+
+				VK_CHECK_RESULT(vkBeginCommandBuffer(command_buffer, &cmdBufInfo));
+				vkCmdBeginRenderPass(command_buffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+				vkCmdEndRenderPass(command_buffer);
+
+				// The render pass leaves the colour target in TRANSFER_SRC_OPTIMAL and its external dependency orders the clear before the copy
+				VkBufferImageCopy region = {};
+				region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				region.imageSubresource.layerCount = 1;
+				region.imageExtent = { 1, 1, 1 };
+				vkCmdCopyImageToBuffer(command_buffer, worker.targets[slot].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, worker.readback[slot].buffer, 1, &region);
+
+				// collect_slot reads the texel on the host once the slot's fence signalled
+				VkBufferMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.buffer = worker.readback[slot].buffer;
+				barrier.offset = 0;
+				barrier.size = VK_WHOLE_SIZE;
+				vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+				VK_CHECK_RESULT(vkEndCommandBuffer(command_buffer));
+			}
+
+			inline void collect_slot(uint32_t slot, Worker &worker) {
+				if (worker.slot_frame[slot] == UINT32_MAX)
+					return;
+				worker.frame_ids.push_back(worker.slot_frame[slot]);
+				worker.frame_texels.push_back(*static_cast<uint32_t*>(worker.readback[slot].mapped));
+				worker.slot_frame[slot] = UINT32_MAX;
+			}
+
+			// Frame loop of a single worker. Runs on its own thread and only touches its own worker.
+			inline void run_worker(uint32_t n_workers, uint32_t n_frames, Worker &worker) {
+				VkDevice device = worker.logical_device.device;
+				uint32_t n_own = n_frames_of_worker(worker.index, n_workers, n_frames);
+				worker.frame_ids.reserve(n_own);
+				worker.frame_texels.reserve(n_own);
+
+				auto t0 = std::chrono::high_resolution_clock::now();
+				for (uint32_t i = 0; i < n_own; i++) {
+					uint32_t frame_id = worker.index + i * n_workers;
+					uint32_t slot = i % MULTIDEVICE_FRAMES_IN_FLIGHT;
+
+					VK_CHECK_RESULT(vkWaitForFences(device, 1, &worker.synchronization.wait_fences[slot], VK_TRUE, UINT64_MAX));
+					VK_CHECK_RESULT(vkResetFences(device, 1, &worker.synchronization.wait_fences[slot]));
+					collect_slot(slot, worker);
+
+					build_command_buffer(frame_id, slot, worker);
+
+					VkSubmitInfo submitInfo = {};
+					submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+					submitInfo.commandBufferCount = 1;
+					submitInfo.pCommandBuffers = &worker.logical_device.command_buffer[slot];
+					VK_CHECK_RESULT(vkQueueSubmit(worker.logical_device.queue_graphics, 1, &submitInfo, worker.synchronization.wait_fences[slot]));
+					worker.slot_frame[slot] = frame_id;
+				}
+
+				// -> drain frames still in flight
+				VK_CHECK_RESULT(vkWaitForFences(device, MULTIDEVICE_FRAMES_IN_FLIGHT, worker.synchronization.wait_fences.data(), VK_TRUE, UINT64_MAX));
+				for (uint32_t slot = 0; slot < MULTIDEVICE_FRAMES_IN_FLIGHT; slot++)
+					collect_slot(slot, worker);
+				// <-
+
+				worker.ms_total = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+			}
+
+			inline void run(uint32_t n_frames, std::vector<Worker> &workers) {
+				std::vector<std::thread> threads;
+				threads.reserve(workers.size());
+				for (auto &worker : workers)
+					threads.emplace_back(run_worker, static_cast<uint32_t>(workers.size()), n_frames, std::ref(worker));
+				for (auto &thread : threads)
+					thread.join();
+			}
+
+			// Gathers the per worker results back into frame order. Returns the number of frames whose texel did not match.
+			inline uint32_t gather(uint32_t n_frames, std::vector<Worker> &workers, std::vector<uint32_t> &frame_texels) {
+				frame_texels.assign(n_frames, 0);
+				uint32_t n_mismatch = 0;
+				for (auto &worker : workers) {
+					for (std::size_t i = 0; i < worker.frame_ids.size(); i++) {
+						uint32_t frame_id = worker.frame_ids[i];
+						frame_texels[frame_id] = worker.frame_texels[i];
+						// R8G8B8A8: red lives in the lowest byte
+						if ((frame_texels[frame_id] & 0xff) != (frame_id & 0xff))
+							n_mismatch++;
+					}
+					std::cout << "worker: " << worker.index << " device: " << worker.logical_device.properties.deviceName
+						<< " frames: " << worker.frame_ids.size() << " ms: " << worker.ms_total << std::endl;
+				}
+				return n_mismatch;
+			}
+
+			// Workers are drained once run() returns, so nothing is in flight anymore
+			inline void destroy_worker(Worker &worker) {
+				VkDevice &device = worker.logical_device.device;
+				for (auto &target : worker.targets)
+					ct::vulkan::destroy_color_attachment(device, target);
+				for (auto &buffer : worker.readback)
+					ct::vulkan::destroy_buffer(device, buffer);
+				ct::vulkan::destroy_framebuffer(device, worker.framebuffer);
+				ct::vulkan::destroy_synchronization(device, worker.synchronization);
+				ct::vulkan::destroy_device(worker.logical_device);
+			}
+
+		}
+	}
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/Dispatch.h"
+#include "utils/EnvHelper.h"
+#include "utils/JobSystem.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace recording {
+#define RECORDING_HASH_SEED 14695981039346656037ull
+#define RECORDING_HASH_PRIME 1099511628211ull
+
+			struct Chunk {
+				VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+				bool is_dirty = true;
+			};
+
+			// Chunks are dealt round robin over lanes, each lane with a command pool of its own. One job records one lane's chunks,
+			// so a pool is only ever used by one thread at a time.
+			struct Lane {
+				VkCommandPool command_pool = VK_NULL_HANDLE;
+				std::chrono::steady_clock::time_point t_begin;
+				double ms_recording = 0.0;
+				uint64_t n_hits = 0;
+				uint64_t n_misses = 0;
+			};
+
+			// A pass split into chunks, each chunk a secondary command buffer per frame slot that is kept until it is marked dirty: by invalidate
+			// when what it draws changed, by begin_slot when what every chunk of the slot shares (target, per slot buffers) changed.
+			// The primary is recorded again whenever it is needed and only executes the chunks, so recording costs what changed instead
+			// of what is drawn, finding what changed included. CT_RECORD_CHUNKS=0 (default) records everything inline as before.
+			struct Cache {
+				VkDevice device = VK_NULL_HANDLE;
+				uint32_t n_chunks = 0;			// CT_RECORD_CHUNKS
+				uint32_t n_slots = 0;
+				std::vector<Lane> lanes;		// one per core the job system has, at most one per chunk
+				std::vector<Chunk> chunks;		// slot * n_chunks + chunk
+				std::vector<uint64_t> slot_hashes;
+				std::vector<VkCommandBuffer> executed;
+			};
+
+			// FNV-1a, seed chains the parts of one chunk
+			inline uint64_t hash(const void *data, size_t size, uint64_t seed = RECORDING_HASH_SEED) {
+				const unsigned char *bytes = static_cast<const unsigned char*>(data);
+				for (size_t i = 0; i < size; i++)
+					seed = (seed ^ bytes[i]) * RECORDING_HASH_PRIME;
+				return seed;
+			}
+
+			template <typename T>
+			inline uint64_t hash(const T &value, uint64_t seed) {
+				return hash(&value, sizeof(T), seed);
+			}
+
+			inline bool is_active(Cache *cache) {
+				return cache != nullptr && cache->n_chunks > 0;
+			}
+
+			// Items (draws) [get_first(chunk), get_first(chunk + 1)) make up the chunk
+			inline uint32_t get_first(uint32_t chunk, uint32_t n_items, Cache &cache) {
+				return (uint32_t)((uint64_t)chunk * n_items / cache.n_chunks);
+			}
+
+			inline uint32_t get_chunk(uint32_t item, uint32_t n_items, Cache &cache) {
+				return (uint32_t)((((uint64_t)item + 1) * cache.n_chunks - 1) / n_items);
+			}
+
+			inline uint32_t get_lane(uint32_t chunk, Cache &cache) {
+				return chunk % (uint32_t)cache.lanes.size();
+			}
+
+			// Up to max_chunks chunks (a chunk needs something to record) for each of n_slots frame slots.
+			// With a job system the chunks get one lane per core, so they can be recorded in parallel.
+			inline void setup(uint32_t n_slots, uint32_t max_chunks, ct::vulkan::LogicalDevice &logical_device, Cache &cache, ct::jobs::JobSystem *jobs = nullptr) {
+				cache.n_chunks = (uint32_t)std::min((long)max_chunks, std::max(0L, ct::env::get_int("CT_RECORD_CHUNKS", 0)));
+				if (cache.n_chunks == 0)
+					return;
+				cache.device = logical_device.device;
+				cache.n_slots = n_slots;
+				cache.lanes.resize(std::min(cache.n_chunks, jobs != nullptr ? jobs->n_workers + 1 : 1));
+				cache.chunks.assign(n_slots * cache.n_chunks, Chunk());
+				cache.slot_hashes.assign(n_slots, 0);
+				for (uint32_t lane = 0; lane < cache.lanes.size(); lane++) {
+					ct::vulkan::create_command_pool(cache.device, logical_device.queue_family_indices.graphics, cache.lanes[lane].command_pool);
+					// The lane's chunks of every slot
+					std::vector<uint32_t> indices;
+					for (uint32_t slot = 0; slot < n_slots; slot++)
+						for (uint32_t chunk = lane; chunk < cache.n_chunks; chunk += (uint32_t)cache.lanes.size())
+							indices.push_back(slot * cache.n_chunks + chunk);
+
+					std::vector<VkCommandBuffer> command_buffers(indices.size());
+					VkCommandBufferAllocateInfo allocateInfo = {};
+					allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+					allocateInfo.commandPool = cache.lanes[lane].command_pool;
+					allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+					allocateInfo.commandBufferCount = (uint32_t)command_buffers.size();
+					VK_CHECK_RESULT(ct::vulkan::dispatch::get_device().vkAllocateCommandBuffers(cache.device, &allocateInfo, command_buffers.data()));
+					for (uint32_t i = 0; i < indices.size(); i++)
+						cache.chunks[indices[i]].command_buffer = command_buffers[i];
+				}
+				cache.executed.resize(cache.n_chunks);
+				std::cout << "recording: chunks: " << cache.n_chunks << " slots: " << n_slots << " lanes: " << cache.lanes.size() << std::endl;
+			}
+
+			// What a chunk draws changed, it is recorded again in every slot
+			inline void invalidate(uint32_t chunk, Cache &cache) {
+				for (uint32_t slot = 0; slot < cache.n_slots; slot++)
+					cache.chunks[slot * cache.n_chunks + chunk].is_dirty = true;
+			}
+
+			// Call before the slot's chunks are recorded, with a hash of everything its chunks share. Marks all of them dirty if it changed.
+			inline void begin_slot(uint32_t slot, uint64_t hash, Cache &cache) {
+				if (cache.slot_hashes[slot] == hash)
+					return;
+				cache.slot_hashes[slot] = hash;
+				for (uint32_t chunk = 0; chunk < cache.n_chunks; chunk++)
+					cache.chunks[slot * cache.n_chunks + chunk].is_dirty = true;
+			}
+
+			// The chunk's secondary for slot, begun inside render_pass and ready to record, if it is dirty.
+			// VK_NULL_HANDLE when the recorded one still holds. The slot's frame fence must have been waited for.
+			// Only the thread recording the chunk's lane may call it.
+			inline VkCommandBuffer begin(uint32_t chunk, uint32_t slot, VkRenderPass render_pass, VkFramebuffer framebuffer, Cache &cache) {
+				Chunk &c = cache.chunks[slot * cache.n_chunks + chunk];
+				Lane &lane = cache.lanes[get_lane(chunk, cache)];
+				if (!c.is_dirty) {
+					lane.n_hits++;
+					return VK_NULL_HANDLE;
+				}
+				lane.n_misses++;
+				c.is_dirty = false;
+				lane.t_begin = std::chrono::steady_clock::now();
+
+				VkCommandBufferInheritanceInfo inheritanceInfo = {};
+				inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+				inheritanceInfo.renderPass = render_pass;
+				inheritanceInfo.subpass = 0;
+				inheritanceInfo.framebuffer = framebuffer;
+				VkCommandBufferBeginInfo cmdBufInfo = {};
+				cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+				cmdBufInfo.pInheritanceInfo = &inheritanceInfo;
+				VK_CHECK_RESULT(ct::vulkan::dispatch::get_device().vkBeginCommandBuffer(c.command_buffer, &cmdBufInfo));
+				return c.command_buffer;
+			}
+
+			inline void end(uint32_t chunk, VkCommandBuffer command_buffer, Cache &cache) {
+				Lane &lane = cache.lanes[get_lane(chunk, cache)];
+				VK_CHECK_RESULT(ct::vulkan::dispatch::get_device().vkEndCommandBuffer(command_buffer));
+				lane.ms_recording += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lane.t_begin).count();
+			}
+
+			// Inside a render pass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+			inline void execute(VkCommandBuffer command_buffer, uint32_t slot, Cache &cache) {
+				for (uint32_t i = 0; i < cache.n_chunks; i++)
+					cache.executed[i] = cache.chunks[slot * cache.n_chunks + i].command_buffer;
+				ct::vulkan::dispatch::get_device().vkCmdExecuteCommands(command_buffer, cache.n_chunks, cache.executed.data());
+			}
+
+			inline void report(std::ostream &os, Cache &cache) {
+				if (cache.n_chunks == 0)
+					return;
+				uint64_t n_hits = 0;
+				uint64_t n_misses = 0;
+				double ms_recording = 0.0;
+				for (auto &lane : cache.lanes) {
+					n_hits += lane.n_hits;
+					n_misses += lane.n_misses;
+					ms_recording += lane.ms_recording;
+					lane.n_hits = 0;
+					lane.n_misses = 0;
+					lane.ms_recording = 0.0;
+				}
+				uint64_t n = n_hits + n_misses;
+				os << "recording: chunks hit: " << n_hits << " missed: " << n_misses << " hit-rate: " << (n > 0 ? 100.0 * n_hits / n : 0.0)
+					<< "% ms per miss: " << (n_misses > 0 ? ms_recording / n_misses : 0.0) << std::endl;
+			}
+
+			// The secondaries go with their lane's pool
+			inline void destroy(Cache &cache) {
+				for (auto &lane : cache.lanes)
+					vkDestroyCommandPool(cache.device, lane.command_pool, ct::vulkan::get_allocator());
+				cache.lanes.clear();
+				cache.chunks.clear();
+				cache.slot_hashes.clear();
+				cache.n_chunks = 0;
+			}
+
+		}
+	}
+}
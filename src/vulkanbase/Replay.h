@@ -0,0 +1,1062 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/DescriptorHelper.h"
+#include "vulkanbase/Capture.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace replay {
+
+			// A captured frame: its submissions in order, each the replay's command buffers of one batch
+			struct Frame {
+				std::vector<std::vector<VkCommandBuffer>> submits;
+			};
+
+			// Everything a capture file needs, created on a headless device. Every recording of a captured command buffer becomes a
+			// command buffer of its own, recorded once while loading, so running the frames only submits.
+			struct Replay {
+				VkDevice device = VK_NULL_HANDLE;
+				VkQueue queue = VK_NULL_HANDLE;
+				VkCommandPool command_pool = VK_NULL_HANDLE;
+
+				// -> by capture id, index 0 is the null handle of ids the capture did not know
+				std::vector<VkImage> images;
+				std::vector<VkBuffer> buffers;
+				std::vector<VkImageView> views;
+				std::vector<VkRenderPass> render_passes;
+				std::vector<VkFramebuffer> framebuffers;
+				std::vector<VkCommandBuffer> command_buffers;	// the newest recording
+				std::vector<VkShaderModule> shader_modules;
+				std::vector<VkDescriptorSetLayout> set_layouts;
+				std::vector<VkPipelineLayout> pipeline_layouts;
+				std::vector<VkPipeline> pipelines;
+				std::vector<VkDescriptorSet> descriptor_sets;
+				std::vector<VkImageUsageFlags> image_usages;		// what the image was created with here
+				std::vector<VkImageUsageFlags> view_usages;			// the usage of the view's image
+				std::vector<std::vector<VkDescriptorPoolSize>> update_after_bind_sizes;	// by set layout, empty unless its sets need a pool of their own
+				// <-
+				std::vector<VkDeviceMemory> memories;
+				std::vector<VkCommandBuffer> recordings;
+				std::vector<Frame> frames;
+				ct::vulkan::descriptor::Allocator descriptor_allocator;
+				std::vector<VkDescriptorPool> update_after_bind_pools;
+				VkCommandBuffer setup_command_buffer = VK_NULL_HANDLE;	// zeroes the buffers while loading
+
+				// Set before load from what the device was created with, has_dynamic_rendering by load from the device table
+				bool has_descriptor_indexing = false;
+				bool has_multi_draw_indirect = false;
+				bool has_dynamic_rendering = false;
+
+				uint64_t n_commands = 0;
+				uint64_t n_skipped = 0;		// commands on resources the capture did not see created
+				uint64_t n_dropped_sets = 0;	// descriptor sets with a write the replay could not make
+			};
+
+			// Captured swapchain images are plain images here, nothing is presented
+			inline VkImageLayout fix_layout(VkImageLayout layout) {
+				return layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR ? VK_IMAGE_LAYOUT_GENERAL : layout;
+			}
+
+			template <typename T>
+			inline T& at(std::vector<T> &handles, uint32_t id) {
+				if (handles.size() <= id)
+					handles.resize(id + 1, T());
+				return handles[id];
+			}
+
+			template <typename T>
+			inline T lookup(const std::vector<T> &handles, uint32_t id) {
+				return id < handles.size() ? handles[id] : T();
+			}
+
+			template <typename T>
+			inline T decode(T handle, const std::vector<T> &handles) {
+				return lookup(handles, (uint32_t)ct::vulkan::capture::to_key(handle));
+			}
+
+			// Contents are not captured, every resource gets device local memory of its own (aliasing of the transient pool is not reproduced).
+			// Buffers start zeroed, so indirect draws of arguments the capture did not see written draw nothing.
+			inline void bind_memory(const VkMemoryRequirements &requirements, ct::vulkan::LogicalDevice &logical_device, Replay &replay, VkDeviceMemory &memory) {
+				VkMemoryAllocateInfo mem_alloc = {};
+				mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+				mem_alloc.allocationSize = requirements.size;
+				mem_alloc.memoryTypeIndex = ct::vulkan::get_memory_type(logical_device.memory_properties, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+				VK_CHECK_RESULT(vkAllocateMemory(replay.device, &mem_alloc, ct::vulkan::get_allocator(), &memory));
+				replay.memories.push_back(memory);
+			}
+
+			// The usage a plain image of info's format can have here. Presentable images come with the swapchain's usage, which may hold
+			// what the format only allows for presentation (storage on an sRGB format), and the capture may come from another device.
+			// 0 if the image cannot be created at all.
+			inline VkImageUsageFlags get_usage(const VkImageCreateInfo &info, ct::vulkan::LogicalDevice &logical_device) {
+				VkFormatProperties formatProps;
+				vkGetPhysicalDeviceFormatProperties(logical_device.physical_device, info.format, &formatProps);
+				VkFormatFeatureFlags features = info.tiling == VK_IMAGE_TILING_LINEAR ? formatProps.linearTilingFeatures : formatProps.optimalTilingFeatures;
+				VkImageUsageFlags usage = info.usage;
+				if (!(features & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT))
+					usage &= ~VK_IMAGE_USAGE_STORAGE_BIT;
+				if (!(features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+					usage &= ~VK_IMAGE_USAGE_SAMPLED_BIT;
+				if (!(features & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT))
+					usage &= ~VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+				if (!(features & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT))
+					usage &= ~VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+				VkImageFormatProperties imageFormatProps;
+				if (usage == 0 || vkGetPhysicalDeviceImageFormatProperties(logical_device.physical_device, info.format, info.imageType, info.tiling, usage, info.flags,
+						&imageFormatProps) != VK_SUCCESS)
+					return 0;
+				return usage;
+			}
+
+			inline void create_image(ct::vulkan::capture::Cursor &cursor, ct::vulkan::LogicalDevice &logical_device, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				VkImageCreateInfo info = ct::vulkan::capture::get<VkImageCreateInfo>(cursor);
+				info.usage = get_usage(info, logical_device);
+				if (info.usage == 0) {
+					std::cout << "replay: image " << id << " cannot be created on this device, commands on it are skipped" << std::endl;
+					return;
+				}
+				at(replay.image_usages, id) = info.usage;
+				VkImage &image = at(replay.images, id);
+				VK_CHECK_RESULT(vkCreateImage(replay.device, &info, ct::vulkan::get_allocator(), &image));
+				VkMemoryRequirements requirements;
+				vkGetImageMemoryRequirements(replay.device, image, &requirements);
+				VkDeviceMemory memory;
+				bind_memory(requirements, logical_device, replay, memory);
+				VK_CHECK_RESULT(vkBindImageMemory(replay.device, image, memory, 0));
+			}
+
+			inline void create_buffer(ct::vulkan::capture::Cursor &cursor, ct::vulkan::LogicalDevice &logical_device, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				VkBufferCreateInfo info = ct::vulkan::capture::get<VkBufferCreateInfo>(cursor);
+				info.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+				VkBuffer &buffer = at(replay.buffers, id);
+				VK_CHECK_RESULT(vkCreateBuffer(replay.device, &info, ct::vulkan::get_allocator(), &buffer));
+				VkMemoryRequirements requirements;
+				vkGetBufferMemoryRequirements(replay.device, buffer, &requirements);
+				VkDeviceMemory memory;
+				bind_memory(requirements, logical_device, replay, memory);
+				VK_CHECK_RESULT(vkBindBufferMemory(replay.device, buffer, memory, 0));
+				vkCmdFillBuffer(replay.setup_command_buffer, buffer, 0, VK_WHOLE_SIZE, 0);
+			}
+
+			inline void create_view(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				VkImageViewCreateInfo info = ct::vulkan::capture::get<VkImageViewCreateInfo>(cursor);
+				uint32_t image_id = (uint32_t)ct::vulkan::capture::to_key(info.image);
+				info.image = lookup(replay.images, image_id);
+				if (info.image == VK_NULL_HANDLE)
+					return;
+				at(replay.view_usages, id) = lookup(replay.image_usages, image_id);
+				VK_CHECK_RESULT(vkCreateImageView(replay.device, &info, ct::vulkan::get_allocator(), &at(replay.views, id)));
+			}
+
+			inline void create_render_pass(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				std::vector<VkAttachmentDescription> attachments = ct::vulkan::capture::get_array<VkAttachmentDescription>(cursor);
+				for (auto &attachment : attachments) {
+					attachment.initialLayout = fix_layout(attachment.initialLayout);
+					attachment.finalLayout = fix_layout(attachment.finalLayout);
+				}
+				uint32_t n_subpasses = ct::vulkan::capture::get<uint32_t>(cursor);
+				std::vector<std::vector<VkAttachmentReference>> inputs(n_subpasses);
+				std::vector<std::vector<VkAttachmentReference>> colors(n_subpasses);
+				std::vector<VkAttachmentReference> depths(n_subpasses);
+				std::vector<VkSubpassDescription> subpasses(n_subpasses);
+				for (uint32_t s = 0; s < n_subpasses; s++) {
+					subpasses[s] = {};
+					subpasses[s].pipelineBindPoint = ct::vulkan::capture::get<VkPipelineBindPoint>(cursor);
+					inputs[s] = ct::vulkan::capture::get_array<VkAttachmentReference>(cursor);
+					colors[s] = ct::vulkan::capture::get_array<VkAttachmentReference>(cursor);
+					depths[s] = ct::vulkan::capture::get<VkAttachmentReference>(cursor);
+					subpasses[s].inputAttachmentCount = (uint32_t)inputs[s].size();
+					subpasses[s].pInputAttachments = inputs[s].data();
+					subpasses[s].colorAttachmentCount = (uint32_t)colors[s].size();
+					subpasses[s].pColorAttachments = colors[s].data();
+					subpasses[s].pDepthStencilAttachment = depths[s].attachment != VK_ATTACHMENT_UNUSED ? &depths[s] : nullptr;
+				}
+				std::vector<VkSubpassDependency> dependencies = ct::vulkan::capture::get_array<VkSubpassDependency>(cursor);
+
+				VkRenderPassCreateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+				info.attachmentCount = (uint32_t)attachments.size();
+				info.pAttachments = attachments.data();
+				info.subpassCount = n_subpasses;
+				info.pSubpasses = subpasses.data();
+				info.dependencyCount = (uint32_t)dependencies.size();
+				info.pDependencies = dependencies.data();
+				VK_CHECK_RESULT(vkCreateRenderPass(replay.device, &info, ct::vulkan::get_allocator(), &at(replay.render_passes, id)));
+			}
+
+			inline void create_framebuffer(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				VkRenderPass render_pass = lookup(replay.render_passes, ct::vulkan::capture::get<uint32_t>(cursor));
+				VkFramebufferCreateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+				info.renderPass = render_pass;
+				info.width = ct::vulkan::capture::get<uint32_t>(cursor);
+				info.height = ct::vulkan::capture::get<uint32_t>(cursor);
+				info.layers = ct::vulkan::capture::get<uint32_t>(cursor);
+				std::vector<uint32_t> ids = ct::vulkan::capture::get_array<uint32_t>(cursor);
+				std::vector<VkImageView> views(ids.size());
+				for (uint32_t i = 0; i < ids.size(); i++) {
+					views[i] = lookup(replay.views, ids[i]);
+					if (views[i] == VK_NULL_HANDLE)
+						return;
+				}
+				if (render_pass == VK_NULL_HANDLE)
+					return;
+				info.attachmentCount = (uint32_t)views.size();
+				info.pAttachments = views.data();
+				VK_CHECK_RESULT(vkCreateFramebuffer(replay.device, &info, ct::vulkan::get_allocator(), &at(replay.framebuffers, id)));
+			}
+
+			inline void create_shader_module(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				std::vector<uint32_t> code = ct::vulkan::capture::get_array<uint32_t>(cursor);
+				VkShaderModuleCreateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+				info.codeSize = code.size() * sizeof(uint32_t);
+				info.pCode = code.data();
+				VK_CHECK_RESULT(vkCreateShaderModule(replay.device, &info, ct::vulkan::get_allocator(), &at(replay.shader_modules, id)));
+			}
+
+			// Layouts of descriptor indexing need it here, a layout the device cannot hold (bindless arrays sized for the capturing device) is skipped
+			inline void create_set_layout(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				VkDescriptorSetLayoutCreateFlags flags = ct::vulkan::capture::get<VkDescriptorSetLayoutCreateFlags>(cursor);
+				std::vector<VkDescriptorSetLayoutBinding> bindings = ct::vulkan::capture::get_array<VkDescriptorSetLayoutBinding>(cursor);
+				std::vector<VkDescriptorBindingFlagsEXT> binding_flags = ct::vulkan::capture::get_array<VkDescriptorBindingFlagsEXT>(cursor);
+				if (!binding_flags.empty() && !replay.has_descriptor_indexing) {
+					std::cout << "replay: set layout " << id << " needs descriptor indexing, sets of it are skipped" << std::endl;
+					return;
+				}
+				VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+				bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+				bindingFlagsInfo.bindingCount = (uint32_t)binding_flags.size();
+				bindingFlagsInfo.pBindingFlags = binding_flags.data();
+				VkDescriptorSetLayoutCreateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+				info.pNext = binding_flags.empty() ? nullptr : &bindingFlagsInfo;
+				info.flags = flags;
+				info.bindingCount = (uint32_t)bindings.size();
+				info.pBindings = bindings.data();
+				VkDescriptorSetLayout layout;
+				if (vkCreateDescriptorSetLayout(replay.device, &info, ct::vulkan::get_allocator(), &layout) != VK_SUCCESS) {
+					std::cout << "replay: set layout " << id << " cannot be created on this device, sets of it are skipped" << std::endl;
+					return;
+				}
+				at(replay.set_layouts, id) = layout;
+				if (flags & VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT) {
+					std::vector<VkDescriptorPoolSize> &sizes = at(replay.update_after_bind_sizes, id);
+					for (auto &binding : bindings)
+						sizes.push_back({ binding.descriptorType, binding.descriptorCount });
+				}
+			}
+
+			inline void create_pipeline_layout(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				std::vector<uint32_t> ids = ct::vulkan::capture::get_array<uint32_t>(cursor);
+				std::vector<VkPushConstantRange> ranges = ct::vulkan::capture::get_array<VkPushConstantRange>(cursor);
+				std::vector<VkDescriptorSetLayout> set_layouts(ids.size());
+				for (uint32_t i = 0; i < ids.size(); i++) {
+					set_layouts[i] = lookup(replay.set_layouts, ids[i]);
+					if (set_layouts[i] == VK_NULL_HANDLE)
+						return;
+				}
+				VkPipelineLayoutCreateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+				info.setLayoutCount = (uint32_t)set_layouts.size();
+				info.pSetLayouts = set_layouts.data();
+				info.pushConstantRangeCount = (uint32_t)ranges.size();
+				info.pPushConstantRanges = ranges.data();
+				VK_CHECK_RESULT(vkCreatePipelineLayout(replay.device, &info, ct::vulkan::get_allocator(), &at(replay.pipeline_layouts, id)));
+			}
+
+			// A shader stage and what its create info points at, read in place so the pointers stay valid
+			struct Stage {
+				VkPipelineShaderStageCreateInfo info;
+				std::vector<char> name;
+				std::vector<VkSpecializationMapEntry> entries;
+				std::vector<char> data;
+				VkSpecializationInfo specialization;
+			};
+
+			// false if the replay does not have the stage's module
+			inline bool get_stage(ct::vulkan::capture::Cursor &cursor, Replay &replay, Stage &stage) {
+				stage.info = {};
+				stage.info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+				stage.info.flags = ct::vulkan::capture::get<VkPipelineShaderStageCreateFlags>(cursor);
+				stage.info.stage = ct::vulkan::capture::get<VkShaderStageFlagBits>(cursor);
+				stage.info.module = lookup(replay.shader_modules, ct::vulkan::capture::get<uint32_t>(cursor));
+				stage.name = ct::vulkan::capture::get_array<char>(cursor);
+				stage.entries = ct::vulkan::capture::get_array<VkSpecializationMapEntry>(cursor);
+				stage.data = ct::vulkan::capture::get_array<char>(cursor);
+				stage.info.pName = stage.name.data();
+				if (!stage.entries.empty() || !stage.data.empty()) {
+					stage.specialization = { (uint32_t)stage.entries.size(), stage.entries.data(), stage.data.size(), stage.data.data() };
+					stage.info.pSpecializationInfo = &stage.specialization;
+				}
+				return stage.info.module != VK_NULL_HANDLE;
+			}
+
+			template <typename T>
+			inline const T* get_pointer(const std::vector<T> &values) {
+				return values.empty() ? nullptr : values.data();
+			}
+
+			// Skipped when a module, the layout or the render pass is missing, or when it is a pipeline of dynamic rendering the replay does not have
+			inline void create_graphics_pipeline(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				using namespace ct::vulkan::capture;
+				uint32_t id = get<uint32_t>(cursor);
+				VkGraphicsPipelineCreateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+				info.flags = get<VkPipelineCreateFlags>(cursor);
+				uint32_t n_stages = get<uint32_t>(cursor);
+				std::vector<Stage> stages(n_stages);
+				std::vector<VkPipelineShaderStageCreateInfo> stageInfos(n_stages);
+				bool is_missing = false;
+				for (uint32_t s = 0; s < n_stages; s++) {
+					is_missing |= !get_stage(cursor, replay, stages[s]);
+					stageInfos[s] = stages[s].info;
+				}
+
+				std::vector<VkPipelineVertexInputStateCreateInfo> vertex = get_array<VkPipelineVertexInputStateCreateInfo>(cursor);
+				std::vector<VkVertexInputBindingDescription> vertexBindings = get_array<VkVertexInputBindingDescription>(cursor);
+				std::vector<VkVertexInputAttributeDescription> vertexAttributes = get_array<VkVertexInputAttributeDescription>(cursor);
+				if (!vertex.empty()) {
+					vertex[0].pVertexBindingDescriptions = vertexBindings.data();
+					vertex[0].pVertexAttributeDescriptions = vertexAttributes.data();
+				}
+				std::vector<VkPipelineInputAssemblyStateCreateInfo> inputAssembly = get_array<VkPipelineInputAssemblyStateCreateInfo>(cursor);
+				std::vector<VkPipelineViewportStateCreateInfo> viewport = get_array<VkPipelineViewportStateCreateInfo>(cursor);
+				std::vector<VkViewport> viewports = get_array<VkViewport>(cursor);
+				std::vector<VkRect2D> scissors = get_array<VkRect2D>(cursor);
+				if (!viewport.empty()) {
+					viewport[0].pViewports = get_pointer(viewports);
+					viewport[0].pScissors = get_pointer(scissors);
+				}
+				std::vector<VkPipelineRasterizationStateCreateInfo> rasterization = get_array<VkPipelineRasterizationStateCreateInfo>(cursor);
+				std::vector<VkPipelineMultisampleStateCreateInfo> multisample = get_array<VkPipelineMultisampleStateCreateInfo>(cursor);
+				std::vector<VkSampleMask> sampleMask = get_array<VkSampleMask>(cursor);
+				if (!multisample.empty())
+					multisample[0].pSampleMask = get_pointer(sampleMask);
+				std::vector<VkPipelineDepthStencilStateCreateInfo> depthStencil = get_array<VkPipelineDepthStencilStateCreateInfo>(cursor);
+				std::vector<VkPipelineColorBlendStateCreateInfo> colorBlend = get_array<VkPipelineColorBlendStateCreateInfo>(cursor);
+				std::vector<VkPipelineColorBlendAttachmentState> blendAttachments = get_array<VkPipelineColorBlendAttachmentState>(cursor);
+				if (!colorBlend.empty())
+					colorBlend[0].pAttachments = blendAttachments.data();
+				std::vector<VkPipelineDynamicStateCreateInfo> dynamic = get_array<VkPipelineDynamicStateCreateInfo>(cursor);
+				std::vector<VkDynamicState> dynamicStates = get_array<VkDynamicState>(cursor);
+				if (!dynamic.empty())
+					dynamic[0].pDynamicStates = dynamicStates.data();
+
+				info.layout = lookup(replay.pipeline_layouts, get<uint32_t>(cursor));
+				uint32_t render_pass_id = get<uint32_t>(cursor);
+				info.renderPass = lookup(replay.render_passes, render_pass_id);
+				info.subpass = get<uint32_t>(cursor);
+				std::vector<VkPipelineRenderingCreateInfoKHR> rendering = get_array<VkPipelineRenderingCreateInfoKHR>(cursor);
+				std::vector<VkFormat> colorFormats = get_array<VkFormat>(cursor);
+				if (!rendering.empty())
+					rendering[0].pColorAttachmentFormats = colorFormats.data();
+				is_missing |= info.layout == VK_NULL_HANDLE;
+				is_missing |= render_pass_id != 0 ? info.renderPass == VK_NULL_HANDLE : rendering.empty() || !replay.has_dynamic_rendering;
+				if (is_missing)
+					return;
+
+				info.pNext = get_pointer(rendering);
+				info.stageCount = n_stages;
+				info.pStages = stageInfos.data();
+				info.pVertexInputState = get_pointer(vertex);
+				info.pInputAssemblyState = get_pointer(inputAssembly);
+				info.pViewportState = get_pointer(viewport);
+				info.pRasterizationState = get_pointer(rasterization);
+				info.pMultisampleState = get_pointer(multisample);
+				info.pDepthStencilState = get_pointer(depthStencil);
+				info.pColorBlendState = get_pointer(colorBlend);
+				info.pDynamicState = get_pointer(dynamic);
+				VK_CHECK_RESULT(vkCreateGraphicsPipelines(replay.device, VK_NULL_HANDLE, 1, &info, ct::vulkan::get_allocator(), &at(replay.pipelines, id)));
+			}
+
+			inline void create_compute_pipeline(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				VkComputePipelineCreateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+				info.flags = ct::vulkan::capture::get<VkPipelineCreateFlags>(cursor);
+				Stage stage;
+				bool has_module = get_stage(cursor, replay, stage);
+				info.stage = stage.info;
+				info.layout = lookup(replay.pipeline_layouts, ct::vulkan::capture::get<uint32_t>(cursor));
+				if (!has_module || info.layout == VK_NULL_HANDLE)
+					return;
+				VK_CHECK_RESULT(vkCreateComputePipelines(replay.device, VK_NULL_HANDLE, 1, &info, ct::vulkan::get_allocator(), &at(replay.pipelines, id)));
+			}
+
+			// Update-after-bind sets get a pool of their own sized for their layout, like the bindless set they come from
+			inline void create_descriptor_set(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				uint32_t id = ct::vulkan::capture::get<uint32_t>(cursor);
+				uint32_t layout_id = ct::vulkan::capture::get<uint32_t>(cursor);
+				VkDescriptorSetLayout layout = lookup(replay.set_layouts, layout_id);
+				if (layout == VK_NULL_HANDLE)
+					return;
+				VkDescriptorSet &set = at(replay.descriptor_sets, id);
+				if (layout_id >= replay.update_after_bind_sizes.size() || replay.update_after_bind_sizes[layout_id].empty()) {
+					ct::vulkan::descriptor::allocate(layout, replay.descriptor_allocator, set);
+					return;
+				}
+				const std::vector<VkDescriptorPoolSize> &sizes = replay.update_after_bind_sizes[layout_id];
+				VkDescriptorPoolCreateInfo poolInfo = {};
+				poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+				poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+				poolInfo.maxSets = 1;
+				poolInfo.poolSizeCount = (uint32_t)sizes.size();
+				poolInfo.pPoolSizes = sizes.data();
+				VkDescriptorPool pool;
+				VK_CHECK_RESULT(vkCreateDescriptorPool(replay.device, &poolInfo, ct::vulkan::get_allocator(), &pool));
+				replay.update_after_bind_pools.push_back(pool);
+				VkDescriptorSetAllocateInfo allocInfo = {};
+				allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+				allocInfo.descriptorPool = pool;
+				allocInfo.descriptorSetCount = 1;
+				allocInfo.pSetLayouts = &layout;
+				VK_CHECK_RESULT(vkAllocateDescriptorSets(replay.device, &allocInfo, &set));
+			}
+
+			// The usage a view's image needs for a descriptor of type
+			inline VkImageUsageFlags get_descriptor_usage(VkDescriptorType type) {
+				switch (type) {
+				case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE: return VK_IMAGE_USAGE_STORAGE_BIT;
+				case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT: return VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+				default: return VK_IMAGE_USAGE_SAMPLED_BIT;
+				}
+			}
+
+			// Updates are applied one write at a time. A write the replay cannot make (a view or buffer it does not have, a view whose image lost
+			// the usage, samplers and texel buffer views which are not captured) drops its set: binding it is skipped, and so are the draws after.
+			inline void update_descriptors(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				using namespace ct::vulkan::capture;
+				uint32_t n_writes = get<uint32_t>(cursor);
+				for (uint32_t w = 0; w < n_writes; w++) {
+					uint32_t set_id = get<uint32_t>(cursor);
+					VkWriteDescriptorSet write = {};
+					write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+					write.dstSet = lookup(replay.descriptor_sets, set_id);
+					write.dstBinding = get<uint32_t>(cursor);
+					write.dstArrayElement = get<uint32_t>(cursor);
+					write.descriptorType = get<VkDescriptorType>(cursor);
+					write.descriptorCount = get<uint32_t>(cursor);
+					std::vector<VkDescriptorImageInfo> images = get_array<VkDescriptorImageInfo>(cursor);
+					std::vector<VkDescriptorBufferInfo> buffers = get_array<VkDescriptorBufferInfo>(cursor);
+					if (write.dstSet == VK_NULL_HANDLE)
+						continue;
+					bool is_usable = write.descriptorType != VK_DESCRIPTOR_TYPE_SAMPLER && write.descriptorType != VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+						&& (images.size() == write.descriptorCount || buffers.size() == write.descriptorCount);
+					VkImageUsageFlags usage = get_descriptor_usage(write.descriptorType);
+					for (auto &image : images) {
+						uint32_t view_id = (uint32_t)to_key(image.imageView);
+						image.imageView = lookup(replay.views, view_id);
+						image.imageLayout = fix_layout(image.imageLayout);
+						is_usable &= image.imageView != VK_NULL_HANDLE && (lookup(replay.view_usages, view_id) & usage) == usage;
+					}
+					for (auto &buffer : buffers) {
+						buffer.buffer = decode(buffer.buffer, replay.buffers);
+						is_usable &= buffer.buffer != VK_NULL_HANDLE;
+					}
+					if (!is_usable) {
+						at(replay.descriptor_sets, set_id) = VK_NULL_HANDLE;
+						replay.n_dropped_sets++;
+						continue;
+					}
+					write.pImageInfo = images.data();
+					write.pBufferInfo = buffers.data();
+					vkUpdateDescriptorSets(replay.device, 1, &write, 0, nullptr);
+				}
+				std::vector<VkCopyDescriptorSet> copies = get_array<VkCopyDescriptorSet>(cursor);
+				for (auto &copy : copies) {
+					uint32_t set_id = (uint32_t)to_key(copy.dstSet);
+					copy.srcSet = decode(copy.srcSet, replay.descriptor_sets);
+					copy.dstSet = decode(copy.dstSet, replay.descriptor_sets);
+					if (copy.dstSet == VK_NULL_HANDLE)
+						continue;
+					if (copy.srcSet == VK_NULL_HANDLE) {
+						at(replay.descriptor_sets, set_id) = VK_NULL_HANDLE;
+						replay.n_dropped_sets++;
+						continue;
+					}
+					vkUpdateDescriptorSets(replay.device, 0, nullptr, 1, &copy);
+				}
+			}
+
+			// What the commands recorded so far left bound, per bind point (0 graphics, 1 compute). A draw or dispatch is skipped when its pipeline,
+			// one of its sets or one of its buffers was skipped.
+			struct State {
+				bool has_pipeline[2] = { false, false };
+				uint32_t missing_sets[2] = { 0, 0 };		// a bit per set index
+				uint32_t missing_vertex_buffers = 0;	// a bit per binding
+				bool is_index_missing = false;
+			};
+
+			inline uint32_t get_bind_index(VkPipelineBindPoint bind_point) {
+				return bind_point == VK_PIPELINE_BIND_POINT_COMPUTE ? 1 : 0;
+			}
+
+			inline void set_missing(uint32_t &missing, uint32_t first, uint32_t count, bool is_missing) {
+				uint32_t mask = (count >= 32 ? ~0u : (1u << count) - 1) << first;
+				missing = is_missing ? missing | mask : missing & ~mask;
+			}
+
+			inline bool can_draw(const State &state, bool is_indexed) {
+				return state.has_pipeline[0] && state.missing_sets[0] == 0 && state.missing_vertex_buffers == 0 && !(is_indexed && state.is_index_missing);
+			}
+
+			// false if the attachment's view was captured but the replay does not have it
+			inline bool decode_attachment(VkRenderingAttachmentInfoKHR &attachment, Replay &replay) {
+				bool is_unused = attachment.imageView == VK_NULL_HANDLE;
+				attachment.imageView = decode(attachment.imageView, replay.views);
+				attachment.resolveImageView = decode(attachment.resolveImageView, replay.views);
+				attachment.imageLayout = fix_layout(attachment.imageLayout);
+				attachment.resolveImageLayout = fix_layout(attachment.resolveImageLayout);
+				return is_unused || attachment.imageView != VK_NULL_HANDLE;
+			}
+
+			// Records one captured command buffer at its captured level. A command on a resource the replay does not have is skipped, a render
+			// pass that cannot begin skips everything up to its end. A secondary continuing a render pass the replay does not have is dropped.
+			inline void record(ct::vulkan::capture::Cursor &cursor, Replay &replay) {
+				using namespace ct::vulkan::capture;
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				uint32_t id = get<uint32_t>(cursor);
+				uint32_t n_ops = get<uint32_t>(cursor);
+				VkCommandBufferLevel level = get<VkCommandBufferLevel>(cursor);
+				VkCommandBufferUsageFlags flags = get<VkCommandBufferUsageFlags>(cursor);
+				uint32_t render_pass_id = get<uint32_t>(cursor);
+				VkCommandBufferInheritanceInfo inheritance = {};
+				inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+				inheritance.renderPass = lookup(replay.render_passes, render_pass_id);
+				inheritance.subpass = get<uint32_t>(cursor);
+				inheritance.framebuffer = lookup(replay.framebuffers, get<uint32_t>(cursor));
+				std::vector<VkCommandBufferInheritanceRenderingInfoKHR> rendering = get_array<VkCommandBufferInheritanceRenderingInfoKHR>(cursor);
+				std::vector<VkFormat> colorFormats = get_array<VkFormat>(cursor);
+				if (!rendering.empty())
+					rendering[0].pColorAttachmentFormats = colorFormats.data();
+				inheritance.pNext = get_pointer(rendering);
+
+				bool is_secondary = level == VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+				if (is_secondary && (flags & VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT)
+						&& (render_pass_id != 0 ? inheritance.renderPass == VK_NULL_HANDLE : rendering.empty() || !replay.has_dynamic_rendering)) {
+					replay.n_commands += n_ops;
+					replay.n_skipped += n_ops;
+					at(replay.command_buffers, id) = VK_NULL_HANDLE;
+					return;
+				}
+
+				VkCommandBuffer command_buffer;
+				VkCommandBufferAllocateInfo allocateInfo = {};
+				allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+				allocateInfo.commandPool = replay.command_pool;
+				allocateInfo.level = level;
+				allocateInfo.commandBufferCount = 1;
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(replay.device, &allocateInfo, &command_buffer));
+				// Frames in flight submit the same recording again before the last submission of it is done
+				VkCommandBufferBeginInfo cmdBufInfo = {};
+				cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				cmdBufInfo.flags = (flags & VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT) | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+				cmdBufInfo.pInheritanceInfo = is_secondary ? &inheritance : nullptr;
+				VK_CHECK_RESULT(vkBeginCommandBuffer(command_buffer, &cmdBufInfo));
+
+				State state;
+				bool is_pass_skipped = false;
+				for (uint32_t i = 0; i < n_ops; i++) {
+					Op op = (Op)get<uint32_t>(cursor);
+					bool is_skipped = is_pass_skipped;
+					switch (op) {
+					case BARRIER: {
+						VkPipelineStageFlags src_stage = get<VkPipelineStageFlags>(cursor);
+						VkPipelineStageFlags dst_stage = get<VkPipelineStageFlags>(cursor);
+						VkDependencyFlags dependency_flags = get<VkDependencyFlags>(cursor);
+						std::vector<VkMemoryBarrier> memory = get_array<VkMemoryBarrier>(cursor);
+						std::vector<VkBufferMemoryBarrier> buffers = get_array<VkBufferMemoryBarrier>(cursor);
+						std::vector<VkImageMemoryBarrier> images = get_array<VkImageMemoryBarrier>(cursor);
+						for (auto &barrier : buffers) {
+							barrier.buffer = decode(barrier.buffer, replay.buffers);
+							is_skipped |= barrier.buffer == VK_NULL_HANDLE;
+						}
+						for (auto &barrier : images) {
+							barrier.image = decode(barrier.image, replay.images);
+							barrier.oldLayout = fix_layout(barrier.oldLayout);
+							barrier.newLayout = fix_layout(barrier.newLayout);
+							is_skipped |= barrier.image == VK_NULL_HANDLE;
+						}
+						if (!is_skipped)
+							vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, dependency_flags, (uint32_t)memory.size(), memory.data(),
+									(uint32_t)buffers.size(), buffers.data(), (uint32_t)images.size(), images.data());
+						break;
+					}
+					case CLEAR_COLOR: {
+						VkImage image = lookup(replay.images, get<uint32_t>(cursor));
+						VkImageLayout layout = get<VkImageLayout>(cursor);
+						VkClearColorValue color = get<VkClearColorValue>(cursor);
+						std::vector<VkImageSubresourceRange> ranges = get_array<VkImageSubresourceRange>(cursor);
+						is_skipped |= image == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdClearColorImage(command_buffer, image, fix_layout(layout), &color, (uint32_t)ranges.size(), ranges.data());
+						break;
+					}
+					case CLEAR_DEPTH_STENCIL: {
+						VkImage image = lookup(replay.images, get<uint32_t>(cursor));
+						VkImageLayout layout = get<VkImageLayout>(cursor);
+						VkClearDepthStencilValue value = get<VkClearDepthStencilValue>(cursor);
+						std::vector<VkImageSubresourceRange> ranges = get_array<VkImageSubresourceRange>(cursor);
+						is_skipped |= image == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdClearDepthStencilImage(command_buffer, image, layout, &value, (uint32_t)ranges.size(), ranges.data());
+						break;
+					}
+					case CLEAR_ATTACHMENTS: {
+						std::vector<VkClearAttachment> attachments = get_array<VkClearAttachment>(cursor);
+						std::vector<VkClearRect> rects = get_array<VkClearRect>(cursor);
+						if (!is_skipped)
+							vkCmdClearAttachments(command_buffer, (uint32_t)attachments.size(), attachments.data(), (uint32_t)rects.size(), rects.data());
+						break;
+					}
+					case COPY_BUFFER: {
+						VkBuffer src = lookup(replay.buffers, get<uint32_t>(cursor));
+						VkBuffer dst = lookup(replay.buffers, get<uint32_t>(cursor));
+						std::vector<VkBufferCopy> regions = get_array<VkBufferCopy>(cursor);
+						is_skipped |= src == VK_NULL_HANDLE || dst == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdCopyBuffer(command_buffer, src, dst, (uint32_t)regions.size(), regions.data());
+						break;
+					}
+					case FILL_BUFFER: {
+						VkBuffer dst = lookup(replay.buffers, get<uint32_t>(cursor));
+						VkDeviceSize offset = get<VkDeviceSize>(cursor);
+						VkDeviceSize size = get<VkDeviceSize>(cursor);
+						uint32_t data = get<uint32_t>(cursor);
+						is_skipped |= dst == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdFillBuffer(command_buffer, dst, offset, size, data);
+						break;
+					}
+					case UPDATE_BUFFER: {
+						VkBuffer dst = lookup(replay.buffers, get<uint32_t>(cursor));
+						VkDeviceSize offset = get<VkDeviceSize>(cursor);
+						std::vector<char> data = get_array<char>(cursor);
+						is_skipped |= dst == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdUpdateBuffer(command_buffer, dst, offset, data.size(), data.data());
+						break;
+					}
+					case COPY_IMAGE:
+					case BLIT_IMAGE: {
+						VkImage src = lookup(replay.images, get<uint32_t>(cursor));
+						VkImageLayout src_layout = fix_layout(get<VkImageLayout>(cursor));
+						VkImage dst = lookup(replay.images, get<uint32_t>(cursor));
+						VkImageLayout dst_layout = fix_layout(get<VkImageLayout>(cursor));
+						is_skipped |= src == VK_NULL_HANDLE || dst == VK_NULL_HANDLE;
+						if (op == COPY_IMAGE) {
+							std::vector<VkImageCopy> regions = get_array<VkImageCopy>(cursor);
+							if (!is_skipped)
+								vkCmdCopyImage(command_buffer, src, src_layout, dst, dst_layout, (uint32_t)regions.size(), regions.data());
+						} else {
+							std::vector<VkImageBlit> regions = get_array<VkImageBlit>(cursor);
+							VkFilter filter = get<VkFilter>(cursor);
+							if (!is_skipped)
+								vkCmdBlitImage(command_buffer, src, src_layout, dst, dst_layout, (uint32_t)regions.size(), regions.data(), filter);
+						}
+						break;
+					}
+					case COPY_BUFFER_TO_IMAGE: {
+						VkBuffer src = lookup(replay.buffers, get<uint32_t>(cursor));
+						VkImage dst = lookup(replay.images, get<uint32_t>(cursor));
+						VkImageLayout dst_layout = fix_layout(get<VkImageLayout>(cursor));
+						std::vector<VkBufferImageCopy> regions = get_array<VkBufferImageCopy>(cursor);
+						is_skipped |= src == VK_NULL_HANDLE || dst == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdCopyBufferToImage(command_buffer, src, dst, dst_layout, (uint32_t)regions.size(), regions.data());
+						break;
+					}
+					case COPY_IMAGE_TO_BUFFER: {
+						VkImage src = lookup(replay.images, get<uint32_t>(cursor));
+						VkImageLayout src_layout = fix_layout(get<VkImageLayout>(cursor));
+						VkBuffer dst = lookup(replay.buffers, get<uint32_t>(cursor));
+						std::vector<VkBufferImageCopy> regions = get_array<VkBufferImageCopy>(cursor);
+						is_skipped |= src == VK_NULL_HANDLE || dst == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdCopyImageToBuffer(command_buffer, src, src_layout, dst, (uint32_t)regions.size(), regions.data());
+						break;
+					}
+					case BEGIN_RENDER_PASS: {
+						VkRenderPassBeginInfo info = {};
+						info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+						info.renderPass = lookup(replay.render_passes, get<uint32_t>(cursor));
+						info.framebuffer = lookup(replay.framebuffers, get<uint32_t>(cursor));
+						info.renderArea = get<VkRect2D>(cursor);
+						std::vector<VkClearValue> clear_values = get_array<VkClearValue>(cursor);
+						VkSubpassContents contents = get<VkSubpassContents>(cursor);
+						info.clearValueCount = (uint32_t)clear_values.size();
+						info.pClearValues = clear_values.data();
+						is_pass_skipped = info.renderPass == VK_NULL_HANDLE || info.framebuffer == VK_NULL_HANDLE;
+						is_skipped = is_pass_skipped;
+						if (!is_skipped)
+							vkCmdBeginRenderPass(command_buffer, &info, contents);
+						break;
+					}
+					case NEXT_SUBPASS: {
+						VkSubpassContents contents = get<VkSubpassContents>(cursor);
+						if (!is_skipped)
+							vkCmdNextSubpass(command_buffer, contents);
+						break;
+					}
+					case END_RENDER_PASS:
+						if (!is_skipped)
+							vkCmdEndRenderPass(command_buffer);
+						is_pass_skipped = false;
+						break;
+					case SET_VIEWPORT: {
+						uint32_t first = get<uint32_t>(cursor);
+						std::vector<VkViewport> viewports = get_array<VkViewport>(cursor);
+						if (!is_skipped)
+							vkCmdSetViewport(command_buffer, first, (uint32_t)viewports.size(), viewports.data());
+						break;
+					}
+					case SET_SCISSOR: {
+						uint32_t first = get<uint32_t>(cursor);
+						std::vector<VkRect2D> scissors = get_array<VkRect2D>(cursor);
+						if (!is_skipped)
+							vkCmdSetScissor(command_buffer, first, (uint32_t)scissors.size(), scissors.data());
+						break;
+					}
+					case BIND_PIPELINE: {
+						uint32_t bind = get_bind_index(get<VkPipelineBindPoint>(cursor));
+						VkPipeline pipeline = lookup(replay.pipelines, get<uint32_t>(cursor));
+						is_skipped |= pipeline == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdBindPipeline(command_buffer, bind == 0 ? VK_PIPELINE_BIND_POINT_GRAPHICS : VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+						state.has_pipeline[bind] = !is_skipped;
+						break;
+					}
+					case BIND_DESCRIPTOR_SETS: {
+						VkPipelineBindPoint bind_point = get<VkPipelineBindPoint>(cursor);
+						VkPipelineLayout layout = lookup(replay.pipeline_layouts, get<uint32_t>(cursor));
+						uint32_t first = get<uint32_t>(cursor);
+						std::vector<uint32_t> ids = get_array<uint32_t>(cursor);
+						std::vector<uint32_t> offsets = get_array<uint32_t>(cursor);
+						std::vector<VkDescriptorSet> sets(ids.size());
+						for (uint32_t s = 0; s < ids.size(); s++) {
+							sets[s] = lookup(replay.descriptor_sets, ids[s]);
+							is_skipped |= sets[s] == VK_NULL_HANDLE;
+						}
+						is_skipped |= layout == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdBindDescriptorSets(command_buffer, bind_point, layout, first, (uint32_t)sets.size(), sets.data(), (uint32_t)offsets.size(), offsets.data());
+						set_missing(state.missing_sets[get_bind_index(bind_point)], first, (uint32_t)sets.size(), is_skipped);
+						break;
+					}
+					case PUSH_CONSTANTS: {
+						VkPipelineLayout layout = lookup(replay.pipeline_layouts, get<uint32_t>(cursor));
+						VkShaderStageFlags stages = get<VkShaderStageFlags>(cursor);
+						uint32_t offset = get<uint32_t>(cursor);
+						std::vector<char> values = get_array<char>(cursor);
+						is_skipped |= layout == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdPushConstants(command_buffer, layout, stages, offset, (uint32_t)values.size(), values.data());
+						break;
+					}
+					case BIND_VERTEX_BUFFERS: {
+						uint32_t first = get<uint32_t>(cursor);
+						std::vector<uint32_t> ids = get_array<uint32_t>(cursor);
+						std::vector<VkDeviceSize> offsets = get_array<VkDeviceSize>(cursor);
+						std::vector<VkBuffer> buffers(ids.size());
+						for (uint32_t b = 0; b < ids.size(); b++) {
+							buffers[b] = lookup(replay.buffers, ids[b]);
+							is_skipped |= buffers[b] == VK_NULL_HANDLE;
+						}
+						if (!is_skipped)
+							vkCmdBindVertexBuffers(command_buffer, first, (uint32_t)buffers.size(), buffers.data(), offsets.data());
+						set_missing(state.missing_vertex_buffers, first, (uint32_t)buffers.size(), is_skipped);
+						break;
+					}
+					case BIND_INDEX_BUFFER: {
+						VkBuffer buffer = lookup(replay.buffers, get<uint32_t>(cursor));
+						VkDeviceSize offset = get<VkDeviceSize>(cursor);
+						VkIndexType type = get<VkIndexType>(cursor);
+						is_skipped |= buffer == VK_NULL_HANDLE;
+						if (!is_skipped)
+							vkCmdBindIndexBuffer(command_buffer, buffer, offset, type);
+						state.is_index_missing = is_skipped;
+						break;
+					}
+					case DRAW: {
+						uint32_t n_vertices = get<uint32_t>(cursor);
+						uint32_t n_instances = get<uint32_t>(cursor);
+						uint32_t first_vertex = get<uint32_t>(cursor);
+						uint32_t first_instance = get<uint32_t>(cursor);
+						is_skipped |= !can_draw(state, false);
+						if (!is_skipped)
+							vkCmdDraw(command_buffer, n_vertices, n_instances, first_vertex, first_instance);
+						break;
+					}
+					case DRAW_INDEXED: {
+						VkDrawIndexedIndirectCommand args = get<VkDrawIndexedIndirectCommand>(cursor);
+						is_skipped |= !can_draw(state, true);
+						if (!is_skipped)
+							vkCmdDrawIndexed(command_buffer, args.indexCount, args.instanceCount, args.firstIndex, args.vertexOffset, args.firstInstance);
+						break;
+					}
+					case DRAW_INDEXED_INDIRECT: {
+						VkBuffer buffer = lookup(replay.buffers, get<uint32_t>(cursor));
+						VkDeviceSize offset = get<VkDeviceSize>(cursor);
+						uint32_t n_draws = get<uint32_t>(cursor);
+						uint32_t stride = get<uint32_t>(cursor);
+						is_skipped |= !can_draw(state, true) || buffer == VK_NULL_HANDLE || (n_draws > 1 && !replay.has_multi_draw_indirect);
+						if (!is_skipped)
+							vkCmdDrawIndexedIndirect(command_buffer, buffer, offset, n_draws, stride);
+						break;
+					}
+					case DRAW_INDEXED_INDIRECT_COUNT: {
+						VkBuffer buffer = lookup(replay.buffers, get<uint32_t>(cursor));
+						VkDeviceSize offset = get<VkDeviceSize>(cursor);
+						VkBuffer count_buffer = lookup(replay.buffers, get<uint32_t>(cursor));
+						VkDeviceSize count_offset = get<VkDeviceSize>(cursor);
+						uint32_t max_draws = get<uint32_t>(cursor);
+						uint32_t stride = get<uint32_t>(cursor);
+						is_skipped |= !can_draw(state, true) || buffer == VK_NULL_HANDLE || count_buffer == VK_NULL_HANDLE || dispatch.vkCmdDrawIndexedIndirectCountKHR == nullptr;
+						if (!is_skipped)
+							dispatch.vkCmdDrawIndexedIndirectCountKHR(command_buffer, buffer, offset, count_buffer, count_offset, max_draws, stride);
+						break;
+					}
+					case DISPATCH: {
+						uint32_t x = get<uint32_t>(cursor);
+						uint32_t y = get<uint32_t>(cursor);
+						uint32_t z = get<uint32_t>(cursor);
+						is_skipped |= !state.has_pipeline[1] || state.missing_sets[1] != 0;
+						if (!is_skipped)
+							vkCmdDispatch(command_buffer, x, y, z);
+						break;
+					}
+					case BEGIN_RENDERING: {
+						VkRenderingInfoKHR info = {};
+						info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+						info.flags = get<VkRenderingFlagsKHR>(cursor);
+						info.renderArea = get<VkRect2D>(cursor);
+						info.layerCount = get<uint32_t>(cursor);
+						info.viewMask = get<uint32_t>(cursor);
+						std::vector<VkRenderingAttachmentInfoKHR> colors = get_array<VkRenderingAttachmentInfoKHR>(cursor);
+						std::vector<VkRenderingAttachmentInfoKHR> depth = get_array<VkRenderingAttachmentInfoKHR>(cursor);
+						std::vector<VkRenderingAttachmentInfoKHR> stencil = get_array<VkRenderingAttachmentInfoKHR>(cursor);
+						bool has_views = true;
+						for (auto &attachment : colors)
+							has_views &= decode_attachment(attachment, replay);
+						for (auto &attachment : depth)
+							has_views &= decode_attachment(attachment, replay);
+						for (auto &attachment : stencil)
+							has_views &= decode_attachment(attachment, replay);
+						info.colorAttachmentCount = (uint32_t)colors.size();
+						info.pColorAttachments = colors.data();
+						info.pDepthAttachment = get_pointer(depth);
+						info.pStencilAttachment = get_pointer(stencil);
+						is_pass_skipped = !has_views || !replay.has_dynamic_rendering;
+						is_skipped = is_pass_skipped;
+						if (!is_skipped)
+							dispatch.vkCmdBeginRenderingKHR(command_buffer, &info);
+						break;
+					}
+					case END_RENDERING:
+						if (!is_skipped)
+							dispatch.vkCmdEndRenderingKHR(command_buffer);
+						is_pass_skipped = false;
+						break;
+					case EXECUTE_COMMANDS: {
+						// Secondaries the replay dropped are left out, the others still run
+						std::vector<uint32_t> ids = get_array<uint32_t>(cursor);
+						std::vector<VkCommandBuffer> secondaries;
+						for (uint32_t secondary_id : ids) {
+							VkCommandBuffer secondary = lookup(replay.command_buffers, secondary_id);
+							if (secondary != VK_NULL_HANDLE)
+								secondaries.push_back(secondary);
+						}
+						is_skipped |= secondaries.empty();
+						if (!is_skipped)
+							vkCmdExecuteCommands(command_buffer, (uint32_t)secondaries.size(), secondaries.data());
+						break;
+					}
+					default:
+						ct::error::exit("replay: unknown command in capture", 1);
+					}
+					replay.n_commands++;
+					replay.n_skipped += is_skipped;
+				}
+				VK_CHECK_RESULT(vkEndCommandBuffer(command_buffer));
+				replay.recordings.push_back(command_buffer);
+				at(replay.command_buffers, id) = command_buffer;
+			}
+
+			// Reads path and builds everything it describes, false if it is not a capture
+			inline bool load(const std::string &path, ct::vulkan::LogicalDevice &logical_device, Replay &replay) {
+				std::ifstream file(path, std::ios::binary);
+				if (!file)
+					return false;
+				std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+				ct::vulkan::capture::Cursor cursor;
+				cursor.data = bytes.data();
+				cursor.size = bytes.size();
+				if (cursor.size < 8 || ct::vulkan::capture::get<uint32_t>(cursor) != CAPTURE_MAGIC || ct::vulkan::capture::get<uint32_t>(cursor) != CAPTURE_VERSION)
+					return false;
+
+				replay.device = logical_device.device;
+				replay.queue = logical_device.queue_graphics;
+				ct::vulkan::create_command_pool(replay.device, logical_device.queue_family_indices.graphics, replay.command_pool);
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				replay.has_dynamic_rendering = dispatch.vkCmdBeginRenderingKHR != nullptr && dispatch.vkCmdEndRenderingKHR != nullptr;
+				std::vector<ct::vulkan::descriptor::PoolRatio> ratios = ct::vulkan::descriptor::get_default_ratios();
+				ratios.push_back({ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f });
+				ratios.push_back({ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1.0f });
+				ct::vulkan::descriptor::setup_allocator(replay.device, ratios, replay.descriptor_allocator);
+				replay.setup_command_buffer = ct::vulkan::get_command_buffer(true, replay.device, replay.command_pool);
+				Frame frame;
+				while (cursor.at + 8 <= cursor.size) {
+					uint32_t type = ct::vulkan::capture::get<uint32_t>(cursor);
+					uint32_t size = ct::vulkan::capture::get<uint32_t>(cursor);
+					if (cursor.at + size > cursor.size)
+						break;
+					ct::vulkan::capture::Cursor payload;
+					payload.data = cursor.data + cursor.at;
+					payload.size = size;
+					cursor.at += size;
+					switch (type) {
+					case ct::vulkan::capture::IMAGE: create_image(payload, logical_device, replay); break;
+					case ct::vulkan::capture::BUFFER: create_buffer(payload, logical_device, replay); break;
+					case ct::vulkan::capture::VIEW: create_view(payload, replay); break;
+					case ct::vulkan::capture::RENDER_PASS: create_render_pass(payload, replay); break;
+					case ct::vulkan::capture::FRAMEBUFFER: create_framebuffer(payload, replay); break;
+					case ct::vulkan::capture::COMMANDS: record(payload, replay); break;
+					case ct::vulkan::capture::SHADER_MODULE: create_shader_module(payload, replay); break;
+					case ct::vulkan::capture::SET_LAYOUT: create_set_layout(payload, replay); break;
+					case ct::vulkan::capture::PIPELINE_LAYOUT: create_pipeline_layout(payload, replay); break;
+					case ct::vulkan::capture::GRAPHICS_PIPELINE: create_graphics_pipeline(payload, replay); break;
+					case ct::vulkan::capture::COMPUTE_PIPELINE: create_compute_pipeline(payload, replay); break;
+					case ct::vulkan::capture::DESCRIPTOR_SET: create_descriptor_set(payload, replay); break;
+					case ct::vulkan::capture::UPDATE_DESCRIPTORS: update_descriptors(payload, replay); break;
+					case ct::vulkan::capture::SUBMIT: {
+						std::vector<uint32_t> ids = ct::vulkan::capture::get_array<uint32_t>(payload);
+						std::vector<VkCommandBuffer> submit;
+						for (uint32_t id : ids) {
+							VkCommandBuffer command_buffer = lookup(replay.command_buffers, id);
+							if (command_buffer != VK_NULL_HANDLE)
+								submit.push_back(command_buffer);
+						}
+						if (!submit.empty())
+							frame.submits.push_back(submit);
+						break;
+					}
+					case ct::vulkan::capture::FRAME:
+						replay.frames.push_back(frame);
+						frame = Frame();
+						break;
+					default:
+						break;
+					}
+				}
+				// Submissions after the last FRAME belong to a frame the capture stopped in the middle of, replaying them would time half a frame
+
+				// The zeroed buffers are seen by everything submitted after
+				VkMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+				vkCmdPipelineBarrier(replay.setup_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+				ct::vulkan::flush_command_buffer(replay.device, replay.command_pool, replay.queue, replay.setup_command_buffer);
+				return true;
+			}
+
+			// Submits the captured frames loops times in order, one vkQueueSubmit per frame and at most frames_in_flight of them
+			// queued, and returns the milliseconds until the last one is done
+			inline double run(uint32_t loops, uint32_t frames_in_flight, Replay &replay) {
+				std::vector<VkFence> fences(std::max(1u, frames_in_flight));
+				VkFenceCreateInfo fenceCreateInfo = {};
+				fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+				fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+				for (auto &fence : fences)
+					VK_CHECK_RESULT(vkCreateFence(replay.device, &fenceCreateInfo, ct::vulkan::get_allocator(), &fence));
+
+				std::vector<VkSubmitInfo> infos;
+				uint64_t n = 0;
+				auto t0 = std::chrono::steady_clock::now();
+				for (uint32_t loop = 0; loop < loops; loop++) {
+					for (const Frame &frame : replay.frames) {
+						VkFence fence = fences[n++ % fences.size()];
+						VK_CHECK_RESULT(vkWaitForFences(replay.device, 1, &fence, VK_TRUE, UINT64_MAX));
+						VK_CHECK_RESULT(vkResetFences(replay.device, 1, &fence));
+						infos.assign(frame.submits.size(), VkSubmitInfo());
+						for (uint32_t s = 0; s < frame.submits.size(); s++) {
+							infos[s].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+							infos[s].commandBufferCount = (uint32_t)frame.submits[s].size();
+							infos[s].pCommandBuffers = frame.submits[s].data();
+						}
+						VK_CHECK_RESULT(vkQueueSubmit(replay.queue, (uint32_t)infos.size(), infos.data(), fence));
+					}
+				}
+				VK_CHECK_RESULT(vkQueueWaitIdle(replay.queue));
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+				for (auto &fence : fences)
+					vkDestroyFence(replay.device, fence, ct::vulkan::get_allocator());
+				return ms;
+			}
+
+			inline void report(std::ostream &os, Replay &replay) {
+				os << "replay: frames: " << replay.frames.size() << " recordings: " << replay.recordings.size() << " images: " << (replay.images.empty() ? 0 : replay.images.size() - 1)
+					<< " buffers: " << (replay.buffers.empty() ? 0 : replay.buffers.size() - 1) << " pipelines: " << (replay.pipelines.empty() ? 0 : replay.pipelines.size() - 1)
+					<< " commands: " << replay.n_commands << " skipped: " << replay.n_skipped << " sets dropped: " << replay.n_dropped_sets << std::endl;
+			}
+
+			inline void destroy(Replay &replay) {
+				for (auto &pipeline : replay.pipelines)
+					if (pipeline != VK_NULL_HANDLE)
+						vkDestroyPipeline(replay.device, pipeline, ct::vulkan::get_allocator());
+				for (auto &layout : replay.pipeline_layouts)
+					if (layout != VK_NULL_HANDLE)
+						vkDestroyPipelineLayout(replay.device, layout, ct::vulkan::get_allocator());
+				if (replay.descriptor_allocator.device != VK_NULL_HANDLE)
+					ct::vulkan::descriptor::destroy_allocator(replay.descriptor_allocator);
+				for (auto &pool : replay.update_after_bind_pools)
+					vkDestroyDescriptorPool(replay.device, pool, ct::vulkan::get_allocator());
+				for (auto &layout : replay.set_layouts)
+					if (layout != VK_NULL_HANDLE)
+						vkDestroyDescriptorSetLayout(replay.device, layout, ct::vulkan::get_allocator());
+				for (auto &module : replay.shader_modules)
+					if (module != VK_NULL_HANDLE)
+						vkDestroyShaderModule(replay.device, module, ct::vulkan::get_allocator());
+				for (auto &framebuffer : replay.framebuffers)
+					if (framebuffer != VK_NULL_HANDLE)
+						vkDestroyFramebuffer(replay.device, framebuffer, ct::vulkan::get_allocator());
+				for (auto &render_pass : replay.render_passes)
+					if (render_pass != VK_NULL_HANDLE)
+						vkDestroyRenderPass(replay.device, render_pass, ct::vulkan::get_allocator());
+				for (auto &view : replay.views)
+					if (view != VK_NULL_HANDLE)
+						vkDestroyImageView(replay.device, view, ct::vulkan::get_allocator());
+				for (auto &image : replay.images)
+					if (image != VK_NULL_HANDLE)
+						vkDestroyImage(replay.device, image, ct::vulkan::get_allocator());
+				for (auto &buffer : replay.buffers)
+					if (buffer != VK_NULL_HANDLE)
+						vkDestroyBuffer(replay.device, buffer, ct::vulkan::get_allocator());
+				for (auto &memory : replay.memories)
+					vkFreeMemory(replay.device, memory, ct::vulkan::get_allocator());
+				if (replay.command_pool != VK_NULL_HANDLE)
+					vkDestroyCommandPool(replay.device, replay.command_pool, ct::vulkan::get_allocator());
+				replay = Replay();
+			}
+
+		}
+	}
+}
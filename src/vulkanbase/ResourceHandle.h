@@ -0,0 +1,124 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/SwapChainHelper.h"
+
+namespace ct {
+	namespace vulkan {
+
+		// Destruction deferred until the GPU has retired the frame (or timeline value) an object was last used in.
+		// Values only grow, so entries stay sorted and collecting pops from the front.
+		struct DeletionQueue {
+			struct Entry {
+				uint64_t value;
+				std::function<void()> destroy;
+			};
+			std::deque<Entry> entries;
+		};
+
+		inline void defer(uint64_t value, std::function<void()> destroy, DeletionQueue &queue) {
+			assert(queue.entries.empty() || queue.entries.back().value <= value);
+			queue.entries.push_back({ value, std::move(destroy) });
+		}
+
+		// Runs everything whose value has been retired. Call once per frame after the frame fence wait.
+		inline void collect(uint64_t completed_value, DeletionQueue &queue) {
+			while (!queue.entries.empty() && queue.entries.front().value <= completed_value) {
+				queue.entries.front().destroy();
+				queue.entries.pop_front();
+			}
+		}
+
+		// Runs everything, only once the device is idle
+		inline void flush(DeletionQueue &queue) {
+			collect(UINT64_MAX, queue);
+		}
+
+		// Move-only owner of one of the handle structs. The value sits on the heap so references to it survive moves.
+		// Without a queue reset() destroys right away, with one it defers to the last submitted value of its clock.
+		template <typename T>
+		class Handle {
+		public:
+			typedef std::function<void(T&)> Destroy;
+
+			Handle() {}
+
+			explicit Handle(Destroy destroy_, DeletionQueue *queue_ = nullptr, const uint64_t *clock_ = nullptr)
+				: value(new T()), destroy(std::move(destroy_)), queue(queue_), clock(clock_) {}
+
+			Handle(Handle &&other) : value(std::move(other.value)), destroy(std::move(other.destroy)), queue(other.queue), clock(other.clock) {}
+
+			Handle& operator=(Handle &&other) {
+				if (this != &other) {
+					reset();
+					value = std::move(other.value);
+					destroy = std::move(other.destroy);
+					queue = other.queue;
+					clock = other.clock;
+				}
+				return *this;
+			}
+
+			Handle(const Handle&) = delete;
+			Handle& operator=(const Handle&) = delete;
+
+			~Handle() {
+				reset();
+			}
+
+			T& operator*() { return *value; }
+			T* operator->() { return value.get(); }
+			T* get() { return value.get(); }
+			explicit operator bool() const { return value != nullptr; }
+
+			void reset() {
+				if (value == nullptr)
+					return;
+				if (queue != nullptr && clock != nullptr) {
+					T *raw = value.release();
+					Destroy fn = destroy;
+					defer(*clock, [raw, fn]() { fn(*raw); delete raw; }, *queue);
+				} else {
+					destroy(*value);
+					value.reset();
+				}
+			}
+
+		private:
+			std::unique_ptr<T> value;
+			Destroy destroy;
+			DeletionQueue *queue = nullptr;
+			const uint64_t *clock = nullptr;
+		};
+
+		// -> owners of the handle structs, device children take the device they belong to by reference, it has to outlive them
+
+		inline Handle<LogicalDevice> make_logical_device() {
+			return Handle<LogicalDevice>(ct::vulkan::destroy_device);
+		}
+
+		inline Handle<DepthStencil> make_depth_stencil(VkDevice &device, DeletionQueue *queue = nullptr, const uint64_t *clock = nullptr) {
+			return Handle<DepthStencil>([&device](DepthStencil &depth_stencil) { ct::vulkan::destroy_depth_stencil(device, depth_stencil); }, queue, clock);
+		}
+
+		inline Handle<Framebuffer> make_framebuffer(VkDevice &device, DeletionQueue *queue = nullptr, const uint64_t *clock = nullptr) {
+			return Handle<Framebuffer>([&device](Framebuffer &framebuffer) { ct::vulkan::destroy_framebuffer(device, framebuffer); }, queue, clock);
+		}
+
+		inline Handle<Synchronization> make_synchronization(VkDevice &device, DeletionQueue *queue = nullptr, const uint64_t *clock = nullptr) {
+			return Handle<Synchronization>([&device](Synchronization &sync) { ct::vulkan::destroy_synchronization(device, sync); }, queue, clock);
+		}
+
+		inline Handle<swapchain::SwapChain> make_swapchain(VkDevice &device, DeletionQueue *queue = nullptr, const uint64_t *clock = nullptr) {
+			return Handle<swapchain::SwapChain>([&device](swapchain::SwapChain &swapchain) { ct::vulkan::swapchain::destroy(device, swapchain); }, queue, clock);
+		}
+		// <-
+
+	}
+}
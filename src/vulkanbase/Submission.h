@@ -0,0 +1,267 @@
+#pragma once
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cassert>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/Dispatch.h"
+#include "utils/EnvHelper.h"
+#include "utils/Trace.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace submission {
+#define SUBMISSION_RING_CAPACITY 256
+#define SUBMISSION_MAX_COMMAND_BUFFERS 4
+#define SUBMISSION_MAX_WAITS 8
+#define SUBMISSION_MAX_SIGNALS 4
+
+			// One batch for a queue: command buffers with the semaphores they wait on and signal, an optional fence,
+			// and an optional present of image_index once the batch is submitted
+			struct Work {
+				VkQueue queue = VK_NULL_HANDLE;
+				uint32_t n_command_buffers = 0;
+				VkCommandBuffer command_buffers[SUBMISSION_MAX_COMMAND_BUFFERS];
+				uint32_t n_waits = 0;
+				VkSemaphore waits[SUBMISSION_MAX_WAITS];
+				VkPipelineStageFlags wait_stages[SUBMISSION_MAX_WAITS];
+				uint32_t n_signals = 0;
+				VkSemaphore signals[SUBMISSION_MAX_SIGNALS];
+				VkFence fence = VK_NULL_HANDLE;
+
+				// -> present, when swapchain is set, on queue_present which may be another queue than the batch's
+				VkQueue queue_present = VK_NULL_HANDLE;
+				VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+				uint32_t image_index = 0;
+				// <-
+			};
+
+			struct Cell {
+				std::atomic<uint64_t> sequence{0};
+				Work work;
+			};
+
+			// Owns the device's queues: producers push work into a bounded ring without locks, one thread drains it and turns every run of
+			// consecutive work for one queue into a single vkQueueSubmit. Order is kept, so semaphores are signalled before they are waited on.
+			// Without the thread (CT_SUBMIT_THREAD unset) work is submitted inline by the thread that pushes it, one call per batch.
+			// The render thread acquires images while the submit thread presents, swapchain_mutex keeps the two calls apart.
+			struct Service {
+				Cell ring[SUBMISSION_RING_CAPACITY];
+				std::atomic<uint64_t> tail{0};
+				uint64_t head = 0;					// only the submit thread moves it
+
+				std::thread thread;
+				std::atomic<bool> running{false};
+				std::mutex sleep_mutex;
+				std::condition_variable wake;
+				std::condition_variable drained;
+				std::atomic<uint64_t> n_done{0};
+				std::mutex swapchain_mutex;
+				Work drained_works[SUBMISSION_RING_CAPACITY];		// the submit thread's copy of what it took
+
+				std::atomic<uint64_t> n_works{0};
+				std::atomic<uint64_t> n_submits{0};
+				std::atomic<uint64_t> n_presents{0};
+				std::atomic<uint64_t> n_full{0};
+			};
+
+			inline void add_command_buffer(VkCommandBuffer command_buffer, Work &work) {
+				assert(work.n_command_buffers < SUBMISSION_MAX_COMMAND_BUFFERS);
+				work.command_buffers[work.n_command_buffers++] = command_buffer;
+			}
+
+			inline void add_wait(VkSemaphore semaphore, VkPipelineStageFlags stage, Work &work) {
+				assert(work.n_waits < SUBMISSION_MAX_WAITS);
+				work.waits[work.n_waits] = semaphore;
+				work.wait_stages[work.n_waits++] = stage;
+			}
+
+			inline void add_signal(VkSemaphore semaphore, Work &work) {
+				assert(work.n_signals < SUBMISSION_MAX_SIGNALS);
+				work.signals[work.n_signals++] = semaphore;
+			}
+
+			inline void set_present(VkQueue queue_present, VkSwapchainKHR swapchain, uint32_t image_index, Work &work) {
+				work.queue_present = queue_present;
+				work.swapchain = swapchain;
+				work.image_index = image_index;
+			}
+
+			// Acquire and present both use the swapchain, which must not be used by two threads at once. Empty without a service.
+			inline std::unique_lock<std::mutex> lock_swapchain(Service *service) {
+				return service != nullptr ? std::unique_lock<std::mutex>(service->swapchain_mutex) : std::unique_lock<std::mutex>();
+			}
+
+			// Submits works[0, count) in order. A run of consecutive works for one queue becomes one vkQueueSubmit, it ends at a second, different
+			// fence (a call signals one fence, once all of its batches are done) or at a present, which needs its batch submitted first.
+			// Works of one frame leave the fence to its last one, or all carry the frame's fence, so they end up in one call.
+			inline void execute(const Work *works, uint32_t count, Service *service) {
+				CT_TRACE_FUNCTION();
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VkSubmitInfo infos[SUBMISSION_RING_CAPACITY];
+				uint32_t begin = 0;
+				while (begin < count) {
+					VkQueue queue = works[begin].queue;
+					VkFence fence = VK_NULL_HANDLE;
+					uint32_t end = begin;
+					while (end < count && works[end].queue == queue
+							&& (fence == VK_NULL_HANDLE || works[end].fence == VK_NULL_HANDLE || works[end].fence == fence)) {
+						const Work &work = works[end];
+						if (work.fence != VK_NULL_HANDLE)
+							fence = work.fence;
+						VkSubmitInfo &submitInfo = infos[end - begin];
+						submitInfo = {};
+						submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+						submitInfo.waitSemaphoreCount = work.n_waits;
+						submitInfo.pWaitSemaphores = work.waits;
+						submitInfo.pWaitDstStageMask = work.wait_stages;
+						submitInfo.commandBufferCount = work.n_command_buffers;
+						submitInfo.pCommandBuffers = work.command_buffers;
+						submitInfo.signalSemaphoreCount = work.n_signals;
+						submitInfo.pSignalSemaphores = work.signals;
+						end++;
+						if (work.swapchain != VK_NULL_HANDLE)
+							break;
+					}
+					VK_CHECK_RESULT(dispatch.vkQueueSubmit(queue, end - begin, infos, fence));
+					if (service != nullptr)
+						service->n_submits.fetch_add(1, std::memory_order_relaxed);
+
+					// The batch before the present signals what it waits on, the last signal semaphore
+					const Work &last = works[end - 1];
+					if (last.swapchain != VK_NULL_HANDLE) {
+						VkPresentInfoKHR presentInfo = {};
+						presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+						presentInfo.swapchainCount = 1;
+						presentInfo.pSwapchains = &last.swapchain;
+						presentInfo.pImageIndices = &last.image_index;
+						if (last.n_signals > 0) {
+							presentInfo.waitSemaphoreCount = 1;
+							presentInfo.pWaitSemaphores = &last.signals[last.n_signals - 1];
+						}
+						{
+							std::unique_lock<std::mutex> lock = lock_swapchain(service);
+							VK_CHECK_RESULT(dispatch.vkQueuePresentKHR(last.queue_present, &presentInfo));
+						}
+						ct::vulkan::capture::frame();
+						if (service != nullptr)
+							service->n_presents.fetch_add(1, std::memory_order_relaxed);
+					}
+					begin = end;
+				}
+			}
+
+			// Everything pushed so far is in, nothing more can be taken now
+			inline uint32_t drain(Work *works, Service &service) {
+				uint32_t count = 0;
+				while (count < SUBMISSION_RING_CAPACITY) {
+					Cell &cell = service.ring[service.head % SUBMISSION_RING_CAPACITY];
+					if (cell.sequence.load(std::memory_order_acquire) != service.head + 1)
+						break;
+					works[count++] = cell.work;
+					cell.sequence.store(service.head + SUBMISSION_RING_CAPACITY, std::memory_order_release);
+					service.head++;
+				}
+				return count;
+			}
+
+			inline void work(Service &service) {
+				while (true) {
+					uint32_t count = drain(service.drained_works, service);
+					if (count > 0) {
+						execute(service.drained_works, count, &service);
+						service.n_done.fetch_add(count, std::memory_order_release);
+						{ std::lock_guard<std::mutex> lock(service.sleep_mutex); }
+						service.drained.notify_all();
+						continue;
+					}
+					std::unique_lock<std::mutex> lock(service.sleep_mutex);
+					if (!service.running.load(std::memory_order_relaxed) && service.tail.load(std::memory_order_acquire) == service.head)
+						return;
+					service.wake.wait(lock, [&service]() {
+						return service.tail.load(std::memory_order_acquire) != service.head || !service.running.load(std::memory_order_relaxed);
+					});
+				}
+			}
+
+			inline void setup(Service &service) {
+				for (uint64_t i = 0; i < SUBMISSION_RING_CAPACITY; i++)
+					service.ring[i].sequence.store(i, std::memory_order_relaxed);
+				if (!ct::env::get_flag("CT_SUBMIT_THREAD"))
+					return;
+				service.running = true;
+				service.thread = std::thread(work, std::ref(service));
+				std::cout << "submission: thread" << std::endl;
+			}
+
+			inline bool is_threaded(Service *service) {
+				return service != nullptr && service->running.load(std::memory_order_relaxed);
+			}
+
+			// Hands the work to the submit thread, or submits it right away without one. A full ring waits for the submit thread, work is never dropped.
+			inline void submit(const Work &work, Service *service) {
+				if (service != nullptr)
+					service->n_works.fetch_add(1, std::memory_order_relaxed);
+				if (!is_threaded(service)) {
+					execute(&work, 1, service);
+					return;
+				}
+				uint64_t position = service->tail.load(std::memory_order_relaxed);
+				while (true) {
+					Cell &cell = service->ring[position % SUBMISSION_RING_CAPACITY];
+					uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+					if (sequence == position) {
+						if (service->tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+							cell.work = work;
+							cell.sequence.store(position + 1, std::memory_order_release);
+							break;
+						}
+					} else if (sequence < position) {
+						service->n_full.fetch_add(1, std::memory_order_relaxed);
+						std::this_thread::yield();
+						position = service->tail.load(std::memory_order_relaxed);
+					} else {
+						position = service->tail.load(std::memory_order_relaxed);
+					}
+				}
+				{ std::lock_guard<std::mutex> lock(service->sleep_mutex); }
+				service->wake.notify_one();
+			}
+
+			// Blocks until the submit thread has presented n frames. Acquiring waits for this only when the images the render thread holds
+			// (acquired, not yet presented) would otherwise exceed what an acquire without timeout allows.
+			inline void wait_presents(uint64_t n, Service *service) {
+				if (!is_threaded(service) || service->n_presents.load(std::memory_order_acquire) >= n)
+					return;
+				CT_TRACE_FUNCTION();
+				std::unique_lock<std::mutex> lock(service->sleep_mutex);
+				service->drained.wait(lock, [service, n]() { return service->n_presents.load(std::memory_order_acquire) >= n; });
+			}
+
+			inline void report(std::ostream &os, Service &service) {
+				uint64_t n_works = service.n_works.load();
+				uint64_t n_submits = service.n_submits.load();
+				os << "submission: works: " << n_works << " vkQueueSubmit: " << n_submits << " works per submit: " << (n_submits > 0 ? (double)n_works / n_submits : 0.0)
+					<< " presents: " << service.n_presents.load() << " ring full: " << service.n_full.load() << std::endl;
+			}
+
+			// Submits what is left and stops the thread, before the device is waited on and destroyed
+			inline void destroy(Service &service) {
+				if (!service.running)
+					return;
+				{
+					std::lock_guard<std::mutex> lock(service.sleep_mutex);
+					service.running = false;
+				}
+				service.wake.notify_all();
+				service.thread.join();
+			}
+
+		}
+	}
+}
@@ -2,11 +2,15 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 #include <vulkan/vulkan.h>
 #include "vulkanbase/VulkanHelper.h"
 #include "vulkanbase/VulkanStrings.h"
+#include "vulkanbase/TraceGpu.h"
+#include "vulkanbase/Submission.h"
 #include "utils/ErrorHelper.h"
+#include "utils/Trace.h"
 
 
 namespace ct {
@@ -23,102 +27,81 @@ namespace ct {
 				VkColorSpaceKHR color_space;
 				
 				uint32_t imagecount;
+				VkImageUsageFlags image_usage;
+				// Images the application may hold (acquired, not yet presented) when it acquires another one without timeout
+				uint32_t max_acquired = 1;
 
 				std::vector<VkImage> images;
 				std::vector<VkImageView> views;
-
-				PFN_vkGetPhysicalDeviceSurfaceSupportKHR fpGetPhysicalDeviceSurfaceSupportKHR;
-				PFN_vkGetPhysicalDeviceSurfaceCapabilitiesKHR fpGetPhysicalDeviceSurfaceCapabilitiesKHR;
-				PFN_vkGetPhysicalDeviceSurfaceFormatsKHR fpGetPhysicalDeviceSurfaceFormatsKHR;
-				PFN_vkGetPhysicalDeviceSurfacePresentModesKHR fpGetPhysicalDeviceSurfacePresentModesKHR;
-				PFN_vkCreateSwapchainKHR fpCreateSwapchainKHR;
-				PFN_vkDestroySwapchainKHR fpDestroySwapchainKHR;
-				PFN_vkGetSwapchainImagesKHR fpGetSwapchainImagesKHR;
-				PFN_vkAcquireNextImageKHR fpAcquireNextImageKHR;
-				PFN_vkQueuePresentKHR fpQueuePresentKHR;
+				// Graphics and present family when they differ, the images are then shared by both queues
+				std::vector<uint32_t> queue_families;
 			};
 
 
-			// Macro to get a procedure address based on a vulkan instance
-#define GET_INSTANCE_PROC_ADDR(inst, entrypoint, container)\
-			{\
-				container.fp##entrypoint = reinterpret_cast<PFN_vk##entrypoint>(vkGetInstanceProcAddr(inst, "vk"#entrypoint));\
-				if (container.fp##entrypoint == NULL) {\
-					ct::error::exit("Swapchain (instance) function entry point is NULL.", 1);\
-				}\
-			}\
-
-
-			// Macro to get a procedure address based on a vulkan device
-#define GET_DEVICE_PROC_ADDR(dev, entrypoint, container)\
-			{\
-				container.fp##entrypoint = reinterpret_cast<PFN_vk##entrypoint>(vkGetDeviceProcAddr(dev, "vk"#entrypoint));\
-				if (container.fp##entrypoint == NULL) {\
-					ct::error::exit("Swapchain (device) function entry point is NULL.", 1);\
-				}\
-			}\
-
-			inline void connect(VkInstance &instance, VkDevice &device, ct::vulkan::swapchain::SwapChain &swapchain) {
-				GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceSupportKHR, swapchain);
-				GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceCapabilitiesKHR, swapchain);
-				GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceFormatsKHR, swapchain);
-				GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfacePresentModesKHR, swapchain);
-				GET_DEVICE_PROC_ADDR(device, CreateSwapchainKHR, swapchain);
-				GET_DEVICE_PROC_ADDR(device, DestroySwapchainKHR, swapchain);
-				GET_DEVICE_PROC_ADDR(device, GetSwapchainImagesKHR, swapchain);
-				GET_DEVICE_PROC_ADDR(device, AcquireNextImageKHR, swapchain);
-				GET_DEVICE_PROC_ADDR(device, QueuePresentKHR, swapchain);
+			// The surface and swapchain functions come from the dispatch tables, connect_instance and connect_device must have run
+			inline void connect(VkInstance &instance, ct::vulkan::swapchain::SwapChain &swapchain) {
+				const ct::vulkan::dispatch::InstanceTable &instance_dispatch = ct::vulkan::dispatch::get_instance();
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (instance_dispatch.vkGetPhysicalDeviceSurfaceSupportKHR == nullptr || instance_dispatch.vkGetPhysicalDeviceSurfaceCapabilitiesKHR == nullptr
+						|| instance_dispatch.vkGetPhysicalDeviceSurfaceFormatsKHR == nullptr || instance_dispatch.vkGetPhysicalDeviceSurfacePresentModesKHR == nullptr) {
+					ct::error::exit("Swapchain (instance) function entry point is NULL.", 1);
+				}
+				if (dispatch.vkCreateSwapchainKHR == nullptr || dispatch.vkDestroySwapchainKHR == nullptr || dispatch.vkGetSwapchainImagesKHR == nullptr
+						|| dispatch.vkAcquireNextImageKHR == nullptr || dispatch.vkQueuePresentKHR == nullptr) {
+					ct::error::exit("Swapchain (device) function entry point is NULL.", 1);
+				}
+				swapchain.instance = instance;
 			}
 
-			inline void check_present_support(VkPhysicalDevice &physical_device, VkSurfaceKHR &surface, ct::vulkan::swapchain::SwapChain &swapchain) {
+			// Picks the family frames are presented from, before create_device creates its queue: the graphics family when it can present
+			// to surface (no sharing between queues), the first family that can otherwise
+			inline void request_present(VkSurfaceKHR &surface, ct::vulkan::LogicalDevice &logical_device) {
 				uint32_t queueCount;
-				vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queueCount, NULL);
+				vkGetPhysicalDeviceQueueFamilyProperties(logical_device.physical_device, &queueCount, NULL);
 				assert(queueCount >= 1);
 				std::cout << "n-queue-families: " << queueCount << std::endl;
 
-				std::vector<VkQueueFamilyProperties> queueProps(queueCount);
-				vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queueCount, queueProps.data());
-
-				std::vector<VkBool32> supportsPresent(queueCount);
-				for (uint32_t i = 0; i < queueCount; i++)
-					swapchain.fpGetPhysicalDeviceSurfaceSupportKHR(physical_device, i, surface, &supportsPresent[i]);
-
-				uint32_t graphicsQueueNodeIndex = UINT32_MAX;
+				uint32_t graphicsQueueNodeIndex = ct::vulkan::get_queue_family_index(logical_device.physical_device, VK_QUEUE_GRAPHICS_BIT);
 				uint32_t presentQueueNodeIndex = UINT32_MAX;
 				for (uint32_t i = 0; i < queueCount; i++) {
-					if ((queueProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0)
-						if (graphicsQueueNodeIndex == UINT32_MAX)
-							graphicsQueueNodeIndex = i;
-
-					if (supportsPresent[i] == VK_TRUE) {
-						graphicsQueueNodeIndex = i;
+					VkBool32 supportsPresent = VK_FALSE;
+					VK_CHECK_RESULT(vkGetPhysicalDeviceSurfaceSupportKHR(logical_device.physical_device, i, surface, &supportsPresent));
+					if (supportsPresent != VK_TRUE)
+						continue;
+					if (presentQueueNodeIndex == UINT32_MAX || i == graphicsQueueNodeIndex)
 						presentQueueNodeIndex = i;
-						break;
-					}
 				}
 
+				// Exit if no queue can present to the surface
 				if (presentQueueNodeIndex == UINT32_MAX)
-					for (uint32_t i = 0; i < queueCount; ++i)
-						if (supportsPresent[i] == VK_TRUE) {
-							presentQueueNodeIndex = i;
-							break;
-						}
-
-				// Exit if either a graphics or a presenting queue hasn't been found
-				if (graphicsQueueNodeIndex == UINT32_MAX || presentQueueNodeIndex == UINT32_MAX)
-					ct::error::exit("Could not find a graphics and/or presenting queue!", -1);
+					ct::error::exit("Could not find a presenting queue!", -1);
+				logical_device.queue_family_indices.present = presentQueueNodeIndex;
+			}
 
-				// todo : Add support for separate graphics and presenting queue
+			inline void check_present_support(ct::vulkan::LogicalDevice &logical_device, VkSurfaceKHR &surface, ct::vulkan::swapchain::SwapChain &swapchain) {
+				const ct::vulkan::dispatch::InstanceTable &instance_dispatch = ct::vulkan::dispatch::get_instance();
+				VkPhysicalDevice &physical_device = logical_device.physical_device;
+				uint32_t graphicsQueueNodeIndex = logical_device.queue_family_indices.graphics;
+				uint32_t presentQueueNodeIndex = logical_device.queue_family_indices.present;
+				VkBool32 supportsPresent = VK_FALSE;
+				if (presentQueueNodeIndex != UINT32_MAX)
+					instance_dispatch.vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, presentQueueNodeIndex, surface, &supportsPresent);
+				if (supportsPresent != VK_TRUE)
+					ct::error::exit("Could not find a presenting queue!", -1);
+
+				// A separate present queue reads the images the graphics queue wrote, both own them through concurrent sharing
+				swapchain.queue_families.clear();
 				if (graphicsQueueNodeIndex != presentQueueNodeIndex)
-					ct::error::exit("Separate graphics and presenting queues are not supported yet!", -1);
+					swapchain.queue_families = { graphicsQueueNodeIndex, presentQueueNodeIndex };
+				std::cout << "queue-families: graphics: " << graphicsQueueNodeIndex << " present: " << presentQueueNodeIndex << std::endl;
 
 				// Get list of supported surface formats
 				uint32_t formatCount;
-				VK_CHECK_RESULT(swapchain.fpGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &formatCount, NULL));
+				VK_CHECK_RESULT(instance_dispatch.vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &formatCount, NULL));
 				assert(formatCount > 0);
 
 				std::vector<VkSurfaceFormatKHR> surfaceFormats(formatCount);
-				VK_CHECK_RESULT(swapchain.fpGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &formatCount, surfaceFormats.data()));
+				VK_CHECK_RESULT(instance_dispatch.vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &formatCount, surfaceFormats.data()));
 
 
 				// If the surface format list only includes one entry with VK_FORMAT_UNDEFINED,
@@ -154,20 +137,23 @@ namespace ct {
 
 			inline void create(uint32_t width, uint32_t height, bool is_vsync, 
 					VkPhysicalDevice &physical_device, VkDevice &device, VkSurfaceKHR &surface, SwapChain &swapchain) {
+				CT_TRACE_FUNCTION();
+				const ct::vulkan::dispatch::InstanceTable &instance_dispatch = ct::vulkan::dispatch::get_instance();
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
 
 				VkSwapchainKHR oldSwapchain = swapchain.swapchain;
 
 				// Get physical device surface properties and formats
 				VkSurfaceCapabilitiesKHR surfCaps;
-				VK_CHECK_RESULT(swapchain.fpGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surfCaps));
+				VK_CHECK_RESULT(instance_dispatch.vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surfCaps));
 
 				// Get available present modes
 				uint32_t presentModeCount;
-				VK_CHECK_RESULT(swapchain.fpGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &presentModeCount, NULL));
+				VK_CHECK_RESULT(instance_dispatch.vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &presentModeCount, NULL));
 				assert(presentModeCount > 0);
 
 				std::vector<VkPresentModeKHR> presentModes(presentModeCount);
-				VK_CHECK_RESULT(swapchain.fpGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &presentModeCount, presentModes.data()));
+				VK_CHECK_RESULT(instance_dispatch.vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &presentModeCount, presentModes.data()));
 
 				VkExtent2D swapchainExtent = {};
 				swapchainExtent.width = width;
@@ -217,6 +203,11 @@ namespace ct {
 				swapchainCI.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
 				swapchainCI.queueFamilyIndexCount = 0;
 				swapchainCI.pQueueFamilyIndices = NULL;
+				if (swapchain.queue_families.size() > 1) {
+					swapchainCI.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+					swapchainCI.queueFamilyIndexCount = (uint32_t)swapchain.queue_families.size();
+					swapchainCI.pQueueFamilyIndices = swapchain.queue_families.data();
+				}
 				swapchainCI.presentMode = swapchainPresentMode;
 				swapchainCI.oldSwapchain = oldSwapchain;
 				// Setting clipped to VK_TRUE allows the implementation to discard rendering outside of the surface area
@@ -232,15 +223,24 @@ namespace ct {
 				if (surfCaps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)
 					swapchainCI.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
-				VK_CHECK_RESULT(swapchain.fpCreateSwapchainKHR(device, &swapchainCI, nullptr, &swapchain.swapchain));
+				// Enable storage on swap chain images if the surface and the colour format allow it (compute clears)
+				VkFormatProperties formatProps;
+				vkGetPhysicalDeviceFormatProperties(physical_device, swapchain.color_format, &formatProps);
+				if ((surfCaps.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT) && (formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT))
+					swapchainCI.imageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
+				swapchain.image_usage = swapchainCI.imageUsage;
+
+				VK_CHECK_RESULT(dispatch.vkCreateSwapchainKHR(device, &swapchainCI, ct::vulkan::get_allocator(), &swapchain.swapchain));
 
 
-				VK_CHECK_RESULT(swapchain.fpGetSwapchainImagesKHR(device, swapchain.swapchain, &swapchain.imagecount, NULL));
+				VK_CHECK_RESULT(dispatch.vkGetSwapchainImagesKHR(device, swapchain.swapchain, &swapchain.imagecount, NULL));
 
 				// Get the swap chain images
 				swapchain.images.resize(swapchain.imagecount);
 				swapchain.views.resize(swapchain.imagecount);
-				VK_CHECK_RESULT(swapchain.fpGetSwapchainImagesKHR(device, swapchain.swapchain, &swapchain.imagecount, swapchain.images.data()));
+				VK_CHECK_RESULT(dispatch.vkGetSwapchainImagesKHR(device, swapchain.swapchain, &swapchain.imagecount, swapchain.images.data()));
+				ct::vulkan::capture::swapchain_images(swapchain.images, swapchainCI);
+				swapchain.max_acquired = std::max(1u, swapchain.imagecount - std::min(swapchain.imagecount, surfCaps.minImageCount));
 
 				// Get the swap chain buffers containing the image and imageview
 				std::cout << "n-swapchain-images: " << swapchain.imagecount << std::endl; 
@@ -265,50 +265,90 @@ namespace ct {
 
 					colorAttachmentView.image = swapchain.images[i];
 
-					VK_CHECK_RESULT(vkCreateImageView(device, &colorAttachmentView, nullptr, &swapchain.views[i]));
+					VK_CHECK_RESULT(vkCreateImageView(device, &colorAttachmentView, ct::vulkan::get_allocator(), &swapchain.views[i]));
+					ct::vulkan::capture::view(swapchain.views[i], colorAttachmentView);
 				}
 			}
 
-			inline void acquire_next_image(VkDevice &device, VkSemaphore &present_complete, ct::vulkan::swapchain::SwapChain &swapchain) {
-				VK_CHECK_RESULT(swapchain.fpAcquireNextImageKHR(device, swapchain.swapchain, UINT64_MAX, present_complete, (VkFence)nullptr, &swapchain.current_buffer));
+			// Views and the swapchain itself, the images belong to the swapchain
+			inline void destroy(VkDevice &device, SwapChain &swapchain) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				for (auto &view : swapchain.views)
+					vkDestroyImageView(device, view, ct::vulkan::get_allocator());
+				swapchain.views.clear();
+				swapchain.images.clear();
+				if (swapchain.swapchain != VK_NULL_HANDLE)
+					dispatch.vkDestroySwapchainKHR(device, swapchain.swapchain, ct::vulkan::get_allocator());
+				swapchain.swapchain = VK_NULL_HANDLE;
+			}
+
+			// With a submit thread the render thread acquires while earlier frames are still in the ring: it only waits for a present when it
+			// would hold more than max_acquired images, and the acquire semaphore it signals is one no pending submission still waits on
+			inline void acquire_next_image(VkDevice &device, ct::vulkan::Synchronization &synchronization, ct::vulkan::swapchain::SwapChain &swapchain,
+					ct::vulkan::submission::Service *service = nullptr) {
+				CT_TRACE_FUNCTION();
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (synchronization.n_acquired > swapchain.max_acquired)
+					ct::vulkan::submission::wait_presents(synchronization.n_acquired - swapchain.max_acquired, service);
+
+				uint32_t index = synchronization.n_acquired % synchronization.acquire_semaphores.size();
+				if (synchronization.acquire_values[index] > synchronization.frame_completed) {
+					VK_CHECK_RESULT(dispatch.vkWaitForFences(device, 1, &synchronization.acquire_fences[index], VK_TRUE, UINT64_MAX));
+					synchronization.frame_completed = synchronization.acquire_values[index];
+				}
+				synchronization.present_complete = synchronization.acquire_semaphores[index];
+				{
+					std::unique_lock<std::mutex> lock = ct::vulkan::submission::lock_swapchain(service);
+					VK_CHECK_RESULT(dispatch.vkAcquireNextImageKHR(device, swapchain.swapchain, UINT64_MAX, synchronization.present_complete, (VkFence)nullptr,
+							&swapchain.current_buffer));
+				}
+				synchronization.n_acquired++;
 			}
 			
 
-			inline void render_and_swap(ct::vulkan::LogicalDevice &logical_device, ct::vulkan::swapchain::SwapChain &swapchain, ct::vulkan::Synchronization &synchronization) {
-				// Use a fence to wait until the command buffer has finished execution before using it again
-				VK_CHECK_RESULT(vkWaitForFences(logical_device.device, 1, &synchronization.wait_fences[swapchain.current_buffer], VK_TRUE, UINT64_MAX));
-				VK_CHECK_RESULT(vkResetFences(logical_device.device, 1, &synchronization.wait_fences[swapchain.current_buffer]));
-
-				// Pipeline stage at which the queue submission will wait (via pWaitSemaphores)
-				VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-				// The submit info structure specifices a command buffer queue submission batch
-				VkSubmitInfo submitInfo = {};
-				submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-				submitInfo.pWaitDstStageMask = &waitStageMask;									// Pointer to the list of pipeline stages that the semaphore waits will occur at
-				submitInfo.pWaitSemaphores = &synchronization.present_complete;							// Semaphore(s) to wait upon before the submitted command buffer starts executing
-				submitInfo.waitSemaphoreCount = 1;												// One wait semaphore
-				submitInfo.pSignalSemaphores = &synchronization.render_complete;						// Semaphore(s) to be signaled when command buffers have completed
-				submitInfo.signalSemaphoreCount = 1;											// One signal semaphore
-				submitInfo.pCommandBuffers = &logical_device.command_buffer[swapchain.current_buffer];					// Command buffers(s) to execute in this batch (submission)
-				submitInfo.commandBufferCount = 1;												// One command buffer
-
-				// Submit to the graphics queue passing a wait fence
-				VK_CHECK_RESULT(vkQueueSubmit(logical_device.queue_graphics, 1, &submitInfo, synchronization.wait_fences[swapchain.current_buffer]));
-				
-				VkPresentInfoKHR presentInfo = {};
-				presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-				presentInfo.pNext = NULL;
-				presentInfo.swapchainCount = 1;
-				presentInfo.pSwapchains = &swapchain.swapchain;
-				presentInfo.pImageIndices = &swapchain.current_buffer;
-				// Check if a wait semaphore has been specified to wait for before presenting the image
-				if (synchronization.render_complete != VK_NULL_HANDLE) {
-					presentInfo.pWaitSemaphores = &synchronization.render_complete;
-					presentInfo.waitSemaphoreCount = 1;
-				} 
-				
-				VK_CHECK_RESULT(swapchain.fpQueuePresentKHR(logical_device.queue_graphics, &presentInfo));
+			// Waits until the acquired image's command buffer has finished its last execution, once per frame right after acquiring and before
+			// anything the frame rewrites (instance buffers, per frame data, the command buffer itself) is touched
+			inline void wait_frame(ct::vulkan::LogicalDevice &logical_device, ct::vulkan::swapchain::SwapChain &swapchain, ct::vulkan::Synchronization &synchronization) {
+				CT_TRACE_FUNCTION();
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VK_CHECK_RESULT(dispatch.vkWaitForFences(logical_device.device, 1, &synchronization.wait_fences[swapchain.current_buffer], VK_TRUE, UINT64_MAX));
+				VK_CHECK_RESULT(dispatch.vkResetFences(logical_device.device, 1, &synchronization.wait_fences[swapchain.current_buffer]));
+				// Submissions on one queue retire in order, so this fence retires every frame up to the one it guarded
+				synchronization.frame_completed = std::max(synchronization.frame_completed, synchronization.fence_values[swapchain.current_buffer]);
+				// The previous submission of this command buffer has retired, its GPU spans can be read back
+				ct::trace::gpu_collect(swapchain.current_buffer);
+			}
 
+			// Submits the frame's command buffer and presents it, through service if there is one (the submit thread merges it with the
+			// unfenced work for the graphics queue pushed right before it, streaming uploads). Frame values count pushed frames, the queue keeps
+			// their order. wait_frame must have been called for the image.
+			inline void render_and_swap(ct::vulkan::LogicalDevice &logical_device, ct::vulkan::swapchain::SwapChain &swapchain, ct::vulkan::Synchronization &synchronization,
+					ct::vulkan::submission::Service *service = nullptr) {
+				CT_TRACE_FUNCTION();
+				// The present semaphore goes first, at the stage that writes the swapchain image, extra waits (if any) follow it
+				ct::vulkan::submission::Work work;
+				work.queue = logical_device.queue_graphics;
+				ct::vulkan::submission::add_wait(synchronization.present_complete, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, work);
+				for (uint32_t i = 0; i < synchronization.extra_waits.size(); i++)
+					ct::vulkan::submission::add_wait(synchronization.extra_waits[i], synchronization.extra_wait_stages[i], work);
+				ct::vulkan::submission::add_command_buffer(logical_device.command_buffer[swapchain.current_buffer], work);
+				// Present waits on render_complete, the last signal of the batch
+				if (synchronization.render_complete != VK_NULL_HANDLE)
+					ct::vulkan::submission::add_signal(synchronization.render_complete, work);
+				work.fence = synchronization.wait_fences[swapchain.current_buffer];
+				// Presented from the present queue, the graphics queue when the device was created without one
+				VkQueue queue_present = logical_device.queue_present != VK_NULL_HANDLE ? logical_device.queue_present : logical_device.queue_graphics;
+				ct::vulkan::submission::set_present(queue_present, swapchain.swapchain, swapchain.current_buffer, work);
+
+				CT_TRACE_SCOPE("submit");
+				ct::vulkan::submission::submit(work, service);
+				synchronization.fence_values[swapchain.current_buffer] = ++synchronization.frame_submitted;
+				// The acquire semaphore is free again once this frame retired
+				uint32_t index = (synchronization.n_acquired - 1) % synchronization.acquire_semaphores.size();
+				synchronization.acquire_values[index] = synchronization.frame_submitted;
+				synchronization.acquire_fences[index] = work.fence;
+				synchronization.extra_waits.clear();
+				synchronization.extra_wait_stages.clear();
 			}
 
 
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "utils/Trace.h"
+
+namespace ct {
+	namespace trace {
+#define TRACE_GPU_SPANS_PER_SLOT 32
+
+		struct GpuSpan {
+			const char *name;
+			uint32_t query;
+		};
+
+		// GPU spans are timestamp pairs inside the command buffers of one frame slot (swapchain image).
+		// They are read back once the slot's fence has signalled and land on the "GPU" track of the CPU timeline.
+		struct GpuTimeline {
+			bool active = false;
+			VkDevice device = VK_NULL_HANDLE;
+			VkQueryPool query_pool = VK_NULL_HANDLE;
+			uint32_t slots = 0;
+			std::vector<std::vector<GpuSpan>> spans;
+			std::vector<std::vector<uint32_t>> open;
+			std::vector<uint64_t> results;
+
+			double ns_per_tick = 1.0;
+			uint64_t tick_mask = ~0ULL;
+			double offset_ns = 0.0;
+		};
+
+		inline GpuTimeline& get_gpu_timeline() {
+			static GpuTimeline timeline;
+			return timeline;
+		}
+
+		inline void gpu_reset_queries(ct::vulkan::LogicalDevice &logical_device, GpuTimeline &timeline) {
+			VkCommandBuffer command_buffer = ct::vulkan::get_command_buffer(true, logical_device.device, logical_device.command_pool);
+			vkCmdResetQueryPool(command_buffer, timeline.query_pool, 0, timeline.slots * 2 * TRACE_GPU_SPANS_PER_SLOT);
+			ct::vulkan::flush_command_buffer(logical_device.device, logical_device.command_pool, logical_device.queue_graphics, command_buffer);
+		}
+
+		// Creates the timestamp queries for n_slots frame slots and maps GPU ticks onto the trace clock.
+		// Does nothing unless tracing is enabled and the graphics queue supports timestamps.
+		inline void gpu_init(uint32_t n_slots, ct::vulkan::LogicalDevice &logical_device) {
+			GpuTimeline &timeline = get_gpu_timeline();
+			if (!is_enabled())
+				return;
+
+			uint32_t queueFamilyCount;
+			vkGetPhysicalDeviceQueueFamilyProperties(logical_device.physical_device, &queueFamilyCount, nullptr);
+			std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+			vkGetPhysicalDeviceQueueFamilyProperties(logical_device.physical_device, &queueFamilyCount, queueFamilyProperties.data());
+			uint32_t valid_bits = queueFamilyProperties[logical_device.queue_family_indices.graphics].timestampValidBits;
+			if (valid_bits == 0) {
+				std::cout << "trace: graphics queue has no timestamps, GPU spans disabled" << std::endl;
+				return;
+			}
+
+			timeline.device = logical_device.device;
+			timeline.slots = n_slots;
+			timeline.ns_per_tick = logical_device.properties.limits.timestampPeriod;
+			timeline.tick_mask = valid_bits >= 64 ? ~0ULL : ((1ULL << valid_bits) - 1);
+			timeline.spans.resize(n_slots);
+			timeline.open.resize(n_slots);
+			for (uint32_t i = 0; i < n_slots; i++) {
+				timeline.spans[i].reserve(TRACE_GPU_SPANS_PER_SLOT);
+				timeline.open[i].reserve(TRACE_GPU_SPANS_PER_SLOT);
+			}
+			// (value, availability) pairs for every query of one slot
+			timeline.results.resize(2 * 2 * TRACE_GPU_SPANS_PER_SLOT);
+
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = n_slots * 2 * TRACE_GPU_SPANS_PER_SLOT;
+			VK_CHECK_RESULT(vkCreateQueryPool(logical_device.device, &queryPoolInfo, ct::vulkan::get_allocator(), &timeline.query_pool));
+
+			// -> clock correlation: one timestamp, the CPU midpoint of its submission round trip is taken as the same instant
+			VkCommandBuffer command_buffer = ct::vulkan::get_command_buffer(true, logical_device.device, logical_device.command_pool);
+			vkCmdResetQueryPool(command_buffer, timeline.query_pool, 0, queryPoolInfo.queryCount);
+			vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timeline.query_pool, 0);
+			auto t0 = std::chrono::steady_clock::now();
+			ct::vulkan::flush_command_buffer(logical_device.device, logical_device.command_pool, logical_device.queue_graphics, command_buffer);
+			auto t1 = std::chrono::steady_clock::now();
+
+			uint64_t ticks;
+			VK_CHECK_RESULT(vkGetQueryPoolResults(logical_device.device, timeline.query_pool, 0, 1, sizeof(ticks), &ticks, sizeof(ticks),
+						VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+			timeline.offset_ns = (to_trace_ns(t0) + to_trace_ns(t1)) / 2.0 - (ticks & timeline.tick_mask) * timeline.ns_per_tick;
+			// <-
+
+			// Leave every query reset, so reads before a slot's first submission just come back unavailable
+			gpu_reset_queries(logical_device, timeline);
+			timeline.active = true;
+		}
+
+		// Call at the start of recording a slot's command buffer, outside of any render pass
+		inline void gpu_begin_frame(VkCommandBuffer command_buffer, uint32_t slot) {
+			const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+			GpuTimeline &timeline = get_gpu_timeline();
+			if (!timeline.active)
+				return;
+			dispatch.vkCmdResetQueryPool(command_buffer, timeline.query_pool, slot * 2 * TRACE_GPU_SPANS_PER_SLOT, 2 * TRACE_GPU_SPANS_PER_SLOT);
+			timeline.spans[slot].clear();
+			timeline.open[slot].clear();
+		}
+
+		// name must outlive the trace (string literal). The labels are there when the instance was created with VK_EXT_debug_utils.
+		inline void gpu_begin(VkCommandBuffer command_buffer, uint32_t slot, const char *name) {
+			const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+			const ct::vulkan::dispatch::InstanceTable &instance_dispatch = ct::vulkan::dispatch::get_instance();
+			GpuTimeline &timeline = get_gpu_timeline();
+			if (instance_dispatch.vkCmdBeginDebugUtilsLabelEXT != nullptr && is_enabled()) {
+				VkDebugUtilsLabelEXT label = {};
+				label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+				label.pLabelName = name;
+				instance_dispatch.vkCmdBeginDebugUtilsLabelEXT(command_buffer, &label);
+			}
+			if (!timeline.active)
+				return;
+
+			std::vector<GpuSpan> &spans = timeline.spans[slot];
+			if (spans.size() == TRACE_GPU_SPANS_PER_SLOT) {
+				timeline.open[slot].push_back(UINT32_MAX);
+				return;
+			}
+			uint32_t query = slot * 2 * TRACE_GPU_SPANS_PER_SLOT + 2 * (uint32_t)spans.size();
+			dispatch.vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timeline.query_pool, query);
+			timeline.open[slot].push_back((uint32_t)spans.size());
+			spans.push_back({ name, query });
+		}
+
+		inline void gpu_end(VkCommandBuffer command_buffer, uint32_t slot) {
+			const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+			const ct::vulkan::dispatch::InstanceTable &instance_dispatch = ct::vulkan::dispatch::get_instance();
+			GpuTimeline &timeline = get_gpu_timeline();
+			if (instance_dispatch.vkCmdEndDebugUtilsLabelEXT != nullptr && is_enabled())
+				instance_dispatch.vkCmdEndDebugUtilsLabelEXT(command_buffer);
+			if (!timeline.active || timeline.open[slot].empty())
+				return;
+
+			uint32_t index = timeline.open[slot].back();
+			timeline.open[slot].pop_back();
+			if (index != UINT32_MAX)
+				dispatch.vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timeline.query_pool, timeline.spans[slot][index].query + 1);
+		}
+
+		// Call after the slot's fence has signalled and before it is submitted again
+		inline void gpu_collect(uint32_t slot) {
+			const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+			GpuTimeline &timeline = get_gpu_timeline();
+			if (!timeline.active || timeline.spans[slot].empty())
+				return;
+
+			std::vector<GpuSpan> &spans = timeline.spans[slot];
+			uint32_t n_queries = 2 * (uint32_t)spans.size();
+			VkResult res = dispatch.vkGetQueryPoolResults(timeline.device, timeline.query_pool, slot * 2 * TRACE_GPU_SPANS_PER_SLOT, n_queries,
+					n_queries * 2 * sizeof(uint64_t), timeline.results.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+			if (res != VK_SUCCESS && res != VK_NOT_READY)
+				return;
+
+			ThreadBuffer *buffer = get_gpu_buffer();
+			for (uint32_t i = 0; i < spans.size(); i++) {
+				uint64_t *begin = &timeline.results[4 * i];
+				uint64_t *end = &timeline.results[4 * i + 2];
+				if (begin[1] == 0 || end[1] == 0)
+					continue;
+				double begin_ns = (begin[0] & timeline.tick_mask) * timeline.ns_per_tick + timeline.offset_ns;
+				double end_ns = (end[0] & timeline.tick_mask) * timeline.ns_per_tick + timeline.offset_ns;
+				if (begin_ns < 0 || end_ns < begin_ns)
+					continue;
+				emit(buffer, spans[i].name, (uint64_t)begin_ns, (uint64_t)end_ns);
+			}
+		}
+
+		// Collected spans stay in the trace, only the queries go
+		inline void gpu_destroy() {
+			GpuTimeline &timeline = get_gpu_timeline();
+			if (timeline.query_pool == VK_NULL_HANDLE)
+				return;
+			vkDestroyQueryPool(timeline.device, timeline.query_pool, ct::vulkan::get_allocator());
+			timeline.query_pool = VK_NULL_HANDLE;
+			timeline.active = false;
+		}
+
+	}
+}
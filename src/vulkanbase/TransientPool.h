@@ -0,0 +1,354 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/MemoryLedger.h"
+#include "utils/ErrorHelper.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace transient {
+#define TRANSIENT_NONE UINT32_MAX
+
+			// A resource that is only needed from first_pass to last_pass of a frame (inclusive).
+			// stages and access are how the passes use it, the barrier towards the next resource in the same memory waits on them.
+			struct Declaration {
+				bool is_image = true;
+				// -> image
+				uint32_t width = 0;
+				uint32_t height = 0;
+				VkFormat format = VK_FORMAT_UNDEFINED;
+				VkImageUsageFlags image_usage = 0;
+				// <-
+				// -> buffer
+				VkDeviceSize size = 0;
+				VkBufferUsageFlags buffer_usage = 0;
+				// <-
+				uint32_t first_pass = 0;
+				uint32_t last_pass = 0;
+				VkPipelineStageFlags stages = 0;
+				VkAccessFlags access = 0;
+			};
+
+			struct Resource {
+				Declaration declaration;
+				VkImage image = VK_NULL_HANDLE;
+				VkImageView view = VK_NULL_HANDLE;
+				VkBuffer buffer = VK_NULL_HANDLE;
+				VkMemoryRequirements requirements = {};
+				uint32_t block = 0;
+				VkDeviceSize offset = 0;
+				// Every other resource in the same memory, begin_use waits on them: the earlier ones of this frame and the later ones of the frame before
+				std::vector<uint32_t> aliases;
+			};
+
+			// One allocation per memory type, every resource of that type is bound at its offset in it
+			struct Block {
+				VkDeviceMemory memory = VK_NULL_HANDLE;
+				uint32_t memory_type = 0;
+				VkDeviceSize size = 0;
+			};
+
+			// Passes declare their transient images and buffers with lifetimes, build() places them so that resources never live at the same time
+			// share memory. Declaring the same list again (every frame) keeps what was built, a different list builds anew.
+			// Contents do not survive from one resource to the next in the same memory: the first use has to start from VK_IMAGE_LAYOUT_UNDEFINED.
+			// Frames in flight share the resources, so all frames have to use them on the same queue for begin_use to order one frame after the other.
+			struct Pool {
+				VkDevice device = VK_NULL_HANDLE;
+				VkPhysicalDeviceMemoryProperties memory_properties;
+				VkDeviceSize granularity = 1;
+				std::vector<Declaration> declarations;
+				std::vector<Resource> resources;
+				std::vector<Block> blocks;
+
+				// -> stats
+				VkDeviceSize requested_bytes = 0;
+				VkDeviceSize allocated_bytes = 0;
+				uint32_t n_aliased = 0;
+				uint32_t n_builds = 0;
+				// <-
+			};
+
+			inline void setup(ct::vulkan::LogicalDevice &logical_device, Pool &pool) {
+				pool.device = logical_device.device;
+				pool.memory_properties = logical_device.memory_properties;
+				// Linear buffers and optimal images next to each other in one allocation have to be this far apart
+				pool.granularity = std::max((VkDeviceSize)1, logical_device.properties.limits.bufferImageGranularity);
+			}
+
+			inline bool is_same(const Declaration &a, const Declaration &b) {
+				return a.is_image == b.is_image && a.width == b.width && a.height == b.height && a.format == b.format && a.image_usage == b.image_usage
+					&& a.size == b.size && a.buffer_usage == b.buffer_usage && a.first_pass == b.first_pass && a.last_pass == b.last_pass
+					&& a.stages == b.stages && a.access == b.access;
+			}
+
+			inline bool is_overlapping(const Declaration &a, const Declaration &b) {
+				return a.first_pass <= b.last_pass && b.first_pass <= a.last_pass;
+			}
+
+			// Start of a frame's declarations, handles are indices in declaration order
+			inline void reset(Pool &pool) {
+				pool.declarations.clear();
+			}
+
+			inline uint32_t declare_image(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, uint32_t first_pass, uint32_t last_pass,
+					VkPipelineStageFlags stages, VkAccessFlags access, Pool &pool) {
+				assert(first_pass <= last_pass);
+				Declaration declaration;
+				declaration.is_image = true;
+				declaration.width = width;
+				declaration.height = height;
+				declaration.format = format;
+				declaration.image_usage = usage;
+				declaration.first_pass = first_pass;
+				declaration.last_pass = last_pass;
+				declaration.stages = stages;
+				declaration.access = access;
+				pool.declarations.push_back(declaration);
+				return (uint32_t)pool.declarations.size() - 1;
+			}
+
+			inline uint32_t declare_buffer(VkDeviceSize size, VkBufferUsageFlags usage, uint32_t first_pass, uint32_t last_pass,
+					VkPipelineStageFlags stages, VkAccessFlags access, Pool &pool) {
+				assert(first_pass <= last_pass);
+				Declaration declaration;
+				declaration.is_image = false;
+				declaration.size = size;
+				declaration.buffer_usage = usage;
+				declaration.first_pass = first_pass;
+				declaration.last_pass = last_pass;
+				declaration.stages = stages;
+				declaration.access = access;
+				pool.declarations.push_back(declaration);
+				return (uint32_t)pool.declarations.size() - 1;
+			}
+
+			inline void release(Pool &pool) {
+				for (auto &resource : pool.resources) {
+					vkDestroyImageView(pool.device, resource.view, ct::vulkan::get_allocator());
+					vkDestroyImage(pool.device, resource.image, ct::vulkan::get_allocator());
+					vkDestroyBuffer(pool.device, resource.buffer, ct::vulkan::get_allocator());
+				}
+				pool.resources.clear();
+				for (auto &block : pool.blocks) {
+					ct::vulkan::memory::untrack(block.memory);
+					vkFreeMemory(pool.device, block.memory, ct::vulkan::get_allocator());
+				}
+				pool.blocks.clear();
+			}
+
+			inline void create(Resource &resource, VkDevice device) {
+				Declaration &declaration = resource.declaration;
+				if (declaration.is_image) {
+					VkImageCreateInfo image = {};
+					image.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+					image.imageType = VK_IMAGE_TYPE_2D;
+					image.format = declaration.format;
+					image.extent = { declaration.width, declaration.height, 1 };
+					image.mipLevels = 1;
+					image.arrayLayers = 1;
+					image.samples = VK_SAMPLE_COUNT_1_BIT;
+					image.tiling = VK_IMAGE_TILING_OPTIMAL;
+					image.usage = declaration.image_usage;
+					VK_CHECK_RESULT(vkCreateImage(device, &image, ct::vulkan::get_allocator(), &resource.image));
+					ct::vulkan::capture::image(resource.image, image);
+					vkGetImageMemoryRequirements(device, resource.image, &resource.requirements);
+				} else {
+					VkBufferCreateInfo bufferInfo = {};
+					bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+					bufferInfo.size = declaration.size;
+					bufferInfo.usage = declaration.buffer_usage;
+					bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+					VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, ct::vulkan::get_allocator(), &resource.buffer));
+					ct::vulkan::capture::buffer(resource.buffer, bufferInfo);
+					vkGetBufferMemoryRequirements(device, resource.buffer, &resource.requirements);
+				}
+			}
+
+			// Biggest first, each at the lowest offset that overlaps no resource of the same memory type alive in any of the same passes
+			inline void place(Pool &pool) {
+				std::vector<uint32_t> order(pool.resources.size());
+				for (uint32_t i = 0; i < order.size(); i++)
+					order[i] = i;
+				std::stable_sort(order.begin(), order.end(), [&pool](uint32_t a, uint32_t b) { return pool.resources[a].requirements.size > pool.resources[b].requirements.size; });
+
+				std::vector<uint32_t> placed;
+				for (uint32_t r : order) {
+					Resource &resource = pool.resources[r];
+					uint32_t memory_type = ct::vulkan::get_memory_type(pool.memory_properties, resource.requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+					resource.block = TRANSIENT_NONE;
+					for (uint32_t b = 0; b < pool.blocks.size(); b++) {
+						if (pool.blocks[b].memory_type == memory_type)
+							resource.block = b;
+					}
+					if (resource.block == TRANSIENT_NONE) {
+						Block block;
+						block.memory_type = memory_type;
+						pool.blocks.push_back(block);
+						resource.block = (uint32_t)pool.blocks.size() - 1;
+					}
+					VkDeviceSize alignment = std::max(resource.requirements.alignment, pool.granularity);
+
+					// Candidates are the start of the block and the end of every live neighbour, the lowest free one wins
+					std::vector<VkDeviceSize> candidates = { 0 };
+					for (uint32_t p : placed) {
+						Resource &other = pool.resources[p];
+						if (other.block == resource.block && is_overlapping(other.declaration, resource.declaration))
+							candidates.push_back(other.offset + other.requirements.size);
+					}
+					resource.offset = UINT64_MAX;
+					for (VkDeviceSize candidate : candidates) {
+						VkDeviceSize offset = (candidate + alignment - 1) / alignment * alignment;
+						if (offset >= resource.offset)
+							continue;
+						bool is_free = true;
+						for (uint32_t p : placed) {
+							Resource &other = pool.resources[p];
+							if (other.block == resource.block && is_overlapping(other.declaration, resource.declaration)
+									&& offset < other.offset + other.requirements.size && other.offset < offset + resource.requirements.size) {
+								is_free = false;
+								break;
+							}
+						}
+						if (is_free)
+							resource.offset = offset;
+					}
+					Block &block = pool.blocks[resource.block];
+					block.size = std::max(block.size, resource.offset + resource.requirements.size);
+					placed.push_back(r);
+				}
+
+				// Resources in the same memory hand it over with a barrier. Not only the ones ending before another starts: with frames in flight
+				// the next frame's first resource takes the memory over from the previous frame's last one, which may still be using it.
+				for (uint32_t r = 0; r < pool.resources.size(); r++) {
+					Resource &resource = pool.resources[r];
+					for (uint32_t p = 0; p < pool.resources.size(); p++) {
+						Resource &other = pool.resources[p];
+						if (p != r && other.block == resource.block && !is_overlapping(other.declaration, resource.declaration)
+								&& resource.offset < other.offset + other.requirements.size && other.offset < resource.offset + resource.requirements.size)
+							resource.aliases.push_back(p);
+					}
+					if (!resource.aliases.empty())
+						pool.n_aliased++;
+				}
+			}
+
+			// Creates, places and binds everything declared since reset(). Returns false if the declarations match what is built, nothing changes then.
+			// Rebuilding destroys the previous resources: no frame still in flight may use them.
+			inline bool build(Pool &pool) {
+				if (pool.declarations.size() == pool.resources.size()) {
+					bool is_unchanged = true;
+					for (uint32_t i = 0; i < pool.declarations.size() && is_unchanged; i++)
+						is_unchanged = is_same(pool.declarations[i], pool.resources[i].declaration);
+					if (is_unchanged)
+						return false;
+				}
+				release(pool);
+				pool.requested_bytes = 0;
+				pool.allocated_bytes = 0;
+				pool.n_aliased = 0;
+
+				pool.resources.resize(pool.declarations.size());
+				for (uint32_t i = 0; i < pool.declarations.size(); i++) {
+					pool.resources[i].declaration = pool.declarations[i];
+					create(pool.resources[i], pool.device);
+					pool.requested_bytes += pool.resources[i].requirements.size;
+				}
+				place(pool);
+
+				for (auto &block : pool.blocks) {
+					VkMemoryAllocateInfo mem_alloc = {};
+					mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+					mem_alloc.allocationSize = block.size;
+					mem_alloc.memoryTypeIndex = block.memory_type;
+					VK_CHECK_RESULT(vkAllocateMemory(pool.device, &mem_alloc, ct::vulkan::get_allocator(), &block.memory));
+					ct::vulkan::memory::track(block.memory, mem_alloc.memoryTypeIndex, mem_alloc.allocationSize, ct::vulkan::memory::TRANSIENT);
+					pool.allocated_bytes += block.size;
+				}
+
+				for (auto &resource : pool.resources) {
+					Block &block = pool.blocks[resource.block];
+					if (!resource.declaration.is_image) {
+						VK_CHECK_RESULT(vkBindBufferMemory(pool.device, resource.buffer, block.memory, resource.offset));
+						continue;
+					}
+					VK_CHECK_RESULT(vkBindImageMemory(pool.device, resource.image, block.memory, resource.offset));
+					bool is_depth = (resource.declaration.image_usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) != 0;
+					VkImageViewCreateInfo view = {};
+					view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+					view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+					view.format = resource.declaration.format;
+					view.subresourceRange.aspectMask = is_depth ? ct::vulkan::get_depth_aspect(resource.declaration.format) : VK_IMAGE_ASPECT_COLOR_BIT;
+					view.subresourceRange.levelCount = 1;
+					view.subresourceRange.layerCount = 1;
+					view.image = resource.image;
+					VK_CHECK_RESULT(vkCreateImageView(pool.device, &view, ct::vulkan::get_allocator(), &resource.view));
+					ct::vulkan::capture::view(resource.view, view);
+				}
+				pool.n_builds++;
+				return true;
+			}
+
+			inline Resource& get(uint32_t handle, Pool &pool) {
+				assert(handle < pool.resources.size());
+				return pool.resources[handle];
+			}
+
+			// The pool keeps ownership, destroy_depth_stencil leaves images without memory of their own alone
+			inline void get_depth_stencil(uint32_t handle, Pool &pool, ct::vulkan::DepthStencil &depth_stencil) {
+				Resource &resource = get(handle, pool);
+				depth_stencil.image = resource.image;
+				depth_stencil.view = resource.view;
+				depth_stencil.mem = VK_NULL_HANDLE;
+				depth_stencil.depth_format = resource.declaration.format;
+			}
+
+			inline void get_color_attachment(uint32_t handle, Pool &pool, ct::vulkan::ColorAttachment &color_attachment) {
+				Resource &resource = get(handle, pool);
+				color_attachment.image = resource.image;
+				color_attachment.view = resource.view;
+				color_attachment.mem = VK_NULL_HANDLE;
+				color_attachment.color_format = resource.declaration.format;
+			}
+
+			// Call before the first pass using handle, every frame: the resources it takes the memory over from have to be done with it, in this frame
+			// and in the one before. Records nothing if no other resource shares the memory.
+			inline void begin_use(VkCommandBuffer command_buffer, uint32_t handle, Pool &pool) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				Resource &resource = get(handle, pool);
+				if (resource.aliases.empty())
+					return;
+				VkMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				VkPipelineStageFlags src_stages = 0;
+				for (uint32_t alias : resource.aliases) {
+					src_stages |= pool.resources[alias].declaration.stages;
+					barrier.srcAccessMask |= pool.resources[alias].declaration.access;
+				}
+				barrier.dstAccessMask = resource.declaration.access;
+				dispatch.vkCmdPipelineBarrier(command_buffer, src_stages, resource.declaration.stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			}
+
+			inline void report(std::ostream &os, Pool &pool) {
+				if (pool.resources.empty())
+					return;
+				double mb = 1024.0 * 1024.0;
+				os << "transient-pool: resources: " << pool.resources.size() << " aliased: " << pool.n_aliased << " requested: " << pool.requested_bytes / mb
+					<< " MB allocated: " << pool.allocated_bytes / mb << " MB saved: " << (pool.requested_bytes - pool.allocated_bytes) / mb << " MB builds: " << pool.n_builds << std::endl;
+			}
+
+			inline void destroy(Pool &pool) {
+				if (pool.device == VK_NULL_HANDLE)
+					return;
+				release(pool);
+				pool.declarations.clear();
+				pool.device = VK_NULL_HANDLE;
+			}
+
+		}
+	}
+}
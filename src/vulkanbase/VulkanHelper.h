@@ -2,10 +2,15 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <cassert>
 
 #include <vulkan/vulkan.h>
 #include "vulkanbase/VulkanStrings.h"
+#include "vulkanbase/HostAllocator.h"
+#include "vulkanbase/Dispatch.h"
+#include "vulkanbase/MemoryLedger.h"
+#include "vulkanbase/Capture.h"
 #include "utils/ErrorHelper.h"
 #include "loader/LoaderBinary.h"
 
@@ -35,31 +40,36 @@ namespace ct {
 
 		struct LogicalDevice {
 			VkPhysicalDevice physical_device;
-			VkDevice device;
+			VkDevice device = VK_NULL_HANDLE;
 			VkPhysicalDeviceProperties properties;
 			VkPhysicalDeviceFeatures features;
-			VkPhysicalDeviceFeatures features_enabled;
+			VkPhysicalDeviceFeatures features_enabled = {};
+			// Extension feature structs chained into device creation, must outlive create_device
+			void *features_next = nullptr;
 			std::vector<const char*> extensions;
 			std::vector<const char*> extensions_enabled;
 			std::vector<std::string> extensions_supported;
 			VkPhysicalDeviceMemoryProperties memory_properties;
-			VkCommandPool command_pool;
+			VkCommandPool command_pool = VK_NULL_HANDLE;
 			std::vector<VkCommandBuffer> command_buffer;
 			VkQueue queue_graphics;
 			VkQueue queue_compute;
+			VkQueue queue_present = VK_NULL_HANDLE;
 
 			struct {
 				uint32_t graphics;
 				uint32_t compute;
 				uint32_t transfer;
+				// Set before create_device when the surface is known, the graphics family otherwise
+				uint32_t present = UINT32_MAX;
 			} queue_family_indices;
 
 		};
 
 		struct DepthStencil {
-			VkImage image;
-			VkDeviceMemory mem;
-			VkImageView view;
+			VkImage image = VK_NULL_HANDLE;
+			VkDeviceMemory mem = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
 
 			VkFormat depth_format;
 		};
@@ -70,11 +80,26 @@ namespace ct {
 
 		};
 
+		struct ColorAttachment {
+			VkImage image = VK_NULL_HANDLE;
+			VkDeviceMemory mem = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+
+			VkFormat color_format;
+		};
+
+		struct Buffer {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceMemory mem = VK_NULL_HANDLE;
+			VkDeviceSize size = 0;
+			void *mapped = nullptr;
+		};
+
 		struct Framebuffer {
 			uint32_t width;
 			uint32_t height;
 			uint32_t size;
-			VkRenderPass render_pass;
+			VkRenderPass render_pass = VK_NULL_HANDLE;
 			std::vector<VkFramebuffer> framebuffer;
 			ct::vulkan::DepthStencil depth_stencil;
 			ct::vulkan::Color color;
@@ -96,14 +121,41 @@ namespace ct {
 		};
 
 		struct Synchronization {
-			VkSemaphore present_complete;
-			VkSemaphore render_complete;
-			VkSemaphore overlay_complete;
+			VkSemaphore present_complete = VK_NULL_HANDLE;		// the acquire semaphore of the current frame, one of acquire_semaphores
+			VkSemaphore render_complete = VK_NULL_HANDLE;
+			VkSemaphore overlay_complete = VK_NULL_HANDLE;
 
 			std::vector<VkFence> wait_fences;
+
+			// Frame values: every submission gets the next one, a fence that signalled retires its value and all earlier ones
+			uint64_t frame_submitted = 0;
+			uint64_t frame_completed = 0;
+			std::vector<uint64_t> fence_values;
+
+			// Extra semaphores the next frame submission waits on (e.g. an async compute pass), consumed by that submission
+			std::vector<VkSemaphore> extra_waits;
+			std::vector<VkPipelineStageFlags> extra_wait_stages;
+
+			// Acquire semaphores used in turn, one more than there are images so an acquire can run ahead of the submission of the frame before.
+			// Each keeps the frame value and fence of the last submission that waited on it, it is signalled again only once that one retired.
+			std::vector<VkSemaphore> acquire_semaphores;
+			std::vector<uint64_t> acquire_values;
+			std::vector<VkFence> acquire_fences;
+			uint64_t n_acquired = 0;
 		};
 
-		inline void create_instance(std::string title, VkInstance &instance) {
+		inline bool is_instance_extension_supported(const char *name) {
+			uint32_t extensionCount = 0;
+			vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+			std::vector<VkExtensionProperties> extensions(extensionCount);
+			vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+			for (auto &extension : extensions)
+				if (std::string(extension.extensionName) == name)
+					return true;
+			return false;
+		}
+
+		inline void create_instance(std::string title, VkInstance &instance, std::vector<const char*> extra_extensions = {}) {
 			VkApplicationInfo appInfo = {};
 			appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
 			appInfo.pApplicationName = title.c_str();
@@ -117,6 +169,7 @@ namespace ct {
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
 			instanceExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 #endif
+			instanceExtensions.insert(instanceExtensions.end(), extra_extensions.begin(), extra_extensions.end());
 
 			VkInstanceCreateInfo instanceCreateInfo = {};
 			instanceCreateInfo.enabledExtensionCount = (uint32_t)instanceExtensions.size();
@@ -126,7 +179,8 @@ namespace ct {
 			instanceCreateInfo.pApplicationInfo = &appInfo;
 
 
-			VK_CHECK_RESULT(vkCreateInstance(&instanceCreateInfo, nullptr, &instance));
+			VK_CHECK_RESULT(vkCreateInstance(&instanceCreateInfo, ct::vulkan::get_allocator(), &instance));
+			ct::vulkan::dispatch::connect_instance(instance, instanceExtensions);
 		}
 
 		VkBool32 get_supported_depth_format(VkPhysicalDevice physical_device, VkFormat &depthFormat) {
@@ -153,6 +207,13 @@ namespace ct {
 			return false;
 		}
 
+		inline VkImageAspectFlags get_depth_aspect(VkFormat depth_format) {
+			// Depth only formats must not name the stencil aspect
+			if (depth_format == VK_FORMAT_D32_SFLOAT || depth_format == VK_FORMAT_D16_UNORM)
+				return VK_IMAGE_ASPECT_DEPTH_BIT;
+			return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+		}
+
 		inline uint32_t get_memory_type(VkPhysicalDeviceMemoryProperties &memory_properties, uint32_t typeBits, VkMemoryPropertyFlags properties) {
 			for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
 				if ((typeBits & 1) == 1) {
@@ -207,20 +268,19 @@ namespace ct {
 			throw std::runtime_error("Could not find a matching queue family index");
 		}
 
-		inline void search_and_pick_gpu(VkInstance &instance, LogicalDevice &logical_device) {
-
-			// -> physical device
+		inline void search_gpus(VkInstance &instance, std::vector<VkPhysicalDevice> &physical_devices) {
 			uint32_t n_gpus = 0;
 			vkEnumeratePhysicalDevices(instance, &n_gpus, nullptr);
 			std::cout << "n-gpus found: " << n_gpus << std::endl;
 
-			std::vector<VkPhysicalDevice> devices(n_gpus);
-			 VK_CHECK_RESULT(vkEnumeratePhysicalDevices(instance, &n_gpus, devices.data()));
+			physical_devices.resize(n_gpus);
+			VK_CHECK_RESULT(vkEnumeratePhysicalDevices(instance, &n_gpus, physical_devices.data()));
 			assert(n_gpus > 0);
-			// <-
+		}
 
+		inline void pick_gpu(VkPhysicalDevice physical_device, LogicalDevice &logical_device) {
 			// -> print out device
-			logical_device.physical_device = devices[0];
+			logical_device.physical_device = physical_device;
 			VkPhysicalDeviceProperties device_properties;
 			vkGetPhysicalDeviceProperties(logical_device.physical_device, &device_properties);
 			std::cout << "Device: " << device_properties.deviceName << std::endl;
@@ -232,13 +292,45 @@ namespace ct {
 			vkGetPhysicalDeviceProperties(logical_device.physical_device, &logical_device.properties);
 			vkGetPhysicalDeviceFeatures(logical_device.physical_device, &logical_device.features);
 			vkGetPhysicalDeviceMemoryProperties(logical_device.physical_device, &logical_device.memory_properties);
+
+			uint32_t extensionCount = 0;
+			vkEnumerateDeviceExtensionProperties(logical_device.physical_device, nullptr, &extensionCount, nullptr);
+			std::vector<VkExtensionProperties> extensions(extensionCount);
+			vkEnumerateDeviceExtensionProperties(logical_device.physical_device, nullptr, &extensionCount, extensions.data());
+			logical_device.extensions_supported.clear();
+			for (auto &extension : extensions)
+				logical_device.extensions_supported.push_back(extension.extensionName);
 			
 			std::cout << "n-memory-types: " << logical_device.memory_properties.memoryTypeCount << std::endl;
 			// <-
 		}
 
+		inline bool is_device_extension_supported(LogicalDevice &logical_device, const char *name) {
+			for (auto &extension : logical_device.extensions_supported)
+				if (extension == name)
+					return true;
+			return false;
+		}
 
-		inline void create_device(LogicalDevice &logical_device) {
+		// Timestamps of a queue family only count in their low timestampValidBits and wrap there, 0 if the family writes none.
+		// Take differences as ((end & mask) - (begin & mask)) & mask.
+		inline uint64_t get_timestamp_mask(LogicalDevice &logical_device, uint32_t queue_family_index) {
+			uint32_t queueFamilyCount;
+			vkGetPhysicalDeviceQueueFamilyProperties(logical_device.physical_device, &queueFamilyCount, nullptr);
+			std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+			vkGetPhysicalDeviceQueueFamilyProperties(logical_device.physical_device, &queueFamilyCount, queueFamilyProperties.data());
+			uint32_t valid_bits = queueFamilyProperties[queue_family_index].timestampValidBits;
+			return valid_bits >= 64 ? ~0ULL : ((1ULL << valid_bits) - 1);
+		}
+
+		inline void search_and_pick_gpu(VkInstance &instance, LogicalDevice &logical_device) {
+			std::vector<VkPhysicalDevice> devices;
+			search_gpus(instance, devices);
+			pick_gpu(devices[0], logical_device);
+		}
+
+
+		inline void create_device(LogicalDevice &logical_device, bool with_swapchain = true) {
 			std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{};
 			float queue_priority = 0.0f;
 			// -> graphics queue
@@ -265,25 +357,41 @@ namespace ct {
 			logical_device.queue_family_indices.transfer = logical_device.queue_family_indices.graphics;
 			// <-
 
+			// -> present queue, its own only when no other queue created here is of its family
+			if (logical_device.queue_family_indices.present == UINT32_MAX)
+				logical_device.queue_family_indices.present = logical_device.queue_family_indices.graphics;
+			if (logical_device.queue_family_indices.present != logical_device.queue_family_indices.graphics
+					&& logical_device.queue_family_indices.present != logical_device.queue_family_indices.compute) {
+				queueInfo = {};
+				queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+				queueInfo.queueFamilyIndex = logical_device.queue_family_indices.present;
+				queueInfo.queueCount = 1;
+				queueInfo.pQueuePriorities = &queue_priority;
+				queueCreateInfos.push_back(queueInfo);
+			}
+			// <-
+
 
-			// -> add swapchain extension
+			// -> add swapchain extension (headless workers render offscreen and skip it)
 			logical_device.extensions = std::vector<const char*>(logical_device.extensions_enabled);
-			logical_device.extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+			if (with_swapchain)
+				logical_device.extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 			// <-
 
 			// -> create logical device
 			VkDeviceCreateInfo deviceCreateInfo = {};
 			deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+			deviceCreateInfo.pNext = logical_device.features_next;
 			deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());;
 			deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
-			//deviceCreateInfo.pEnabledFeatures = &logical_device.features_enabled;
+			deviceCreateInfo.pEnabledFeatures = &logical_device.features_enabled;
 
 			if (logical_device.extensions.size() > 0) {
 				deviceCreateInfo.enabledExtensionCount = (uint32_t)logical_device.extensions.size();
 				deviceCreateInfo.ppEnabledExtensionNames = logical_device.extensions.data();
 			}
 
-			VK_CHECK_RESULT(vkCreateDevice(logical_device.physical_device, &deviceCreateInfo, nullptr, &logical_device.device));
+			VK_CHECK_RESULT(vkCreateDevice(logical_device.physical_device, &deviceCreateInfo, ct::vulkan::get_allocator(), &logical_device.device));
 			// <-
 		}
 
@@ -291,6 +399,7 @@ namespace ct {
 			// -> create graphics queue from device
 			vkGetDeviceQueue(logical_device.device, logical_device.queue_family_indices.graphics, 0, &queue_graphics);
 			vkGetDeviceQueue(logical_device.device, logical_device.queue_family_indices.compute, 0, &queue_compute);
+			vkGetDeviceQueue(logical_device.device, logical_device.queue_family_indices.present, 0, &logical_device.queue_present);
 			// <-
 		}
 
@@ -299,7 +408,7 @@ namespace ct {
 			cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 			cmdPoolInfo.queueFamilyIndex = queue_family_index;
 			cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-			VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &command_pool));
+			VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, ct::vulkan::get_allocator(), &command_pool));
 		}
 
 
@@ -312,24 +421,31 @@ namespace ct {
 			commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 			commandBufferAllocateInfo.commandBufferCount = imagecount;
 
-			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, command_buffer.data()));
+			VK_CHECK_RESULT(ct::vulkan::dispatch::get_device().vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, command_buffer.data()));
 		}
 
 
 		inline void create_synchronization(VkDevice &device, std::vector<VkCommandBuffer> &command_buffer, Synchronization &sync) {
 			VkSemaphoreCreateInfo semaphoreCreateInfo {};
 			semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-			vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &sync.present_complete);
-			vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &sync.render_complete);
-			vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &sync.overlay_complete);
+			sync.acquire_semaphores.resize(command_buffer.size() + 1);
+			sync.acquire_values.assign(sync.acquire_semaphores.size(), 0);
+			sync.acquire_fences.assign(sync.acquire_semaphores.size(), VK_NULL_HANDLE);
+			for (auto &semaphore : sync.acquire_semaphores)
+				vkCreateSemaphore(device, &semaphoreCreateInfo, ct::vulkan::get_allocator(), &semaphore);
+			sync.present_complete = sync.acquire_semaphores[0];
+			sync.n_acquired = 0;
+			vkCreateSemaphore(device, &semaphoreCreateInfo, ct::vulkan::get_allocator(), &sync.render_complete);
+			vkCreateSemaphore(device, &semaphoreCreateInfo, ct::vulkan::get_allocator(), &sync.overlay_complete);
 
 			// Wait fences to sync command buffer access
 			VkFenceCreateInfo fenceCreateInfo {};
 			fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 			fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 			sync.wait_fences.resize(command_buffer.size());
+			sync.fence_values.assign(command_buffer.size(), 0);
 			for (auto& fence : sync.wait_fences) {
-				VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
+				VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, ct::vulkan::get_allocator(), &fence));
 
 			}
 		}
@@ -350,7 +466,7 @@ namespace ct {
 			image.arrayLayers = 1;
 			image.samples = VK_SAMPLE_COUNT_1_BIT;
 			image.tiling = VK_IMAGE_TILING_OPTIMAL;
-			image.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			image.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 			image.flags = 0;
 
 			VkMemoryAllocateInfo mem_alloc = {};
@@ -366,7 +482,7 @@ namespace ct {
 			depthStencilView.format = depth_stencil.depth_format;
 			depthStencilView.flags = 0;
 			depthStencilView.subresourceRange = {};
-			depthStencilView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+			depthStencilView.subresourceRange.aspectMask = get_depth_aspect(depth_stencil.depth_format);
 			depthStencilView.subresourceRange.baseMipLevel = 0;
 			depthStencilView.subresourceRange.levelCount = 1;
 			depthStencilView.subresourceRange.baseArrayLayer = 0;
@@ -374,37 +490,130 @@ namespace ct {
 
 			VkMemoryRequirements memReqs;
 
-			VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &depth_stencil.image));
+			VK_CHECK_RESULT(vkCreateImage(device, &image, ct::vulkan::get_allocator(), &depth_stencil.image));
+			ct::vulkan::capture::image(depth_stencil.image, image);
 			vkGetImageMemoryRequirements(device, depth_stencil.image, &memReqs);
 			mem_alloc.allocationSize = memReqs.size;
 			mem_alloc.memoryTypeIndex = get_memory_type(memory_properties, memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device, &mem_alloc, nullptr, &depth_stencil.mem));
+			VK_CHECK_RESULT(vkAllocateMemory(device, &mem_alloc, ct::vulkan::get_allocator(), &depth_stencil.mem));
+			ct::vulkan::memory::track(depth_stencil.mem, mem_alloc.memoryTypeIndex, mem_alloc.allocationSize, ct::vulkan::memory::DEPTH);
 			VK_CHECK_RESULT(vkBindImageMemory(device, depth_stencil.image, depth_stencil.mem, 0));
 
 			depthStencilView.image = depth_stencil.image;
-			VK_CHECK_RESULT(vkCreateImageView(device, &depthStencilView, nullptr, &depth_stencil.view));
+			VK_CHECK_RESULT(vkCreateImageView(device, &depthStencilView, ct::vulkan::get_allocator(), &depth_stencil.view));
+			ct::vulkan::capture::view(depth_stencil.view, depthStencilView);
+
+		}
+
+		inline void setup_color_attachment(uint32_t width, uint32_t height, VkFormat color_format, VkImageUsageFlags usage, VkDevice &device, VkPhysicalDeviceMemoryProperties &memory_properties,
+				ColorAttachment &color_attachment) {
+			color_attachment.color_format = color_format;
+
+			VkImageCreateInfo image = {};
+			image.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			image.pNext = NULL;
+			image.imageType = VK_IMAGE_TYPE_2D;
+			image.format = color_format;
+			image.extent = { width, height, 1 };
+			image.mipLevels = 1;
+			image.arrayLayers = 1;
+			image.samples = VK_SAMPLE_COUNT_1_BIT;
+			image.tiling = VK_IMAGE_TILING_OPTIMAL;
+			image.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | usage;
+			image.flags = 0;
+
+			VkMemoryRequirements memReqs;
+			VK_CHECK_RESULT(vkCreateImage(device, &image, ct::vulkan::get_allocator(), &color_attachment.image));
+			ct::vulkan::capture::image(color_attachment.image, image);
+			vkGetImageMemoryRequirements(device, color_attachment.image, &memReqs);
 
+			VkMemoryAllocateInfo mem_alloc = {};
+			mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			mem_alloc.allocationSize = memReqs.size;
+			mem_alloc.memoryTypeIndex = get_memory_type(memory_properties, memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			VK_CHECK_RESULT(vkAllocateMemory(device, &mem_alloc, ct::vulkan::get_allocator(), &color_attachment.mem));
+			ct::vulkan::memory::track(color_attachment.mem, mem_alloc.memoryTypeIndex, mem_alloc.allocationSize, ct::vulkan::memory::SWAPCHAIN);
+			VK_CHECK_RESULT(vkBindImageMemory(device, color_attachment.image, color_attachment.mem, 0));
+
+			VkImageViewCreateInfo colorView = {};
+			colorView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			colorView.pNext = NULL;
+			colorView.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			colorView.format = color_format;
+			colorView.flags = 0;
+			colorView.subresourceRange = {};
+			colorView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			colorView.subresourceRange.baseMipLevel = 0;
+			colorView.subresourceRange.levelCount = 1;
+			colorView.subresourceRange.baseArrayLayer = 0;
+			colorView.subresourceRange.layerCount = 1;
+			colorView.image = color_attachment.image;
+			VK_CHECK_RESULT(vkCreateImageView(device, &colorView, ct::vulkan::get_allocator(), &color_attachment.view));
+			ct::vulkan::capture::view(color_attachment.view, colorView);
 		}
 
-		inline void setup_render_pass(VkFormat &color_format, VkFormat &depth_format, VkDevice &device, VkRenderPass &render_pass) {
+		// Buffers used from more than one queue family (queue_families) are created concurrent instead of transferring ownership
+		inline void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkDevice &device, VkPhysicalDeviceMemoryProperties &memory_properties,
+				Buffer &buffer, std::vector<uint32_t> queue_families = {}) {
+			buffer.size = size;
+			std::sort(queue_families.begin(), queue_families.end());
+			queue_families.erase(std::unique(queue_families.begin(), queue_families.end()), queue_families.end());
+
+			VkBufferCreateInfo bufferInfo = {};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = size;
+			bufferInfo.usage = usage;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			if (queue_families.size() > 1) {
+				bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+				bufferInfo.queueFamilyIndexCount = (uint32_t)queue_families.size();
+				bufferInfo.pQueueFamilyIndices = queue_families.data();
+			}
+			VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, ct::vulkan::get_allocator(), &buffer.buffer));
+			ct::vulkan::capture::buffer(buffer.buffer, bufferInfo);
+
+			VkMemoryRequirements memReqs;
+			vkGetBufferMemoryRequirements(device, buffer.buffer, &memReqs);
+
+			VkMemoryAllocateInfo mem_alloc = {};
+			mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			mem_alloc.allocationSize = memReqs.size;
+			mem_alloc.memoryTypeIndex = get_memory_type(memory_properties, memReqs.memoryTypeBits, properties);
+			VK_CHECK_RESULT(vkAllocateMemory(device, &mem_alloc, ct::vulkan::get_allocator(), &buffer.mem));
+			// Host visible sources of copies only are staging, everything else counts as a buffer
+			bool is_staging = usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT && (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+			ct::vulkan::memory::track(buffer.mem, mem_alloc.memoryTypeIndex, mem_alloc.allocationSize, is_staging ? ct::vulkan::memory::STAGING : ct::vulkan::memory::BUFFER);
+			VK_CHECK_RESULT(vkBindBufferMemory(device, buffer.buffer, buffer.mem, 0));
+
+			// Host visible buffers stay mapped for their whole lifetime
+			if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+				VK_CHECK_RESULT(vkMapMemory(device, buffer.mem, 0, VK_WHOLE_SIZE, 0, &buffer.mapped));
+		}
+
+		inline void setup_render_pass(VkFormat &color_format, VkFormat &depth_format, VkDevice &device, VkRenderPass &render_pass,
+				VkImageLayout final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_CLEAR) {
+			// Loaded attachments come in the layouts every clear leaves them in
+			bool is_load = load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
 			VkAttachmentDescription attachments[2];
 			// Color attachment
 			attachments[0].format = color_format;
 			attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
-			attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			attachments[0].flags = 0;
+			attachments[0].loadOp = load_op;
 			attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 			attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 			attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-			attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+			attachments[0].initialLayout = is_load ? final_layout : VK_IMAGE_LAYOUT_UNDEFINED;
+			attachments[0].finalLayout = final_layout;
 			// Depth attachment
 			attachments[1].format = depth_format;
 			attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-			attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			attachments[1].flags = 0;
+			attachments[1].loadOp = load_op;
 			attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-			attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			attachments[1].stencilLoadOp = load_op;
 			attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-			attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			attachments[1].initialLayout = is_load ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
 			attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 			VkAttachmentReference colorReference = {};
@@ -436,6 +645,18 @@ namespace ct {
 			dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 			dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 			dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+			if (is_load) {
+				// Whatever wrote the attachments before (a clear by transfer, compute or an earlier pass) has to be done and visible
+				dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+					| VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+				dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+					| VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+				dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+					| VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+				dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+					| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+				dependencies[0].dependencyFlags = 0;
+			}
 
 			dependencies[1].srcSubpass = 0;
 			dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
@@ -444,6 +665,12 @@ namespace ct {
 			dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 			dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 			dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+			if (final_layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+				// Copied or blitted from right after the pass, the colour writes have to be done and visible to the transfer
+				dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+				dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				dependencies[1].dependencyFlags = 0;
+			}
 
 			VkRenderPassCreateInfo renderPassInfo = {};
 			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -454,14 +681,15 @@ namespace ct {
 			renderPassInfo.dependencyCount = 2;
 			renderPassInfo.pDependencies = dependencies;
 
-			VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &render_pass));
+			VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, ct::vulkan::get_allocator(), &render_pass));
+			ct::vulkan::capture::render_pass(render_pass, renderPassInfo);
 
 		}
 
 		inline void create_pipeline_cache(VkDevice &device, VkPipelineCache &pipeline_cache) {
 			VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
 			pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-			VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipeline_cache));
+			VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, ct::vulkan::get_allocator(), &pipeline_cache));
 		}
 
 
@@ -493,10 +721,52 @@ namespace ct {
 			framebuffer.framebuffer.resize(imagecount);
 			for (uint32_t i = 0; i < framebuffer.framebuffer.size(); i++) {
 				attachments[0] = color_views[i];
-				VK_CHECK_RESULT(vkCreateFramebuffer(device, &frameBufferCreateInfo, nullptr, &framebuffer.framebuffer[i]));
+				VK_CHECK_RESULT(vkCreateFramebuffer(device, &frameBufferCreateInfo, ct::vulkan::get_allocator(), &framebuffer.framebuffer[i]));
+				ct::vulkan::capture::framebuffer(framebuffer.framebuffer[i], frameBufferCreateInfo);
 			}
 		}
 
+		inline VkAccessFlags get_layout_access(VkImageLayout layout, bool is_destination) {
+			switch (layout) {
+				case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+					return is_destination ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+				case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+					return is_destination ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+				case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+					return VK_ACCESS_TRANSFER_READ_BIT;
+				case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+					return VK_ACCESS_TRANSFER_WRITE_BIT;
+				case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+					return VK_ACCESS_SHADER_READ_BIT;
+				case VK_IMAGE_LAYOUT_GENERAL:
+					return is_destination ? VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT : VK_ACCESS_SHADER_WRITE_BIT;
+				default:
+					// UNDEFINED and PRESENT_SRC carry no access that needs to be made available
+					return 0;
+			}
+		}
+
+		// Records an image layout transition, access masks are derived from the layouts
+		inline void set_image_layout(VkCommandBuffer command_buffer, VkImage image, VkImageAspectFlags aspect, VkImageLayout old_layout, VkImageLayout new_layout,
+				VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+			const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = get_layout_access(old_layout, false);
+			barrier.dstAccessMask = get_layout_access(new_layout, true);
+			barrier.oldLayout = old_layout;
+			barrier.newLayout = new_layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange.aspectMask = aspect;
+			barrier.subresourceRange.baseMipLevel = 0;
+			barrier.subresourceRange.levelCount = 1;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = 1;
+			dispatch.vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+
 		VkCommandBuffer get_command_buffer(bool should_begin, VkDevice &device, VkCommandPool &command_pool) {
 			VkCommandBuffer cmdBuffer;
 
@@ -533,14 +803,14 @@ namespace ct {
 			fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 			fenceCreateInfo.flags = 0;
 			VkFence fence;
-			VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
+			VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, ct::vulkan::get_allocator(), &fence));
 
 			// Submit to the queue
 			VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
 			// Wait for the fence to signal that command buffer has finished executing
 			VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
 
-			vkDestroyFence(device, fence, nullptr);
+			vkDestroyFence(device, fence, ct::vulkan::get_allocator());
 			vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
 		}
 
@@ -555,13 +825,89 @@ namespace ct {
 				moduleCreateInfo.pCode = (uint32_t*)shader_code.data();
 
 				VkShaderModule shaderModule;
-				VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, NULL, &shaderModule));
+				VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, ct::vulkan::get_allocator(), &shaderModule));
+				ct::vulkan::capture::shader_module(shaderModule, moduleCreateInfo);
 
 				return shaderModule;
 			} else
 				ct::error::exit("Could not open file: " + filename, 1);
 		}
 
+		// -> destruction: every destroy_* nulls what it destroyed, so a second call is a no-op
+
+		// Images without memory of their own belong to whoever bound them (the transient pool), only the handles are dropped
+		inline void destroy_depth_stencil(VkDevice &device, DepthStencil &depth_stencil) {
+			if (depth_stencil.mem != VK_NULL_HANDLE) {
+				vkDestroyImageView(device, depth_stencil.view, ct::vulkan::get_allocator());
+				vkDestroyImage(device, depth_stencil.image, ct::vulkan::get_allocator());
+				ct::vulkan::memory::untrack(depth_stencil.mem);
+				vkFreeMemory(device, depth_stencil.mem, ct::vulkan::get_allocator());
+			}
+			depth_stencil.view = VK_NULL_HANDLE;
+			depth_stencil.image = VK_NULL_HANDLE;
+			depth_stencil.mem = VK_NULL_HANDLE;
+		}
+
+		inline void destroy_color_attachment(VkDevice &device, ColorAttachment &attachment) {
+			if (attachment.mem != VK_NULL_HANDLE) {
+				vkDestroyImageView(device, attachment.view, ct::vulkan::get_allocator());
+				vkDestroyImage(device, attachment.image, ct::vulkan::get_allocator());
+				ct::vulkan::memory::untrack(attachment.mem);
+				vkFreeMemory(device, attachment.mem, ct::vulkan::get_allocator());
+			}
+			attachment.view = VK_NULL_HANDLE;
+			attachment.image = VK_NULL_HANDLE;
+			attachment.mem = VK_NULL_HANDLE;
+		}
+
+		inline void destroy_buffer(VkDevice &device, Buffer &buffer) {
+			if (buffer.mapped != nullptr)
+				vkUnmapMemory(device, buffer.mem);
+			vkDestroyBuffer(device, buffer.buffer, ct::vulkan::get_allocator());
+			ct::vulkan::memory::untrack(buffer.mem);
+			vkFreeMemory(device, buffer.mem, ct::vulkan::get_allocator());
+			buffer = Buffer();
+		}
+
+		// Framebuffers, render pass and the depth stencil they share
+		inline void destroy_framebuffer(VkDevice &device, Framebuffer &framebuffer) {
+			for (auto &fb : framebuffer.framebuffer)
+				vkDestroyFramebuffer(device, fb, ct::vulkan::get_allocator());
+			framebuffer.framebuffer.clear();
+			vkDestroyRenderPass(device, framebuffer.render_pass, ct::vulkan::get_allocator());
+			framebuffer.render_pass = VK_NULL_HANDLE;
+			destroy_depth_stencil(device, framebuffer.depth_stencil);
+		}
+
+		inline void destroy_synchronization(VkDevice &device, Synchronization &sync) {
+			for (auto &semaphore : sync.acquire_semaphores)
+				vkDestroySemaphore(device, semaphore, ct::vulkan::get_allocator());
+			sync.acquire_semaphores.clear();
+			sync.acquire_values.clear();
+			sync.acquire_fences.clear();
+			vkDestroySemaphore(device, sync.render_complete, ct::vulkan::get_allocator());
+			vkDestroySemaphore(device, sync.overlay_complete, ct::vulkan::get_allocator());
+			sync.present_complete = VK_NULL_HANDLE;
+			sync.render_complete = VK_NULL_HANDLE;
+			sync.overlay_complete = VK_NULL_HANDLE;
+			for (auto &fence : sync.wait_fences)
+				vkDestroyFence(device, fence, ct::vulkan::get_allocator());
+			sync.wait_fences.clear();
+			sync.fence_values.clear();
+		}
+
+		// Command buffers go with their pool. Every other child of the device has to be destroyed before.
+		inline void destroy_device(LogicalDevice &logical_device) {
+			if (logical_device.device == VK_NULL_HANDLE)
+				return;
+			vkDestroyCommandPool(logical_device.device, logical_device.command_pool, ct::vulkan::get_allocator());
+			logical_device.command_pool = VK_NULL_HANDLE;
+			logical_device.command_buffer.clear();
+			vkDestroyDevice(logical_device.device, ct::vulkan::get_allocator());
+			logical_device.device = VK_NULL_HANDLE;
+		}
+		// <-
+
 
 
 	}
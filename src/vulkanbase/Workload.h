@@ -0,0 +1,744 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <vulkan/vulkan.h>
+#include "vulkanbase/VulkanHelper.h"
+#include "vulkanbase/DescriptorHelper.h"
+#include "vulkanbase/DynamicRendering.h"
+#include "vulkanbase/Recording.h"
+#include "vulkanbase/Immediate.h"
+#include "utils/ErrorHelper.h"
+#include "utils/EnvHelper.h"
+#include "utils/JobSystem.h"
+#include "loader/LoaderBinary.h"
+
+namespace ct {
+	namespace vulkan {
+		namespace workload {
+#define WORKLOAD_SEED 42
+#define WORKLOAD_MOTION_AMPLITUDE 0.1f
+// Objects per job when moving and blending is split over the job system
+#define WORKLOAD_MIN_CHUNK 4096
+
+			// Everything is read from CT_WORKLOAD_* environment variables, CT_WORKLOAD_OBJECTS=0 (default) disables the workload
+			struct Params {
+				uint32_t n_objects = 0;			// CT_WORKLOAD_OBJECTS
+				uint32_t n_draws = 1;			// CT_WORKLOAD_DRAWS, objects are split evenly over instanced draws
+				uint32_t n_materials = 1;		// CT_WORKLOAD_MATERIALS, one uniform buffer descriptor set each
+				uint32_t n_pipelines = 1;		// CT_WORKLOAD_PIPELINES, pipeline i does i + 1 pattern iterations per fragment
+				float overdraw = 1.0f;			// CT_WORKLOAD_OVERDRAW, summed object area over screen area
+				float update_rate = 0.0f;		// CT_WORKLOAD_UPDATE, fraction of objects moved (and uploaded) per frame
+				float churn = 0.0f;				// CT_WORKLOAD_CHURN, fraction of draws shown or hidden per frame, which changes what is recorded
+				float spread = 1.0f;			// CT_WORKLOAD_SPREAD, objects are scattered over [-spread, spread]^2 in NDC, above 1 some are off screen
+				uint32_t grid = 4;				// CT_WORKLOAD_GRID, quads per side of the object mesh
+			};
+
+			struct Vertex {
+				float position[2];
+			};
+
+			// Per instance vertex attribute: xy centre, z depth, w half extent
+			struct Instance {
+				float position[4];
+			};
+
+			// CPU side animation state of one object
+			struct Motion {
+				float base[2];
+				float phase;
+				float speed;
+			};
+
+			// std140 layout of the fragment shader's Material block
+			struct Material {
+				float color[4];
+				float params[4];
+			};
+
+			// What the simulation thread publishes every tick: all objects, and the ones this tick moved as they were before it
+			struct Snapshot {
+				std::vector<Instance> instances;
+				std::vector<Instance> previous;
+			};
+
+			struct Draw {
+				uint32_t pipeline;
+				uint32_t material;
+				uint32_t first_instance;
+				uint32_t instance_count;
+				bool hidden;
+			};
+
+			struct Workload {
+				bool active = false;
+				Params params;
+				VkDevice device = VK_NULL_HANDLE;
+
+				// -> geometry
+				ct::vulkan::Buffer vertex_buffer;
+				ct::vulkan::Buffer index_buffer;
+				uint32_t index_count = 0;
+				// <-
+
+				// -> objects: the CPU copy is the truth, every frame slot has its own mapped copy that is brought up to date before reuse
+				std::vector<Instance> instances;
+				std::vector<Motion> motions;
+				std::vector<ct::vulkan::Buffer> instance_buffers;
+				std::vector<uint64_t> slot_frame;
+				uint64_t frame = 0;
+				uint32_t n_updates = 0;
+				uint64_t bytes_uploaded = 0;
+				// Set once apply() interpolated, the latest tick's objects then change every frame until the next tick
+				bool is_interpolated = false;
+				// <-
+
+				// -> materials and pipelines
+				ct::vulkan::Buffer material_buffer;
+				VkDeviceSize material_stride = 0;
+				ct::vulkan::descriptor::Allocator descriptor_allocator;
+				VkDescriptorSetLayout material_layout = VK_NULL_HANDLE;
+				std::vector<VkDescriptorSet> material_sets;
+				VkRenderPass render_pass = VK_NULL_HANDLE;
+				// Dynamic rendering backend if set to one, the pipelines are then built against attachment formats instead of render_pass
+				ct::vulkan::rendering::Rendering *rendering = nullptr;
+				// Moving, blending and uploading objects is split over it if set
+				ct::jobs::JobSystem *jobs = nullptr;
+				// Setup uploads are batched into it if set, each one waits for its own submit otherwise
+				ct::vulkan::immediate::Context *immediate = nullptr;
+				VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+				VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+				std::vector<VkPipeline> pipelines;
+				// <-
+
+				// Sorted by pipeline, then material, so binds only happen on change
+				std::vector<Draw> draws;
+				uint32_t n_pipeline_binds = 0;
+				uint32_t n_material_binds = 0;
+				// Draws toggled per frame (round robin), only the command buffers have to follow
+				uint32_t n_churn = 0;
+				uint32_t churn_next = 0;
+			};
+
+			inline void read_params(Params &params) {
+				params.n_objects = (uint32_t)std::max(0L, ct::env::get_int("CT_WORKLOAD_OBJECTS", params.n_objects));
+				params.n_draws = (uint32_t)std::max(1L, ct::env::get_int("CT_WORKLOAD_DRAWS", params.n_draws));
+				params.n_materials = (uint32_t)std::max(1L, ct::env::get_int("CT_WORKLOAD_MATERIALS", params.n_materials));
+				params.n_pipelines = (uint32_t)std::max(1L, ct::env::get_int("CT_WORKLOAD_PIPELINES", params.n_pipelines));
+				params.overdraw = (float)std::max(0.0, ct::env::get_double("CT_WORKLOAD_OVERDRAW", params.overdraw));
+				params.update_rate = (float)std::min(1.0, std::max(0.0, ct::env::get_double("CT_WORKLOAD_UPDATE", params.update_rate)));
+				params.churn = (float)std::min(1.0, std::max(0.0, ct::env::get_double("CT_WORKLOAD_CHURN", params.churn)));
+				params.grid = (uint32_t)std::max(1L, ct::env::get_int("CT_WORKLOAD_GRID", params.grid));
+				params.spread = (float)std::max(0.01, ct::env::get_double("CT_WORKLOAD_SPREAD", params.spread));
+			}
+
+			// Device local buffer filled once through a staging buffer. With an immediate context the copy joins its open batch
+			// and the staging buffer goes when the batch is done, the buffer can be used once the context finished.
+			inline void upload(const void *data, VkDeviceSize size, VkBufferUsageFlags usage, ct::vulkan::LogicalDevice &logical_device, ct::vulkan::Buffer &buffer,
+					ct::vulkan::immediate::Context *immediate = nullptr, std::vector<uint32_t> queue_families = {}) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				ct::vulkan::Buffer staging;
+				ct::vulkan::create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						logical_device.device, logical_device.memory_properties, staging);
+				std::memcpy(staging.mapped, data, size);
+				ct::vulkan::create_buffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+						logical_device.device, logical_device.memory_properties, buffer, queue_families);
+
+				VkBufferCopy region = { 0, 0, size };
+				if (immediate != nullptr) {
+					VkCommandBuffer command_buffer = ct::vulkan::immediate::begin(*immediate);
+					dispatch.vkCmdCopyBuffer(command_buffer, staging.buffer, buffer.buffer, 1, &region);
+					ct::vulkan::immediate::retire(staging, *immediate);
+					ct::vulkan::immediate::end(*immediate);
+					return;
+				}
+				VkCommandBuffer command_buffer = ct::vulkan::get_command_buffer(true, logical_device.device, logical_device.command_pool);
+				dispatch.vkCmdCopyBuffer(command_buffer, staging.buffer, buffer.buffer, 1, &region);
+				ct::vulkan::flush_command_buffer(logical_device.device, logical_device.command_pool, logical_device.queue_graphics, command_buffer);
+				ct::vulkan::destroy_buffer(logical_device.device, staging);
+			}
+
+			// A grid of grid x grid quads spanning [-1, 1]^2
+			inline void setup_geometry(ct::vulkan::LogicalDevice &logical_device, Workload &workload) {
+				uint32_t grid = workload.params.grid;
+				std::vector<Vertex> vertices;
+				vertices.reserve((grid + 1) * (grid + 1));
+				for (uint32_t y = 0; y <= grid; y++)
+					for (uint32_t x = 0; x <= grid; x++)
+						vertices.push_back({ { 2.0f * x / grid - 1.0f, 2.0f * y / grid - 1.0f } });
+
+				std::vector<uint32_t> indices;
+				indices.reserve(6 * grid * grid);
+				for (uint32_t y = 0; y < grid; y++) {
+					for (uint32_t x = 0; x < grid; x++) {
+						uint32_t i = y * (grid + 1) + x;
+						indices.insert(indices.end(), { i, i + 1, i + grid + 1, i + 1, i + grid + 2, i + grid + 1 });
+					}
+				}
+				workload.index_count = (uint32_t)indices.size();
+
+				upload(vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, logical_device, workload.vertex_buffer, workload.immediate);
+				upload(indices.data(), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, logical_device, workload.index_buffer, workload.immediate);
+			}
+
+			// Object size is picked so that the objects on screen together cover it overdraw times
+			inline void setup_objects(uint32_t n_slots, ct::vulkan::LogicalDevice &logical_device, Workload &workload) {
+				uint32_t n = workload.params.n_objects;
+				float spread = workload.params.spread;
+				float half_extent = spread * std::sqrt(workload.params.overdraw / n);
+
+				std::mt19937 rng(WORKLOAD_SEED);
+				std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+				workload.instances.resize(n);
+				workload.motions.resize(n);
+				for (uint32_t i = 0; i < n; i++) {
+					Motion &motion = workload.motions[i];
+					motion.base[0] = spread * (2.0f * unit(rng) - 1.0f);
+					motion.base[1] = spread * (2.0f * unit(rng) - 1.0f);
+					motion.phase = 6.2831853f * unit(rng);
+					motion.speed = 0.5f + unit(rng);
+					Instance &instance = workload.instances[i];
+					instance.position[0] = motion.base[0];
+					instance.position[1] = motion.base[1];
+					instance.position[2] = unit(rng);
+					instance.position[3] = half_extent;
+				}
+				workload.n_updates = (uint32_t)(workload.params.update_rate * n);
+
+				workload.instance_buffers.resize(n_slots);
+				workload.slot_frame.assign(n_slots, 0);
+				// Storage usage lets a culling pass read them instead of the vertex stage
+				for (auto &buffer : workload.instance_buffers) {
+					ct::vulkan::create_buffer(n * sizeof(Instance), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+							logical_device.device, logical_device.memory_properties, buffer);
+					std::memcpy(buffer.mapped, workload.instances.data(), n * sizeof(Instance));
+				}
+			}
+
+			inline void setup_materials(ct::vulkan::LogicalDevice &logical_device, ct::vulkan::descriptor::LayoutCache &layout_cache, Workload &workload) {
+				uint32_t n = workload.params.n_materials;
+				VkDeviceSize alignment = std::max((VkDeviceSize)1, logical_device.properties.limits.minUniformBufferOffsetAlignment);
+				workload.material_stride = (sizeof(Material) + alignment - 1) / alignment * alignment;
+
+				std::mt19937 rng(WORKLOAD_SEED + 1);
+				std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+				std::vector<char> data(n * workload.material_stride, 0);
+				for (uint32_t i = 0; i < n; i++) {
+					Material material = { { unit(rng), unit(rng), unit(rng), 1.0f }, { 4.0f + 28.0f * unit(rng), 0.0f, 0.0f, 0.0f } };
+					std::memcpy(&data[i * workload.material_stride], &material, sizeof(Material));
+				}
+				upload(data.data(), data.size(), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, logical_device, workload.material_buffer, workload.immediate);
+
+				VkDescriptorSetLayoutBinding binding = { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr };
+				workload.material_layout = ct::vulkan::descriptor::get_layout({ binding }, layout_cache);
+
+				ct::vulkan::descriptor::setup_allocator(logical_device.device, { { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f } }, workload.descriptor_allocator);
+				workload.material_sets.resize(n);
+				std::vector<VkDescriptorBufferInfo> bufferInfos(n);
+				std::vector<VkWriteDescriptorSet> writes(n);
+				for (uint32_t i = 0; i < n; i++) {
+					ct::vulkan::descriptor::allocate(workload.material_layout, workload.descriptor_allocator, workload.material_sets[i]);
+					bufferInfos[i] = { workload.material_buffer.buffer, i * workload.material_stride, sizeof(Material) };
+					writes[i] = {};
+					writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+					writes[i].dstSet = workload.material_sets[i];
+					writes[i].dstBinding = 0;
+					writes[i].descriptorCount = 1;
+					writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+					writes[i].pBufferInfo = &bufferInfos[i];
+				}
+				ct::vulkan::dispatch::get_device().vkUpdateDescriptorSets(logical_device.device, n, writes.data(), 0, nullptr);
+			}
+
+			// Returns false if the shaders have not been compiled
+			inline bool setup_pipelines(VkFormat color_format, VkFormat depth_format, VkImageLayout color_layout, ct::vulkan::LogicalDevice &logical_device, Workload &workload) {
+				std::vector<char> vertex_code, fragment_code;
+				ct::load_binary(std::string(SHADER_BIN_DIR) + "workload/draw.vert.spv", vertex_code);
+				ct::load_binary(std::string(SHADER_BIN_DIR) + "workload/draw.frag.spv", fragment_code);
+				if (vertex_code.empty() || fragment_code.empty()) {
+					std::cout << "workload: shaders not found in " << SHADER_BIN_DIR << ", workload disabled" << std::endl;
+					return false;
+				}
+				VkDevice &device = logical_device.device;
+
+				// Draws load what the clear left behind
+				bool is_dynamic = ct::vulkan::rendering::is_dynamic(workload.rendering);
+				if (!is_dynamic)
+					ct::vulkan::setup_render_pass(color_format, depth_format, device, workload.render_pass, color_layout, VK_ATTACHMENT_LOAD_OP_LOAD);
+				VkPipelineRenderingCreateInfoKHR pipelineRenderingInfo = ct::vulkan::rendering::get_pipeline_info(color_format, depth_format);
+				ct::vulkan::create_pipeline_cache(device, workload.pipeline_cache);
+
+				VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+				pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+				pipelineLayoutInfo.setLayoutCount = 1;
+				pipelineLayoutInfo.pSetLayouts = &workload.material_layout;
+				VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, ct::vulkan::get_allocator(), &workload.pipeline_layout));
+				ct::vulkan::capture::pipeline_layout(workload.pipeline_layout, pipelineLayoutInfo);
+
+				VkShaderModule modules[2];
+				std::vector<char> *codes[2] = { &vertex_code, &fragment_code };
+				for (int32_t i = 0; i < 2; i++) {
+					VkShaderModuleCreateInfo moduleCreateInfo = {};
+					moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+					moduleCreateInfo.codeSize = codes[i]->size();
+					moduleCreateInfo.pCode = (uint32_t*)codes[i]->data();
+					VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, ct::vulkan::get_allocator(), &modules[i]));
+					ct::vulkan::capture::shader_module(modules[i], moduleCreateInfo);
+				}
+
+				// -> fixed function state shared by every pipeline
+				VkVertexInputBindingDescription vertexBindings[2] = {
+					{ 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX },
+					{ 1, sizeof(Instance), VK_VERTEX_INPUT_RATE_INSTANCE }
+				};
+				VkVertexInputAttributeDescription vertexAttributes[2] = {
+					{ 0, 0, VK_FORMAT_R32G32_SFLOAT, 0 },
+					{ 1, 1, VK_FORMAT_R32G32B32A32_SFLOAT, 0 }
+				};
+				VkPipelineVertexInputStateCreateInfo vertexInputState = {};
+				vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+				vertexInputState.vertexBindingDescriptionCount = 2;
+				vertexInputState.pVertexBindingDescriptions = vertexBindings;
+				vertexInputState.vertexAttributeDescriptionCount = 2;
+				vertexInputState.pVertexAttributeDescriptions = vertexAttributes;
+
+				VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
+				inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+				inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+				VkPipelineViewportStateCreateInfo viewportState = {};
+				viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+				viewportState.viewportCount = 1;
+				viewportState.scissorCount = 1;
+
+				VkPipelineRasterizationStateCreateInfo rasterizationState = {};
+				rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+				rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+				rasterizationState.cullMode = VK_CULL_MODE_NONE;
+				rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+				rasterizationState.lineWidth = 1.0f;
+
+				VkPipelineMultisampleStateCreateInfo multisampleState = {};
+				multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+				multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+				VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
+				depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+				depthStencilState.depthTestEnable = VK_TRUE;
+				depthStencilState.depthWriteEnable = VK_TRUE;
+				depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+				VkPipelineColorBlendAttachmentState blendAttachmentState = {};
+				blendAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+				VkPipelineColorBlendStateCreateInfo colorBlendState = {};
+				colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+				colorBlendState.attachmentCount = 1;
+				colorBlendState.pAttachments = &blendAttachmentState;
+
+				VkDynamicState dynamicStates[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+				VkPipelineDynamicStateCreateInfo dynamicState = {};
+				dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+				dynamicState.dynamicStateCount = 2;
+				dynamicState.pDynamicStates = dynamicStates;
+				// <-
+
+				// -> one pipeline per variant, the variant is a specialization constant of the fragment shader
+				workload.pipelines.resize(workload.params.n_pipelines);
+				for (uint32_t i = 0; i < workload.params.n_pipelines; i++) {
+					int32_t variant = (int32_t)i;
+					VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(int32_t) };
+					VkSpecializationInfo specializationInfo = {};
+					specializationInfo.mapEntryCount = 1;
+					specializationInfo.pMapEntries = &specializationEntry;
+					specializationInfo.dataSize = sizeof(int32_t);
+					specializationInfo.pData = &variant;
+
+					VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+					shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+					shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+					shaderStages[0].module = modules[0];
+					shaderStages[0].pName = "main";
+					shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+					shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+					shaderStages[1].module = modules[1];
+					shaderStages[1].pName = "main";
+					shaderStages[1].pSpecializationInfo = &specializationInfo;
+
+					VkGraphicsPipelineCreateInfo pipelineInfo = {};
+					pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+					pipelineInfo.stageCount = 2;
+					pipelineInfo.pStages = shaderStages;
+					pipelineInfo.pVertexInputState = &vertexInputState;
+					pipelineInfo.pInputAssemblyState = &inputAssemblyState;
+					pipelineInfo.pViewportState = &viewportState;
+					pipelineInfo.pRasterizationState = &rasterizationState;
+					pipelineInfo.pMultisampleState = &multisampleState;
+					pipelineInfo.pDepthStencilState = &depthStencilState;
+					pipelineInfo.pColorBlendState = &colorBlendState;
+					pipelineInfo.pDynamicState = &dynamicState;
+					pipelineInfo.layout = workload.pipeline_layout;
+					pipelineInfo.pNext = is_dynamic ? &pipelineRenderingInfo : nullptr;
+					pipelineInfo.renderPass = workload.render_pass;
+					pipelineInfo.subpass = 0;
+					VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, workload.pipeline_cache, 1, &pipelineInfo, ct::vulkan::get_allocator(), &workload.pipelines[i]));
+					ct::vulkan::capture::graphics_pipeline(workload.pipelines[i], pipelineInfo);
+				}
+				// <-
+
+				vkDestroyShaderModule(device, modules[0], ct::vulkan::get_allocator());
+				vkDestroyShaderModule(device, modules[1], ct::vulkan::get_allocator());
+				return true;
+			}
+
+			// Draw i uses pipeline i % n_pipelines and material i % n_materials, then draws are sorted by state like a renderer would
+			inline void setup_draws(Workload &workload) {
+				uint32_t n = workload.params.n_objects;
+				uint32_t n_draws = workload.params.n_draws;
+				workload.draws.resize(n_draws);
+				for (uint32_t i = 0; i < n_draws; i++) {
+					Draw &draw = workload.draws[i];
+					draw.pipeline = i % workload.params.n_pipelines;
+					draw.material = i % workload.params.n_materials;
+					draw.first_instance = (uint32_t)((uint64_t)i * n / n_draws);
+					draw.instance_count = (uint32_t)((uint64_t)(i + 1) * n / n_draws) - draw.first_instance;
+					draw.hidden = false;
+				}
+				std::stable_sort(workload.draws.begin(), workload.draws.end(), [](const Draw &a, const Draw &b) {
+					return a.pipeline != b.pipeline ? a.pipeline < b.pipeline : a.material < b.material;
+				});
+
+				workload.n_pipeline_binds = 0;
+				workload.n_material_binds = 0;
+				for (uint32_t i = 0; i < n_draws; i++) {
+					if (i == 0 || workload.draws[i].pipeline != workload.draws[i - 1].pipeline)
+						workload.n_pipeline_binds++;
+					if (i == 0 || workload.draws[i].material != workload.draws[i - 1].material)
+						workload.n_material_binds++;
+				}
+				workload.n_churn = (uint32_t)(workload.params.churn * n_draws);
+				workload.churn_next = 0;
+			}
+
+			// n_slots frame slots each get their own instance buffer. Does nothing when params.n_objects is 0.
+			// color_layout is the layout the clear leaves colour in and the pass has to leave it in.
+			// With an immediate context the uploads are only in flight on return, finish it before the first frame.
+			inline void setup(Params params, uint32_t n_slots, VkFormat color_format, VkFormat depth_format, VkImageLayout color_layout, ct::vulkan::LogicalDevice &logical_device,
+					ct::vulkan::descriptor::LayoutCache &layout_cache, Workload &workload, ct::vulkan::rendering::Rendering *rendering = nullptr, ct::jobs::JobSystem *jobs = nullptr,
+					ct::vulkan::immediate::Context *immediate = nullptr) {
+				if (params.n_objects == 0)
+					return;
+				params.n_draws = std::min(params.n_draws, params.n_objects);
+				workload.params = params;
+				workload.device = logical_device.device;
+				workload.rendering = rendering;
+				workload.jobs = jobs;
+				workload.immediate = immediate;
+
+				setup_materials(logical_device, layout_cache, workload);
+				if (!setup_pipelines(color_format, depth_format, color_layout, logical_device, workload))
+					return;
+				setup_geometry(logical_device, workload);
+				setup_objects(n_slots, logical_device, workload);
+				setup_draws(workload);
+				workload.active = true;
+
+				std::cout << "workload: objects: " << params.n_objects << " draws: " << params.n_draws << " triangles: " << (uint64_t)params.n_objects * workload.index_count / 3
+					<< " pipelines: " << params.n_pipelines << " (binds: " << workload.n_pipeline_binds << ")"
+					<< " materials: " << params.n_materials << " (binds: " << workload.n_material_binds << ")"
+					<< " overdraw: " << params.overdraw << " spread: " << params.spread << " updates-per-frame: " << workload.n_updates << std::endl;
+			}
+
+			inline void move(double t, const Motion &motion, Instance &instance) {
+				float angle = (float)(t * motion.speed) + motion.phase;
+				instance.position[0] = motion.base[0] + WORKLOAD_MOTION_AMPLITUDE * std::sin(angle);
+				instance.position[1] = motion.base[1] + WORKLOAD_MOTION_AMPLITUDE * std::cos(angle);
+			}
+
+			// Moves the n_updates objects frame moves (round robin) in objects to where they are at t, keeping where they were in previous if set
+			inline void move_range(uint64_t frame, double t, Instance *objects, Instance *previous, const Workload &workload) {
+				struct Range {
+					uint32_t start;
+					double t;
+					Instance *objects;
+					Instance *previous;
+					const Workload *workload;
+				} range = { (uint32_t)((frame * workload.n_updates) % workload.params.n_objects), t, objects, previous, &workload };
+				ct::jobs::parallel_for(workload.n_updates, WORKLOAD_MIN_CHUNK, [](void *data, uint32_t begin, uint32_t end) {
+					Range &range = *static_cast<Range*>(data);
+					uint32_t n = range.workload->params.n_objects;
+					for (uint32_t k = begin; k < end; k++) {
+						uint32_t i = (range.start + k) % n;
+						if (range.previous != nullptr)
+							range.previous[k] = range.objects[i];
+						move(range.t, range.workload->motions[i], range.objects[i]);
+					}
+				}, &range, workload.jobs);
+			}
+
+			// Moves the next n_updates objects (round robin) on the CPU copy
+			inline void animate(double t, Workload &workload) {
+				if (!workload.active)
+					return;
+				workload.frame++;
+				move_range(workload.frame, t, workload.instances.data(), nullptr, workload);
+			}
+
+			// Shows or hides the next n_churn draws (round robin), consecutive draws so the change stays in few chunks.
+			// The chunks of a recording cache holding them are marked dirty.
+			inline void churn(Workload &workload, ct::vulkan::recording::Cache *cache = nullptr) {
+				if (!workload.active || workload.n_churn == 0)
+					return;
+				uint32_t n_draws = (uint32_t)workload.draws.size();
+				bool has_cache = ct::vulkan::recording::is_active(cache);
+				uint32_t last_chunk = UINT32_MAX;
+				for (uint32_t k = 0; k < workload.n_churn; k++) {
+					uint32_t i = (workload.churn_next + k) % n_draws;
+					workload.draws[i].hidden = !workload.draws[i].hidden;
+					if (!has_cache)
+						continue;
+					uint32_t chunk = ct::vulkan::recording::get_chunk(i, n_draws, *cache);
+					if (chunk != last_chunk)
+						ct::vulkan::recording::invalidate(chunk, *cache);
+					last_chunk = chunk;
+				}
+				workload.churn_next = (workload.churn_next + workload.n_churn) % n_draws;
+			}
+
+			// -> fixed step simulation: the simulation thread moves its own copy of the objects, the render thread applies the snapshots
+			inline void prepare_snapshot(Workload &workload, Snapshot &snapshot) {
+				snapshot.instances = workload.instances;
+				snapshot.previous.resize(workload.n_updates);
+			}
+
+			// Runs on the simulation thread, which owns objects. Tick k moves the same round robin range frame k would move in animate.
+			// Only reads the motions of workload, which do not change after setup.
+			inline void simulate(uint64_t tick, double t, std::vector<Instance> &objects, const Workload &workload, Snapshot &snapshot) {
+				move_range(tick, t, objects.data(), snapshot.previous.data(), workload);
+				// Same size every tick, prepare_snapshot allocated it
+				ct::jobs::parallel_copy(snapshot.instances.data(), objects.data(), objects.size() * sizeof(Instance), workload.jobs);
+			}
+
+			// Render thread: brings the CPU copy to the snapshot of tick and blends the objects that tick moved from where they were by alpha.
+			// Ranges of skipped ticks are copied as they are, the range of the previously applied tick too as it was left blended.
+			inline void apply(uint64_t tick, Snapshot &snapshot, float alpha, Workload &workload) {
+				if (!workload.active || workload.n_updates == 0 || tick == 0)
+					return;
+				uint32_t n = workload.params.n_objects;
+				if (tick != workload.frame) {
+					uint32_t count = (uint32_t)std::min((uint64_t)n, (tick - workload.frame + 1) * workload.n_updates);
+					uint32_t start = count == n ? 0 : (uint32_t)((workload.frame * workload.n_updates) % n);
+					uint32_t first_count = std::min(count, n - start);
+					ct::jobs::parallel_copy(workload.instances.data() + start, snapshot.instances.data() + start, first_count * sizeof(Instance), workload.jobs);
+					if (count > first_count)
+						ct::jobs::parallel_copy(workload.instances.data(), snapshot.instances.data(), (count - first_count) * sizeof(Instance), workload.jobs);
+					workload.frame = tick;
+				}
+				struct Blend {
+					uint32_t start;
+					float alpha;
+					Snapshot *snapshot;
+					Workload *workload;
+				} blend = { (uint32_t)((tick * workload.n_updates) % n), alpha, &snapshot, &workload };
+				ct::jobs::parallel_for(workload.n_updates, WORKLOAD_MIN_CHUNK, [](void *data, uint32_t begin, uint32_t end) {
+					Blend &blend = *static_cast<Blend*>(data);
+					uint32_t n = blend.workload->params.n_objects;
+					for (uint32_t k = begin; k < end; k++) {
+						uint32_t i = (blend.start + k) % n;
+						const Instance &from = blend.snapshot->previous[k];
+						const Instance &to = blend.snapshot->instances[i];
+						for (int c = 0; c < 2; c++)
+							blend.workload->instances[i].position[c] = from.position[c] + blend.alpha * (to.position[c] - from.position[c]);
+					}
+				}, &blend, workload.jobs);
+				workload.is_interpolated = true;
+			}
+			// <-
+
+			// Copies every object moved since the slot was last used into its instance buffer. Call after the slot's fence has signalled.
+			inline void sync_slot(uint32_t slot, Workload &workload) {
+				if (!workload.active || workload.n_updates == 0)
+					return;
+				uint32_t n = workload.params.n_objects;
+				uint64_t frames = workload.frame - workload.slot_frame[slot];
+				workload.slot_frame[slot] = workload.frame;
+				// Interpolated objects of the slot's last frame have moved since, as have those of the current frame
+				if (workload.is_interpolated)
+					frames++;
+				if (frames == 0)
+					return;
+
+				// Frames s+1..frame moved one contiguous (wrapping) range
+				uint32_t count = (uint32_t)std::min((uint64_t)n, frames * workload.n_updates);
+				uint32_t start = count == n ? 0 : (uint32_t)(((workload.frame - frames + 1) * workload.n_updates) % n);
+				uint32_t first_count = std::min(count, n - start);
+				Instance *mapped = static_cast<Instance*>(workload.instance_buffers[slot].mapped);
+				ct::jobs::parallel_copy(mapped + start, workload.instances.data() + start, first_count * sizeof(Instance), workload.jobs);
+				if (count > first_count)
+					ct::jobs::parallel_copy(mapped, workload.instances.data(), (count - first_count) * sizeof(Instance), workload.jobs);
+				workload.bytes_uploaded += (uint64_t)count * sizeof(Instance);
+			}
+
+			// Starts the workload's pass on top of whatever the clear left in target. Secondary contents only with the render pass backend.
+			inline void begin_pass(VkCommandBuffer command_buffer, ct::vulkan::rendering::Target &target, VkSubpassContents contents, Workload &workload) {
+				if (ct::vulkan::rendering::is_dynamic(workload.rendering)) {
+					ct::vulkan::rendering::begin(command_buffer, target, VK_ATTACHMENT_LOAD_OP_LOAD, nullptr, *workload.rendering);
+				} else {
+					VkRenderPassBeginInfo renderPassBeginInfo = {};
+					renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+					renderPassBeginInfo.renderPass = workload.render_pass;
+					renderPassBeginInfo.framebuffer = target.framebuffer;
+					renderPassBeginInfo.renderArea.offset = { 0, 0 };
+					renderPassBeginInfo.renderArea.extent = { target.width, target.height };
+					ct::vulkan::dispatch::get_device().vkCmdBeginRenderPass(command_buffer, &renderPassBeginInfo, contents);
+				}
+			}
+
+			// Viewport, scissor and the mesh but no instances, in every command buffer that draws (secondaries inherit none of it)
+			inline void bind_state(VkCommandBuffer command_buffer, ct::vulkan::rendering::Target &target, Workload &workload) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				uint32_t width = target.width;
+				uint32_t height = target.height;
+				VkViewport viewport = { 0.0f, 0.0f, (float)width, (float)height, 0.0f, 1.0f };
+				VkRect2D scissor = { { 0, 0 }, { width, height } };
+				dispatch.vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+				dispatch.vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+				VkDeviceSize offset = 0;
+				dispatch.vkCmdBindVertexBuffers(command_buffer, 0, 1, &workload.vertex_buffer.buffer, &offset);
+				dispatch.vkCmdBindIndexBuffer(command_buffer, workload.index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+			}
+
+			inline void begin_render(VkCommandBuffer command_buffer, ct::vulkan::rendering::Target &target, Workload &workload) {
+				begin_pass(command_buffer, target, VK_SUBPASS_CONTENTS_INLINE, workload);
+				bind_state(command_buffer, target, workload);
+			}
+
+			inline void end_render(VkCommandBuffer command_buffer, ct::vulkan::rendering::Target &target, Workload &workload) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				if (ct::vulkan::rendering::is_dynamic(workload.rendering))
+					ct::vulkan::rendering::end(command_buffer, target, *workload.rendering);
+				else
+					dispatch.vkCmdEndRenderPass(command_buffer);
+			}
+
+			// One instanced draw per visible Draw in draws[begin, end), binds what changes between them
+			inline void record_draws(VkCommandBuffer command_buffer, uint32_t slot, uint32_t begin, uint32_t end, Workload &workload) {
+				const ct::vulkan::dispatch::DeviceTable &dispatch = ct::vulkan::dispatch::get_device();
+				VkDeviceSize offset = 0;
+				dispatch.vkCmdBindVertexBuffers(command_buffer, 1, 1, &workload.instance_buffers[slot].buffer, &offset);
+
+				uint32_t pipeline = UINT32_MAX;
+				uint32_t material = UINT32_MAX;
+				for (uint32_t i = begin; i < end; i++) {
+					const Draw &draw = workload.draws[i];
+					if (draw.hidden)
+						continue;
+					if (draw.pipeline != pipeline) {
+						pipeline = draw.pipeline;
+						dispatch.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, workload.pipelines[pipeline]);
+					}
+					if (draw.material != material) {
+						material = draw.material;
+						dispatch.vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, workload.pipeline_layout, 0, 1, &workload.material_sets[material], 0, nullptr);
+					}
+					dispatch.vkCmdDrawIndexed(command_buffer, workload.index_count, draw.instance_count, 0, 0, draw.first_instance);
+				}
+			}
+
+			// What every chunk of the slot depends on besides its draws: the slot's instances and the target. Changes to the draws mark their
+			// chunks dirty when they happen (churn), so nothing here walks the draws.
+			inline uint64_t hash_slot(uint32_t slot, ct::vulkan::rendering::Target &target, Workload &workload) {
+				uint64_t hash = ct::vulkan::recording::hash(workload.instance_buffers[slot].buffer, RECORDING_HASH_SEED);
+				hash = ct::vulkan::recording::hash(target.framebuffer, hash);
+				hash = ct::vulkan::recording::hash(target.width, hash);
+				hash = ct::vulkan::recording::hash(target.height, hash);
+				return hash;
+			}
+
+			// Records all draws of the workload. With a recording cache (render pass backend only) the draws are split into its chunks,
+			// dirty chunks are recorded again and the pass only executes them. The cache's lanes are recorded as jobs, one per lane.
+			inline void record(VkCommandBuffer command_buffer, uint32_t slot, ct::vulkan::rendering::Target &target, Workload &workload,
+					ct::vulkan::recording::Cache *cache = nullptr) {
+				if (!workload.active)
+					return;
+				uint32_t n_draws = (uint32_t)workload.draws.size();
+				if (!ct::vulkan::recording::is_active(cache) || ct::vulkan::rendering::is_dynamic(workload.rendering)) {
+					begin_render(command_buffer, target, workload);
+					record_draws(command_buffer, slot, 0, n_draws, workload);
+					end_render(command_buffer, target, workload);
+					return;
+				}
+				ct::vulkan::recording::begin_slot(slot, hash_slot(slot, target, workload), *cache);
+				struct Lanes {
+					uint32_t slot;
+					ct::vulkan::rendering::Target *target;
+					Workload *workload;
+					ct::vulkan::recording::Cache *cache;
+				} lanes = { slot, &target, &workload, cache };
+				ct::jobs::parallel_for((uint32_t)cache->lanes.size(), 1, [](void *data, uint32_t begin_lane, uint32_t end_lane) {
+					Lanes &lanes = *static_cast<Lanes*>(data);
+					ct::vulkan::recording::Cache &cache = *lanes.cache;
+					Workload &workload = *lanes.workload;
+					uint32_t n_draws = (uint32_t)workload.draws.size();
+					uint32_t n_lanes = (uint32_t)cache.lanes.size();
+					for (uint32_t lane = begin_lane; lane < end_lane; lane++) {
+						for (uint32_t c = lane; c < cache.n_chunks; c += n_lanes) {
+							VkCommandBuffer secondary = ct::vulkan::recording::begin(c, lanes.slot, workload.render_pass, lanes.target->framebuffer, cache);
+							if (secondary == VK_NULL_HANDLE)
+								continue;
+							uint32_t begin = ct::vulkan::recording::get_first(c, n_draws, cache);
+							uint32_t end = ct::vulkan::recording::get_first(c + 1, n_draws, cache);
+							bind_state(secondary, *lanes.target, workload);
+							record_draws(secondary, lanes.slot, begin, end, workload);
+							ct::vulkan::recording::end(c, secondary, cache);
+						}
+					}
+				}, &lanes, workload.jobs);
+				begin_pass(command_buffer, target, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS, workload);
+				ct::vulkan::recording::execute(command_buffer, slot, *cache);
+				end_render(command_buffer, target, workload);
+			}
+
+			// Bytes of instance data copied since the last report
+			inline void report(std::ostream &os, Workload &workload) {
+				if (!workload.active)
+					return;
+				os << "workload-uploaded-bytes: " << workload.bytes_uploaded << std::endl;
+				workload.bytes_uploaded = 0;
+			}
+
+			// The material layout belongs to the layout cache
+			inline void destroy(Workload &workload) {
+				if (workload.device == VK_NULL_HANDLE)
+					return;
+				VkDevice &device = workload.device;
+				for (auto &pipeline : workload.pipelines)
+					vkDestroyPipeline(device, pipeline, ct::vulkan::get_allocator());
+				workload.pipelines.clear();
+				vkDestroyPipelineCache(device, workload.pipeline_cache, ct::vulkan::get_allocator());
+				vkDestroyPipelineLayout(device, workload.pipeline_layout, ct::vulkan::get_allocator());
+				vkDestroyRenderPass(device, workload.render_pass, ct::vulkan::get_allocator());
+				workload.pipeline_cache = VK_NULL_HANDLE;
+				workload.pipeline_layout = VK_NULL_HANDLE;
+				workload.render_pass = VK_NULL_HANDLE;
+				ct::vulkan::descriptor::destroy_allocator(workload.descriptor_allocator);
+				workload.material_sets.clear();
+				ct::vulkan::destroy_buffer(device, workload.material_buffer);
+				ct::vulkan::destroy_buffer(device, workload.vertex_buffer);
+				ct::vulkan::destroy_buffer(device, workload.index_buffer);
+				for (auto &buffer : workload.instance_buffers)
+					ct::vulkan::destroy_buffer(device, buffer);
+				workload.instance_buffers.clear();
+				workload.active = false;
+				workload.device = VK_NULL_HANDLE;
+			}
+
+		}
+	}
+}
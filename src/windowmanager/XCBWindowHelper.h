@@ -3,9 +3,11 @@
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <poll.h>
 
 #include <xcb/xcb.h>
 #include "utils/ErrorHelper.h"
+#include "vulkanbase/HostAllocator.h"
 
 
 namespace ct {
@@ -19,6 +21,12 @@ namespace ct {
 				xcb_screen_t *screen;
 				xcb_window_t window;
 				xcb_intern_atom_reply_t *atom_wm_delete_window;
+
+				// Set by handle_events, whoever redraws clears them
+				uint32_t width = 0;
+				uint32_t height = 0;
+				bool is_exposed = false;
+				bool is_resized = false;
 			};
 
 			inline xcb_intern_atom_reply_t* intern_atom_helper(xcb_connection_t *conn, bool only_if_exists, const char *str) {
@@ -48,6 +56,8 @@ namespace ct {
 				uint32_t value_list[32];
 
 				window.window = xcb_generate_id(window.connection);
+				window.width = width_window;
+				window.height = height_window;
 
 				value_mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
 				value_list[0] = window.screen->black_pixel;
@@ -89,7 +99,7 @@ namespace ct {
 				surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR;
 				surfaceCreateInfo.connection = window.connection;
 				surfaceCreateInfo.window = window.window;
-				VK_CHECK_RESULT(vkCreateXcbSurfaceKHR(instance, &surfaceCreateInfo, nullptr, &window.surface));
+				VK_CHECK_RESULT(vkCreateXcbSurfaceKHR(instance, &surfaceCreateInfo, ct::vulkan::get_allocator(), &window.surface));
 			}
 
 
@@ -97,12 +107,36 @@ namespace ct {
 				xcb_flush(connection);
 			};
 
+			// Blocks until the connection has events to read or timeout_ms passed (-1 waits forever). Events already queued by xcb
+			// are not seen by the file descriptor, drain them with xcb_poll_for_event first.
+			inline bool wait_for_events(xcb_connection_t *connection, int timeout_ms) {
+				xcb_flush(connection);
+				pollfd fd = {};
+				fd.fd = xcb_get_file_descriptor(connection);
+				fd.events = POLLIN;
+				return poll(&fd, 1, timeout_ms) > 0;
+			}
+
 			void handle_events(const xcb_generic_event_t *event, ct::windowmanager::xcb::Window &window) {
 				switch (event->response_type & 0x7f) {
 					case XCB_CLIENT_MESSAGE:
 						if ((*(xcb_client_message_event_t*)event).data.data32[0] == (*window.atom_wm_delete_window).atom)
 							window.is_alive = false;
 						break;
+					case XCB_EXPOSE:
+						// Only the last of a series of exposures asks for a redraw
+						if ((*(xcb_expose_event_t*)event).count == 0)
+							window.is_exposed = true;
+						break;
+					case XCB_CONFIGURE_NOTIFY: {
+						const xcb_configure_notify_event_t &configure = *(xcb_configure_notify_event_t*)event;
+						if (configure.width != window.width || configure.height != window.height) {
+							window.width = configure.width;
+							window.height = configure.height;
+							window.is_resized = true;
+						}
+						break;
+					}
 				}
 			};
 